@@ -211,7 +211,7 @@ combo_action_t combo_recognize(void)//const uint16_t keydown,
 
     // loop over the rules for this state attempting to transition.
     uint8_t offset = pgm_read_byte(&(state_offset[combo_state]));
-    combo_state_t *rule = state_table + offset;
+    const combo_state_t *rule = state_table + offset;
     while(pgm_read_byte(&(rule->state_num)) == combo_state) {
         uint8_t keyrule = pgm_read_byte(&(rule->key));
 
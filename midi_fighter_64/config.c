@@ -31,6 +31,8 @@
 #include "midi.h"
 #include "eeprom.h"
 #include "combo.h"
+#include "profile.h"
+#include "stack.h"
 
 
 // SysEx command constants
@@ -38,11 +40,12 @@
 #define SYSEX_COMMAND_PULL_CONF    0x2
 #define SYSEX_COMMAND_SYSTEM       0x3
 #define SYSEX_COMMAND_BULK_XFER    0x4
+#define SYSEX_COMMAND_STATS        0x5
 
 uint8_t g_auto_update = 0;
 
 // Command structure
-#define TV_TABLE_SIZE 24
+#define TV_TABLE_SIZE 26
 typedef union {
     struct {
         // Message data                TAG
@@ -77,6 +80,10 @@ typedef union {
 		uint8_t sleepTime;          // 22
 		uint8_t sideBank;           // 23
 
+        // KEYS
+        uint8_t keyScanPeriod;      // 24 (1 - KEY_SCAN_PERIOD_MAX steps of ~0.77ms, 0 = unchanged)
+        uint8_t debounceDepth;      // 25 (1 - KEY_DEBOUNCE_DEPTH_MAX samples, 0 = unchanged)
+
     };
     uint8_t bytes[TV_TABLE_SIZE];
 } tvtable_t;
@@ -98,14 +105,16 @@ void tv_table_decode(tvtable_t* table, uint8_t* buffer, uint8_t size)
 void sysExCmdPushConfig (uint8_t length, uint8_t* buffer) // Store Configuration data received via MIDI Sysex
 {
 	uint8_t side_bank_prev_state = G_EE_SIDE_BANK; 
-	// First disable watch dog as EEPROM is slow
-	wdt_disable();	
+	uint8_t key_scan_period_prev = G_EE_KEY_SCAN_PERIOD;
+	uint8_t key_debounce_depth_prev = G_EE_KEY_DEBOUNCE_DEPTH;
 	
     tvtable_t config = {{0}};
     tv_table_decode(&config, buffer, length);
 
     // Change settings
-    G_EE_MIDI_CHANNEL          = config.midiChannel - 1;
+    if (config.midiChannel >= 1 && config.midiChannel <= 16) { // refuse rather than alias a bad channel
+        G_EE_MIDI_CHANNEL      = config.midiChannel - 1;
+    }
     G_EE_MIDI_VELOCITY         = config.midiVelocity;
 
     G_EE_FOUR_BANKS_MODE    = config.fourBanksMode;
@@ -124,6 +133,14 @@ void sysExCmdPushConfig (uint8_t length, uint8_t* buffer) // Store Configuration
 	G_EE_PICK_SENSITIVITY   = config.pickSens;
 	G_EE_SLEEP_TIME         = config.sleepTime;
 	G_EE_SIDE_BANK          = config.sideBank;
+	// Older utilities don't send the key timing tags, keep the current
+	// settings rather than reading their absence as 0.
+	if (config.keyScanPeriod >= 1 && config.keyScanPeriod <= KEY_SCAN_PERIOD_MAX) {
+		G_EE_KEY_SCAN_PERIOD = config.keyScanPeriod;
+	}
+	if (config.debounceDepth >= 1 && config.debounceDepth <= KEY_DEBOUNCE_DEPTH_MAX) {
+		G_EE_KEY_DEBOUNCE_DEPTH = config.debounceDepth;
+	}
     
 	if (G_EE_SIDE_BANK != side_bank_prev_state) {
 		if (!G_EE_SIDE_BANK) { // if side_bank button was newly disabled, switch to bank 1
@@ -141,14 +158,12 @@ void sysExCmdPushConfig (uint8_t length, uint8_t* buffer) // Store Configuration
 	// Save to EEPROM
     eeprom_save_edits();
     send_config_data();
-	// Load the new settings
-	eeprom_setup();  // !review: this is redundant because save_edits already puts the settings in these places
-	// - calling eeprom_setup is a double check allows us to see if the Eeeprom was written correctly
-	// -- causing the settings to immediately fail if the eeprom was not written correctly.
-	// - !revsision: consider calling eeprom_check() (which would just 'check' that the read values match the current ones)
-     
-	// Enable watchdog again
-	wdt_enable(WDTO_2S);
+	// The background writer is still saving, so there is nothing to read
+	// back yet: the settings in RAM are already the new ones. Only new key
+	// timing restarts the debounce and its telemetry.
+	if (G_EE_KEY_SCAN_PERIOD != key_scan_period_prev || G_EE_KEY_DEBOUNCE_DEPTH != key_debounce_depth_prev) {
+		key_configure(G_EE_KEY_SCAN_PERIOD, G_EE_KEY_DEBOUNCE_DEPTH);
+	}
 }
 
 void send_config_data (void)
@@ -175,6 +190,8 @@ void send_config_data (void)
 								21, G_EE_PICK_SENSITIVITY,
 								22, G_EE_SLEEP_TIME,
 								23, G_EE_SIDE_BANK,
+								24, G_EE_KEY_SCAN_PERIOD,
+								25, G_EE_KEY_DEBOUNCE_DEPTH,
                                 0xf7};
     midi_stream_sysex(/* number of bytes in payload:  */ sizeof(payload), payload);
 }
@@ -191,6 +208,47 @@ void Jump_To_Bootloader (void);  //!mark: bootloader crashes: just include jumpt
 void menu (void);
 void eeprom_factory_reset (void);
 
+// 16-bit value as 3 septets, LSB first
+static uint8_t* sysex_put_u16 (uint8_t* ptr, uint16_t value)
+{
+    *ptr++ = value & 0x7f;
+    *ptr++ = (value >> 7) & 0x7f;
+    *ptr++ = value >> 14;
+    return ptr;
+}
+
+/**********
+System Protocol:
+    0xf0 0x0 0x1 0x79 0x3 CMD 0xf7
+        CMD:        1   Jump to the bootloader
+                    2   Factory reset the EEPROM
+                    3   Stack report
+
+    Stack report response:
+    0xf0 0x0 0x1 0x79 0x3 0x3 STATIC FREE UNUSED 0xf7
+        STATIC:         Bytes of RAM taken by the globals
+        FREE:           Bytes of RAM above them, left to the stack
+        UNUSED:         Of those, bytes the stack has not reached since reset
+                        (0 without ENABLE_STACK_PAINT). FREE - UNUSED is the
+                        stack's high-water mark.
+        3 septets each, LSB first.
+**********/
+
+static void send_stack_report (void)
+{
+    uint8_t payload[] = {0xf0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7f,
+                                SYSEX_COMMAND_SYSTEM,
+                                0x3,
+                                0,0,0, 0,0,0, 0,0,0, // static, free, unused
+                                0xf7};
+    uint8_t* ptr = payload + 6;
+    ptr = sysex_put_u16(ptr, stack_static_bytes());
+    ptr = sysex_put_u16(ptr, stack_free_bytes());
+    ptr = sysex_put_u16(ptr, stack_unused_bytes());
+    midi_stream_sysex(sizeof(payload), payload);
+    midi_flush();
+}
+
 void sysExCmdSystem (uint8_t length, uint8_t* buffer)
 {
     if (length == 0) return;
@@ -234,13 +292,16 @@ void sysExCmdSystem (uint8_t length, uint8_t* buffer)
 			//while(true){}; // !review: Force Reset (why? when you could just call load_default_settings?)
         }
         break;
+    case 3:
+        send_stack_report();
+        break;
     default:
         break;
     }
 }
 
-extern uint8_t default_bank_inactive[2][64*3];
-extern uint8_t default_bank_active[2][64*3];
+extern uint8_t default_bank_inactive[2][64*KEY_COLOR_BYTES];
+extern uint8_t default_bank_active[2][64*KEY_COLOR_BYTES];
 
 /**********
 Bulk Transfer Protocol:
@@ -288,7 +349,7 @@ void sysExCmdBulkXfer(uint8_t length, uint8_t* buffer)
                 if (tag == 0x0) return; // Extended tags not supported
                 uint8_t part = *buffer++; // Transfers may consist of multiple parts
                 if (part == 0) return; // Invalid part number
-                uint8_t total = *buffer++;
+                buffer++; // Total number of parts, not needed to place this one
                 uint8_t size = *buffer++;
                 if (size > length - 5) return; // Not enough data to support payload
                 
@@ -311,17 +372,24 @@ void sysExCmdBulkXfer(uint8_t length, uint8_t* buffer)
                 //uint8_t bank   = table[part - 1][0];
                 //uint8_t offset = table[part - 1][1];
 
-                if (tag == 1) {
-                    for (uint8_t idx = 0; idx < size; ++idx) {
-                        default_bank_inactive[bank][offset + idx] = ((*buffer++) * 2);
-                    }
-					adjust_inactive_bank_leds_for_power(bank, offset, size);
-                } else if (tag == 2) {
-                    for (uint8_t idx = 0; idx < size; ++idx) {
-                        default_bank_active[bank][offset + idx] = ((*buffer++) * 2);
-                    }
-					adjust_active_bank_leds_for_power(bank, offset, size);
-                }
+				// Keys store default_color[] indices, snap the RGB payload to them
+				uint8_t *dest;
+				if (tag == 1) {
+					dest = default_bank_inactive[bank];
+				} else if (tag == 2) {
+					dest = default_bank_active[bank];
+				} else {
+					return; // Invalid tag
+				}
+				uint8_t rgb[24];
+				if (size > sizeof(rgb)) return;
+				for (uint8_t idx = 0; idx < size; ++idx) {
+					rgb[idx] = ((*buffer++) * 2);
+				}
+				size -= size % 3; // whole keys only
+				for (uint8_t idx = 0; idx < size; idx += 3) {
+					dest[(offset + idx) / 3] = display_palette_index(rgb + idx);
+				}
             }
         } else if (command == 1) { // PULL
             uint8_t* source;
@@ -359,7 +427,7 @@ void sysExCmdBulkXfer(uint8_t length, uint8_t* buffer)
                 for (uint8_t idx=10; idx < size+10; ++idx) {
                     // Convert Firmware Color Code to 7-bit midi sysex color code
                     // mf64 (4 to 5bit to 7-bit)
-                    uint16_t this_color = source[index++];
+                    uint16_t this_color = display_key_rgb_byte(source, index++);
                     this_color = this_color * DISPLAY_SCALING_COLOR_OUT_MAX_VALUE / DISPLAY_SCALING_COLOR_IN_MAX_VALUE;
                     //this_color = this_color * (uint16_t)(DISPLAY_SCALING_COLOR_OUT_MAX_VALUE) / (uint16_t)(DISPLAY_SCALING_COLOR_IN_MAX_VALUE);
                     payload[idx] = this_color;
@@ -369,12 +437,273 @@ void sysExCmdBulkXfer(uint8_t length, uint8_t* buffer)
                 
                 // Send the message
                 midi_stream_sysex(11 + size, payload);
-				MIDI_Device_Flush(g_midi_interface_info); // MIDI_Device_USBTask calls flush, but has redundant checks that we are avoiding.
+				midi_flush(); // MIDI_Device_USBTask calls flush, but has redundant checks that we are avoiding.
             }
         }
     }
 }
 
+/**********
+Stats Protocol:
+    Read back run time statistics of the firmware.
+
+    0xf0 0x0 0x1 0x79 0x5 CMD SECTION 0xf7
+        CMD:        0   Request
+                    1   Response
+                    2   Reset the section's statistics
+        SECTION:    0   Main loop profiler
+                    1   LED frames
+                    2   Key debounce
+                    3   Key event queue
+                    4   MIDI out
+                    5   EEPROM writer
+
+    Profiler response, one message per stage (see profile.h for the stages):
+    0xf0 0x0 0x1 0x79 0x5 0x1 0x0 STAGE MIN MAX P99 BUCKETS 0xf7
+        MIN, MAX, P99:  Stage durations in 4us ticks, 3 septets each, LSB first
+        BUCKETS:        PROFILE_NUM_BUCKETS histogram counts, 2 septets each, LSB first
+                        Bucket n counts durations of 2^(n-1) to 2^n-1 ticks.
+
+    LED frames response:
+    0xf0 0x0 0x1 0x79 0x5 0x1 0x1 SENT SKIPPED 0xf7
+        SENT, SKIPPED:  Frames sent to / skipped as unchanged, 3 septets each, LSB first
+
+    Key debounce response:
+    0xf0 0x0 0x1 0x79 0x5 0x1 0x2 BOUNCES PRESSES LATENCY 0xf7
+        BOUNCES:        Runs of disagreeing samples too short to change a key's state
+        PRESSES:        Debounced key presses
+        LATENCY:        Average time from a press's first closed sample to its
+                        debounced state, in us
+        3 septets each, LSB first. Changing the key timing settings resets them.
+
+    Key event queue response:
+    0xf0 0x0 0x1 0x79 0x5 0x1 0x3 READ DROPPED WAIT_MAX WAIT_AVG 0xf7
+        READ, DROPPED:  Key edges sent / lost to a full queue
+        WAIT_MAX, WAIT_AVG: Time edges spent queued before their MIDI was
+                        sent, in system_time_ms ticks (~0.77ms)
+        3 septets each, LSB first.
+
+    MIDI out response:
+    0xf0 0x0 0x1 0x79 0x5 0x1 0x4 PACKETS EVENTS DROPPED FRAME_MAX 0xf7
+        PACKETS, EVENTS: IN banks written and the events in them
+        DROPPED:        Events lost to a host that stopped reading
+        FRAME_MAX:      Most IN banks written in one USB frame (1ms)
+        3 septets each, LSB first.
+
+    EEPROM writer response:
+    0xf0 0x0 0x1 0x79 0x5 0x1 0x5 PENDING WRITTEN UNCHANGED 0xf7
+        PENDING:        Bytes of the current save still to be checked
+        WRITTEN, UNCHANGED: Bytes saves have written / found already saved
+        3 septets each, LSB first.
+**********/
+
+#define SYSEX_STATS_PROFILER 0x0
+#define SYSEX_STATS_LEDS     0x1
+#define SYSEX_STATS_KEYS     0x2
+#define SYSEX_STATS_KEY_EVENTS 0x3
+#define SYSEX_STATS_MIDI_OUT 0x4
+#define SYSEX_STATS_EEPROM   0x5
+
+#define KEY_SCAN_STEP_US 768 // Timer0 256 * 48 / 16MHz
+
+#if ENABLE_PROFILER > 0
+static void send_profiler_stats (void)
+{
+    for (uint8_t stage = 0; stage < PROFILE_NUM_STAGES; ++stage) {
+        uint8_t payload[8 + 3*3 + PROFILE_NUM_BUCKETS*2 + 1] = {
+                                0xf0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7f,
+                                SYSEX_COMMAND_STATS,
+                                0x1, // 0x0 = request, 0x1 = response
+                                SYSEX_STATS_PROFILER,
+                                stage};
+        uint8_t* ptr = payload + 8;
+        ptr = sysex_put_u16(ptr, g_profile[stage].min);
+        ptr = sysex_put_u16(ptr, g_profile[stage].max);
+        ptr = sysex_put_u16(ptr, profile_p99(stage));
+        for (uint8_t b = 0; b < PROFILE_NUM_BUCKETS; ++b) {
+            *ptr++ = g_profile[stage].bucket[b] & 0x7f;
+            *ptr++ = g_profile[stage].bucket[b] >> 7;
+        }
+        *ptr = 0xf7;
+        midi_stream_sysex(sizeof(payload), payload);
+        midi_flush();
+    }
+}
+#endif
+
+#if ENABLE_LED_FRAME_SKIP > 0
+static void send_led_stats (void)
+{
+    uint8_t payload[] = {0xf0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7f,
+                                SYSEX_COMMAND_STATS,
+                                0x1, // 0x0 = request, 0x1 = response
+                                SYSEX_STATS_LEDS,
+                                0,0,0, 0,0,0, // sent, skipped
+                                0xf7};
+    uint8_t* ptr = payload + 7;
+    ptr = sysex_put_u16(ptr, g_led_frames_sent);
+    ptr = sysex_put_u16(ptr, g_led_frames_skipped);
+    midi_stream_sysex(sizeof(payload), payload);
+    midi_flush();
+}
+#endif
+
+static void send_key_stats (void)
+{
+    uint8_t payload[] = {0xf0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7f,
+                                SYSEX_COMMAND_STATS,
+                                0x1, // 0x0 = request, 0x1 = response
+                                SYSEX_STATS_KEYS,
+                                0,0,0, 0,0,0, 0,0,0, // bounces, presses, latency
+                                0xf7};
+    cli();
+    uint16_t bounces = g_key_bounces_rejected;
+    uint16_t presses = g_key_presses;
+    uint32_t latency = g_key_press_latency;
+    sei();
+    if (presses) {
+        // Average first: a press adds at most 255 samples, so neither product
+        // below can overflow however many presses have been summed.
+        uint16_t step_us = g_key_scan_period * KEY_SCAN_STEP_US;
+        latency = (latency / presses) * step_us + (latency % presses) * step_us / presses;
+    }
+    uint8_t* ptr = payload + 7;
+    ptr = sysex_put_u16(ptr, bounces);
+    ptr = sysex_put_u16(ptr, presses);
+    ptr = sysex_put_u16(ptr, latency > 0xFFFF ? 0xFFFF : latency);
+    midi_stream_sysex(sizeof(payload), payload);
+    midi_flush();
+}
+
+static void send_key_event_stats (void)
+{
+    uint8_t payload[] = {0xf0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7f,
+                                SYSEX_COMMAND_STATS,
+                                0x1, // 0x0 = request, 0x1 = response
+                                SYSEX_STATS_KEY_EVENTS,
+                                0,0,0, 0,0,0, 0,0,0, 0,0,0, // read, dropped, wait max, wait avg
+                                0xf7};
+    uint8_t* ptr = payload + 7;
+    ptr = sysex_put_u16(ptr, g_key_events_read);
+    ptr = sysex_put_u16(ptr, g_key_events_dropped);
+    ptr = sysex_put_u16(ptr, g_key_event_wait_max);
+    ptr = sysex_put_u16(ptr, g_key_events_read ? g_key_event_wait_total / g_key_events_read : 0);
+    midi_stream_sysex(sizeof(payload), payload);
+    midi_flush();
+}
+
+static void send_midi_out_stats (void)
+{
+    uint8_t payload[] = {0xf0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7f,
+                                SYSEX_COMMAND_STATS,
+                                0x1, // 0x0 = request, 0x1 = response
+                                SYSEX_STATS_MIDI_OUT,
+                                0,0,0, 0,0,0, 0,0,0, 0,0,0, // packets, events, dropped, frame max
+                                0xf7};
+    uint8_t* ptr = payload + 7;
+    ptr = sysex_put_u16(ptr, g_midi_tx_packets);
+    ptr = sysex_put_u16(ptr, g_midi_tx_events);
+    ptr = sysex_put_u16(ptr, g_midi_tx_dropped);
+    ptr = sysex_put_u16(ptr, g_midi_tx_frame_packets_max);
+    midi_stream_sysex(sizeof(payload), payload);
+    midi_flush();
+}
+
+static void send_eeprom_stats (void)
+{
+    uint8_t payload[] = {0xf0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7f,
+                                SYSEX_COMMAND_STATS,
+                                0x1, // 0x0 = request, 0x1 = response
+                                SYSEX_STATS_EEPROM,
+                                0,0,0, 0,0,0, 0,0,0, // pending, written, unchanged
+                                0xf7};
+    uint16_t pending = eeprom_save_pending();
+    cli();
+    uint16_t written = g_eeprom_bytes_written;
+    uint16_t unchanged = g_eeprom_bytes_unchanged;
+    sei();
+    uint8_t* ptr = payload + 7;
+    ptr = sysex_put_u16(ptr, pending);
+    ptr = sysex_put_u16(ptr, written);
+    ptr = sysex_put_u16(ptr, unchanged);
+    midi_stream_sysex(sizeof(payload), payload);
+    midi_flush();
+}
+
+void sysExCmdStats (uint8_t length, uint8_t* buffer)
+{
+    if (length < 2) return;
+
+    uint8_t command = buffer[0];
+    uint8_t section = buffer[1];
+    switch (section) {
+#if ENABLE_PROFILER > 0
+    case SYSEX_STATS_PROFILER:
+        if (command == 0) {
+            send_profiler_stats();
+        } else if (command == 2) {
+            profile_reset();
+        }
+        break;
+#endif
+#if ENABLE_LED_FRAME_SKIP > 0
+    case SYSEX_STATS_LEDS:
+        if (command == 0) {
+            send_led_stats();
+        } else if (command == 2) {
+            g_led_frames_sent = 0;
+            g_led_frames_skipped = 0;
+        }
+        break;
+#endif
+    case SYSEX_STATS_KEYS:
+        if (command == 0) {
+            send_key_stats();
+        } else if (command == 2) {
+            cli();
+            g_key_bounces_rejected = 0;
+            g_key_presses = 0;
+            g_key_press_latency = 0;
+            sei();
+        }
+        break;
+    case SYSEX_STATS_KEY_EVENTS:
+        if (command == 0) {
+            send_key_event_stats();
+        } else if (command == 2) {
+            g_key_events_read = 0;
+            cli();
+            g_key_events_dropped = 0;
+            sei();
+            g_key_event_wait_max = 0;
+            g_key_event_wait_total = 0;
+        }
+        break;
+    case SYSEX_STATS_MIDI_OUT:
+        if (command == 0) {
+            send_midi_out_stats();
+        } else if (command == 2) {
+            g_midi_tx_packets = 0;
+            g_midi_tx_events = 0;
+            g_midi_tx_dropped = 0;
+            g_midi_tx_frame_packets_max = 0;
+        }
+        break;
+    case SYSEX_STATS_EEPROM:
+        if (command == 0) {
+            send_eeprom_stats();
+        } else if (command == 2) {
+            cli();
+            g_eeprom_bytes_written = 0;
+            g_eeprom_bytes_unchanged = 0;
+            sei();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
 void config_setup (void)
 {
     // Install SysEx command handlers
@@ -382,4 +711,5 @@ void config_setup (void)
     sysex_install(SYSEX_COMMAND_PULL_CONF, sysExCmdPullConfig);
     sysex_install(SYSEX_COMMAND_SYSTEM,    sysExCmdSystem);
     sysex_install(SYSEX_COMMAND_BULK_XFER, sysExCmdBulkXfer);
+    sysex_install(SYSEX_COMMAND_STATS,     sysExCmdStats);
 }
@@ -39,19 +39,58 @@
 #define USB_RX_METHOD USB_RX_ONCE_PER_MAINLOOP
 // - How many packets to look for per iteration
 #if USB_RX_METHOD < USB_RX_PERIODICALLY
-#define USB_RX_FAIL_LIMIT 120
 #define USB_RX_PACKET_LIMIT 512
 #else
-#define USB_RX_FAIL_LIMIT 160
 #define USB_RX_PACKET_LIMIT 2
 #endif
 
-#define ENABLE_LUFA_2015_LARGE_PACKET_UPGRADE 0
+// - The OUT endpoint is drained a bank at a time, every event read straight from the endpoint FIFO
+
+// - MIDI Transmit
+// -- events are packed in RAM and written to the IN endpoint a bank at a time
+#define MIDI_TX_BUFFER_SIZE 64 // one IN bank, 16 events
 
 // - MIDI Feedback
 #define ENABLE_NOTE_OFF_FEEDBACK_DELAY 1
-#define NOTE_OFF_FEEDBACK_DELAY_LIMIT 2 // !review: working value was 20, works at '1' with increased throughput, works at '2'
-#define DEBOUNCE_BUFFER_SIZE 10
+#ifndef NOTE_OFF_FEEDBACK_DELAY_LIMIT
+#define NOTE_OFF_FEEDBACK_DELAY_LIMIT 2 // in system_time_ms ticks // !review: working value was 20, works at '1' with increased throughput, works at '2'
+#endif
+// -- NoteOffs are binned by 16-bit arrival time into a few slots, only due slots are visited
+#define NOTE_OFF_WHEEL_SLOTS 4 // 21 bytes of RAM each, at least 2
+// -- the feedback compositors visit only the notes set in g_midi_note_lit, a byte (8 notes) at a time
+
+// - Key Debounce (one sample per Timer0 interrupt, every KEY_SCAN_PERIOD * ~0.77ms)
+// -- press and release both need KEY_DEBOUNCE_DEPTH agreeing samples (vertical counters)
+#define KEY_DEBOUNCE_DEPTH 4 // default, settable over sysex (EE_KEY_DEBOUNCE_DEPTH)
+#define KEY_DEBOUNCE_DEPTH_MAX 8 // 3-bit counters
+#define KEY_SCAN_PERIOD 1 // default scan period in ~0.77ms steps, settable over sysex (EE_KEY_SCAN_PERIOD)
+#define KEY_SCAN_PERIOD_MAX 5 // the Timer0 reload of 256 - 48*period must stay positive
+#define KEY_BOUNCE_WINDOW 32 // samples; a press that starts within this many samples of an unfinished one is the same press bouncing
+
+// - Key Events
+// -- the Timer0 ISR queues timestamped key edges as it debounces
+#define KEY_EVENT_QUEUE_SIZE 32 // edges, power of 2, one slot is always left empty
+#define KEY_EVENTS_PER_PASS 16  // edges sent per main loop pass, an IN endpoint's worth
+
+// - LED Refresh
+#ifndef ENABLE_LED_FRAME_SKIP
+#define ENABLE_LED_FRAME_SKIP 1 // don't resend a frame identical to the last one sent
+#endif
+#define LED_FRAME_SKIP_LIMIT 40 // but do resend it after 40 skips (~1s), in case an LED lost its state
+
+// - Display
+// -- every key's layers are resolved in one pass, each byte of g_display_buffer written once
+// -- each rate's flash and pulse phase is taken once a frame, from sintable()
+// -- each geometric animation step is a PROGMEM template laid over the grid a row at a time
+// -- each geometric animation's step is worked out from its own start time
+// - EEPROM
+// -- the EE_READY interrupt writes the bytes that changed while the main loop runs
+#define EEPROM_SAVE_COMPARE_LIMIT 16 // unchanged bytes the EE_READY interrupt checks before giving the CPU back
+// -- the saved image carries a CRC, and is read in blocks at boot
+// -- the image is kept twice, and a compaction rewrites the older copy
+// -- small saves are appended to a journal at EE_JOURNAL, spreading the wear
+// -- key colors are held in RAM and the EEPROM as an index into default_color[], which is in flash
+#define KEY_COLOR_BYTES 1
 
 #define MIDI_FEEDBACK_MF3D_MODE 0  // 20 colors
 #define MIDI_FEEDBACK_ABLETON_MODE 1 // 15 2-bit dimable colors, 68 custom colors
@@ -67,6 +106,12 @@
 #define ENABLE_TEST_OUT_NOTE_COUNTERS 0
 #define ENABLE_TEST_OUT_USB_PACKETS_PER_INTERVAL 0
 #define ENABLE_TEST_IN_LED_CALIBRATION 0
+// - Main loop profiler, read back with the stats sysex command (uses Timer3, ~130 bytes RAM)
+#ifndef ENABLE_PROFILER
+#define ENABLE_PROFILER 0 // the host simulation turns it on
+#endif
+// - Paint the free RAM at reset to find the stack's high-water mark, read back with the system sysex command
+#define ENABLE_STACK_PAINT 1
 
 // CPU port constants ---------------------------------------------------------
 
@@ -139,7 +184,11 @@
 
 // Increment this when the EEPROM layout requires resetting to the factory
 // default.
-#define EEPROM_LAYOUT                 1
+#define EEPROM_LAYOUT                 6  // 6 keeps a second copy of the image, at EE_IMAGE_B
+#define EEPROM_LAYOUT_ONE_IMAGE       5  // images from 5 are kept, with their journal at EE_JOURNAL
+#define EEPROM_LAYOUT_JOURNAL_HIGH    4  // images from 4 are kept, with their journal at EE_JOURNAL_HIGH
+#define EEPROM_LAYOUT_RGB             3  // images up to this one are kept, as the nearest palette colors
+#define EEPROM_LAYOUT_NO_CRC          1
 
 // EEPROM memory locations of persistent settings
 #define EE_EEPROM_VERSION        0x0000  // Is the EEPROM layout current?
@@ -165,11 +214,22 @@
 #define EE_PICK_SENSITIVITY      0x0016  // Sets the sensitivity of the pickup detection.
 #define EE_SLEEP_TIME            0x0017  // Sets time period (1 - 60 Minutes) for sleep timer, 0 to disable
 #define EE_SIDE_BANK             0x0018  // If enabled then side button number changes with bank
-
-#define EE_COLORS_IDLE			 0x006F  // Start of idle color map, size = 2*64*3
-#define EE_COLORS_ACTIVE		 0x01EF  // Start of active color map, size = 2*64*3
-#define EE_COLORS_LAST		 	 0x036F  // 0x018F is the next free EEPROM slot for use
+#define EE_KEY_SCAN_PERIOD       0x0019  // Key scan period in ~0.77ms steps (1 - KEY_SCAN_PERIOD_MAX)
+#define EE_KEY_DEBOUNCE_DEPTH    0x001A  // Agreeing samples needed to change a key's state (1 - KEY_DEBOUNCE_DEPTH_MAX)
+#define EE_IMAGE_CRC             0x001B  // CRC-16 (CCITT, LSB first) of the settings and colors, from EEPROM_LAYOUT 2
+#define EE_IMAGE_SEQUENCE        0x001D  // Counts the saves of the image, newest wins; in the CRC from EEPROM_LAYOUT 6
+#define EE_SETTINGS_END          0x001E  // The header and settings are read as one block, up to here
+
+#define EE_COLORS_IDLE			 0x006F  // Start of idle color map, size = 2*64*KEY_COLOR_BYTES
+#define EE_COLORS_ACTIVE		 0x00EF  // Start of active color map, size = 2*64
+#define EE_COLORS_RGB_IDLE       0x006F  // Where EEPROM_LAYOUT_RGB and older keep idle then active, size = 2*2*64*3
+#define EE_JOURNAL               0x016F  // Settings journal, 32 4-byte records from EEPROM_LAYOUT 5
+#define EE_JOURNAL_END           0x01EF  // 0x01EF is the next free EEPROM slot for use
+#define EE_IMAGE_B               0x0200  // The second copy of the image, at each address above plus this, up to 0x036F
+#define EE_COLORS_LAST		 	 0x036F  // End of the colors EEPROM_LAYOUT_RGB and older keep, and of image B
 #define EE_FACTORY_RESET_FLAG    0x038F  // Stores the EEPROM factory reset flag
+#define EE_JOURNAL_HIGH          0x0390  // Where EEPROM_LAYOUT 3 and 4 keep the journal, up to the end of the EEPROM
+#define EE_JOURNAL_HIGH_END      0x0400
     
 // Device Output Modes
 #define MIDI_OUTPUT_MODE_NOTES_ONLY  0x00
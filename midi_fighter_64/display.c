@@ -23,7 +23,7 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
+#include <avr/pgmspace.h>
 
 #include "key.h"
 #include "midi.h"
@@ -42,10 +42,12 @@ uint8_t g_display_buffer[64 * 3]; // This can be reduced to 64: we are treating
 uint8_t x_value;
 uint8_t y_value;
 uint16_t g_level_display_mask;
+uint8_t g_display_layers = DISPLAY_LAYERS_ALL;
 
-// Pulse LEDs: To get symmetrical cycle make sure that 
-// rgb_freq  x 32 = n * 2pi
-static float rgb_freq = 0.049f;
+// This frame's flash states (bit rate-1) and pulse levels of the 8 rates,
+// see animation_phase_update()
+static uint8_t animation_flash_on;
+static uint8_t animation_pulse_level[8];
 
 // Prototypes -----------------------------------------------------------------
 
@@ -56,14 +58,42 @@ void back_fade(const uint8_t value, uint8_t *buffer);
 
 // Locals ---------------------------------------------------------------------
 
+// Write an RGB color to a key's three bytes of g_display_buffer.
+// !review: LED Colors are inverted for the MF64 Hardware (led communications) (BRG instead of RGB), this is the one place we reverse their order
+static inline void display_put_rgb(uint8_t *dest, const uint8_t *rgb)
+{
+	dest[0] = rgb[2];
+	dest[1] = rgb[0];
+	dest[2] = rgb[1];
+}
+
+// Color sources: a key's color (default_color[colors[key]]), a default_color[] or
+// ableton_midi_feedback_colors[] entry, or a ball demo color. The tables are
+// in flash and a key's color is an index into default_color[], so every
+// source is a flash address, read straight into the BRG order of
+// g_display_buffer.
+#define DEFAULT_COLOR(id, c) pgm_read_byte(&default_color[id][c])
+
+static inline void display_put_color(uint8_t *dest, const uint8_t *src)
+{
+	dest[0] = pgm_read_byte(src + 2);
+	dest[1] = pgm_read_byte(src);
+	dest[2] = pgm_read_byte(src + 1);
+}
+
+static inline void display_get_color(uint8_t *rgb, const uint8_t *src)
+{
+	memcpy_P(rgb, src, 3);
+}
+
 
 // Four banks of RGB colors for the displays.
 // Each bank has two states, default and active.
 //
 // NOTE: This should take up 16*3*4*2 = 384 bytes of EEPROM to store. We have 1KB.
 
-uint8_t default_bank_inactive[2][64*3]; // Init now done in load_default_colors()
-uint8_t default_bank_active[2][64*3]; // Init now done in load_default_colors()
+uint8_t default_bank_inactive[2][64*KEY_COLOR_BYTES]; // Init now done in load_default_colors()
+uint8_t default_bank_active[2][64*KEY_COLOR_BYTES]; // Init now done in load_default_colors()
 
 
 enum DefaultColorIds {
@@ -91,7 +121,7 @@ enum DefaultColorIds {
 
 // This array holds the default colors, matched to those in the utility
 
-const uint8_t default_color[20][3] = { // This array is used to remap sysex rgb values in to a small subset of colors.
+const uint8_t default_color[20][3] PROGMEM = { // This array is used to remap sysex rgb values in to a small subset of colors.
 	// Listed as RGB but actual order that this is sent to the led controller is BRG
 	{0x00,0x00,0x00},   // 0: Off 
 	{48,0x00,0x00},		// Red
@@ -118,7 +148,7 @@ const uint8_t default_color[20][3] = { // This array is used to remap sysex rgb
 };
 
 #if MIDI_FEEDBACK_MODE == MIDI_FEEDBACK_ABLETON_MODE
-const uint8_t ableton_midi_feedback_colors[128][3] = {
+const uint8_t ableton_midi_feedback_colors[128][3] PROGMEM = {
 	// - [0-49] provide 15 colors each with 4 shades. [60-127] provide 68 unique colors
 	// - for full details on these colors that are mapped to midi velocities.
 	// -- View the spreadsheet at 'repository root directory'/docs/ableton_live_color_scheme.xlsx'
@@ -262,155 +292,274 @@ const uint8_t ableton_midi_feedback_colors[128][3] = {
 // local functions ------------------------------------------------------------
 
 void load_default_colors(void) {
-	uint8_t index = 0;
-	for (uint8_t this_button=0; this_button < 64; this_button++) { // Quadrant 1: Lavender/ Green 64=NUM_BUTTONS
-		default_bank_inactive[0][index] = default_color[COLORID_OFF][0];
-		default_bank_inactive[0][index+1] = default_color[COLORID_OFF][1];
-		default_bank_inactive[0][index+2] = default_color[COLORID_OFF][2];
-		default_bank_active[0][index] = default_color[COLORID_BLUE][0];
-		default_bank_active[0][index+1] = default_color[COLORID_BLUE][1];
-		default_bank_active[0][index+2] = default_color[COLORID_BLUE][2];	
-		index += 3;
-	}
-	index = 0;
-	for (uint8_t this_button=0; this_button < 64; this_button++) { // Quadrant 1: Lavender/ Green 64=NUM_BUTTONS
-		default_bank_inactive[1][index] = default_color[COLORID_WHITE][0];
-		default_bank_inactive[1][index+1] = default_color[COLORID_WHITE][1];
-		default_bank_inactive[1][index+2] = default_color[COLORID_WHITE][2];
-		default_bank_active[1][index] = default_color[COLORID_GREEN][0];
-		default_bank_active[1][index+1] = default_color[COLORID_GREEN][1];
-		default_bank_active[1][index+2] = default_color[COLORID_GREEN][2];
-		index += 3;
+	memset(default_bank_inactive[0], COLORID_OFF, NUM_BUTTONS);
+	memset(default_bank_active[0], COLORID_BLUE, NUM_BUTTONS);
+	memset(default_bank_inactive[1], COLORID_WHITE, NUM_BUTTONS);
+	memset(default_bank_active[1], COLORID_GREEN, NUM_BUTTONS);
+}
+
+// The key color nearest rgb, for colors pushed over sysex or saved as RGB
+// by an older EEPROM layout.
+uint8_t display_palette_index(const uint8_t *rgb)
+{
+	uint8_t nearest = COLORID_OFF;
+	uint16_t nearest_distance = 0xFFFF;
+	for (uint8_t id = 0; id < DISPLAY_PALETTE_SIZE && nearest_distance; ++id) {
+		uint16_t distance = 0;
+		for (uint8_t c = 0; c < 3; ++c) {
+			distance += abs((int16_t)rgb[c] - pgm_read_byte(&default_color[id][c]));
+		}
+		if (distance < nearest_distance) {
+			nearest = id;
+			nearest_distance = distance;
+		}
 	}
+	return nearest;
 }
 
-void info_display_active(void) //const uint8_t bank, const uint16_t key_state, uint8_t *buffer)
-				// info_display_active(g_bank_selected, g_key_state, g_display_buffer);
+// Byte i of a bank's key colors as RGB, for a sysex pull.
+uint8_t display_key_rgb_byte(const uint8_t *colors, uint16_t i)
 {
-    // Overwrite active LEDs with active color state (LED Local Control by Button State: On)
-    uint64_t key_bit = 1;
-    const uint8_t *active_src = default_bank_active[g_bank_selected]; // active_state_buffer;
-	const uint8_t *inactive_src = default_bank_inactive[g_bank_selected]; //inactive_state_buffer;
-    uint8_t *dest = g_display_buffer;
-    for (uint8_t i=0; i<NUM_BUTTONS; ++i) {  
+	return pgm_read_byte(&default_color[colors[i / 3]][i % 3]);
+}
+
+// Call note_fn for every note of a bank's 64 in one layer of
+// g_midi_note_state (0: colors, 1: animations) with a non-zero velocity.
+// i is the note's g_midi_note_state index and key its button.
+typedef void (*midi_note_fn_t)(uint8_t i, uint8_t key, uint8_t velocity, uint8_t *buffer);
+
+// Works a byte of g_midi_note_lit (8 notes) at a time, so a bank with
+// nothing lit costs 8 byte tests, and shifts through a byte only as far as
+// its last lit note.
+static void midi_for_each_note(uint8_t layer, uint8_t bank, midi_note_fn_t note_fn, uint8_t *buffer)
+{
+	const uint8_t* lit = (const uint8_t*)&g_midi_note_lit[layer][bank];
+	uint8_t bank_offset = bank * NUM_BUTTONS;
+	for (uint8_t byte = 0; byte < 8; ++byte) {
 		#if USB_RX_METHOD >= USB_RX_PERIODICALLY
 		Midifighter_GetIncomingUsbMidiMessages();
 		#endif
-
-        if(g_key_state & key_bit) {
-			// !review: LED Colors are inverted for the MF64 Hardware (led communications) (BRG instead of RGB), this is one place we reverse their order
-			*dest++ = *(active_src+2);
-            *dest++ = *(active_src); 
-            *dest++ = *(active_src+1);
-			active_src += 3;
-			inactive_src += 3;
-        } else {
-			// !review: LED Colors are inverted for the MF64 Hardware (led communications) (BRG instead of RGB), this is one place we reverse their order
-			*dest++ = *(inactive_src+2);
-            *dest++ = *(inactive_src); 
-            *dest++ = *(inactive_src+1);			
-			active_src += 3;
-			inactive_src += 3;
-	        //dest += 3;
-        }
-        key_bit <<= 1;
-    }
+		uint8_t bits = lit[byte]; // receiving can change the mask as we go
+		for (uint8_t key = byte << 3; bits; ++key, bits >>= 1) { // up to the byte's last lit note
+			if (bits & 1) {
+				uint8_t velocity = g_midi_note_state[layer][bank_offset + key];
+				if (velocity > 0) {
+					note_fn(bank_offset + key, key, velocity, buffer);
+				}
+			}
+		}
+	}
 }
 
+// Override the display state of a given arcade button with a color set by
+// the velocity of a Note On event of the same pitch.
 #if MIDI_FEEDBACK_MODE == MIDI_FEEDBACK_ABLETON_MODE
-#warning ABLETON LIVE Midi Feedback Mode
-void midi_color_state(const uint8_t bank, uint8_t *buffer) // (Midi Feedback - Button Colors (Usage)) g_bank_selected, g_display_buffer
+#pragma message "ABLETON LIVE Midi Feedback Mode"
+// - color scheme is that of ableton live 2017
+static const uint8_t* midi_color_source(uint8_t key, uint8_t velocity) // RGB
 {
-	// Override the display state of a given arcade button with a color set by
-	// the velocity of a Note On event of the same pitch.
-	// - color scheme is that of ableton live 2017
-
-	uint8_t bank_offset = g_bank_selected * NUM_BUTTONS;
-	for (uint8_t i=bank_offset; i<bank_offset + NUM_BUTTONS; ++i) {
-		uint8_t velocity = g_midi_note_state[0][i]; // Arcade button color info is stored in the first array
-		if (velocity > 0 ){
-			uint8_t key = i & BUTTON_ID_FLAGS; // treat as 64 buttons, only points to g_display_buffer which only stores active bank
-			uint8_t *ptr = buffer + key * 3;
-			// !review: LED Colors are inverted for the MF64 Hardware (led communications) (BRG instead of RGB), this is one place we reverse their order
-			*ptr++ = ableton_midi_feedback_colors[velocity][2];
-			*ptr++ = ableton_midi_feedback_colors[velocity][0];
-			*ptr++ = ableton_midi_feedback_colors[velocity][1];		
-		}
-	}
+	return ableton_midi_feedback_colors[velocity];
 }
 
 #elif MIDI_FEEDBACK_MODE == MIDI_FEEDBACK_MF3D_MODE
-#warning Midi Fighter 3D Midi Feedback Mode
-void midi_color_state(const uint8_t bank, uint8_t *buffer) // (Midi Feedback - Button Colors (Usage)) g_bank_selected, g_display_buffer 
+#pragma message "Midi Fighter 3D Midi Feedback Mode"
+// Color overrides are sent on the same channel
+// The settings are arrange as such
+// Velocity		Action
+//	      0     No Change
+//   1 - 120    Each of the 20 default colors, each color spans a velocity range of 6
+// 121 - 127    Active Color
+static const uint8_t* midi_color_source(uint8_t key, uint8_t velocity) // RGB
 {
-	// Override the display state of a given arcade button with a color set by
-	// the velocity of a Note On event of the same pitch.
-	// Color overrides are sent on the same channel
-	// The settings are arrange as such
-	// Velocity		Action
-	//	      0     No Change
-	//   1 - 120    Each of the 20 default colors, each color spans a velocity range of 6
-	// 121 - 127    Active Color
-	
-	// pre banking uint8_t bank_offset = MIDI_BASENOTE + g_bank_selected * 64; //!bank64 probably needs adjustment
-	uint8_t bank_offset = g_bank_selected * NUM_BUTTONS;
-	for (uint8_t i=bank_offset; i<bank_offset + NUM_BUTTONS; ++i) {
-		
-		uint8_t velocity = g_midi_note_state[0][i]; // Arcade button color info is stored in the first array
-		uint8_t key = i & BUTTON_ID_FLAGS; // treat as 64 buttons, only points to g_display_buffer which only stores active bank
-		
-		if (velocity > 0) {
-			if (velocity <121) {
-				// Create a color index from the velocity
-				uint8_t color = clamp(((velocity-1)/6)-1,0,19);
-				uint8_t *ptr = buffer + key * 3;
-				// Overwrite the color information
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = default_color[color][2];
-				*ptr++ = default_color[color][0];
-				*ptr++ = default_color[color][1];
-			}
-			else if (velocity < 127) {
-				// Create a color index from the velocity
-				uint8_t color = COLORID_WHITE;
-				uint8_t *ptr = buffer + key * 3;
-				// Overwrite the color information
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = default_color[color][2];
-				*ptr++ = default_color[color][0];
-				*ptr++ = default_color[color][1];				
-			}
-			else {	
-				uint8_t *src = default_bank_active[g_bank_selected] + key * 3 ;
-				uint8_t *ptr = buffer + key * 3;
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];
-			}
-		}
+	if (velocity <121) {
+		// Create a color index from the velocity
+		uint8_t color = clamp(((velocity-1)/6)-1,0,19);
+		return default_color[color];
+	}
+	else if (velocity < 127) {
+		return default_color[COLORID_WHITE];
+	}
+	else {	
+		return default_color[default_bank_active[g_bank_selected][key]];
 	}
 }
 #endif //MIDI_FEEDBACK_MODE == MIDI_FEEDBACK_MF3D_MODE
 
 // !review: move animations to a new file and keep this small? (animations.c and .h)
-#define CONCURRENT_GEOMETRIC_ANIMATIONS 4
-uint8_t geometric_animation_btn_id[CONCURRENT_GEOMETRIC_ANIMATIONS] = {0,0,0,0};
-uint8_t geometric_animation_type[CONCURRENT_GEOMETRIC_ANIMATIONS] = {GEOMETRIC_ANIMATION_TYPE_SQUARE, GEOMETRIC_ANIMATION_TYPE_SQUARE, GEOMETRIC_ANIMATION_TYPE_SQUARE, GEOMETRIC_ANIMATION_TYPE_SQUARE};
-uint8_t geometric_animation_pos[CONCURRENT_GEOMETRIC_ANIMATIONS] = {GEOMETRIC_ANIMATION_STEPS_SQUARE, GEOMETRIC_ANIMATION_STEPS_SQUARE, GEOMETRIC_ANIMATION_STEPS_SQUARE, GEOMETRIC_ANIMATION_STEPS_SQUARE};
-uint8_t geometric_animation_color_id[CONCURRENT_GEOMETRIC_ANIMATIONS] = {0,0,0,0}; //  default_colors index
-uint8_t * geometric_animation_color_ptr[CONCURRENT_GEOMETRIC_ANIMATIONS]; // array of pointers
-
-uint8_t geometric_animation_id = 0;
+uint8_t geometric_animation_btn_id[CONCURRENT_GEOMETRIC_ANIMATIONS];
+uint8_t geometric_animation_type[CONCURRENT_GEOMETRIC_ANIMATIONS]; // GEOMETRIC_ANIMATION_TYPE_SQUARE
+uint8_t geometric_animation_pos[CONCURRENT_GEOMETRIC_ANIMATIONS] = { [0 ... CONCURRENT_GEOMETRIC_ANIMATIONS-1] = GEOMETRIC_ANIMATION_STEPS_SQUARE }; // all finished
+const uint8_t * geometric_animation_color_ptr[CONCURRENT_GEOMETRIC_ANIMATIONS]; // array of pointers
+
 uint8_t assign_geometric_animation_id = 0;
 
+// Number of steps in each type of animation
+static const uint8_t geometric_animation_steps[GEOMETRIC_ANIMATION_TYPES] PROGMEM = {
+	GEOMETRIC_ANIMATION_STEPS_SQUARE,
+	GEOMETRIC_ANIMATION_STEPS_CIRCLE,
+	GEOMETRIC_ANIMATION_STEPS_STAR,
+	GEOMETRIC_ANIMATION_STEPS_TRIANGLE
+};
+
+// system_time_ms when each animation started: its step is worked out from
+// how long it has been running, not counted off a tick shared by them all.
+uint16_t geometric_animation_start_ms[CONCURRENT_GEOMETRIC_ANIMATIONS];
+
+// Bring each running animation up to the step its age calls for. A late
+// frame skips the steps it missed instead of slowing down, and steps only
+// move forward. This runs every frame whether or not the animations are
+// drawn, and while the USB is down, so an animation is seen to finish well
+// inside the 65 seconds system_time_ms takes to wrap and can't be restarted
+// by the wrap.
+void geometric_animation_advance(void) {
+	uint16_t now = system_time_ms;
+	for (uint8_t this_animation = 0; this_animation < CONCURRENT_GEOMETRIC_ANIMATIONS; this_animation++)
+	{
+		uint8_t steps = pgm_read_byte(&geometric_animation_steps[geometric_animation_type[this_animation] & 0x03]);
+		uint8_t pos = geometric_animation_pos[this_animation];
+		if (pos >= steps) { // animation complete
+			continue;
+		}
+		uint16_t elapsed = now - geometric_animation_start_ms[this_animation];
+		while (pos < steps && elapsed >= (uint16_t)(pos + 1) * GEOMETRIC_ANIMATION_STEP_TICKS) {
+			pos++;
+		}
+		geometric_animation_pos[this_animation] = pos;
+	}
+}
+
+#if CONCURRENT_GEOMETRIC_ANIMATIONS > 16
+#error geometric_animation_top[] holds animation ids in nibbles
+#endif
+// Keys the animations lit this frame, and which animation shows on each (a
+// nibble per key): the highest id, just as the last one drawn used to.
+// display_compose() paints them.
+static uint64_t geometric_animation_keys;
+static uint8_t geometric_animation_top[NUM_BUTTONS / 2];
+
+// Every step of every shape as the keys it lights around its button, steps 1
+// on (step 0 lights nothing). A template is 15 rows, from 7 rows below the
+// button to 7 above, each a byte of the columns to one side: bit n is n
+// columns away. All four shapes are the same to the left as to the right.
+// Generated from the shapes' original key-by-key loops; the "geometric" sim
+// scenario checks every step against the frames those loops drew.
+#define GEOMETRIC_TEMPLATE_ROWS 15
+static const uint8_t geometric_templates[][GEOMETRIC_TEMPLATE_ROWS] PROGMEM = {
+	// SQUARE, steps 1-7
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x03,0x02,0x03,0x00,0x00,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x00,0x00,0x07,0x04,0x04,0x04,0x07,0x00,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x00,0x0F,0x08,0x08,0x08,0x08,0x08,0x0F,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x1F,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x1F,0x00,0x00,0x00},
+	{0x00,0x00,0x3F,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x3F,0x00,0x00},
+	{0x00,0x7F,0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x7F,0x00},
+	{0xFF,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0xFF},
+	// CIRCLE, steps 1-13
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x01,0x02,0x01,0x00,0x00,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x00,0x00,0x03,0x04,0x04,0x04,0x03,0x00,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x00,0x03,0x04,0x08,0x08,0x08,0x04,0x03,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x07,0x0C,0x18,0x10,0x10,0x10,0x18,0x0C,0x07,0x00,0x00,0x00},
+	{0x00,0x00,0x07,0x0C,0x18,0x30,0x20,0x20,0x20,0x30,0x18,0x0C,0x07,0x00,0x00},
+	{0x00,0x0F,0x1C,0x38,0x70,0x60,0x40,0x40,0x40,0x60,0x70,0x38,0x1C,0x0F,0x00},
+	{0x0F,0x1C,0x38,0x70,0xE0,0xC0,0x80,0x80,0x80,0xC0,0xE0,0x70,0x38,0x1C,0x0F},
+	{0x1C,0x38,0x70,0xE0,0xC0,0x80,0x00,0x00,0x00,0x80,0xC0,0xE0,0x70,0x38,0x1C},
+	{0x38,0x70,0xE0,0xC0,0x80,0x00,0x00,0x00,0x00,0x00,0x80,0xC0,0xE0,0x70,0x38},
+	{0x70,0xE0,0xC0,0x80,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0xC0,0xE0,0x70},
+	{0xE0,0xC0,0x80,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0xC0,0xE0},
+	{0xC0,0x80,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0xC0},
+	{0x80,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80},
+	// STAR, steps 1-10
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x03,0x02,0x03,0x00,0x00,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x00,0x00,0x05,0x03,0x06,0x03,0x05,0x00,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x00,0x09,0x05,0x03,0x0E,0x03,0x05,0x09,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x11,0x09,0x05,0x00,0x1C,0x00,0x05,0x09,0x11,0x00,0x00,0x00},
+	{0x00,0x00,0x21,0x11,0x09,0x00,0x00,0x38,0x00,0x00,0x09,0x11,0x21,0x00,0x00},
+	{0x00,0x41,0x21,0x11,0x00,0x00,0x00,0x70,0x00,0x00,0x00,0x11,0x21,0x41,0x00},
+	{0x81,0x41,0x21,0x00,0x00,0x00,0x00,0xE0,0x00,0x00,0x00,0x00,0x21,0x41,0x81},
+	{0x81,0x41,0x00,0x00,0x00,0x00,0x00,0xC0,0x00,0x00,0x00,0x00,0x00,0x41,0x81},
+	{0x81,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0x00,0x00,0x00,0x00,0x00,0x00,0x81},
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+	// TRIANGLE, steps 1-14
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x03,0x01,0x00,0x00,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x0F,0x04,0x02,0x01,0x00,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x00,0x00,0x3F,0x10,0x08,0x04,0x02,0x01,0x00,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0x00,0xFF,0x40,0x20,0x10,0x08,0x04,0x02,0x01,0x00,0x00,0x00},
+	{0x00,0x00,0x00,0xFF,0x00,0x80,0x40,0x20,0x10,0x08,0x04,0x02,0x01,0x00,0x00},
+	{0x00,0x00,0xFF,0x00,0x00,0x00,0x80,0x40,0x20,0x10,0x08,0x04,0x02,0x01,0x00},
+	{0x00,0xFF,0x00,0x00,0x00,0x00,0x00,0x80,0x40,0x20,0x10,0x08,0x04,0x02,0x01},
+	{0xFF,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0x40,0x20,0x10,0x08,0x04,0x02},
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0x40,0x20,0x10,0x08,0x04},
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0x40,0x20,0x10,0x08},
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0x40,0x20,0x10},
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0x40,0x20},
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0x40},
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80}
+};
+// Template of each type's step 1
+static const uint8_t geometric_template_first[GEOMETRIC_ANIMATION_TYPES] PROGMEM = {
+	0,
+	GEOMETRIC_ANIMATION_STEPS_SQUARE-1,
+	GEOMETRIC_ANIMATION_STEPS_SQUARE-1 + GEOMETRIC_ANIMATION_STEPS_CIRCLE-1,
+	GEOMETRIC_ANIMATION_STEPS_SQUARE-1 + GEOMETRIC_ANIMATION_STEPS_CIRCLE-1 + GEOMETRIC_ANIMATION_STEPS_STAR-1
+};
+
+static inline uint8_t reverse_bits(uint8_t b) {
+	b = (b >> 4) | (b << 4);
+	b = ((b & 0xCC) >> 2) | ((b & 0x33) << 2);
+	return ((b & 0xAA) >> 1) | ((b & 0x55) << 1);
+}
+
+// The keys an animation lights at its current step, by button id. The
+// template is laid over the grid a row at a time: its row byte shifted to
+// the button's column for the right side, mirrored for the left.
+static uint64_t geometric_animation_mask(uint8_t anim) {
+	uint8_t type = geometric_animation_type[anim];
+	const uint8_t *template = geometric_templates[pgm_read_byte(&geometric_template_first[type]) + geometric_animation_pos[anim] - 1];
+	uint8_t btn_id = geometric_animation_btn_id[anim];
+	uint8_t btn_row = (btn_id >> 2) & 0x07; // bottom row is row0
+	uint8_t btn_col = (btn_id & 0x03) + (btn_id >= 32 ? 4 : 0);
+	uint64_t mask = 0;
+	uint8_t *mask_bytes = (uint8_t*)&mask;
+	template += (GEOMETRIC_TEMPLATE_ROWS >> 1) - btn_row; // the button's row is the template's middle one
+	for (uint8_t row = 0; row < GEOMETRIC_ANIMATION_ROWS; ++row) {
+		uint8_t right = pgm_read_byte(template + row);
+		if (!right) {
+			continue;
+		}
+		uint8_t cols = (uint8_t)(right << btn_col) | (uint8_t)(reverse_bits(right) >> (7 - btn_col));
+		// - mf 64 is wired as 4 individual 4x4 grids: a row's left half and right half are 32 buttons apart
+		uint8_t shift = (row & 1) << 2;
+		mask_bytes[row >> 1] |= (cols & 0x0F) << shift;
+		mask_bytes[4 + (row >> 1)] |= (cols >> 4) << shift;
+	}
+	return mask;
+}
+
+static void geometric_animation_paint(uint8_t anim) {
+	uint64_t mask = geometric_animation_mask(anim);
+	const uint8_t *mask_bytes = (const uint8_t*)&mask;
+	// mark each lit key as this animation's, a pair of keys at a time
+	geometric_animation_keys |= mask;
+	uint8_t high = anim << 4;
+	for (uint8_t byte = 0; byte < 8; ++byte) {
+		uint8_t bits = mask_bytes[byte];
+		for (uint8_t *top = &geometric_animation_top[byte << 2]; bits; ++top, bits >>= 2) {
+			if (bits & 0x01) {
+				*top = (*top & 0xF0) | anim;
+			}
+			if (bits & 0x02) {
+				*top = (*top & 0x0F) | high;
+			}
+		}
+	}
+}
+
 
 void set_geometric_animation_color_source(uint8_t button_id) {
 	// read midi value and use that color to set the pointer
 	// - note: may need to add keypos_to_midipos for other devices (on 64 keypos and midipos are the same)
 	uint8_t velocity = g_midi_note_state[0][button_id+NUM_BUTTONS*g_bank_selected]; // Arcade button color info is stored in the first array
 	if (velocity <= 0 || velocity >= 121) {
-		geometric_animation_color_ptr[assign_geometric_animation_id] = default_bank_active[g_bank_selected] + button_id*3;
+		geometric_animation_color_ptr[assign_geometric_animation_id] = default_color[default_bank_active[g_bank_selected][button_id]];
 	}
 	else {
 		uint8_t color = clamp(((velocity-1)/6)-1,0,19);
@@ -419,19 +568,7 @@ void set_geometric_animation_color_source(uint8_t button_id) {
 }
 
 // Row, Column: starts at BOTTOM-LEFT Corner (bottom row is row0, left column is column0)
-// - mf 64 is wired as 4 individual 4x4 grids, the get_geometric functions convert this wiring.
-uint8_t get_geometric_button_row(void) {
-	uint8_t this_row = (geometric_animation_btn_id[geometric_animation_id] >> 2 ) & 0x07;
-	return this_row;
-}
-uint8_t get_geometric_button_column(void) {
-	uint8_t this_column = geometric_animation_btn_id[geometric_animation_id] & 0x03;
-	if (geometric_animation_btn_id[geometric_animation_id]  >= 32) {
-		this_column = this_column + 4;
-	}
-	return this_column;
-}
-// - this converts geometry back to button_id
+// - mf 64 is wired as 4 individual 4x4 grids, this converts geometry back to button_id
 uint8_t get_button_id_from_row_column(uint8_t button_row, uint8_t button_column) {
 	if (button_row >= GEOMETRIC_ANIMATION_ROWS) {
 		return 0xFF; // NUM_BUTTONS
@@ -458,152 +595,18 @@ void start_geometric_square_animation(uint8_t button_id) {
 	geometric_animation_pos[assign_geometric_animation_id] = 0;
 	geometric_animation_type[assign_geometric_animation_id] = GEOMETRIC_ANIMATION_TYPE_SQUARE;
 	set_geometric_animation_color_source(button_id);
-	g_led_counter[GEOMETRIC_ANIMATION_G_LED_IDX] = GEOMETRIC_ANIMATION_G_LED_LIMIT;
-}
-void run_geometric_square_animation(uint8_t *buffer, bool update_animation) {
-	// Increment the Counter
-	if (update_animation) {
-		// increment the animation state
-		geometric_animation_pos[geometric_animation_id] = geometric_animation_pos[geometric_animation_id] + 1;
-		if (geometric_animation_pos[geometric_animation_id] >= GEOMETRIC_ANIMATION_STEPS_SQUARE) { // exit if animation complete
-			return; // !review: i belieive this is redundant to what is being done in run_geometric_animation()
-		}
-	}	
-	
-	// Set the led states
-	if (!geometric_animation_pos[geometric_animation_id]) { // at first, only the button itself is lit
-		return;
-	}
-	// run the animation. Let's light up some leds!
-	else {
-		// - get the 'on' color of the current led
-		// - get column row position of the current button
-		uint8_t btn_row = get_geometric_button_row();
-		uint8_t btn_col = get_geometric_button_column();
-		// - calculate the column/row limits for the current geometric_animation_position (outer edges of the square)
-		uint8_t min_row = btn_row - geometric_animation_pos[geometric_animation_id]; // Note: we are depending on overflow
-		uint8_t max_row = btn_row + geometric_animation_pos[geometric_animation_id];
-		uint8_t min_col = btn_col - geometric_animation_pos[geometric_animation_id];
-		uint8_t max_col = btn_col + geometric_animation_pos[geometric_animation_id];
-		// - calculate the limits of the mf64, so we can determine what to show, and what is out of bounds
-		uint8_t start_col = min_col < GEOMETRIC_ANIMATION_COLS ? min_col:0; // note: depends on 'overflow' in calculation of min_col
-		uint8_t end_col = max_col < GEOMETRIC_ANIMATION_COLS ? max_col:GEOMETRIC_ANIMATION_COLS-1;
-		uint8_t start_row = min_row < GEOMETRIC_ANIMATION_ROWS ? min_row:0;
-		uint8_t end_row = max_row < GEOMETRIC_ANIMATION_ROWS ? max_row:GEOMETRIC_ANIMATION_ROWS-1;
-		uint8_t *src = geometric_animation_color_ptr[geometric_animation_id];
-		
-		// - Light all applicable leds (full upper row, full lower row, outer square edges only on other rows
-		for (uint8_t this_row = start_row; this_row <= end_row; this_row++) {
-			for (uint8_t this_col = start_col; this_col <= end_col; this_col++) {
-				bool light_led = false;
-				if (this_row == min_row || this_row == max_row) { // Case: light all columns
-					light_led = true;
-				} else if (this_col == min_col || this_col == max_col) { // Case: only light outer edges of the square
-					light_led = true;
-				}
-				
-				if (light_led ){
-					//else {light_led = false;}
-					uint8_t btn_id = get_button_id_from_row_column(this_row, this_col);
-					uint8_t led_index = btn_id*3;
-					uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-					// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-					*ptr++ = src[2];
-					*ptr++ = src[0];
-					*ptr++ = src[1];
-				}
-			}
-		}
-	}
 }
 // Geometric Square Animation (end)
 
 // Geometric Circle Animation (start)
 
 void start_geometric_circle_animation(uint8_t button_id) {
-	//uint8_t geometric_animation_id = 0;
 	geometric_animation_btn_id[assign_geometric_animation_id] = button_id;
 	geometric_animation_pos[assign_geometric_animation_id] = 0;
 	geometric_animation_type[assign_geometric_animation_id] = GEOMETRIC_ANIMATION_TYPE_CIRCLE;
 	set_geometric_animation_color_source(button_id);
-	g_led_counter[GEOMETRIC_ANIMATION_G_LED_IDX] = GEOMETRIC_ANIMATION_G_LED_LIMIT;
-}
-
-uint8_t get_distance_from_center_in_steps(uint8_t btn_row, uint8_t btn_col, uint8_t this_row, uint8_t this_col) {
-	uint8_t row_distance = btn_row > this_row ? btn_row-this_row: this_row-btn_row;
-	uint8_t col_distance = btn_col > this_col ? btn_col-this_col: this_col-btn_col;
-	return (row_distance + col_distance);
 }
 
-void run_geometric_circle_animation(uint8_t *buffer, bool update_animation) {
-	
-	if (update_animation) {
-		// increment the animation state
-		geometric_animation_pos[geometric_animation_id] = geometric_animation_pos[geometric_animation_id] + 1;
-		if (geometric_animation_pos[geometric_animation_id] >= GEOMETRIC_ANIMATION_STEPS_CIRCLE) { // exit if animation complete
-			return; // !review: i belieive this is redundant to what is being done in run_geometric_animation()
-		}
-	}	
-	
-	// Set the led states
-	if (!geometric_animation_pos[geometric_animation_id]) { // at first, only the button itself is lit
-		return;
-	}
-	else {
-		// - get the 'on' color of the current led
-		// - get column row position of the current button
-		uint8_t btn_row = get_geometric_button_row();
-		uint8_t btn_col = get_geometric_button_column();
-		// - calculate the column/row limits for the current geometric_animation_position (outer edges of the square)
-		uint8_t min_row = btn_row - geometric_animation_pos[geometric_animation_id]; // Note: we are depending on overflow
-		uint8_t max_row = btn_row + geometric_animation_pos[geometric_animation_id];
-		uint8_t min_col = btn_col - geometric_animation_pos[geometric_animation_id];
-		uint8_t max_col = btn_col + geometric_animation_pos[geometric_animation_id];
-		// - calculate the limits of the mf64, so we can determine what to show, and what is out of bounds
-		uint8_t start_col = min_col < GEOMETRIC_ANIMATION_COLS ? min_col:0; // note: depends on 'overflow' in calculation of min_col
-		uint8_t end_col = max_col < GEOMETRIC_ANIMATION_COLS ? max_col:GEOMETRIC_ANIMATION_COLS-1;
-		uint8_t start_row = min_row < GEOMETRIC_ANIMATION_ROWS ? min_row:0;
-		uint8_t end_row = max_row < GEOMETRIC_ANIMATION_ROWS ? max_row:GEOMETRIC_ANIMATION_ROWS-1;
-		uint8_t *src = geometric_animation_color_ptr[geometric_animation_id];
-
-		uint8_t circle_incrementer = geometric_animation_pos[geometric_animation_id] >> 1; // for every two states, we will add 1 to each side of the circle edges
-		circle_incrementer = circle_incrementer <= 3 ? circle_incrementer:3; 
-		
-		uint8_t minimum_distance_steps = geometric_animation_pos[geometric_animation_id]; // in steps (in one step you can move one led horizontally OR vertically) (no diagonal in this calc)
-		uint8_t maximum_distance_steps = geometric_animation_pos[geometric_animation_id] == 1 ? minimum_distance_steps: minimum_distance_steps+circle_incrementer; // in steps
-
-		// - Light all applicable leds ()
-		for (uint8_t this_row = start_row; this_row <= end_row; this_row++) {
-			for (uint8_t this_col = start_col; this_col <= end_col; this_col++) {
-				bool light_led = false;
-				
-				uint8_t distance_in_steps = get_distance_from_center_in_steps(btn_row, btn_col, this_row, this_col);
-				if (distance_in_steps < minimum_distance_steps) {
-				}
-				else if (distance_in_steps == minimum_distance_steps) {
-					if (this_row == min_row || this_row == max_row || this_col == min_col || this_col == max_col) {
-						light_led = true;
-					}
-				}
-				else if (distance_in_steps <= maximum_distance_steps) {
-					light_led = true;
-				}
-				
-				if (light_led ){
-					//else {light_led = false;}
-					uint8_t btn_id = get_button_id_from_row_column(this_row, this_col);
-					uint8_t led_index = btn_id*3;
-					uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-					// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-					*ptr++ = src[2];
-					*ptr++ = src[0];
-					*ptr++ = src[1];
-				}
-			}
-		}
-	}	
-	
-}
 // Geometric Circle Animation (end)
 
 // Geometric Star Animation (start)
@@ -612,127 +615,6 @@ void start_geometric_star_animation(uint8_t button_id) {
 	geometric_animation_pos[assign_geometric_animation_id] = 0;
 	geometric_animation_type[assign_geometric_animation_id] = GEOMETRIC_ANIMATION_TYPE_STAR;
 	set_geometric_animation_color_source(button_id);
-	g_led_counter[GEOMETRIC_ANIMATION_G_LED_IDX] = GEOMETRIC_ANIMATION_G_LED_LIMIT;
-}
-void run_geometric_star_animation(uint8_t *buffer, bool update_animation) {
-	
-	if (update_animation) {
-		// increment the animation state
-		geometric_animation_pos[geometric_animation_id] = geometric_animation_pos[geometric_animation_id] + 1;
-		if (geometric_animation_pos[geometric_animation_id] >= GEOMETRIC_ANIMATION_STEPS_STAR) { // exit if animation complete
-			return; // !review: i belieive this is redundant to what is being done in run_geometric_animation()
-		}		
-	}
-	// Set the led states
-	if (!geometric_animation_pos[geometric_animation_id]) { // at first, only the button itself is lit
-		return;
-	}
-	// run the animation. Let's light up some leds!
-	else {
-		// - get the 'on' color of the current led
-		// - get column row position of the current button
-		uint8_t btn_row = get_geometric_button_row();
-		uint8_t btn_col = get_geometric_button_column();
-		// - calculate the column/row limits for the current geometric_animation_position (outer edges of the square)
-		uint8_t min_row = btn_row - geometric_animation_pos[geometric_animation_id]; // Note: we are depending on overflow
-		uint8_t max_row = btn_row + geometric_animation_pos[geometric_animation_id];
-		uint8_t min_col = btn_col - geometric_animation_pos[geometric_animation_id];
-		uint8_t max_col = btn_col + geometric_animation_pos[geometric_animation_id];
-		uint8_t *src = geometric_animation_color_ptr[geometric_animation_id];
-
-		// - Light Five Lines Top Left, Top Center, Top Right, Bottom Left, Bottom Right
-		uint8_t counter = geometric_animation_pos[geometric_animation_id];
-		uint8_t tail_position = 0;
-		while(counter > 0 && tail_position < GEOMETRIC_STAR_MAX_TAIL_LENGTH) { // Light up a string of up to TAIL_LENGTH lights to make the star more obvious
-			// -- Draw Top Center Line
-			uint8_t btn_id = get_button_id_from_row_column(max_row-tail_position, btn_col);
-			if (btn_id < 64) { // 64= NUM_BUTTONS
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];
-			}
-			// -- Draw Bottom Center Line (8pt star only)
-			btn_id = get_button_id_from_row_column(min_row+tail_position, btn_col);
-			if (btn_id < 64) { // 64= NUM_BUTTONS
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];
-			}
-			// -- Draw Top Left Line
-			btn_id = get_button_id_from_row_column(max_row-tail_position, min_col+tail_position);
-			if (btn_id < 64) { // 64= NUM_BUTTONS
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];
-			}			
-			// -- Draw Top Right Line
-			btn_id = get_button_id_from_row_column(max_row-tail_position, max_col-tail_position);
-			if (btn_id < 64) { // 64= NUM_BUTTONS
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];
-			}
-			// -- Draw Bottom Left Line
-			btn_id = get_button_id_from_row_column(min_row+tail_position, min_col+tail_position);
-			if (btn_id < 64) { // 64= NUM_BUTTONS
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];
-			}			
-			
-			// -- Draw Bottom Right Line
-			btn_id = get_button_id_from_row_column(min_row+tail_position, max_col-tail_position);
-			if (btn_id < 64) { // 64= NUM_BUTTONS
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];
-			}
-			
-			// -- Draw Left Line (8pt star only)
-			btn_id = get_button_id_from_row_column(btn_row, min_col+tail_position);
-			if (btn_id < 64) { // 64= NUM_BUTTONS
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];
-			}			
-			
-			// -- Draw Right Line (8pt star only)
-			btn_id = get_button_id_from_row_column(btn_row, max_col-tail_position);
-			if (btn_id < 64) { // 64= NUM_BUTTONS
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];
-			}
-						
-			// Go to the Next Set of Leds				
-			counter -= 1;
-			tail_position += 1;
-		}
-	}
 }
 // Geometric Star Animation (end)
 
@@ -742,102 +624,16 @@ void start_geometric_triangle_animation(uint8_t button_id) {
 	geometric_animation_pos[assign_geometric_animation_id] = 0;
 	geometric_animation_type[assign_geometric_animation_id] = GEOMETRIC_ANIMATION_TYPE_TRIANGLE;
 	set_geometric_animation_color_source(button_id);
-	g_led_counter[GEOMETRIC_ANIMATION_G_LED_IDX] = GEOMETRIC_ANIMATION_G_LED_LIMIT;
 }
 
-void run_geometric_triangle_animation(uint8_t *buffer, bool update_animation) {
-	
-	if (update_animation) {
-		// increment the animation state
-		geometric_animation_pos[geometric_animation_id] = geometric_animation_pos[geometric_animation_id] + 1;
-		if (geometric_animation_pos[geometric_animation_id] >= GEOMETRIC_ANIMATION_STEPS_TRIANGLE) { // exit if animation complete
-			return; // !review: i belieive this is redundant to what is being done in run_geometric_animation()
-		}
-	}
-	
-	// Set the led states
-	if (!geometric_animation_pos[geometric_animation_id]) { // at first, only the button itself is lit
-		return;
-	}
-	// run the animation. Let's light up some leds!
-	else {
-		// - get the 'on' color of the current led
-		// - get column row position of the current button
-		uint8_t btn_row = get_geometric_button_row();
-		uint8_t btn_col = get_geometric_button_column();
-		// - calculate the column/row limits for the current geometric_animation_position (outer edges of the square)
-		uint8_t min_row = btn_row - (geometric_animation_pos[geometric_animation_id]-1); // Note: we are depending on overflow
-		uint8_t max_row = btn_row + geometric_animation_pos[geometric_animation_id];
-		uint8_t min_col = btn_col - (1 + (geometric_animation_pos[geometric_animation_id]-1)*2);
-		uint8_t max_col = btn_col + (1 + (geometric_animation_pos[geometric_animation_id]-1)*2);
-		// - calculate the limits of the mf64, so we can determine what to show, and what is out of bounds
-		uint8_t start_col = min_col < GEOMETRIC_ANIMATION_COLS ? min_col:0; // note: depends on 'overflow' in calculation of min_col
-		uint8_t end_col = max_col < GEOMETRIC_ANIMATION_COLS ? max_col:GEOMETRIC_ANIMATION_COLS-1;
-		uint8_t start_row = min_row < GEOMETRIC_ANIMATION_ROWS ? min_row:0;
-		uint8_t end_row = max_row < GEOMETRIC_ANIMATION_ROWS ? max_row:GEOMETRIC_ANIMATION_ROWS-1;
-		uint8_t *src = geometric_animation_color_ptr[geometric_animation_id];
-		
-		// - Light all applicable leds (single led on upper row, full lower row, Lines drawn between these two row endpoints
-		// -- Light the bottom row (all leds in range)
-		if (start_row == min_row) {
-			for (uint8_t this_col = start_col; this_col <= end_col; this_col++) {
-				uint8_t btn_id = get_button_id_from_row_column(start_row, this_col);
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];				
-			}
-			//start_row += 1; // skip this row in subsequent routines
-		}
-		// -- Light the top row (single led)
-		if (end_row == max_row) { // if this button exists
-			uint8_t btn_id = get_button_id_from_row_column(end_row, btn_col);	
-			uint8_t led_index = btn_id*3;
-			uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-			// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-			*ptr++ = src[2];
-			*ptr++ = src[0];
-			*ptr++ = src[1];
-		}
-		// -- Light the leds to connect the top and bottom rows
-		
-		for (uint8_t this_row = start_row; this_row <= end_row; this_row++) {
-			uint8_t distance_from_bottom = this_row - min_row; // note: this depends on 8-bit overflow of min_row to
-			uint8_t left_col = min_col + distance_from_bottom;
-			uint8_t right_col = max_col - distance_from_bottom;
-			
-			if (left_col < GEOMETRIC_ANIMATION_COLS) {
-				uint8_t btn_id = get_button_id_from_row_column(this_row, left_col);
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];				
-			}
-			if (right_col < GEOMETRIC_ANIMATION_COLS) {
-				uint8_t btn_id = get_button_id_from_row_column(this_row, right_col);
-				uint8_t led_index = btn_id*3;
-				uint8_t *ptr = buffer + led_index;  // Copy To LED Buffer for this LED
-				// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
-				*ptr++ = src[2];
-				*ptr++ = src[0];
-				*ptr++ = src[1];				
-			}
-		}
-	}
-}
 
 // Geometric Triangle Animation (end)
 
 
 void start_geometric_animation(uint8_t button_id, uint8_t animation_id) {
 	//bool update_animation = false;
-	if (g_led_counter[1] == 0) { // !review: move this section to geometric_animation_state?
-		// reset the counter.
-		g_led_counter[1] = GEOMETRIC_ANIMATION_G_LED_LIMIT;
+	if (animation_id < GEOMETRIC_ANIMATION_TYPES) {
+		geometric_animation_start_ms[assign_geometric_animation_id] = system_time_ms;
 	}
 	switch (animation_id) {
 		case GEOMETRIC_ANIMATION_TYPE_CIRCLE:
@@ -858,37 +654,16 @@ void start_geometric_animation(uint8_t button_id, uint8_t animation_id) {
 	assign_geometric_animation_id = (assign_geometric_animation_id + 1) % CONCURRENT_GEOMETRIC_ANIMATIONS; // increment for the next time this is run
 }
 
-void geometric_animation_state(const uint8_t bank, uint8_t *buffer) {
-	bool update_animation = false;
-	if (g_led_counter[1] == 0) { // !review: move this section to geometric_animation_state?
-		// reset the counter.
-		g_led_counter[1] = GEOMETRIC_ANIMATION_G_LED_LIMIT;
-		update_animation = true;
-	}
-		
+void geometric_animation_state(void) {
+	geometric_animation_keys = 0;
 	for (uint8_t this_animation = 0; this_animation < CONCURRENT_GEOMETRIC_ANIMATIONS; this_animation++)
 	{
-		geometric_animation_id = this_animation; //+ assign_geometric_animation_id) % CONCURRENT_GEOMETRIC_ANIMATIONS;
-		
-		if (geometric_animation_type[this_animation] < 1) { // GEOMETRIC_ANIMATION_TYPE_SQUARE
-			if (geometric_animation_pos[this_animation] < GEOMETRIC_ANIMATION_STEPS_SQUARE) { // exit if animation complete
-				run_geometric_square_animation(buffer, update_animation);
-			}
-		}
-		else if (geometric_animation_type[this_animation] < 2) { // GEOMETRIC_ANIMATION_TYPE_CIRCLE
-			if (geometric_animation_pos[this_animation] < GEOMETRIC_ANIMATION_STEPS_CIRCLE) { // exit if animation complete
-				run_geometric_circle_animation(buffer, update_animation);
-			}
+		uint8_t steps = pgm_read_byte(&geometric_animation_steps[geometric_animation_type[this_animation] & 0x03]);
+		if (geometric_animation_pos[this_animation] >= steps) { // animation complete
+			continue;
 		}
-		else if (geometric_animation_type[this_animation] < 3) { // GEOMETRIC_ANIMATION_TYPE_STAR
-			if (geometric_animation_pos[this_animation] < GEOMETRIC_ANIMATION_STEPS_STAR) { // exit if animation complete
-				run_geometric_star_animation(buffer, update_animation); 
-			}
-		}
-		else if (geometric_animation_type[this_animation] < 4) { // GEOMETRIC_ANIMATION_TYPE_TRIANGLE
-			if (geometric_animation_pos[this_animation] < GEOMETRIC_ANIMATION_STEPS_TRIANGLE) { // exit if animation complete
-				run_geometric_triangle_animation(buffer, update_animation);
-			}
+		if (geometric_animation_pos[this_animation]) { // at first, only the button itself is lit
+			geometric_animation_paint(this_animation);
 		}
 	}
 }
@@ -910,22 +685,22 @@ void rgb_test_animation_state(uint8_t *buffer) {
 	uint8_t red, green, blue;
 	// !review: LED Colors are inverted for the MF64 (BRG instead of RGB), this is one place we reverse their order
 	if (rgb_test_position <= 0) { // off
-		red = default_color[COLORID_OFF][0];
-		green = default_color[COLORID_OFF][1];
-		blue = default_color[COLORID_OFF][2];
+		red = DEFAULT_COLOR(COLORID_OFF, 0);
+		green = DEFAULT_COLOR(COLORID_OFF, 1);
+		blue = DEFAULT_COLOR(COLORID_OFF, 2);
 	} else if (rgb_test_position == 1) { // red
-		red = default_color[COLORID_RED][0];
-		green = default_color[COLORID_RED][1];
-		blue = default_color[COLORID_RED][2];
+		red = DEFAULT_COLOR(COLORID_RED, 0);
+		green = DEFAULT_COLOR(COLORID_RED, 1);
+		blue = DEFAULT_COLOR(COLORID_RED, 2);
 	} else if (rgb_test_position == 2) { // green
-		red = default_color[COLORID_GREEN][0];
-		green = default_color[COLORID_GREEN][1];
-		blue = default_color[COLORID_GREEN][2];
+		red = DEFAULT_COLOR(COLORID_GREEN, 0);
+		green = DEFAULT_COLOR(COLORID_GREEN, 1);
+		blue = DEFAULT_COLOR(COLORID_GREEN, 2);
 		
 	} else if (rgb_test_position >= 3) { // blue
-		red = default_color[COLORID_BLUE][0];
-		green = default_color[COLORID_BLUE][1];
-		blue = default_color[COLORID_BLUE][2];
+		red = DEFAULT_COLOR(COLORID_BLUE, 0);
+		green = DEFAULT_COLOR(COLORID_BLUE, 1);
+		blue = DEFAULT_COLOR(COLORID_BLUE, 2);
 	}
 	
 	for (uint8_t this_led = 0; this_led < 64; this_led++) // this_led
@@ -942,106 +717,156 @@ void rgb_test_animation_state(uint8_t *buffer) {
 
 
 
-void midi_animation_state(const uint8_t bank,uint8_t *buffer)
+// Apply a note's animation to its key's color, three bytes in either order.
+static void midi_animation_modify(uint8_t velocity, uint8_t *ptr)
 {
-	// Override the display state of a given arcade button with an animation set by
-	// the velocity of a Note On event of the same pitch.
-	// Animation settings are sent on the next channel.
-	uint8_t bank_offset = bank ? NUM_BUTTONS: 0; // !bank64 logic limited to two banks
-	
-	for (uint8_t i=bank_offset; i<bank_offset + 64; ++i) {
-		#if USB_RX_METHOD >= USB_RX_PERIODICALLY
-		Midifighter_GetIncomingUsbMidiMessages(); // !error: remove USB_RX_PERIODICALLY
-		#endif
-		
-		uint8_t velocity = g_midi_note_state[1][i]; // Arcade button animation info is stored in the second array
-		uint8_t key = i & BUTTON_ID_FLAGS; // truncate to 64 buttons, only points to g_display_buffer which only stores active bank
- 
-		if (velocity > 0) {
-			// Single Button VU
-			if (velocity < 18 ){
-				// !review: make vu_meter work?
-				//uint8_t *ptr = buffer + key * 3;
-				//uint8_t level = velocity - 1;
-				//uint8_t src[3] = {0x00,0x00,0xFF};
-				//uint8_t *col = src;
-				//vu_meter(level, true, col, ptr);
-			}
-			// Brightness
-			else if (velocity < 34) {
-				uint8_t *ptr = buffer + key * 3;
-				uint8_t level = velocity-18;
-				uint8_t result[3];
-				
-				result[0] = (ptr[0]*level)>>4;
-				result[1] = (ptr[1]*level)>>4;
-				result[2] = (ptr[2]*level)>>4;
-				
-				ptr[0] = result[0];
-				ptr[1] = result[1];
-				ptr[2] = result[2];
-			}
-			// Flash Animation - Gates the current color with a flash rate
-			else if (velocity < 42) {
-				if(!flash_animation(velocity-33)) {
-					uint8_t *ptr = buffer + key * 3;
-					ptr[0] = 0x00;
-					ptr[1] = 0x00;
-					ptr[2] = 0x00;
-				}				
-			}
-			// Pulse Animation - Pulse the current color at a certain rate
-			else if (velocity < 50) {
-				
-				uint8_t *ptr = buffer + key * 3;
-				uint8_t cycle_level = pulse_animation(velocity-41);
-				
-				uint8_t result[3];
-				
-				result[0] = (ptr[0]*cycle_level)>>8;
-				result[1] = (ptr[1]*cycle_level)>>8;
-				result[2] = (ptr[2]*cycle_level)>>8;
-				
-				ptr[0] = result[0];
-				ptr[1] = result[1];
-				ptr[2] = result[2];
-				
-			}
-			else if (velocity < 54) { // Geometric Animations
-				// Trigger the start of the animation. It will be run in a separate process for the time being.
-				// !review: !bank64: setting this when in a different bank will cause it to be triggered only after the bank is changed...
-				start_geometric_animation(i & BUTTON_ID_FLAGS, velocity - 50);
-				// These are one shot animations. Reset the value to 0, so the animation doesn't run again.
-				g_midi_note_state[1][i] = 0; // Arcade button animation info is stored in the second array
-			}
+	// Single Button VU
+	if (velocity < 18 ){
+		// !review: make vu_meter work?
+		//uint8_t level = velocity - 1;
+		//uint8_t src[3] = {0x00,0x00,0xFF};
+		//uint8_t *col = src;
+		//vu_meter(level, true, col, ptr);
+	}
+	// Brightness
+	else if (velocity < 34) {
+		uint8_t level = velocity-18;
+		ptr[0] = (ptr[0]*level)>>4;
+		ptr[1] = (ptr[1]*level)>>4;
+		ptr[2] = (ptr[2]*level)>>4;
+	}
+	// Flash Animation - Gates the current color with a flash rate
+	else if (velocity < 42) {
+		if(!flash_animation(velocity-33)) {
+			ptr[0] = 0x00;
+			ptr[1] = 0x00;
+			ptr[2] = 0x00;
+		}				
+	}
+	// Pulse Animation - Pulse the current color at a certain rate
+	else if (velocity < 50) {
+		uint8_t cycle_level = pulse_animation(velocity-41);
+		ptr[0] = (ptr[0]*cycle_level)>>8;
+		ptr[1] = (ptr[1]*cycle_level)>>8;
+		ptr[2] = (ptr[2]*cycle_level)>>8;
+	}
+	// Geometric Animations (50 - 53) are one shots, started by midi_animation_start()
+}
+
+static void midi_animation_start_note(uint8_t i, uint8_t key, uint8_t velocity, uint8_t *buffer)
+{
+	if (velocity >= 50 && velocity < 54) { // Geometric Animations
+		// !review: !bank64: setting this when in a different bank will cause it to be triggered only after the bank is changed...
+		start_geometric_animation(key, velocity - 50);
+		// These are one shot animations. Reset the value to 0, so the animation doesn't run again.
+		midi_note_state_set(1, i, 0); // Arcade button animation info is stored in the second array
+	}
+}
+
+// Start the geometric animations the host asked for on the animation
+// channel (velocities 50 - 53), before the frame's geometric animations are
+// laid out, so one starts in the frame it is seen whether or not its key
+// ends up covered.
+static void midi_animation_start(void)
+{
+	midi_for_each_note(1, g_bank_selected ? 1 : 0, midi_animation_start_note, NULL); // !bank64 logic limited to two banks
+}
+
+// Work out every flash and pulse rate's phase from display_flash_counter once
+// a frame, so a pulsing key costs a table read rather than a float sin().
+static void animation_phase_update(void)
+{
+	uint16_t counter = display_flash_counter; // one reading for the whole frame
+	uint16_t pulse_counter = counter << (midi_clock_enabled ? 5 : 4);
+	uint8_t flash_on = 0;
+	for (uint8_t rate = 1; rate <= 8; ++rate) {
+		if (counter & (SIXTEENTH_FLASH_STATE<<(8-rate))) {
+			flash_on |= 1 << (rate-1);
 		}
-		
-		
+		// sin(0.049*rgb_step) went through two periods in the 256 steps, sintable() goes through one
+		uint8_t rgb_step = (uint8_t)(pulse_counter >> (8-rate));
+		animation_pulse_level[rate-1] = sintable(rgb_step << 1) + 127;
 	}
+	animation_flash_on = flash_on;
 }
 
 // Returns the flash state of the 8 available flash rates.
 bool flash_animation(uint8_t flash_rate)
 {
-	if (display_flash_counter & (SIXTEENTH_FLASH_STATE<<(8-flash_rate))) {
-		return true;
-	}
-	else {
-		return false;
-	}
+	return (animation_flash_on & (1 << (flash_rate-1))) != 0;
 }
 // Returns a sin function brightness level for up to 8 different rates
 uint8_t pulse_animation(uint8_t pulse_rate)
 {
-	uint8_t rgb_step;
-	if(!midi_clock_enabled){
-		rgb_step  = (uint8_t)(((display_flash_counter<<4)>>(8-pulse_rate)) & 0xFF);
-	}
-	else{
-		rgb_step  = (uint8_t)(((display_flash_counter<<5)>>(8-pulse_rate)) & 0xFF);
+	return animation_pulse_level[pulse_rate-1];
+}
+
+// Resolve every layer of a key, topmost first, before writing it, so each
+// byte of g_display_buffer is written once per frame rather than once per
+// layer covering it, and the layers hidden under a geometric animation or
+// the sleep demo are never worked out. Keys are taken 8 at a time from the
+// lit-note and geometric masks like midi_for_each_note().
+static void display_compose(uint8_t layers)
+{
+	uint8_t color_offset = g_bank_selected * NUM_BUTTONS;
+	uint8_t animation_offset = (g_bank_selected ? 1 : 0) * NUM_BUTTONS; // !bank64 logic limited to two banks, as midi_animation_start()
+	const uint8_t *active_src = default_bank_active[g_bank_selected];
+	const uint8_t *inactive_src = default_bank_inactive[g_bank_selected];
+	uint8_t *dest = g_display_buffer;
+	uint8_t key = 0;
+	for (uint8_t byte = 0; byte < 8; ++byte) {
+		#if USB_RX_METHOD >= USB_RX_PERIODICALLY
+		Midifighter_GetIncomingUsbMidiMessages();
+		#endif
+		uint8_t keys_down = ((const uint8_t*)&g_key_state)[byte];
+		uint8_t color_bits = 0;
+		uint8_t animation_bits = 0;
+		uint8_t geometric_bits = 0;
+		if (layers & DISPLAY_LAYER_FEEDBACK_COLOR) {
+			color_bits = ((const uint8_t*)&g_midi_note_lit[0][g_bank_selected])[byte];
+		}
+		if (layers & DISPLAY_LAYER_FEEDBACK_ANIMATION) {
+			animation_bits = ((const uint8_t*)&g_midi_note_lit[1][animation_offset ? 1 : 0])[byte];
+		}
+		if (layers & DISPLAY_LAYER_GEOMETRIC) {
+			geometric_bits = ((const uint8_t*)&geometric_animation_keys)[byte];
+		}
+		if (!(color_bits | animation_bits | geometric_bits) && !(layers & DISPLAY_LAYER_SLEEP)) {
+			// Nothing over these 8 keys but their key colors
+			for (uint8_t bit = 1; bit; bit <<= 1, ++key, dest += 3) {
+				display_put_color(dest, default_color[((keys_down & bit) ? active_src : inactive_src)[key]]);
+			}
+			continue;
+		}
+		for (uint8_t bit = 1; bit; bit <<= 1, ++key, dest += 3) {
+			const uint8_t *src;
+			if (geometric_bits & bit) {
+				uint8_t top = geometric_animation_top[key >> 1];
+				src = geometric_animation_color_ptr[(key & 1) ? top >> 4 : top & 0x0F];
+			}
+			else if (layers & DISPLAY_LAYER_SLEEP) {
+				src = ball_demo_color(key);
+			}
+			else {
+				uint8_t color = (color_bits & bit) ? g_midi_note_state[0][color_offset + key] : 0;
+				if (color > 0) {
+					src = midi_color_source(key, color);
+				}
+				else {
+					src = default_color[((keys_down & bit) ? active_src : inactive_src)[key]];
+				}
+				uint8_t animation = (animation_bits & bit) ? g_midi_note_state[1][animation_offset + key] : 0;
+				if (animation > 0) {
+					uint8_t rgb[3];
+					display_get_color(rgb, src);
+					midi_animation_modify(animation, rgb);
+					display_put_rgb(dest, rgb);
+					continue;
+				}
+			}
+			display_put_color(dest, src);
+		}
 	}
-	uint8_t level = sin((rgb_freq*rgb_step)) * 127 + 127;
-	return level;
 }
 
 // Global Functions -----------------------------------------------------------
@@ -1050,13 +875,10 @@ void default_display_run(void) //const uint8_t bank, g_bank_selected
 						 //const uint16_t key_state, , g_key_state
 						//	   uint8_t *buffer), g_display_buffer
 {
-	// - Set LEDs based on Button Press State
-	//info_display_inactive();//g_bank_selected, g_display_buffer);
-	info_display_active(); //g_bank_selected, g_key_state, g_display_buffer);
-		
-	// ... and allow the user to write colors using MIDI input.
-	midi_color_state(g_bank_selected, g_display_buffer);
-	midi_animation_state(g_bank_selected, g_display_buffer);
+	uint8_t layers = g_display_layers;
+	bool sleeping = false;
+	
+	animation_phase_update();
 	
 	// Sleep Animation
 	// Increment timing counters
@@ -1083,7 +905,7 @@ void default_display_run(void) //const uint8_t bank, g_bank_selected
 		}
 		if (sleep_minute_counter > G_EE_SLEEP_TIME)
 		{
-			ball_demo_run(g_display_buffer);
+			sleeping = true;
 		}
 		if (g_key_down)
 		{
@@ -1091,181 +913,24 @@ void default_display_run(void) //const uint8_t bank, g_bank_selected
 			sleep_minute_counter=0;
 		}
 	}
-	geometric_animation_state(g_bank_selected, g_display_buffer);
+	if (!sleeping) {
+		layers &= ~DISPLAY_LAYER_SLEEP;
+	}
+	if (layers & DISPLAY_LAYER_SLEEP) {
+		ball_demo_update();
+	}
+	
+	// Mark the keys the geometric animations cover, then draw the frame in one pass
+	if (layers & DISPLAY_LAYER_FEEDBACK_ANIMATION) {
+		midi_animation_start();
+	}
+	geometric_animation_advance();
+	if (layers & DISPLAY_LAYER_GEOMETRIC) {
+		geometric_animation_state();
+	}
+	display_compose(layers);
 	
 	#if ENABLE_RGB_TEST > 0
 	rgb_test_animation_state(g_display_buffer);
 	#endif	
 }
-
-#define LAVENDER_GREEN_LIMIT 0x24 // Can't be lavender if it has a lot of green (MF3D Patch)
-#define MF3D_UTILITY_BRIGHT_COLOR_LIMIT 0x80
-#define MF3D_UTILITY_DIM_COLOR_LIMIT 0x27
-// Sysex Configuration Extensions -----------------------------------------------
-// - !review (adust functions below): MF3D Compatibility Patch (allow 20 colors that are scaled for power)
-// -- this could be updated to a simpler equation, but 
-// --- you need to be very careful about power draw. 128 leds can pull up to 2-Amps
-// ---- but usb devices are limited to 0.5-Amps
-void adjust_inactive_bank_leds_for_power(uint8_t bank, uint8_t offset, uint8_t size)
-{
-	for (uint8_t this_byte = offset; this_byte < offset + size; this_byte+=3) {
-		uint8_t this_rgb[3];
-		uint8_t this_color_id;
-		this_rgb[0] = default_bank_inactive[bank][this_byte];
-		this_rgb[1] = default_bank_inactive[bank][this_byte+1];
-		this_rgb[2] = default_bank_inactive[bank][this_byte+2];
-		if (!this_rgb[0]) // No Red
-		{
-			if (!this_rgb[1]) // Blue or Off (No Red No Green)
-			{
-				if (!this_rgb[2]) { // Case: Off -> No Change actually necessary
-					this_color_id = COLORID_OFF;
-				}
-				else { // BLUE
-					if (this_rgb[2] == default_color[COLORID_BLUE][2]) {continue;} // Patch: do not change if already assigned as MF64 Color
-					this_color_id = this_rgb[2] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_BLUE : COLORID_BLUE_DIM;
-				}
-			}
-			else if (!this_rgb[2]) // GREEN only (no red no blue)
-			{
-				if (this_rgb[1] == default_color[COLORID_GREEN][1]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_GREEN : COLORID_GREEN_DIM;
-			}
-			else  // No Red, Yes Green, Yes Blue: CYAN
-			{
-				if (this_rgb[1] == default_color[COLORID_CYAN][1]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_CYAN : COLORID_CYAN_DIM;
-			}
-		}
-		else if (!this_rgb[1]) // Yes Red, No Green
-		{
-			if (!this_rgb[2]) // RED ONLY
-			{
-				if (this_rgb[0] == default_color[COLORID_RED][0]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_RED : COLORID_RED_DIM;
-			}
-			else // Red and Blue (PINK) Note Lavender has some green in it
-			{
-				if (this_rgb[0] == default_color[COLORID_PINK][0]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_PINK : COLORID_PINK_DIM;
-			}
-			
-		}
-		else if (!this_rgb[2]) // Yes Red, Yes Green, No Blue (Yellow or 
-		{
-			// Yellow, Orange, or Chartreuse (rx midi (value is *2) chart:5f,7f,00, yellow: 7f,5f,00, orange: 7f,22,00)
-			if (this_rgb[0] < this_rgb[1]) // CHARTRUESE: more green than red 
-			{
-				if (this_rgb[1] == default_color[COLORID_CHARTREUSE][1]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_CHARTREUSE : COLORID_CHARTREUSE_DIM;
-			}
-			else if (this_rgb[0] >> 1 >= this_rgb[1]) // ORANGE: more than twice as much red as green
-			{
-				if (this_rgb[0] == default_color[COLORID_ORANGE][0]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_ORANGE : COLORID_ORANGE_DIM;				
-			}
-			else // YELLOW 
-			{
-				if (this_rgb[0] == default_color[COLORID_YELLOW][0]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_YELLOW : COLORID_YELLOW_DIM;
-			}
-		}
-		else // White or lavender
-		{
-			if (this_rgb[1] > LAVENDER_GREEN_LIMIT) {  // White
-				this_color_id = COLORID_WHITE;//this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_WHITE
-			}
-			else { // Lavender
-				// - If blue is bright, assume lavendar is intended to be bright
-				if (this_rgb[2] == default_color[COLORID_LAVENDER][2]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_LAVENDER : COLORID_LAVENDER_DIM;			
-			}
-			
-		}
-		default_bank_inactive[bank][this_byte] = default_color[this_color_id][0];
-		default_bank_inactive[bank][this_byte+1] = default_color[this_color_id][1];
-		default_bank_inactive[bank][this_byte+2] = default_color[this_color_id][2];
-	}
-}
-void adjust_active_bank_leds_for_power(uint8_t bank, uint8_t offset, uint8_t size)
-{
-	//default_bank_inactive[bank][offset + idx] = ((*buffer++) * 2);
-	for (uint8_t this_byte = offset; this_byte < offset + size; this_byte+=3) { 
-		uint8_t this_rgb[3];
-		uint8_t this_color_id;
-		this_rgb[0] = default_bank_active[bank][this_byte];
-		this_rgb[1] = default_bank_active[bank][this_byte+1];
-		this_rgb[2] = default_bank_active[bank][this_byte+2];
-		if (!this_rgb[0]) // No Red
-		{
-			if (!this_rgb[1]) // Blue or Off (No Red No Green)
-			{
-				if (!this_rgb[2]) { // Case: Off -> No Change actually necessary
-					this_color_id = COLORID_OFF;
-				}
-				else { // BLUE
-					if (this_rgb[2] == default_color[COLORID_BLUE][2]) {continue;} // Patch: do not change if already assigned as MF64 Color
-					this_color_id = this_rgb[2] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_BLUE : COLORID_BLUE_DIM;
-				}
-			}
-			else if (!this_rgb[2]) // GREEN only (no red no blue)
-			{
-				if (this_rgb[1] == default_color[COLORID_GREEN][1]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_GREEN : COLORID_GREEN_DIM;
-			}
-			else  // No Red, Yes Green, Yes Blue: CYAN
-			{
-				if (this_rgb[1] == default_color[COLORID_CYAN][1]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_CYAN : COLORID_CYAN_DIM;
-			}
-		}
-		else if (!this_rgb[1]) // Yes Red, No Green
-		{
-			if (!this_rgb[2]) // RED ONLY
-			{
-				if (this_rgb[0] == default_color[COLORID_RED][0]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_RED : COLORID_RED_DIM;
-			}
-			else // Red and Blue (PINK) Note Lavender has some green in it
-			{
-				if (this_rgb[0] == default_color[COLORID_PINK][0]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_PINK : COLORID_PINK_DIM;
-			}
-			
-		}
-		else if (!this_rgb[2]) // Yes Red, Yes Green, No Blue (Yellow or 
-		{
-			// Yellow, Orange, or Chartreuse (rx midi (value is *2) chart:5f,7f,00, yellow: 7f,5f,00, orange: 7f,22,00)
-			if (this_rgb[0] < this_rgb[1]) // CHARTRUESE: more green than red 
-			{
-				if (this_rgb[1] == default_color[COLORID_CHARTREUSE][1]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[1] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_CHARTREUSE : COLORID_CHARTREUSE_DIM;
-			}
-			else if (this_rgb[0] >> 1 >= this_rgb[1]) // ORANGE: more than twice as much red as green
-			{
-				if (this_rgb[0] == default_color[COLORID_ORANGE][0]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_ORANGE : COLORID_ORANGE_DIM;				
-			}
-			else // YELLOW 
-			{
-				if (this_rgb[0] == default_color[COLORID_YELLOW][0]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_YELLOW : COLORID_YELLOW_DIM;
-			}
-		}
-		else // White or lavender
-		{
-			if (this_rgb[1] > LAVENDER_GREEN_LIMIT) {  // White
-				this_color_id = COLORID_WHITE;//this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_WHITE
-			}
-			else { // Lavender
-				// - If blue is bright, assume lavendar is intended to be bright
-				if (this_rgb[2] == default_color[COLORID_LAVENDER][2]) {continue;} // Patch: do not change if already assigned as MF64 Color
-				this_color_id = this_rgb[0] > MF3D_UTILITY_BRIGHT_COLOR_LIMIT ? COLORID_LAVENDER : COLORID_LAVENDER_DIM;			
-			}
-			
-		}
-		default_bank_active[bank][this_byte] = default_color[this_color_id][0];
-		default_bank_active[bank][this_byte+1] = default_color[this_color_id][1];
-		default_bank_active[bank][this_byte+2] = default_color[this_color_id][2];
-	}
-}
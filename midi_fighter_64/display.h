@@ -25,6 +25,8 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <avr/pgmspace.h>
+#include "constants.h"
 
 // Constants ------------------------------------------------------------------
 #define ENABLE_RGB_TEST 0
@@ -38,8 +40,7 @@
 // -- Grid Properties
 #define GEOMETRIC_ANIMATION_ROWS 8
 #define GEOMETRIC_ANIMATION_COLS 8
-#define GEOMETRIC_ANIMATION_G_LED_IDX 3
-#define GEOMETRIC_ANIMATION_G_LED_LIMIT	0x70 // Time delay between animation steps = LIMIT*0.5ms
+#define GEOMETRIC_ANIMATION_STEP_TICKS 75 // Time delay between animation steps, in system_time_ms ticks (~0.77ms)
 // -- Animation Types
 #define GEOMETRIC_ANIMATION_TYPES 4
 #define GEOMETRIC_ANIMATION_TYPE_SQUARE 0
@@ -53,13 +54,24 @@
 #define GEOMETRIC_ANIMATION_STEPS_TRIANGLE 15
 
 #define GEOMETRIC_STAR_MAX_TAIL_LENGTH 3 // how many squares should the star expand through?
+#define CONCURRENT_GEOMETRIC_ANIMATIONS 16 // animations running at once, the oldest is replaced
+
+// - Frame Layers, bottom to top (g_display_layers)
+// -- the base colors for the key states are always drawn
+#define DISPLAY_LAYER_FEEDBACK_COLOR     0x01 // MIDI feedback colors (g_midi_note_state[0])
+#define DISPLAY_LAYER_FEEDBACK_ANIMATION 0x02 // MIDI brightness, flash and pulse (g_midi_note_state[1])
+#define DISPLAY_LAYER_SLEEP              0x04 // ball demo once the sleep time is up
+#define DISPLAY_LAYER_GEOMETRIC          0x08 // geometric animations
+#define DISPLAY_LAYERS_ALL               0x0F
 
 // Globals --------------------------------------------------------------------
 
 // Storage for the LED state
 extern uint8_t g_display_buffer[64 * 3];
 extern uint16_t g_level_display_mask;
-extern const uint8_t default_color[20][3];
+#define DISPLAY_PALETTE_SIZE 20 // the key colors are indices into default_color[]
+extern const uint8_t default_color[DISPLAY_PALETTE_SIZE][3] PROGMEM;
+extern uint8_t g_display_layers; // DISPLAY_LAYER_ flags of the layers drawn
 
 // functions ------------------------------------------------------------------
 // - LED Refreshing
@@ -74,11 +86,12 @@ void start_geometric_circle_animation(uint8_t button_id);
 void start_geometric_star_animation(uint8_t button_id);
 void start_geometric_triangle_animation(uint8_t button_id);
 void start_geometric_animation(uint8_t button_id, uint8_t animation_id);
+void geometric_animation_advance(void);
 uint8_t get_button_id_from_row_column(uint8_t button_row, uint8_t button_column);
 
 // - Sysex Configuration Extensions
-void adjust_inactive_bank_leds_for_power(uint8_t bank, uint8_t offset, uint8_t size);
-void adjust_active_bank_leds_for_power(uint8_t bank, uint8_t offset, uint8_t size);
+uint8_t display_palette_index(const uint8_t *rgb);
+uint8_t display_key_rgb_byte(const uint8_t *colors, uint16_t i);
 
 // ----------------------------------------------------------------------------
 
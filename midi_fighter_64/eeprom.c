@@ -22,7 +22,9 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
+#include <util/crc16.h>
 
 #include "key.h"
 #include "midi.h"
@@ -49,41 +51,28 @@ uint8_t G_EE_PICK_SENSITIVITY;
 uint8_t G_EE_SLEEP_TIME;
 uint8_t G_EE_TILT_TYPE;
 uint8_t G_EE_SIDE_BANK;
+uint8_t G_EE_KEY_SCAN_PERIOD;
+uint8_t G_EE_KEY_DEBOUNCE_DEPTH;
 
 uint8_t g_self_test_passed; // for legacy purposes only, not used by mf64
-extern uint8_t default_bank_inactive[2][64*3];
-extern uint8_t default_bank_active[2][64*3];
+extern uint8_t default_bank_inactive[2][64*KEY_COLOR_BYTES];
+extern uint8_t default_bank_active[2][64*KEY_COLOR_BYTES];
 
 
 // EEPROM functions ------------------------------------------------------------
 
-// Write an 8-bit value to EEPROM memory.
-//
-void eeprom_write(uint16_t address, uint8_t data)
+// The background writer owns EEAR and EEDR while EERIE is set, so direct
+// reads and writes wait for it to finish first.
+static inline void eeprom_writer_wait(void)
 {
-    // Wait for completion of previous write
-    while(EECR & (1<<EEPE)) {}  // !review: add timeout?
-    // Set up Address and Data Registers
-    EEAR = address & 0x0fff; // mask out 512 bytes
-    EEDR = data;
-    // This next critical section cannot have an interrupt occur between the
-    // two writes or the write will fail and we will lose the information,
-    // so disable all interrupts for a moment.
-    cli();
-    // Write logical one to EEMPE (Master Program Enable) to allow us to
-    // write.
-    EECR |= (1<<EEMPE);
-    // Then within 4 cycles, initiate the eeprom write by writing to the
-    // EEPE (Program Enable) strobe.
-    EECR |= (1<<EEPE);
-    // Reenable interrupts.
-    sei();
+    while (EECR & (1<<EERIE)) {}
 }
 
 // Read an 8-bit value from EEPROM memory.
 //
 uint8_t eeprom_read(uint16_t address)
 {
+    eeprom_writer_wait();
     // Wait for completion of previous write
     while(EECR & (1<<EEPE)) {} // !review: add timeout?
     // Set up address register
@@ -95,8 +84,297 @@ uint8_t eeprom_read(uint16_t address)
 }
 
 
+// EEPROM image ---------------------------------------------------------------
+
+// The saved settings, and where each lives.
+typedef struct {
+    uint8_t address;
+    uint8_t *value;
+} eeprom_setting_t;
+
+static const eeprom_setting_t eeprom_settings[] PROGMEM = {
+    { EE_MIDI_CHANNEL,       &G_EE_MIDI_CHANNEL },
+    { EE_MIDI_VELOCITY,      &G_EE_MIDI_VELOCITY },
+    { EE_COMBOS_ENABLE,      &G_EE_COMBOS_ENABLE },
+    { EE_MIDI_OUTPUT_MODE,   &G_EE_MIDI_OUTPUT_MODE },
+    { EE_FOUR_BANKS_MODE,    &G_EE_FOUR_BANKS_MODE },
+    { EE_TILT_MODE,          &G_EE_TILT_MODE },
+    { EE_TILT_MASK,          &G_EE_TILT_MASK },
+    { EE_ANIMATIONS,         &G_EE_ANIMATIONS },
+    { EE_TILT_SENSITIVITY,   &G_EE_TILT_SENSITIVITY },
+    { EE_PITCH_SENSITIVITY,  &G_EE_PITCH_SENSITIVITY },
+    { EE_TILT_RANGE,         &G_EE_TILT_RANGE },
+    { EE_PITCH_RANGE,        &G_EE_PITCH_RANGE },
+    { EE_TILT_DEADZONE,      &G_EE_TILT_DEADZONE },
+    { EE_PITCH_DEADZONE,     &G_EE_PITCH_DEADZONE },
+    { EE_TILT_AXIS,          &G_EE_TILT_AXIS },
+    { EE_PICK_SENSITIVITY,   &G_EE_PICK_SENSITIVITY },
+    { EE_SLEEP_TIME,         &G_EE_SLEEP_TIME },
+    { EE_SIDE_BANK,          &G_EE_SIDE_BANK },
+    { EE_KEY_SCAN_PERIOD,    &G_EE_KEY_SCAN_PERIOD },
+    { EE_KEY_DEBOUNCE_DEPTH, &G_EE_KEY_DEBOUNCE_DEPTH },
+};
+
+#define EEPROM_IMAGE_SETTINGS (sizeof(eeprom_settings) / sizeof(eeprom_settings[0]))
+#define EEPROM_IMAGE_COLORS   (2 * NUM_BANKS * NUM_BUTTONS * KEY_COLOR_BYTES) // idle then active, from EE_COLORS_IDLE
+
+#if EE_COLORS_ACTIVE != EE_COLORS_IDLE + NUM_BANKS * NUM_BUTTONS * KEY_COLOR_BYTES
+#error the idle and active colors are saved and checked as one run
+#endif
+
+// Read count bytes from address on, waiting out the writer and any write in
+// progress once rather than for every byte.
+static void eeprom_read_block(uint8_t *dest, uint16_t address, uint16_t count)
+{
+    eeprom_writer_wait();
+    while(EECR & (1<<EEPE)) {}
+    while (count--) {
+        EEAR = address++;
+        EECR |= (1<<EERE);
+        *dest++ = EEDR;
+    }
+}
+
+// The image CRC covers the settings in eeprom_settings[] order, then the
+// idle and active colors. The settings are taken from block, a copy of the
+// EEPROM up to EE_SETTINGS_END, or from the globals if block is NULL.
+static uint16_t eeprom_settings_crc(const uint8_t *block)
+{
+    uint16_t crc = 0xFFFF;
+    for (uint8_t i = 0; i < EEPROM_IMAGE_SETTINGS; ++i) {
+        uint8_t value = block ? block[pgm_read_byte(&eeprom_settings[i].address)] :
+                                *(uint8_t*)pgm_read_ptr(&eeprom_settings[i].value);
+        crc = _crc_ccitt_update(crc, value);
+    }
+    return crc;
+}
+
+static uint16_t eeprom_colors_crc(uint16_t crc, const uint8_t *colors, uint16_t count)
+{
+    while (count--) {
+        crc = _crc_ccitt_update(crc, *colors++);
+    }
+    return crc;
+}
+
+// CRC of the image the settings and colors in RAM would save as.
+static uint16_t eeprom_image_crc(void)
+{
+    uint16_t crc = eeprom_settings_crc(NULL);
+    crc = eeprom_colors_crc(crc, (uint8_t*)default_bank_inactive, EEPROM_IMAGE_COLORS / 2);
+    return eeprom_colors_crc(crc, (uint8_t*)default_bank_active, EEPROM_IMAGE_COLORS / 2);
+}
+
+// The image is kept twice, at 0 and at EE_IMAGE_B, each with a sequence
+// number under its CRC. A compaction rewrites the older copy from RAM with
+// the next number, its CRC last, so a save cut short by a power loss leaves
+// the newer copy as it was. At boot the newest copy that matches its CRC
+// wins, and only if neither does is the EEPROM reset.
+static uint16_t eeprom_image = 0;         // the copy in use: 0, or EE_IMAGE_B
+static uint8_t eeprom_image_sequence = 0; // its sequence number
+
+#if EE_IMAGE_B + EE_MIDI_CHANNEL < EE_JOURNAL_END || EE_IMAGE_B + EE_COLORS_IDLE + EEPROM_IMAGE_COLORS > EE_JOURNAL_HIGH
+#error the second copy of the image overlaps a journal
+#endif
+
+// Read the copy of the image at image into the settings and colors. True
+// if it matches its CRC, which covers the sequence number from this layout.
+static bool eeprom_image_load(uint16_t image, uint8_t layout)
+{
+    uint8_t block[EE_SETTINGS_END];
+    eeprom_read_block(block, image, sizeof(block));
+    for (uint8_t i = 0; i < EEPROM_IMAGE_SETTINGS; ++i) {
+        *(uint8_t*)pgm_read_ptr(&eeprom_settings[i].value) = block[pgm_read_byte(&eeprom_settings[i].address)];
+    }
+    eeprom_read_block((uint8_t*)default_bank_inactive, image + EE_COLORS_IDLE, EEPROM_IMAGE_COLORS / 2);
+    eeprom_read_block((uint8_t*)default_bank_active, image + EE_COLORS_ACTIVE, EEPROM_IMAGE_COLORS / 2);
+
+    uint16_t crc = eeprom_image_crc();
+    eeprom_image = image;
+    eeprom_image_sequence = 0;
+    if (layout == EEPROM_LAYOUT) {
+        eeprom_image_sequence = block[EE_IMAGE_SEQUENCE];
+        crc = _crc_ccitt_update(crc, eeprom_image_sequence);
+    }
+    return crc == (block[EE_IMAGE_CRC] | (block[EE_IMAGE_CRC + 1] << 8));
+}
+
+
+// Settings journal -----------------------------------------------------------
+
+// Rather than rewrite a changed byte (and the image CRC) in place, a small
+// save appends a record for it to the journal at EE_JOURNAL, after the colors,
+// so a utility pushing the same few settings over and over wears the whole
+// journal rather than the same three cells. The image CRC covers the image
+// alone; at boot the image is checked, then the journal replayed over it
+// oldest first, so the latest record for each byte wins.
+//
+// A record is { value, address low, check, address high }, written in that
+// order. The address high byte doubles as the commit byte: 0xFF there marks
+// the first empty record. A record whose check doesn't match was cut short,
+// and ends the journal like an empty one. The check is seeded with the
+// sequence number of the copy of the image the record was written over, so
+// records left from before a compaction are never replayed over the newer
+// copy.
+//
+// A save that doesn't fit compacts the journal: the older copy of the
+// image is rewritten from RAM, then the journal cleared from the last record
+// back.
+#define EEPROM_RECORD_VALUE        0
+#define EEPROM_RECORD_ADDRESS_LOW  1
+#define EEPROM_RECORD_CHECK        2
+#define EEPROM_RECORD_ADDRESS_HIGH 3
+#define EEPROM_RECORD_SIZE         4
+#define EEPROM_JOURNAL_RECORDS     ((EE_JOURNAL_END - EE_JOURNAL) / EEPROM_RECORD_SIZE)
+
+#if (EE_JOURNAL_HIGH_END - EE_JOURNAL_HIGH) / EEPROM_RECORD_SIZE > EEPROM_JOURNAL_RECORDS
+#error the journal of an older layout is read into eeprom_journal_address[]
+#endif
+
+static uint16_t eeprom_journal_address[EEPROM_JOURNAL_RECORDS]; // the image byte each record holds
+static uint8_t eeprom_journal_count = 0;                        // records in use
+static uint16_t eeprom_journal_read = EE_JOURNAL;               // where they were read from
+
+static void eeprom_compact(void);
+
+static uint8_t eeprom_record_check(uint16_t address, uint8_t value)
+{
+    uint8_t check = _crc8_ccitt_update(eeprom_image_sequence, address & 0xFF);
+    check = _crc8_ccitt_update(check, address >> 8);
+    return _crc8_ccitt_update(check, value);
+}
+
+// Where the saved byte at address lives in RAM, NULL if it isn't one.
+static uint8_t *eeprom_image_value(uint16_t address)
+{
+    if (address >= EE_COLORS_IDLE && address < EE_COLORS_IDLE + EEPROM_IMAGE_COLORS / 2) {
+        return (uint8_t*)default_bank_inactive + (address - EE_COLORS_IDLE);
+    }
+    if (address >= EE_COLORS_ACTIVE && address < EE_COLORS_ACTIVE + EEPROM_IMAGE_COLORS / 2) {
+        return (uint8_t*)default_bank_active + (address - EE_COLORS_ACTIVE);
+    }
+    for (uint8_t i = 0; i < EEPROM_IMAGE_SETTINGS; ++i) {
+        if (pgm_read_byte(&eeprom_settings[i].address) == address) {
+            return pgm_read_ptr(&eeprom_settings[i].value);
+        }
+    }
+    return NULL;
+}
+
+// Find the records of the journal from journal to journal_end. Their
+// addresses are settings, or colors up to colors_end. Both differ for an
+// image from an older layout.
+static void eeprom_journal_scan(uint16_t journal, uint16_t journal_end, uint16_t colors_end)
+{
+    uint8_t record[EEPROM_RECORD_SIZE];
+    uint8_t records = (journal_end - journal) / EEPROM_RECORD_SIZE;
+    eeprom_journal_read = journal;
+    eeprom_journal_count = 0;
+    while (eeprom_journal_count < records) {
+        eeprom_read_block(record, journal + eeprom_journal_count * EEPROM_RECORD_SIZE, sizeof(record));
+        uint16_t address = record[EEPROM_RECORD_ADDRESS_LOW] | (record[EEPROM_RECORD_ADDRESS_HIGH] << 8);
+        bool known = address < EE_COLORS_IDLE ? eeprom_image_value(address) != NULL : address < colors_end;
+        if (!known || record[EEPROM_RECORD_CHECK] != eeprom_record_check(address, record[EEPROM_RECORD_VALUE])) {
+            break;
+        }
+        eeprom_journal_address[eeprom_journal_count++] = address;
+    }
+}
+
+// Replay the journal from journal to journal_end over the settings and
+// colors read from the image.
+static void eeprom_journal_load(uint16_t journal, uint16_t journal_end)
+{
+    eeprom_journal_scan(journal, journal_end, EE_COLORS_IDLE + EEPROM_IMAGE_COLORS);
+    for (uint8_t i = 0; i < eeprom_journal_count; ++i) {
+        eeprom_read_block(eeprom_image_value(eeprom_journal_address[i]),
+                          journal + i * EEPROM_RECORD_SIZE + EEPROM_RECORD_VALUE, 1);
+    }
+}
+
+// Lay the journal over count bytes read from the image at address.
+static void eeprom_journal_apply(uint8_t *dest, uint16_t address, uint16_t count)
+{
+    for (uint8_t i = 0; i < eeprom_journal_count; ++i) {
+        if (eeprom_journal_address[i] >= address && eeprom_journal_address[i] < address + count) {
+            eeprom_read_block(dest + (eeprom_journal_address[i] - address),
+                              eeprom_journal_read + i * EEPROM_RECORD_SIZE + EEPROM_RECORD_VALUE, 1);
+        }
+    }
+}
+
+
 // EEPROM settings ------------------------------------------------------------
 
+// The key timing settings were added without changing the layout version,
+// so older EEPROMs hold erased (0xFF) bytes there: fall back to the defaults
+// for anything out of range. A MIDI channel over 15 is refused the same way
+// rather than masked onto another channel.
+static void eeprom_settings_check(void)
+{
+	if (G_EE_MIDI_CHANNEL > 15) {
+		G_EE_MIDI_CHANNEL = 2; // MIDI channel (3), the factory default
+	}
+	if (G_EE_KEY_SCAN_PERIOD < 1 || G_EE_KEY_SCAN_PERIOD > KEY_SCAN_PERIOD_MAX) {
+		G_EE_KEY_SCAN_PERIOD = KEY_SCAN_PERIOD;
+	}
+	if (G_EE_KEY_DEBOUNCE_DEPTH < 1 || G_EE_KEY_DEBOUNCE_DEPTH > KEY_DEBOUNCE_DEPTH_MAX) {
+		G_EE_KEY_DEBOUNCE_DEPTH = KEY_DEBOUNCE_DEPTH;
+	}
+}
+
+// Load an image saved with three bytes per key color, by EEPROM_LAYOUT_RGB
+// or older, with its colors snapped to the palette. True if it matches its
+// CRC; its journal is checked as it was saved. Its colors span both copies
+// of the image in this layout, so a power loss while it is saved again can
+// still lose it.
+static bool eeprom_setup_rgb(uint8_t *block, uint8_t layout)
+{
+    const uint16_t colors = 2 * NUM_BANKS * NUM_BUTTONS * 3;
+    uint8_t rgb[24];
+    uint16_t crc = eeprom_settings_crc(block);
+    eeprom_image = 0;
+    eeprom_image_sequence = 0;
+    if (layout == EEPROM_LAYOUT_RGB) {
+        eeprom_journal_scan(EE_JOURNAL_HIGH, EE_JOURNAL_HIGH_END, EE_COLORS_RGB_IDLE + colors);
+    }
+    eeprom_journal_apply(block, EE_EEPROM_VERSION, EE_SETTINGS_END);
+    for (uint8_t i = 0; i < EEPROM_IMAGE_SETTINGS; ++i) {
+        *(uint8_t*)pgm_read_ptr(&eeprom_settings[i].value) = block[pgm_read_byte(&eeprom_settings[i].address)];
+    }
+    for (uint16_t i = 0; i < colors; i += sizeof(rgb)) {
+        eeprom_read_block(rgb, EE_COLORS_RGB_IDLE + i, sizeof(rgb));
+        crc = eeprom_colors_crc(crc, rgb, sizeof(rgb));
+        eeprom_journal_apply(rgb, EE_COLORS_RGB_IDLE + i, sizeof(rgb));
+        for (uint8_t c = 0; c < sizeof(rgb); c += 3) {
+            uint8_t key = (i + c) / 3;
+            uint8_t *dest = key < NUM_BANKS * NUM_BUTTONS ? (uint8_t*)default_bank_inactive + key :
+                                                            (uint8_t*)default_bank_active + key - NUM_BANKS * NUM_BUTTONS;
+            *dest = display_palette_index(rgb + c);
+        }
+    }
+    eeprom_journal_count = 0;
+
+    uint16_t saved = block[EE_IMAGE_CRC] | (block[EE_IMAGE_CRC + 1] << 8);
+    return layout == EEPROM_LAYOUT_NO_CRC || saved == crc;
+}
+
+// A journal record's check is only 8 bits, so make sure every key color
+// is in the palette.
+static void eeprom_colors_check(void)
+{
+    uint8_t *inactive = (uint8_t*)default_bank_inactive;
+    uint8_t *active = (uint8_t*)default_bank_active;
+    for (uint8_t i = 0; i < NUM_BANKS * NUM_BUTTONS; ++i) {
+        if (inactive[i] >= DISPLAY_PALETTE_SIZE) {
+            inactive[i] = 0; // off
+        }
+        if (active[i] >= DISPLAY_PALETTE_SIZE) {
+            active[i] = 0; // off
+        }
+    }
+}
+
 // Set up the EEPROM system for use and read out the settings into the
 // global values.
 //
@@ -104,91 +382,295 @@ uint8_t eeprom_read(uint16_t address)
 // to the EEPROM doesn't match this software version we're running, we reset
 // the EEPROM values to their default settings.
 //
+// The settings are read as one block and the colors straight into place,
+// then the copy of the image is checked against its CRC. The newer copy is
+// read first, and the older one if that fails (a save cut short, or a worn
+// cell); only if both fail is the EEPROM reset. The journal is then replayed
+// over the image. Images from older layouts are kept, and saved again in
+// this one, the layout version written last.
+//
 void eeprom_setup(void)
 {
-    // If our EEPROM layout has changed, reset everything.
-    if (eeprom_read(EE_EEPROM_VERSION) != EEPROM_LAYOUT) {
+    uint8_t block[EE_SETTINGS_END];
+    eeprom_read_block(block, EE_EEPROM_VERSION, sizeof(block));
+    g_self_test_passed = block[EE_FIRST_BOOT_CHECK];
+
+    uint8_t layout = block[EE_EEPROM_VERSION];
+    bool loaded;
+    if (layout == EEPROM_LAYOUT) {
+        // The sequence numbers wrap, so the newer is the one a little ahead
+        uint16_t newer = (int8_t)(eeprom_read(EE_IMAGE_B + EE_IMAGE_SEQUENCE) - block[EE_IMAGE_SEQUENCE]) > 0 ?
+                         EE_IMAGE_B : 0;
+        loaded = eeprom_image_load(newer, layout) || eeprom_image_load(newer ^ EE_IMAGE_B, layout);
+        if (loaded) {
+            eeprom_journal_load(EE_JOURNAL, EE_JOURNAL_END);
+        }
+    }
+    else if (layout == EEPROM_LAYOUT_ONE_IMAGE || layout == EEPROM_LAYOUT_JOURNAL_HIGH) {
+        // The first copy alone, with the journal where the layout put it
+        loaded = eeprom_image_load(0, layout);
+        if (loaded && layout == EEPROM_LAYOUT_ONE_IMAGE) {
+            eeprom_journal_load(EE_JOURNAL, EE_JOURNAL_END);
+        }
+        else if (loaded) {
+            eeprom_journal_load(EE_JOURNAL_HIGH, EE_JOURNAL_HIGH_END);
+        }
+    }
+    else if (layout >= EEPROM_LAYOUT_NO_CRC && layout <= EEPROM_LAYOUT_RGB) {
+        loaded = eeprom_setup_rgb(block, layout);
+    }
+    else {
+        // If our EEPROM layout has changed, reset everything.
+        loaded = false;
+    }
+
+    if (!loaded) {
         eeprom_factory_reset();
+        return;
     }
-	else {
-	}
+    eeprom_colors_check();
+    eeprom_settings_check();
+    if (layout != EEPROM_LAYOUT) {
+        eeprom_compact();
+    }
+}
 
-    // Read the EEPROM into the global settings.
-    g_self_test_passed = eeprom_read(EE_FIRST_BOOT_CHECK);
-    G_EE_MIDI_CHANNEL = eeprom_read(EE_MIDI_CHANNEL);
-    G_EE_MIDI_VELOCITY = eeprom_read(EE_MIDI_VELOCITY);
-	
-	G_EE_COMBOS_ENABLE = eeprom_read(EE_COMBOS_ENABLE);
-	G_EE_MIDI_OUTPUT_MODE = eeprom_read(EE_MIDI_OUTPUT_MODE);
-	G_EE_FOUR_BANKS_MODE = eeprom_read(EE_FOUR_BANKS_MODE);
-	G_EE_TILT_MODE = eeprom_read(EE_TILT_MODE);
-	G_EE_TILT_MASK = eeprom_read(EE_TILT_MASK);
-	G_EE_ANIMATIONS = eeprom_read(EE_ANIMATIONS);
-	G_EE_TILT_SENSITIVITY = eeprom_read(EE_TILT_SENSITIVITY);
- 	G_EE_PITCH_SENSITIVITY = eeprom_read(EE_PITCH_SENSITIVITY);
- 	G_EE_TILT_RANGE = eeprom_read(EE_TILT_RANGE);
- 	G_EE_PITCH_RANGE = eeprom_read(EE_PITCH_RANGE);
- 	G_EE_TILT_DEADZONE = eeprom_read(EE_TILT_DEADZONE);
- 	G_EE_PITCH_DEADZONE = eeprom_read(EE_PITCH_DEADZONE);
- 	G_EE_TILT_AXIS = eeprom_read(EE_TILT_AXIS);
-	G_EE_SIDE_BANK = eeprom_read(EE_SIDE_BANK);
-
-	 
-    G_EE_PICK_SENSITIVITY = eeprom_read(EE_PICK_SENSITIVITY);
-    G_EE_SLEEP_TIME = eeprom_read(EE_SLEEP_TIME);
-	
-	// If 'saved' data already exists, then overwrite the default colors table with the saved data
-	for (uint16_t bank=0; bank<NUM_BANKS; ++bank) { // mf64 only 1 bank
-		// Load the idle colors from EEPROM
-		uint8_t* colors = default_bank_inactive[bank];
-		for (uint16_t i=0; i<64*3; ++i) {  // 64 = NUM_BUTTONS
-			colors[i] = eeprom_read(EE_COLORS_IDLE+(NUM_BUTTONS*3*bank)+i);
-		}
-		// Load the active colors from EEPROM
-		colors = default_bank_active[bank];
-		for (uint16_t i=0; i<64*3; ++i) { // 64 = NUM_BUTTONS
-			colors[i] = eeprom_read(EE_COLORS_ACTIVE+(NUM_BUTTONS*3*bank)+i);
-		}
-	}
+// Journaling background writer. A save first counts the bytes that differ
+// from what is saved (the image with the journal over it), then appends a
+// record for each if they all fit, or compacts as soon as it finds they
+// don't. Like the
+// writer below it runs from the EE_READY interrupt, a write at a time, and
+// gives the CPU back after EEPROM_SAVE_COMPARE_LIMIT bytes without one.
+#define EEPROM_SAVE_IDLE   0
+#define EEPROM_SAVE_COUNT  1 // counting the bytes that changed
+#define EEPROM_SAVE_APPEND 2 // journaling them
+#define EEPROM_SAVE_IMAGE  3 // compacting: rewriting the older copy of the image, then its CRC
+#define EEPROM_SAVE_CLEAR  4 // compacting: clearing the journal, last record first
+
+#define EEPROM_SAVE_SIZE (EEPROM_IMAGE_SETTINGS + EEPROM_IMAGE_COLORS)
+
+uint16_t g_eeprom_bytes_written = 0;
+uint16_t g_eeprom_bytes_unchanged = 0;
+static volatile uint8_t eeprom_save_phase = EEPROM_SAVE_IDLE;
+static volatile uint16_t eeprom_save_next;  // next image byte, or journal record while clearing
+static uint16_t eeprom_save_changed;        // bytes the count found changed
+static volatile bool eeprom_save_again;     // saved while compacting: count again once it is done
+static uint16_t eeprom_save_crc;            // of the image bytes a compaction has passed
+static uint8_t eeprom_record[EEPROM_RECORD_SIZE];
+static uint16_t eeprom_record_address;
+static uint8_t eeprom_record_next = EEPROM_RECORD_SIZE; // next byte of the record being appended
+
+// The image byte the save has reached, and where it lives in RAM.
+static uint8_t *eeprom_image_slot(uint16_t slot, uint16_t *address)
+{
+    if (slot < EEPROM_IMAGE_SETTINGS) {
+        *address = pgm_read_byte(&eeprom_settings[slot].address);
+        return pgm_read_ptr(&eeprom_settings[slot].value);
+    }
+    slot -= EEPROM_IMAGE_SETTINGS;
+    *address = EE_COLORS_IDLE + slot;
+    return slot < EEPROM_IMAGE_COLORS / 2 ? (uint8_t*)default_bank_inactive + slot :
+                                            (uint8_t*)default_bank_active + (slot - EEPROM_IMAGE_COLORS / 2);
+}
+
+// The saved value of an image byte: its latest record, or the image.
+static uint8_t eeprom_saved_value(uint16_t address)
+{
+    uint16_t saved = eeprom_image + address;
+    uint8_t i = eeprom_journal_count;
+    while (i--) {
+        if (eeprom_journal_address[i] == address) {
+            saved = EE_JOURNAL + i * EEPROM_RECORD_SIZE + EEPROM_RECORD_VALUE;
+            break;
+        }
+    }
+    EEAR = saved;
+    EECR |= (1<<EERE);
+    return EEDR;
 }
 
-// Used by the menu system, if we have edited any of the global values then
-// save them off to the EEPROM.
+// Write value to address unless it already holds it. True if a write started.
+static bool eeprom_writer_put(uint16_t address, uint8_t value)
+{
+    EEAR = address;
+    EECR |= (1<<EERE);
+    if (EEDR == value) {
+        g_eeprom_bytes_unchanged++;
+        return false;
+    }
+    // Interrupts are off in here, so EEPE follows EEMPE in time.
+    EEDR = value;
+    EECR |= (1<<EEMPE);
+    EECR |= (1<<EEPE);
+    g_eeprom_bytes_written++;
+    return true;
+}
+
+ISR(EE_READY_vect)
+{
+    uint8_t compare_limit = EEPROM_SAVE_COMPARE_LIMIT;
+    uint16_t next = eeprom_save_next;
+    uint8_t phase = eeprom_save_phase;
+    for (;;) {
+        if (eeprom_record_next < EEPROM_RECORD_SIZE) {
+            uint8_t i = eeprom_record_next++;
+            uint16_t address = EE_JOURNAL + eeprom_journal_count * EEPROM_RECORD_SIZE + i;
+            if (eeprom_record_next == EEPROM_RECORD_SIZE) {
+                eeprom_journal_address[eeprom_journal_count++] = eeprom_record_address;
+            }
+            if (eeprom_writer_put(address, eeprom_record[i])) {
+                break; // back when the write is done
+            }
+        }
+        else if (phase == EEPROM_SAVE_COUNT || phase == EEPROM_SAVE_APPEND) {
+            if (next == EEPROM_SAVE_SIZE) {
+                phase = phase == EEPROM_SAVE_COUNT && eeprom_save_changed ? EEPROM_SAVE_APPEND : EEPROM_SAVE_IDLE;
+                next = 0;
+                continue;
+            }
+            uint16_t address;
+            uint8_t value = *eeprom_image_slot(next, &address);
+            if (eeprom_saved_value(address) != value) {
+                if (phase == EEPROM_SAVE_COUNT) {
+                    if (++eeprom_save_changed > EEPROM_JOURNAL_RECORDS - eeprom_journal_count) {
+                        phase = EEPROM_SAVE_IMAGE; // no need to count the rest
+                        next = 0;
+                        continue;
+                    }
+                }
+                else if (eeprom_journal_count == EEPROM_JOURNAL_RECORDS) {
+                    // More changed since the count than fit
+                    phase = EEPROM_SAVE_IMAGE;
+                    next = 0;
+                    continue;
+                }
+                else {
+                    eeprom_record[EEPROM_RECORD_VALUE] = value;
+                    eeprom_record[EEPROM_RECORD_ADDRESS_LOW] = address & 0xFF;
+                    eeprom_record[EEPROM_RECORD_CHECK] = eeprom_record_check(address, value);
+                    eeprom_record[EEPROM_RECORD_ADDRESS_HIGH] = address >> 8;
+                    eeprom_record_address = address;
+                    eeprom_record_next = 0;
+                    next++;
+                    continue;
+                }
+            }
+            next++;
+        }
+        else if (phase == EEPROM_SAVE_IMAGE) {
+            uint16_t image = eeprom_image ^ EE_IMAGE_B; // the older copy
+            uint16_t address;
+            uint8_t value;
+            if (next == 0) {
+                eeprom_save_crc = 0xFFFF;
+            }
+            if (next < EEPROM_SAVE_SIZE) {
+                value = *eeprom_image_slot(next, &address);
+                eeprom_save_crc = _crc_ccitt_update(eeprom_save_crc, value);
+            }
+            else if (next == EEPROM_SAVE_SIZE) {
+                address = EE_IMAGE_SEQUENCE;
+                value = eeprom_image_sequence + 1;
+                eeprom_save_crc = _crc_ccitt_update(eeprom_save_crc, value);
+            }
+            else if (next < EEPROM_SAVE_SIZE + 3) {
+                address = EE_IMAGE_CRC + (next - EEPROM_SAVE_SIZE - 1);
+                value = address == EE_IMAGE_CRC ? eeprom_save_crc & 0xFF : eeprom_save_crc >> 8;
+            }
+            else if (next == EEPROM_SAVE_SIZE + 3) {
+                // Only once a copy is saved in this layout does the version say so
+                image = 0;
+                address = EE_EEPROM_VERSION;
+                value = EEPROM_LAYOUT;
+            }
+            else {
+                // The older copy is now the newer, and the journal over the other is done with
+                eeprom_image = image;
+                eeprom_image_sequence++;
+                eeprom_journal_count = 0;
+                phase = EEPROM_SAVE_CLEAR;
+                next = EEPROM_JOURNAL_RECORDS;
+                continue;
+            }
+            next++;
+            if (eeprom_writer_put(image + address, value)) {
+                break;
+            }
+        }
+        else if (phase == EEPROM_SAVE_CLEAR) {
+            if (next == 0) {
+                phase = eeprom_save_again ? EEPROM_SAVE_COUNT : EEPROM_SAVE_IDLE;
+                eeprom_save_again = false;
+                eeprom_save_changed = 0;
+                continue;
+            }
+            next--;
+            if (eeprom_writer_put(EE_JOURNAL + next * EEPROM_RECORD_SIZE + EEPROM_RECORD_ADDRESS_HIGH, 0xFF)) {
+                break;
+            }
+        }
+        else {
+            EECR &= ~(1<<EERIE); // all saved
+            break;
+        }
+        if (--compare_limit == 0) {
+            break; // fires again straight away, once the other interrupts have had a look in
+        }
+    }
+    eeprom_save_next = next;
+    eeprom_save_phase = phase;
+}
+
+// Bytes still to be checked, and written if they changed.
+uint16_t eeprom_save_pending(void)
+{
+    cli();
+    uint16_t next = eeprom_save_next;
+    uint16_t pending;
+    switch (eeprom_save_phase) {
+    case EEPROM_SAVE_COUNT:  pending = 2 * EEPROM_SAVE_SIZE - next; break;
+    case EEPROM_SAVE_APPEND: pending = EEPROM_SAVE_SIZE - next; break;
+    case EEPROM_SAVE_IMAGE:  pending = EEPROM_SAVE_SIZE + 4 - next + EEPROM_JOURNAL_RECORDS; break;
+    case EEPROM_SAVE_CLEAR:  pending = next; break;
+    default:                 pending = 0; break;
+    }
+    if (eeprom_save_again) {
+        pending += 2 * EEPROM_SAVE_SIZE;
+    }
+    sei();
+    return pending;
+}
+
+// Save the settings and color scheme in the background. A save started
+// while one is running starts again from the top, so bytes it had already
+// passed are checked against their latest values, unless it is compacting:
+// the older copy is then part rewritten, so the compaction finishes with the
+// bytes it has passed, and the count runs again after it.
 //
-void eeprom_save_edits(void)  // Save Settings and Color Scheme settings to EEPROM
-{
-    eeprom_write(EE_MIDI_CHANNEL, G_EE_MIDI_CHANNEL);
-    eeprom_write(EE_MIDI_VELOCITY, G_EE_MIDI_VELOCITY);
-	eeprom_write(EE_COMBOS_ENABLE, G_EE_COMBOS_ENABLE);
-	eeprom_write(EE_MIDI_OUTPUT_MODE, G_EE_MIDI_OUTPUT_MODE);
-	eeprom_write(EE_FOUR_BANKS_MODE, G_EE_FOUR_BANKS_MODE);
-	eeprom_write(EE_TILT_MODE, G_EE_TILT_MODE);
-	eeprom_write(EE_TILT_MASK, G_EE_TILT_MASK);
-	eeprom_write(EE_ANIMATIONS, G_EE_ANIMATIONS);
- 	eeprom_write(EE_TILT_SENSITIVITY,G_EE_TILT_SENSITIVITY);
- 	eeprom_write(EE_PITCH_SENSITIVITY,G_EE_PITCH_SENSITIVITY);
- 	eeprom_write(EE_TILT_RANGE,G_EE_TILT_RANGE);
- 	eeprom_write(EE_PITCH_RANGE,G_EE_PITCH_RANGE);
- 	eeprom_write(EE_TILT_DEADZONE,G_EE_TILT_DEADZONE);
- 	eeprom_write(EE_PITCH_DEADZONE,G_EE_PITCH_DEADZONE);
- 	eeprom_write(EE_TILT_AXIS, G_EE_TILT_AXIS);
-	eeprom_write(EE_PICK_SENSITIVITY, G_EE_PICK_SENSITIVITY);
-	eeprom_write(EE_SLEEP_TIME, G_EE_SLEEP_TIME);
-	eeprom_write(EE_SIDE_BANK, G_EE_SIDE_BANK);
-	
-	for (uint16_t bank=0; bank<NUM_BANKS; ++bank) {
-		// Save the idle colors to EEPROM
-		uint8_t* colors = default_bank_inactive[bank];  // !review: pressing 'send to midifighter' rapidly in utility, frequently results in the 'active' color being sat as the 'idle' color
-		for (uint16_t i=0; i<64*3; ++i) {
-			eeprom_write(EE_COLORS_IDLE+(64*3*bank)+i, colors[i]);  
-		}
-		// Save the active colors to EEPROM
-		colors = default_bank_active[bank];
-		for (uint16_t i=0; i<64*3; ++i) {
-			eeprom_write(EE_COLORS_ACTIVE+(64*3*bank)+i, colors[i]);
-		}
-	}
+void eeprom_save_edits(void)
+{
+    cli();
+    if (eeprom_save_phase >= EEPROM_SAVE_IMAGE) {
+        eeprom_save_again = true;
+    }
+    else {
+        eeprom_save_phase = EEPROM_SAVE_COUNT;
+        eeprom_save_next = 0;
+        eeprom_save_changed = 0;
+    }
+    EECR |= (1<<EERIE);
+    sei();
+}
 
+// Save the image from RAM over the older copy and clear the journal, for a
+// factory reset or an image from an older layout.
+static void eeprom_compact(void)
+{
+    cli();
+    eeprom_save_phase = EEPROM_SAVE_IMAGE;
+    eeprom_save_next = 0;
+    EECR |= (1<<EERIE);
+    sei();
 }
 
 // Return the EEPROM values to their factory default values, erasing any
@@ -199,10 +681,9 @@ void eeprom_factory_reset(void)
      // NOTE: hardware check on first boot only occurs if the eeprom was zeroed.
     // and not every time we reflash an eeprom. That keeps it a rare event.
 
-    eeprom_write(EE_EEPROM_VERSION, EEPROM_LAYOUT);
+	// The layout version is written after the image, by the compaction below.
 	// We dont want to reset the first boot check otherwise user must
 	// perform button test after a factory reset
-    //eeprom_write(EE_FIRST_BOOT_CHECK,      0xff); // Enable for factory firmware only
 
     // Reset the global variables to their default versions, as they were
     // read with their old values before the factory reset happened and they
@@ -227,10 +708,12 @@ void eeprom_factory_reset(void)
 	G_EE_PICK_SENSITIVITY = 0x40;
 	G_EE_SIDE_BANK = 0x00; // Corner Bank Change
 	G_EE_SLEEP_TIME = 0x3C;
+	G_EE_KEY_SCAN_PERIOD = KEY_SCAN_PERIOD;
+	G_EE_KEY_DEBOUNCE_DEPTH = KEY_DEBOUNCE_DEPTH;
  	// Load the Default Color Scheme
  	load_default_colors();
 	// Save the edits to settings and color scheme
-	eeprom_save_edits();
+	eeprom_compact(); // the journal may not have been read
 }
 
 
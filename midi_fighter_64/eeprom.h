@@ -23,6 +23,10 @@
 #ifndef _EEPROM_H_INCLUDED
 #define _EEPROM_H_INCLUDED
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "constants.h"
+
 // Device settings
 
 extern uint8_t G_EE_COMBOS_ENABLE;
@@ -42,15 +46,20 @@ extern uint8_t G_EE_TILT_AXIS;
 extern uint8_t G_EE_PICK_SENSITIVITY;
 extern uint8_t G_EE_SLEEP_TIME;
 extern uint8_t G_EE_SIDE_BANK;
+extern uint8_t G_EE_KEY_SCAN_PERIOD;
+extern uint8_t G_EE_KEY_DEBOUNCE_DEPTH;
 
 
 // EEPROM functions -----------------------------------------------
 
-void eeprom_write(uint16_t address, uint8_t data);
 uint8_t eeprom_read(uint16_t address);
 void eeprom_factory_reset(void);
 void eeprom_setup(void);
 void eeprom_save_edits(void);
 
+extern uint16_t g_eeprom_bytes_written;   // - bytes the background writer changed
+extern uint16_t g_eeprom_bytes_unchanged; // - bytes it found already saved
+uint16_t eeprom_save_pending(void);
+
 
 #endif // _EEPROM_H_INCLUDED
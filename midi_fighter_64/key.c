@@ -23,15 +23,51 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <util/delay.h>
 #include "key.h"
 #include "constants.h"
+#include "eeprom.h"
 
 #include "led.h"
 #include "midi.h" // for g_midi_note_off_counter
 
 // Globals ---------------------------------------------------------------------
 
-uint64_t g_key_debounce_buffer[DEBOUNCE_BUFFER_SIZE]; // The debounce buffer
+// Vertical counter debounce: each key has a 3-bit count of the consecutive
+// samples that disagree with its debounced state. The counts are stored
+// bit-sliced (bit n of every key's count in key_count[n]) so a byte
+// operation updates 8 keys at once.
+static uint8_t key_count[3][8];
+static volatile uint64_t key_debounced_state = 0; // Written by the ISR only
+// The count at which the next disagreeing sample flips a key, as bit masks
+// (see key_configure).
+static uint8_t key_flip_at[3];
+static uint8_t key_debounce_depth = KEY_DEBOUNCE_DEPTH; // Samples a new state must hold for
+
+// Debounce telemetry. A press is timed from its first closed sample, so a
+// bouncing contact counts the bounces in its latency.
+static uint8_t key_sample_count = 0;    // Free running sample clock
+static uint8_t key_press_start[64];     // key_sample_count at the press's first closed sample
+static uint8_t key_press_pending[8];    // Keys with a press being debounced
+volatile uint16_t g_key_bounces_rejected = 0; // Runs of disagreeing samples too short to flip a key
+volatile uint16_t g_key_presses = 0;          // Debounced presses
+volatile uint32_t g_key_press_latency = 0;    // Sum of the presses' latency, in samples
+// Single producer (ISR), single consumer (main loop) ring of key edges. Each
+// side only writes its own index, and a one byte index is read atomically, so
+// no locking is needed.
+static volatile key_event_t key_event_queue[KEY_EVENT_QUEUE_SIZE];
+static volatile uint8_t key_event_head = 0; // Next slot the ISR writes
+static volatile uint8_t key_event_tail = 0; // Next slot the main loop reads
+volatile uint16_t g_key_events_dropped = 0;
+// Resync after a full queue: the main loop's copy of the key state its edges
+// have described, and the keys still to send to bring it up to date.
+static volatile uint8_t key_event_overflow = 0; // Set by the ISR when it drops an edge
+static uint64_t key_event_sent_state = 0;
+static uint64_t key_event_resync = 0;
+static uint64_t key_event_resync_state = 0;
+uint16_t g_key_events_read = 0;
+uint16_t g_key_event_wait_max = 0;
+uint32_t g_key_event_wait_total = 0;
 uint64_t g_key_state = 0;      // Current state of the keys after debounce.
 uint64_t g_key_prev_state = 0; // State of the keys when last polled.
 uint64_t g_key_up = 0;         // Key was released since last poll.
@@ -41,6 +77,9 @@ uint64_t g_key_bank_last_up = 0;         // Bank key was pressed in (for note of
 volatile uint16_t system_time_ms = 0; // 0 to 65 seconds
 uint16_t last_led_refresh_time_ms = 0;
 #define TIMER_TIMEOUT_1MS	0xD0
+#define TIMER_SCAN_STEP	(0x100 - TIMER_TIMEOUT_1MS) // Timer0 counts per scan period step
+uint8_t g_key_scan_period = KEY_SCAN_PERIOD; // ~0.77ms steps between samples
+static uint8_t key_scan_reload = TIMER_TIMEOUT_1MS; // TCNT0 reload for g_key_scan_period
 
 // Key Functions --------------------------------------------------
 
@@ -67,31 +106,28 @@ void key_setup(void)
     PORTD |= KEY_CLOCK;
     PORTD |= KEY_LATCH;
 
-    // Start the debounce buffer in an empty state.
-    memset(g_key_debounce_buffer, 0, DEBOUNCE_BUFFER_SIZE*sizeof(uint32_t));
-
-    // Setup TIMER0 to trigger an overflow interrupt 1000 times a second.
-    // Our counter is incremented every 256 / 16000000 = 0.000016 seconds.
-    // Our key debounce buffer is 10 samples, meaning we need the counter
-    // to count to x where (256*10*x)/16000000 = 0.001 seconds. This gives us
-    // A counter value of 62.5 (rounded to 62), but the counter increments
-    // from a base number to the overflow point at 255 so we need to set
-    // the counter to (255 - 62) = 193 = 0xC1
-    // Strictly, we're polling the buttons at 1008Hz, but who's counting...
-	// - in reality, the time spent in this interrupt also comes into play
-	// -- for mf64 this number was custom adjusted to 0xD0 by monitoring the 
-	// --- firmware using the ENABLE_TEST_OUT options in contants.h
+	key_configure(G_EE_KEY_SCAN_PERIOD, G_EE_KEY_DEBOUNCE_DEPTH);
+
+    // Setup TIMER0 to trigger an overflow interrupt once per key sample.
+    // Our counter is incremented every 256 / 16000000 = 0.000016 seconds,
+    // and key_configure() has set key_scan_reload to count TIMER_SCAN_STEP
+    // (48) of those, ~0.77ms, per step of the scan period. Each interrupt
+    // feeds one sample to the vertical counters, and a key flips once its
+    // count of disagreeing samples reaches key_flip_at[], so a press or a
+    // release takes the debounce depth times the scan period to be seen.
+	// - the 48 counts (a reload of 0xD0) were custom adjusted for mf64 by
+	// -- monitoring the firmware using the ENABLE_TEST_OUT options in contants.h
 	
 
     // Set the Timer0 prescaler to clock/256 (CS0x=100)
     TCCR0B |= _BV(CS02);
     TCCR0B &= ~_BV(CS01);
     TCCR0B &= ~_BV(CS00);
-    // Setup Timer0 to count up from 192 (see calculations above).
-    TCNT0 = TIMER_TIMEOUT_1MS;
-	// !review: performance: if TIMER_TIMEOUT was increased to 2ms,
-	// - processor would have a lot more execution time between interrupts
-	// -- note that if you do this DEBOUNCE_BUFFER_SIZE must be cut in half
+    // Setup Timer0 to count up from the reload (see calculations above).
+    TCNT0 = key_scan_reload;
+	// !review: performance: a longer scan period (EE_KEY_SCAN_PERIOD) leaves
+	// - the processor a lot more execution time between interrupts
+	// -- note that if you do this EE_KEY_DEBOUNCE_DEPTH should be cut to match
 	// --- or button delay will be added.
 	
     // Set the Timer0 Overflow Interrupt Enable bit.
@@ -120,12 +156,9 @@ void key_disable(void)
 //
 ISR(TIMER0_OVF_vect)
 {
-    // Where to write the next value in the ring buffer.
-    static uint8_t buffer_pos = 0;
-	
     // The counter just overflowed, so reset the counter to the magic number
-    // 193 (see above).
-    TCNT0 = TIMER_TIMEOUT_1MS;
+    // 193 (see above), less a step for each extra scan period.
+    TCNT0 = key_scan_reload;
 	
 	// Read in all Button States
     // Latch the key, reads on a falling edge.
@@ -141,42 +174,230 @@ ISR(TIMER0_OVF_vect)
         bit <<= 1;
         PORTD |= KEY_CLOCK; // clock works on the rising edge, leave it high after use.		
 	}
-    g_key_debounce_buffer[buffer_pos] = ~value; // Note: MF64 has inverted buttons (compared to 3D). Only logically matters right here! '~'
-    buffer_pos = (buffer_pos + 1) % DEBOUNCE_BUFFER_SIZE;
+    key_debounce_sample(~value); // Note: MF64 has inverted buttons (compared to 3D). Only logically matters right here! '~'
 	
-	system_time_ms += 1;
+	system_time_ms += g_key_scan_period;
   	return;
 }
 
-// Read the current keystate by reconstructing the key samples from the
-// debounce buffer by ANDing together all the samples. Each bit represents a
-// single sample of one key, so the columns line up to represent that state
-// of a single key over time. The result of this read is stored in the
-// global variable "g_key_state".
+// Set the key scan period (in ~0.77ms steps) and the number of samples a key
+// must hold a new state for before it is accepted. Out of range values fall
+// back to the defaults. Restarts the debounce of keys that are changing and,
+// as the latency units change with the period, the debounce telemetry.
 //
-// NOTE: If any bit is set in the column, the key is considered "activated",
-// so this debouncer is good at recognizing bounces on press/release but
-// doesn't filter or surpress transitory EMF bits. If you've got EMF bits
-// being triggered on a Midifighter, you have bigger problems than
-// debouncing. For more, read Jack Ganssle's short guide to debounce
-// algorithms:
+void key_configure(uint8_t scan_period, uint8_t debounce_depth)
+{
+	if (scan_period < 1 || scan_period > KEY_SCAN_PERIOD_MAX) {
+		scan_period = KEY_SCAN_PERIOD;
+	}
+	if (debounce_depth < 1 || debounce_depth > KEY_DEBOUNCE_DEPTH_MAX) {
+		debounce_depth = KEY_DEBOUNCE_DEPTH;
+	}
+	cli();
+	g_key_scan_period = scan_period;
+	key_debounce_depth = debounce_depth;
+	key_scan_reload = 0x100 - TIMER_SCAN_STEP*scan_period;
+	uint8_t flip_at = debounce_depth - 1;
+	key_flip_at[0] = (flip_at & 0x01) ? 0xFF : 0x00;
+	key_flip_at[1] = (flip_at & 0x02) ? 0xFF : 0x00;
+	key_flip_at[2] = (flip_at & 0x04) ? 0xFF : 0x00;
+	// A count already past a lowered flip point would have to wrap first.
+	memset(key_count, 0, sizeof(key_count));
+	memset(key_press_pending, 0, sizeof(key_press_pending));
+	g_key_bounces_rejected = 0;
+	g_key_presses = 0;
+	g_key_press_latency = 0;
+	sei();
+}
+
+// Update the debounce telemetry for the 8 keys of byte i of a sample. A press
+// that starts again soon after an unfinished one is the same contact
+// bouncing, so it keeps the earlier start time.
+static void key_debounce_telemetry(uint8_t i, uint8_t rejected, uint8_t started, uint8_t pressed)
+{
+	while (rejected) {
+		rejected &= rejected - 1;
+		++g_key_bounces_rejected;
+	}
+	uint8_t *start = &key_press_start[i*8];
+	for (uint8_t bit = 0x01; started | pressed; bit <<= 1, ++start) {
+		if (started & bit) {
+			started &= ~bit;
+			if (!(key_press_pending[i] & bit) ||
+				(uint8_t)(key_sample_count - *start) >= KEY_BOUNCE_WINDOW) {
+				*start = key_sample_count;
+				key_press_pending[i] |= bit;
+			}
+		}
+		if (pressed & bit) {
+			pressed &= ~bit;
+			key_press_pending[i] &= ~bit;
+			if (g_key_presses != 0xFFFF) { // saturate, keeping the average valid
+				++g_key_presses;
+				g_key_press_latency += (uint8_t)(key_sample_count - *start);
+			}
+		}
+	}
+}
+
+// Queue an edge for each key in flip, byte i of the key masks, lowest key
+// first. state is the byte's new debounced state. An edge that finds the
+// queue full is dropped and the main loop resyncs once it has caught up (see
+// key_event_pop), so a flurry of presses through a main loop stall can lose
+// a tap but never leaves a note stuck.
 //
-//     http://www.ganssle.com/debouncing.pdf
+static void key_event_push(uint8_t i, uint8_t flip, uint8_t state)
+{
+	uint16_t now = system_time_ms;
+	do {
+		uint8_t bit = flip & -flip;
+		flip &= flip - 1;
+		uint8_t head = key_event_head;
+		uint8_t next = (head + 1) & (KEY_EVENT_QUEUE_SIZE - 1);
+		if (next == key_event_tail) {
+			++g_key_events_dropped;
+			key_event_overflow = 1;
+			continue;
+		}
+		key_event_queue[head].key = (i << 3) | key_bit_index(bit) | ((state & bit) ? KEY_EVENT_DOWN : 0);
+		key_event_queue[head].time_ms = now;
+		key_event_head = next; // publish the edge last
+	} while (flip);
+}
+
+// Whether the state a key edge leaves its key in is the one already sent.
+static bool key_event_is_sent(uint8_t key)
+{
+	const uint8_t* sent = (const uint8_t*)&key_event_sent_state;
+	bool down = sent[(key & KEY_EVENT_KEY) >> 3] & (1 << (key & 7));
+	return down == ((key & KEY_EVENT_DOWN) != 0);
+}
+
+// Take the next key edge to send, returning false if there is none. Called
+// by the main loop only, just before it sends the edge's MIDI, so the time
+// spent queued is recorded here.
+//
+// Once the queue has dropped edges and then emptied, the debounced state is
+// compared with the state the sent edges describe, and an edge is made up for
+// each key that differs before any edge queued after the comparison. Queued
+// edges that no longer change a key (their other half was dropped) are
+// skipped.
+bool key_event_pop(key_event_t* event)
+{
+	uint8_t tail = key_event_tail;
+	if (key_event_overflow && !key_event_resync && tail == key_event_head) {
+		cli();
+		if (tail == key_event_head) { // nothing was queued before the comparison
+			key_event_overflow = 0;
+			key_event_resync_state = key_debounced_state;
+			key_event_resync = key_event_resync_state ^ key_event_sent_state;
+		}
+		sei();
+	}
+	if (key_event_resync) {
+		const uint8_t* resync = (const uint8_t*)&key_event_resync;
+		const uint8_t* state = (const uint8_t*)&key_event_resync_state;
+		uint8_t i = 0;
+		while (!resync[i]) { ++i; }
+		uint8_t bit = resync[i] & -resync[i];
+		((uint8_t*)&key_event_resync)[i] &= ~bit;
+		event->key = (i << 3) | key_bit_index(bit) | ((state[i] & bit) ? KEY_EVENT_DOWN : 0);
+		event->time_ms = system_time_ms;
+	}
+	else {
+		do {
+			if (tail == key_event_head) {
+				key_event_tail = tail;
+				return false;
+			}
+			event->key = key_event_queue[tail].key;
+			event->time_ms = key_event_queue[tail].time_ms;
+			tail = (tail + 1) & (KEY_EVENT_QUEUE_SIZE - 1);
+		} while (key_event_is_sent(event->key));
+		key_event_tail = tail;
+	}
+	uint8_t* sent = (uint8_t*)&key_event_sent_state;
+	sent[(event->key & KEY_EVENT_KEY) >> 3] ^= 1 << (event->key & 7);
+
+	uint16_t wait = system_time_ms - event->time_ms;
+	if (wait > g_key_event_wait_max) {
+		g_key_event_wait_max = wait;
+	}
+	g_key_event_wait_total += wait;
+	++g_key_events_read;
+	return true;
+}
+
+// Debounce one sample of all 64 keys (1 = closed), called by the ISR.
+//
+// A key's debounced state flips when the debounce depth's worth of samples
+// in a row disagree with it, and any agreeing sample resets its count, so
+// press and release are filtered the same way. Works a byte (8 keys) at a
+// time as 64-bit logic is slow on an 8-bit CPU.
+void key_debounce_sample(uint64_t sample)
+{
+	const uint8_t flip_at0 = key_flip_at[0];
+	const uint8_t flip_at1 = key_flip_at[1];
+	const uint8_t flip_at2 = key_flip_at[2];
+	uint8_t *samples = (uint8_t *)&sample;
+	volatile uint8_t *states = (volatile uint8_t *)&key_debounced_state;
+	++key_sample_count;
+	for (uint8_t i=0; i<8; i++) {
+		uint8_t c0 = key_count[0][i];
+		uint8_t c1 = key_count[1][i];
+		uint8_t c2 = key_count[2][i];
+		uint8_t differ = samples[i] ^ states[i];
+		uint8_t flip = differ & ~((c0 ^ flip_at0) | (c1 ^ flip_at1) | (c2 ^ flip_at2));
+		states[i] ^= flip;
+		if (flip) {
+			key_event_push(i, flip, states[i]);
+		}
+		// Telemetry, only for the rare samples where a key starts or stops
+		// disagreeing with its state.
+		uint8_t counting = c0 | c1 | c2;
+		uint8_t rejected = counting & ~differ;
+		uint8_t started = differ & ~counting & samples[i]; // closed on an open key
+		uint8_t pressed = flip & samples[i];
+		if (rejected | started | pressed) {
+			key_debounce_telemetry(i, rejected, started, pressed);
+		}
+		// Count the keys that still disagree, clear the rest.
+		uint8_t keep = differ & ~flip;
+		key_count[2][i] = (c2 ^ (c1 & c0)) & keep;
+		key_count[1][i] = (c1 ^ c0) & keep;
+		key_count[0][i] = ~c0 & keep;
+	}
+}
+
+// Read the current keystate, debounced by the ISR, into the global variable
+// "g_key_state".
 //
 // g_key_state corresponds to the shift register inputs as below
 //    U6       U5       U4
 // HGFEDCBA HGEFDCBA HGEFDCBA
-
 uint32_t key_read(void)
 {
-    // Debounce the keys by ANDing the columns of key samples together.
-    g_key_state = 0xffffffffffffffff;
-    for(uint8_t i=0; i<DEBOUNCE_BUFFER_SIZE; ++i) {
-        g_key_state &= g_key_debounce_buffer[i];
-    }
+    // The ISR keeps the debounced state, take a copy so it can't change
+    // under key_calc(). Each key lives in a single byte, so a copy torn by
+    // the ISR still holds a valid old or new state for every key.
+    g_key_state = key_debounced_state;
     return g_key_state;
 }
 
+// Wait until a key held since the scan started has been debounced, one
+// sample past the debounce depth in case the first sample missed the contact.
+// system_time_ms advances by the scan period with every sample, so a slow scan
+// or a deep debounce (up to ~35ms) waits longer.
+//
+void key_wait_debounced(void)
+{
+	uint16_t wait = (key_debounce_depth + 1) * g_key_scan_period;
+	uint16_t start = system_time_ms;
+	while ((uint16_t)(system_time_ms - start) <= wait) {
+		_delay_us(100);
+	}
+}
+
 // Update the key up and key down global variables. We need to separate this
 // from reading the key state as we may read the state many times to update
 // the LEDs while waiting for a USB endpoint to become available.
@@ -30,8 +30,24 @@
 
 // Extern Globals --------------------------------------------------------------
 
-// The key debounce buffer.
-extern uint64_t g_key_debounce_buffer[DEBOUNCE_BUFFER_SIZE];
+// Debounce telemetry, updated by the ISR.
+extern volatile uint16_t g_key_bounces_rejected; // Runs of disagreeing samples too short to flip a key
+extern volatile uint16_t g_key_presses;          // Debounced presses
+extern volatile uint32_t g_key_press_latency;    // Sum of the presses' latency, in samples
+
+// A debounced key edge, queued by the ISR for the main loop.
+#define KEY_EVENT_DOWN 0x80   // Set in key for a press
+#define KEY_EVENT_KEY  0x3F   // Key number (0..63) in key
+typedef struct {
+    uint8_t  key;
+    uint16_t time_ms;         // system_time_ms when the edge was debounced
+} key_event_t;
+
+// Key event queue statistics.
+extern volatile uint16_t g_key_events_dropped; // Edges lost to a full queue (ISR)
+extern uint16_t g_key_events_read;             // Edges taken off the queue
+extern uint16_t g_key_event_wait_max;          // Longest and total time edges spent
+extern uint32_t g_key_event_wait_total;        // - in the queue, in system_time_ms
 
 // The key states (after debounce).
 extern uint64_t g_key_state;      // Current state of the keys.
@@ -43,6 +59,7 @@ extern uint64_t g_key_bank_last_up;         // Bank key was pressed in (for note
 #define LED_REFRESH_LIMIT 25 // 25 was working value
 extern volatile uint16_t system_time_ms; // 0 to 65 seconds
 extern uint16_t last_led_refresh_time_ms;
+extern uint8_t g_key_scan_period; // ~0.77ms steps between key samples
 
 // Interrupt service routine ---------------------------------------------------
 ISR(TIMER0_OVF_vect);
@@ -50,7 +67,22 @@ ISR(TIMER0_OVF_vect);
 // Key functions ---------------------------------------------------------------
 void key_setup(void);
 void key_disable(void);
+void key_configure(uint8_t scan_period, uint8_t debounce_depth);
+void key_debounce_sample(uint64_t sample);
 uint32_t key_read(void);
+void key_wait_debounced(void);
 void key_calc(void);
+bool key_event_pop(key_event_t* event);
+
+// The index (0 to 7) of the only bit set in a byte of a key mask, without
+// looping over the bits.
+static inline uint8_t key_bit_index(uint8_t bit)
+{
+    uint8_t index = 0;
+    if (bit & 0xF0) { index += 4; }
+    if (bit & 0xCC) { index += 2; }
+    if (bit & 0xAA) { index += 1; }
+    return index;
+}
 
 #endif // _KEY_H_INCLUDED
@@ -29,6 +29,7 @@
 #include "display.h"
 #include "key.h"
 #include "midi.h"
+#include <util/crc16.h>
 
 // Global variables ------------------------------------------------------------
 
@@ -346,17 +347,17 @@ void led_update_pixels(uint8_t *buffer)
 
 //volatile uint8_t *led_group_ports[4] = {&PORTB, &PORTC, &PORTB, &PORTB};
 //uint8_t led_group_masks[4] = {LED_ASYNC_GROUP0, LED_ASYNC_GROUP1, LED_ASYNC_GROUP2, LED_ASYNC_GROUP3};
-void led_update_pixel_group0(uint8_t *buffer)
+void led_update_pixel_group0(const uint8_t *buffer)
 {
 		//volatile uint8_t *this_port = led_group_ports[group_id];
 		//uint8_t port_bit_flag = led_group_masks[group_id];
 	static uint32_t test_buffer = 0x00000000;
-	uint32_t *single_led_buffer;
+	const uint32_t *single_led_buffer;
 	// Turn off interrupts for a moment.
 	//cli();
 	for (uint8_t this_led=0; this_led <= 31; this_led++) {
 		// Get One RGB State from Buffer
-		single_led_buffer = (uint32_t *)(buffer);
+		single_led_buffer = (const uint32_t *)(buffer);
 		test_buffer = *single_led_buffer;
 		if (this_led & 0x01) { // every other led changes button, we are treat each button as a single led (even though there are two per button)
 			buffer = buffer + 3;
@@ -390,16 +391,16 @@ void led_update_pixel_group0(uint8_t *buffer)
 	return;
 }
 
-void led_update_pixel_group1(uint8_t *buffer) 
+void led_update_pixel_group1(const uint8_t *buffer) 
 {
 	//DDRC |= LED_ASYNC;
 	static uint32_t test_buffer = 0x00000000;
-	uint32_t *single_led_buffer;	
+	const uint32_t *single_led_buffer;	
 	// Turn off interrupts for a moment.
 	//cli();
 	for (uint8_t this_led=0; this_led <= 31; this_led++) {
 		// Get One RGB State from Buffer
-		single_led_buffer = (uint32_t *)(buffer);
+		single_led_buffer = (const uint32_t *)(buffer);
 		test_buffer = *single_led_buffer;
 		if (this_led & 0x01) { // every other led changes button, we are treat each button as a single led (even though there are two per button)
 			buffer = buffer + 3;
@@ -432,15 +433,15 @@ void led_update_pixel_group1(uint8_t *buffer)
 	return;
 }
 
-void led_update_pixel_group2(uint8_t *buffer)
+void led_update_pixel_group2(const uint8_t *buffer)
 {
 	static uint32_t test_buffer = 0x00000000;
-	uint32_t *single_led_buffer;
+	const uint32_t *single_led_buffer;
 	// Turn off interrupts for a moment.
 	//cli();
 	for (uint8_t this_led=0; this_led <= 31; this_led++) {
 		// Get One RGB State from Buffer
-		single_led_buffer = (uint32_t *)(buffer);
+		single_led_buffer = (const uint32_t *)(buffer);
 		test_buffer = *single_led_buffer;
 		if (this_led & 0x01) { // every other led changes button, we are treat each button as a single led (even though there are two per button)
 			buffer = buffer + 3;
@@ -473,15 +474,15 @@ void led_update_pixel_group2(uint8_t *buffer)
 	return;
 }
 
-void led_update_pixel_group3(uint8_t *buffer)
+void led_update_pixel_group3(const uint8_t *buffer)
 {
 	static uint32_t test_buffer = 0x00000000;
-	uint32_t *single_led_buffer;
+	const uint32_t *single_led_buffer;
 	// Turn off interrupts for a moment.
 	//cli();
 	for (uint8_t this_led=0; this_led <= 31; this_led++) {
 		// Get One RGB State from Buffer
-		single_led_buffer = (uint32_t *)(buffer);
+		single_led_buffer = (const uint32_t *)(buffer);
 		test_buffer = *single_led_buffer;
 		if (this_led & 0x01) { // every other led changes button, we are treat each button as a single led (even though there are two per button)
 			buffer = buffer + 3;
@@ -514,20 +515,84 @@ void led_update_pixel_group3(uint8_t *buffer)
 	return;
 }
 
+// A frame goes out one strand per call to led_update_next_group(), so the
+// key scan and USB are serviced between strands instead of waiting ~2.4ms.
+// - Each strand is still written in one piece with interrupts off, a gap
+//   inside a strand would latch it early.
+// - The next frame is only started once all four strands are sent, so each
+//   strand idles low for at least three other strands (>1.5ms) between
+//   frames, well over the WS2812 reset time.
+static uint8_t *led_frame_buffer;
+static uint8_t led_next_group = 4; // 4 = no frame in progress
+
 void led_update_pixels(uint8_t *buffer)
 {
 	DDRC |= LED_ASYNC_GROUP1; // !review: we don't need to set this every time
 	DDRB |= LED_ASYNC_GROUP0 | LED_ASYNC_GROUP2 | LED_ASYNC_GROUP3; // !review: we don't need to set this every time
+	led_frame_buffer = buffer;
+	led_next_group = 0;
+	led_update_next_group();
+}
+
+bool led_update_busy(void)
+{
+	return led_next_group < 4;
+}
+
+void led_update_next_group(void)
+{
 	cli(); // disable interrupts
-	led_update_pixel_group0(buffer); // Test
-	led_update_pixel_group1(buffer+48);
-	led_update_pixel_group2(buffer+96);
-	led_update_pixel_group3(buffer+144);
+	switch (led_next_group) {
+	case 0:
+		led_update_pixel_group0(led_frame_buffer);
+		break;
+	case 1:
+		led_update_pixel_group1(led_frame_buffer+48);
+		break;
+	case 2:
+		led_update_pixel_group2(led_frame_buffer+96);
+		break;
+	case 3:
+		led_update_pixel_group3(led_frame_buffer+144);
+		break;
+	default:
+		sei();
+		return;
+	}
 	sei(); // reenable interrupts
-	return;
+	led_next_group += 1;
 }
 #endif // FOUR_STRANDS
 
+// Frame skipping --------------------------------------------------------------
+
+#if ENABLE_LED_FRAME_SKIP > 0
+// The LEDs hold their colour, so a frame identical to the last one sent can
+// be skipped. Frames are compared by CRC rather than keeping a 192 byte copy
+// - a changed frame with a colliding CRC is corrected by the forced refresh.
+uint16_t g_led_frames_sent;
+uint16_t g_led_frames_skipped;
+static uint16_t led_last_frame_crc;
+static uint8_t led_skip_count = LED_FRAME_SKIP_LIMIT; // always send the first frame
+
+bool led_frame_changed(uint8_t *buffer)
+{
+	uint16_t crc = 0xFFFF;
+	for (uint8_t i=0; i < NUM_BUTTONS*3; ++i) {
+		crc = _crc_ccitt_update(crc, buffer[i]);
+	}
+	if (crc == led_last_frame_crc && led_skip_count < LED_FRAME_SKIP_LIMIT) {
+		led_skip_count += 1;
+		g_led_frames_skipped += 1;
+		return false;
+	}
+	led_last_frame_crc = crc;
+	led_skip_count = 0;
+	g_led_frames_sent += 1;
+	return true;
+}
+#endif
+
 // Lightshow effects -----------------------------------------------------------
 
 // Rainbow ----------------------------------------------
@@ -706,7 +771,8 @@ bool repeat_collision_limit_reached(uint8_t this_ball, uint8_t that_ball) {
 	}
 }
 
-void ball_demo_run(uint8_t *buffer) {
+// Move the balls on, when it's time to.
+void ball_demo_update(void) {
 	if (g_led_counter[2] == 0) {
 		// restart the counter
 		g_led_counter[2] = 0x30;
@@ -816,27 +882,17 @@ void ball_demo_run(uint8_t *buffer) {
 			}
 		} 
 	} // update the animation (END)
-	
-	// Light/ Darken All LEDs
-	for (uint8_t this_row = 0; this_row < 8; this_row++) {
-		for (uint8_t this_col = 0; this_col < 8; this_col++) {
-			uint8_t btn_id = get_button_id_from_row_column(this_row, this_col);
-			uint8_t ball_id = ball_grid[this_row][this_col];
-			uint8_t *display_ptr = buffer;
-			if (ball_id >= BALL_DEMO_MAX_BALLS) {
-				// Black: No adjustment to color_ptr needed.
-				*(display_ptr+3*btn_id) = default_color[0][2];
-				*(display_ptr+3*btn_id+1) = default_color[0][0];
-				*(display_ptr+3*btn_id+2) = default_color[0][1];				
-			}
-			else {
-				uint8_t color = ball_color[ball_id];
-				*(display_ptr+3*btn_id) = default_color[color][2];
-				*(display_ptr+3*btn_id+1) = default_color[color][0];
-				*(display_ptr+3*btn_id+2) = default_color[color][1];
-			}
-		}
+}
+
+// The color of a button in the demo, black or its ball's (RGB)
+const uint8_t* ball_demo_color(uint8_t btn_id) {
+	uint8_t this_row = (btn_id >> 2) & 0x07; // bottom row is row0
+	uint8_t this_col = (btn_id & 0x03) + (btn_id >= 32 ? 4 : 0);
+	uint8_t ball_id = ball_grid[this_row][this_col];
+	if (ball_id >= BALL_DEMO_MAX_BALLS) {
+		return default_color[0]; // Black
 	}
+	return default_color[ball_color[ball_id]];
 }
 #endif // LIGHTSHOW
 
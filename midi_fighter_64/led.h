@@ -41,6 +41,7 @@
 #define LED_CONFIGURATION_FOUR_STRANDS 1 // production units
 #define LED_CONFIGURATION LED_CONFIGURATION_FOUR_STRANDS
 
+
 // animation counters
 extern uint16_t g_led_counter[4];
 extern uint8_t display_cycle_counter;
@@ -56,12 +57,22 @@ void led_setup(void);
 void led_disable(void);
 void led_enable(void);
 void led_update_pixels(uint8_t *buffer);
+#if LED_CONFIGURATION == LED_CONFIGURATION_FOUR_STRANDS
+// - a frame goes out one strand per main loop pass (interrupts are off while a strand is written)
+bool led_update_busy(void);
+void led_update_next_group(void);
+#endif
 
 // for compatibility with original MF code
-void led_update_pixel_group0(uint8_t *buffer);
-void led_update_pixel_group1(uint8_t *buffer);
-void led_update_pixel_group2(uint8_t *buffer);
-void led_update_pixel_group3(uint8_t *buffer);
+void led_update_pixel_group0(const uint8_t *buffer);
+void led_update_pixel_group1(const uint8_t *buffer);
+void led_update_pixel_group2(const uint8_t *buffer);
+void led_update_pixel_group3(const uint8_t *buffer);
+#if ENABLE_LED_FRAME_SKIP > 0
+extern uint16_t g_led_frames_sent;
+extern uint16_t g_led_frames_skipped;
+bool led_frame_changed(uint8_t *buffer);
+#endif
 void led_set_state(uint16_t new_state, uint32_t color);
 void led_set_state_dfu(void);
 
@@ -70,7 +81,8 @@ void rainbow_setup(void);
 bool rainbow_run(uint8_t *buffer);
 
 void ball_demo_setup(void);
-void ball_demo_run(uint8_t *buffer);
+void ball_demo_update(void);
+const uint8_t* ball_demo_color(uint8_t btn_id);
 
 // Tests
 #if ENABLE_TEST_IN_LED_CALIBRATION > 0
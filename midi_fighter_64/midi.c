@@ -53,14 +53,14 @@ static USB_ClassInfo_MIDI_Device_t s_midi_interface = {
 		.DataINEndpoint = 
 		{
 			.Address          = MIDI_STREAM_IN_EPADDR,
-			.Size             = 64, // 64
-			.Banks            = 1, // !review: 0,1,2,+ none has any effect on throughput, why?
+			.Size             = MIDI_STREAM_EPSIZE,
+			.Banks            = MIDI_STREAM_BANKS,
 		},
 		.DataOUTEndpoint = 
 		{
 			.Address          = MIDI_STREAM_OUT_EPADDR,
-			.Size             = 64, // 64
-			.Banks            = 1,	// !review: 0,1,2,+ none has any effect on throughput, why? Can we set to 3ms, and then read a bunch of messages continuously?
+			.Size             = MIDI_STREAM_EPSIZE,
+			.Banks            = MIDI_STREAM_BANKS, // the host sends the next packet while one is drained
 		},
 	},
 };
@@ -112,7 +112,8 @@ uint8_t G_EE_MIDI_VELOCITY = 74;     // Default velocity for NoteOn (0..127)
 uint8_t g_midi_note_state[2][MIDI_MAX_NOTES]; 
 // - velocity of MIDI notes we track: For [0] and [1]: 0-63 are bank1 (G_EE_MIDI_CHANNEL) and 64-127 are bank 2 (G_EE_MIDI_CHANNEL-1)
 uint8_t g_midi_note_off_counter[MIDI_MAX_NOTES]; //  0-63 are bank 1, 64-127 are bank 2
-// - note in minimal interrupts mode, this stores system time in 8-bit, in maximum interrupt modes, each item is a ms counter
+// - 0x80 | the NoteOff wheel slot of a pending NoteOff
+uint64_t g_midi_note_lit[2][NUM_BANKS]; // - [layer][bank], kept in step by midi_note_state_set()
 
 uint16_t g_bank_select_counter[NUM_BANKS]; // Counts a 3 second delay
 uint8_t g_midi_sysex_channel = 5;   // fixed channel for now *** FIX THIS ***
@@ -130,10 +131,104 @@ void midi_setup(void)
     // basenote, expnote, channel and velocity have already been set up via
     // the EEPROM settings. Clear the MIDI keystate.
     memset(g_midi_note_state, 0, sizeof(g_midi_note_state)); // review: why do we have two*MIDI_MAX_NOTES, but only save one. Is one unused?
+    memset(g_midi_note_lit, 0, sizeof(g_midi_note_lit));
     memset(g_midi_note_off_counter, 0, sizeof(g_midi_note_off_counter)); // review: why do we have two*MIDI_MAX_NOTES, but only save one. Is one unused?
     memset(g_bank_select_counter, 0, sizeof(g_bank_select_counter)); // review: why do we have two*MIDI_MAX_NOTES, but only save one. Is one unused?
 }
 
+// MIDI transmit --------------------------------------------------------------
+
+// Outgoing events are packed into a RAM copy of the IN bank and written to
+// the endpoint in one burst when it fills or at midi_flush(), instead of
+// selecting the endpoint and running Endpoint_Write_Stream_LE() per event.
+// An event that finds the buffer full and every bank still held by the host
+// is dropped and counted, rather than holding the main loop until the host
+// reads. Sysex replies, which a cut would corrupt, instead wait for a free
+// bank, and if the host hasn't taken one within USB_STREAM_TIMEOUT_MS the
+// staged events are dropped and counted.
+uint16_t g_midi_tx_packets;       // IN banks written
+uint16_t g_midi_tx_events;        // events in them
+uint16_t g_midi_tx_dropped;       // events lost to a host that wasn't reading
+uint8_t g_midi_tx_frame_packets_max; // most banks written in one USB frame
+static uint8_t midi_tx_buffer[MIDI_TX_BUFFER_SIZE];
+static uint8_t midi_tx_length;
+static uint16_t midi_tx_frame;
+static uint8_t midi_tx_frame_packets;
+
+// Write the staged events to the IN endpoint. Without wait, events are
+// left staged if the host still holds every bank.
+static void midi_tx_commit(bool wait)
+{
+	uint8_t length = midi_tx_length;
+	if (!length) {
+		return;
+	}
+	if (USB_DeviceState != DEVICE_STATE_Configured) {
+		midi_tx_length = 0;
+		g_midi_tx_dropped += length / sizeof(MIDI_EventPacket_t);
+		return;
+	}
+	Endpoint_SelectEndpoint(g_midi_interface_info->Config.DataINEndpoint.Address);
+	if (!Endpoint_IsINReady()) {
+		if (!wait) {
+			return;
+		}
+		if (Endpoint_WaitUntilReady() != ENDPOINT_READYWAIT_NoError) {
+			midi_tx_length = 0;
+			g_midi_tx_dropped += length / sizeof(MIDI_EventPacket_t);
+			return;
+		}
+	}
+	midi_tx_length = 0;
+	for (uint8_t i = 0; i < length; ++i) {
+		Endpoint_Write_8(midi_tx_buffer[i]);
+	}
+	Endpoint_ClearIN();
+
+	++g_midi_tx_packets;
+	g_midi_tx_events += length / sizeof(MIDI_EventPacket_t);
+	uint16_t frame = USB_Device_GetFrameNumber();
+	if (frame != midi_tx_frame) {
+		midi_tx_frame = frame;
+		midi_tx_frame_packets = 0;
+	}
+	if (++midi_tx_frame_packets > g_midi_tx_frame_packets_max) {
+		g_midi_tx_frame_packets_max = midi_tx_frame_packets;
+	}
+}
+
+static void midi_send_event(const MIDI_EventPacket_t* event)
+{
+	if (midi_tx_length > MIDI_TX_BUFFER_SIZE - sizeof(MIDI_EventPacket_t)) {
+		midi_tx_commit(false); // the bank is full, send it and start the next
+		if (midi_tx_length) { // the host holds every bank
+			++g_midi_tx_dropped;
+			return;
+		}
+	}
+	memcpy(midi_tx_buffer + midi_tx_length, event, sizeof(MIDI_EventPacket_t));
+	midi_tx_length += sizeof(MIDI_EventPacket_t);
+}
+
+// The host asked for the reply and is reading, so a full buffer waits for a
+// bank rather than cutting the message short.
+static void midi_send_sysex_event(const MIDI_EventPacket_t* event)
+{
+	if (midi_tx_length > MIDI_TX_BUFFER_SIZE - sizeof(MIDI_EventPacket_t)) {
+		midi_tx_commit(true);
+	}
+	midi_send_event(event);
+}
+
+// Hand the staged events to the host if a bank is free. Unlike
+// MIDI_Device_Flush() this never waits for the host to read the bank: with
+// two banks the next one can be filled meanwhile, and if both are still
+// queued the events go out on a later pass.
+void midi_flush(void)
+{
+	midi_tx_commit(false);
+}
+
 void midi_stream_raw_note(const uint8_t channel,
                           const uint8_t pitch,
                           const bool onoff,
@@ -154,7 +249,7 @@ void midi_stream_raw_note(const uint8_t channel,
     midi_event.Data1       = command | (midi_channel & 0x0f);  // 0..15
     midi_event.Data2       = pitch & 0x7f;   // 0..127
     midi_event.Data3       = velocity & 0x7f; // 0..127
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 
@@ -180,7 +275,7 @@ void midi_stream_note_ch(const uint8_t channel,
     midi_event.Data2       = pitch & 0x7f;   // 0..127
     midi_event.Data3       = G_EE_MIDI_VELOCITY & 0x7f; // 0..127
 
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 void midi_stream_raw_cc(const uint8_t channel,
@@ -198,7 +293,7 @@ void midi_stream_raw_cc(const uint8_t channel,
     midi_event.Data1       = command | (channel & 0x0f); // 0..15
     midi_event.Data2       = cc & 0x7f;   // 0..127
     midi_event.Data3       = value & 0x7f;  // 0..127
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 
@@ -231,7 +326,7 @@ void midi_stream_note(const uint8_t pitch, const bool onoff)
     midi_event.Data2       = pitch & 0x7f;   // 0..127
     midi_event.Data3       = G_EE_MIDI_VELOCITY & 0x7f; // 0..127
 
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 // Append a Control Change Event to the currently selected USB Endpoint. If
@@ -256,7 +351,7 @@ void midi_stream_cc(const uint8_t controller, const uint8_t value)
     midi_event.Data2       = controller & 0x7f;   // 0..127
     midi_event.Data3       = value & 0x7f;  // 0..127
 
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 // Append a SysEx Event to the currently selected USB Endpoint. If
@@ -299,7 +394,7 @@ void midi_stream_sysex (const uint8_t length, uint8_t* data)
         }
         midi_event.Data2       = *data++;
         midi_event.Data3       = *data++;
-        MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+        midi_send_sysex_event(&midi_event);
         num -= 3;
     }
     if (num) {
@@ -339,7 +434,7 @@ void midi_stream_sysex (const uint8_t length, uint8_t* data)
             midi_event.Data2    = *data++;
             midi_event.Data3    = *data++;
         }
-        MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+        midi_send_sysex_event(&midi_event);
     }
 }
 
@@ -416,7 +511,7 @@ void midi_stream_sysex_identify()  // DEPRECATED (not used), has been replaced b
     midi_event.Data1       = 0xF0; // Start of Sysex
     midi_event.Data2       = 0x7E; // Non-Realtime
     midi_event.Data3       = 0x05; // ID of this Device (constant for now)
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 	#if USE_LUFA_2015 > 0
 	  midi_event.Event     = 0x4;
 	#else
@@ -425,7 +520,7 @@ void midi_stream_sysex_identify()  // DEPRECATED (not used), has been replaced b
     midi_event.Data1       = 0x06; // MIDI - General Information
     midi_event.Data2       = 0x7E; // MIDI - Identity Reply
     midi_event.Data3       = MIDI_MFR_ID_0; // MIDI = Manufacturer's ID byte 0
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 	#if USE_LUFA_2015 > 0
 	  midi_event.Event     = 0x4;
 	#else
@@ -434,7 +529,7 @@ void midi_stream_sysex_identify()  // DEPRECATED (not used), has been replaced b
     midi_event.Data1       = MIDI_MFR_ID_1; // MIDI = Manufacturer's ID byte 1
     midi_event.Data2       = MIDI_MFR_ID_2; // MIDI = Manufacturer's ID byte 2 = DJTechTools
     midi_event.Data3       = DEVICE_FAMILY_LSB;  // Family ID (LSB)
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 	#if USE_LUFA_2015 > 0
 	  midi_event.Event     = 0x4;
 	#else
@@ -443,7 +538,7 @@ void midi_stream_sysex_identify()  // DEPRECATED (not used), has been replaced b
     midi_event.Data1       = DEVICE_FAMILY_MSB; // Family ID (MSB) = 0x0003 = Midifighter3D
     midi_event.Data2       = 0x01; // Model ID (LSB)
     midi_event.Data3       = 0x00; // Model ID(MSB) = 0x0001 = basic model
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 	#if USE_LUFA_2015 > 0
 	  midi_event.Event     = 0x4;
 	#else
@@ -452,7 +547,7 @@ void midi_stream_sysex_identify()  // DEPRECATED (not used), has been replaced b
     midi_event.Data1       = DEVICE_VERSION_DAY; // Firmware Version (LSB)
     midi_event.Data2       = DEVICE_VERSION_MONTH; // Firmware Version
     midi_event.Data3       = DEVICE_VERSION_YEAR_LSB; // Firmware Version
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 	#if USE_LUFA_2015 > 0
 	  midi_event.Event     = 0x6;
 	#else
@@ -461,7 +556,7 @@ void midi_stream_sysex_identify()  // DEPRECATED (not used), has been replaced b
     midi_event.Data1       = DEVICE_VERSION_YEAR_MSB; // Firmware Version (MSB) = 0x20110724
     midi_event.Data2       = 0xf7; // And of sysex
     midi_event.Data3       = 0x00; // PADDING
-    MIDI_Device_SendEventPacket(g_midi_interface_info, &midi_event);
+    midi_send_event(&midi_event);
 }
 
 void midi_clock(void)
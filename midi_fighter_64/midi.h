@@ -50,6 +50,7 @@ extern uint8_t G_EE_MIDI_CHANNEL;
 extern uint8_t G_EE_MIDI_VELOCITY;
 extern uint8_t g_midi_note_state[2][MIDI_MAX_NOTES]; //[0]=Midi Feedback, [1]=Animation State
 extern uint8_t g_midi_note_off_counter[MIDI_MAX_NOTES]; //
+extern uint64_t g_midi_note_lit[2][NUM_BANKS]; // bit per g_midi_note_state entry that is non-zero
 extern uint16_t g_bank_select_counter[NUM_BANKS]; //
 extern uint8_t g_midi_sysex_channel;
 
@@ -58,6 +59,11 @@ extern bool g_midi_sysex_is_valid;
 	
 extern bool midi_clock_enabled;
 
+extern uint16_t g_midi_tx_packets;
+extern uint16_t g_midi_tx_events;
+extern uint16_t g_midi_tx_dropped;
+extern uint8_t g_midi_tx_frame_packets_max;
+
 // MIDI function prototypes ----------------------------------------------------
 
 void midi_setup(void);
@@ -88,4 +94,18 @@ void midi_clock(void);
 
 void midi_clock_enable(bool state);
 
+// Store a velocity in layer (0: colors, 1: animations) of g_midi_note_state,
+// keeping g_midi_note_lit in step so the compositors can skip unlit notes.
+static inline void midi_note_state_set(uint8_t layer, uint8_t index, uint8_t velocity)
+{
+    g_midi_note_state[layer][index] = velocity;
+    uint8_t* lit = (uint8_t*)g_midi_note_lit[layer] + (index >> 3); // bank 1's 8 bytes then bank 2's (little endian)
+    uint8_t bit = 1 << (index & 7);
+    if (velocity) {
+        *lit |= bit;
+    } else {
+        *lit &= ~bit;
+    }
+}
+
 #endif // _MIDI_H_INCLUDED
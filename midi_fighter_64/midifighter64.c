@@ -51,6 +51,7 @@
 #include "jumptoboot.h"
 #include "sysex.h"
 #include "config.h"
+#include "profile.h"
 
 
 
@@ -183,27 +184,102 @@ void EVENT_USB_Device_UnhandledControlRequest(void)
 // is the heart of the MidiFighter.
 //
 //#define USB_RX_FAIL_LIMIT 100 // seems to work (0 can see squares sometimes)
-void update_note_off_feedback_delay(void) {
-	uint16_t sys_time_7 = system_time_ms & 0x7F; // !note: this must stay as a uin16_t, for some reason, setting this as a uint8_t appears to grab the MSB for system_time_ms
-    for (uint8_t this_key = 0; this_key < (NUM_BANKS*NUM_BUTTONS); this_key++) {
-		uint8_t note_off_time = g_midi_note_off_counter[this_key];
-		if (note_off_time & 0x80) {
-			note_off_time &= 0x7F; // Strip off the 'flag'
-			if ((sys_time_7 - note_off_time) >= NOTE_OFF_FEEDBACK_DELAY_LIMIT) {
-				g_midi_note_state[0][this_key] = 0; // set value to 0, banks 1 and 2 are on [0][this_key]
-				g_midi_note_off_counter[this_key] = 0; // reset counter so it doesn't happen again				
+#if ENABLE_NOTE_OFF_FEEDBACK_DELAY > 0
+// NoteOffs waiting out the feedback delay, binned by arrival time. Each slot
+// of the wheel takes the NoteOffs of NOTE_OFF_WHEEL_TICKS ticks and comes
+// due when its newest one is NOTE_OFF_FEEDBACK_DELAY_LIMIT old, so a refresh
+// only looks at NOTE_OFF_WHEEL_SLOTS times and the keys that are due.
+//
+// The rest of the wheel spans at least the delay, so by the time a slot is
+// reused everything in it is due and gets applied there and then. Times are
+// only ever compared as 16-bit differences, so the clock wrapping is fine.
+//
+// A pending key's g_midi_note_off_counter is 0x80 | its slot, a NoteOn just
+// takes it out of the slot.
+#define NOTE_OFF_WHEEL_TICKS ((NOTE_OFF_FEEDBACK_DELAY_LIMIT + NOTE_OFF_WHEEL_SLOTS - 2) / (NOTE_OFF_WHEEL_SLOTS - 1))
+typedef struct {
+	uint8_t keys[MIDI_MAX_NOTES / 8]; // bit per key_id
+	uint8_t count;                    // keys in the slot
+	uint16_t start_ms;                // system_time_ms of the slot's first NoteOff
+	uint16_t last_ms;                 // and of its newest
+} note_off_slot_t;
+static note_off_slot_t note_off_wheel[NOTE_OFF_WHEEL_SLOTS];
+static uint8_t note_off_slot = 0; // slot taking NoteOffs
+
+// Take a pending NoteOff out of its slot, it has been overridden.
+static void note_off_cancel(uint8_t key_id)
+{
+	uint8_t counter = g_midi_note_off_counter[key_id];
+	if (counter & 0x80) {
+		note_off_slot_t* slot = &note_off_wheel[counter & 0x7F];
+		slot->keys[key_id >> 3] &= ~(1 << (key_id & 7));
+		slot->count -= 1;
+		g_midi_note_off_counter[key_id] = 0;
+	}
+}
+
+// Turn off the feedback of every key in the slot and empty it.
+static void note_off_expire(note_off_slot_t* slot)
+{
+	for (uint8_t i = 0; i < sizeof(slot->keys) && slot->count; i++) {
+		uint8_t bits = slot->keys[i];
+		if (!bits) {
+			continue;
+		}
+		slot->keys[i] = 0;
+		for (uint8_t key_id = i << 3; bits; key_id++, bits >>= 1) {
+			if (bits & 1) {
+				midi_note_state_set(0, key_id, 0); // banks 1 and 2 are on [0][key_id]
+				g_midi_note_off_counter[key_id] = 0;
+				slot->count -= 1;
 				#if ENABLE_TEST_OUT_NOTE_COUNTERS > 0
 				note_off_delay_count += 1;
 				#endif
 			}
-			else {
-				#if ENABLE_TEST_OUT_NOTE_COUNTERS > 0
-				note_off_delay_skip_count += 1;
-				#endif			
-			}
 		}
-    }
+	}
+}
+
+// Start the feedback delay for a NoteOff, in the current slot unless that
+// has been taking NoteOffs for NOTE_OFF_WHEEL_TICKS already.
+static void note_off_start(uint8_t key_id)
+{
+	uint16_t sys_time_16 = system_time_ms;
+	note_off_cancel(key_id);
+	note_off_slot_t* slot = &note_off_wheel[note_off_slot];
+	if (slot->count && (uint16_t)(sys_time_16 - slot->start_ms) >= NOTE_OFF_WHEEL_TICKS) {
+		note_off_slot = (note_off_slot + 1) % NOTE_OFF_WHEEL_SLOTS;
+		slot = &note_off_wheel[note_off_slot];
+		note_off_expire(slot); // a whole turn old, so due
+	}
+	if (!slot->count) {
+		slot->start_ms = sys_time_16;
+	}
+	slot->keys[key_id >> 3] |= 1 << (key_id & 7);
+	slot->count += 1;
+	slot->last_ms = sys_time_16;
+	g_midi_note_off_counter[key_id] = 0x80 | note_off_slot;
+}
+
+// Apply the NoteOffs whose delay is up.
+void update_note_off_feedback_delay(void) {
+	uint16_t sys_time_16 = system_time_ms;
+	for (uint8_t i = 0; i < NOTE_OFF_WHEEL_SLOTS; i++) {
+		note_off_slot_t* slot = &note_off_wheel[i];
+		if (!slot->count) {
+			continue;
+		}
+		if ((uint16_t)(sys_time_16 - slot->last_ms) >= NOTE_OFF_FEEDBACK_DELAY_LIMIT) {
+			note_off_expire(slot);
+		}
+		else {
+			#if ENABLE_TEST_OUT_NOTE_COUNTERS > 0
+			note_off_delay_skip_count += 1;
+			#endif
+		}
+	}
 }
+#endif
 
 // !review: many of these key_ functions can be moved to key.c and key.h
 const uint8_t bank_select_key_ids[NUM_BANKS] = {28,63};
@@ -251,7 +327,7 @@ void service_bank_select_buttons(void) {
 	uint16_t sys_time_16 = system_time_ms;
 	for (uint8_t this_bank = 0; this_bank < NUM_BANKS; this_bank++) {
 		uint16_t this_time = g_bank_select_counter[this_bank];
-		if (this_time > 0 && sys_time_16 - this_time >= counter_limit) { // updated by Timer0 Interrupt every 1 ms
+		if (this_time > 0 && (uint16_t)(sys_time_16 - this_time) >= counter_limit) { // updated by Timer0 Interrupt every 1 ms
 			change_bank(this_bank);
 			send_change_bank_notification(this_bank);
 			break; // exit for loop
@@ -259,10 +335,169 @@ void service_bank_select_buttons(void) {
 	}
 }
 
+// USB-MIDI receive ------------------------------------------------------------
+
+// Which bank each MIDI channel's feedback is for, relative to
+// G_EE_MIDI_CHANNEL: the channel itself is bank 1 (key_id 0-63), the one
+// below is bank 2 (key_id 64-127) and the one above drives the animations.
+#define MIDI_RX_BANK_1         0            // key_id offset
+#define MIDI_RX_BANK_2         NUM_BUTTONS  // key_id offset
+#define MIDI_RX_ANIMATIONS     0xFE
+#define MIDI_RX_IGNORED        0xFF
+static uint8_t midi_rx_channel_bank[16];
+static uint8_t midi_rx_bank_channel = 0xFF; // The G_EE_MIDI_CHANNEL the table is for
+
+static void midi_rx_update_channel_banks(void)
+{
+	memset(midi_rx_channel_bank, MIDI_RX_IGNORED, sizeof(midi_rx_channel_bank));
+	// The channel is checked when it is loaded or pushed; should a bad one
+	// get through, ignore all feedback rather than take another channel's.
+	// The channels either side wrap around between 0 and 15.
+	if (G_EE_MIDI_CHANNEL <= 15) {
+		midi_rx_channel_bank[G_EE_MIDI_CHANNEL] = MIDI_RX_BANK_1;
+		midi_rx_channel_bank[(G_EE_MIDI_CHANNEL - 1) & 0x0F] = MIDI_RX_BANK_2;
+		midi_rx_channel_bank[(G_EE_MIDI_CHANNEL + 1) & 0x0F] = MIDI_RX_ANIMATIONS;
+	}
+	midi_rx_bank_channel = G_EE_MIDI_CHANNEL;
+}
+
+// A NoteOn, if the channel is one of ours update the stored velocity.
+static void midi_rx_note_on(MIDI_EventPacket_t* event)
+{
+	uint8_t bank = midi_rx_channel_bank[event->Data1 & 0x0F];
+	uint8_t note = event->Data2 & 0x7F;
+	uint8_t velocity = event->Data3 & 0x7F;
+	if (bank == MIDI_RX_ANIMATIONS) {
+		midi_note_state_set(MIDI_CHANNEL_INDEX_ANIMATIONS, note, velocity);
+		return;
+	}
+	uint8_t key_id = note - MIDI_BASENOTE;
+	if (bank == MIDI_RX_IGNORED || key_id >= NUM_BUTTONS) {
+		return;
+	}
+	key_id += bank;
+	midi_note_state_set(MIDI_CHANNEL_INDEX_CONTROL_BANKS, key_id, velocity);
+	#if ENABLE_NOTE_OFF_FEEDBACK_DELAY > 0
+	  note_off_cancel(key_id);
+	#endif
+	#if ENABLE_TEST_OUT_NOTE_COUNTERS > 0
+	if (bank == MIDI_RX_BANK_1) {
+		note_on_count += 1;
+	}
+	#endif
+}
+
+// A NoteOff event, so record a zero in the MIDI keystate. Yes, a noteoff can
+// have a "velocity", but we're relying on the keystate to be zero when we
+// have a noteoff, otherwise the LEDs won't match the state when we come to
+// calculate them.
+static void midi_rx_note_off(MIDI_EventPacket_t* event)
+{
+	uint8_t bank = midi_rx_channel_bank[event->Data1 & 0x0F];
+	uint8_t note = event->Data2 & 0x7F;
+	if (bank == MIDI_RX_ANIMATIONS) {
+		// animation note off's occur immediately and use note and not key_id (both banks on single channel)
+		midi_note_state_set(MIDI_CHANNEL_INDEX_ANIMATIONS, note, 0);
+		return;
+	}
+	uint8_t key_id = note - MIDI_BASENOTE;
+	if (bank == MIDI_RX_IGNORED || key_id >= NUM_BUTTONS) {
+		return;
+	}
+	key_id += bank;
+	#if ENABLE_NOTE_OFF_FEEDBACK_DELAY <= 0
+	  midi_note_state_set(MIDI_CHANNEL_INDEX_CONTROL_BANKS, key_id, 0);
+	#else
+	  note_off_start(key_id); // update_note_off_feedback_delay() clears g_midi_note_state once the delay is up
+	#endif
+	#if ENABLE_TEST_OUT_NOTE_COUNTERS > 0
+	if (bank == MIDI_RX_BANK_1) {
+		note_off_count += 1;
+	}
+	#endif
+}
+
+static void midi_rx_cc(MIDI_EventPacket_t* event)
+{
+	uint8_t cc = event->Data2;
+	uint8_t cc_value = event->Data3;
+	if (midi_rx_channel_bank[event->Data1 & 0x0F] == MIDI_RX_BANK_1 && cc == MF64_BANK_CC) {
+		uint8_t bank = cc_value > 0 ? 1:0;
+		change_bank(bank); // do not send a notification back!
+	}
+
+	// !test: led colors and power
+	#if ENABLE_TEST_IN_LED_CALIBRATION > 0
+	if (cc == 0) {
+		led_set_test_colors(cc_value, 0xFF, 0xFF); // Red (> 0x7F means no change)
+	}
+	else if (cc == 1) {
+		// Green
+		led_set_test_colors(0xFF, cc_value, 0xFF);
+	}
+	else if (cc == 2) {
+		// Blue
+		led_set_test_colors(0xFF, 0xFF, cc_value);
+	}
+	#endif
+}
+
+// This is a single byte Real Time message.
+static void midi_rx_realtime(MIDI_EventPacket_t* event)
+{
+	switch (event->Data1) {
+	case 0xF8 :
+		// Midi Clock Event
+		midi_clock_enable(true);
+		midi_clock();
+		break;
+	case 0xFA :
+		// Midi Clock Start Event
+		midi_clock_enable(true);
+		break;
+	case 0xFC :
+		// Midi Clock Stop Event
+		midi_clock_enable(false);
+		break;
+	}
+}
+
+// The handler for each USB-MIDI Code Index Number, the lower 4-bits of the
+// event packet's first byte, which tells us what kind of data it contains
+// and whether to expect more data in the same message:
+//
+//     0x0 = Reserved for Misc
+//     0x1 = Reserved for Cable events
+//     0x2 = 2-byte System Common
+//     0x3 = 3-byte System Common
+//     0x4 = 3-byte Sysex starts or continues
+//     0x5 = 1-byte System Common or Sysex ends
+//     0x6 = 2-byte Sysex ends
+//     0x7 = 3-byte Sysex ends
+//     0x8 = Note Off
+//     0x9 = Note On
+//     0xA = Poly KeyPress
+//     0xB = Control Change (CC)
+//     0xC = Program Change
+//     0xD = Channel Pressure
+//     0xE = PitchBend Change
+//     0xF = 1-byte message
+//
+typedef void (*midi_rx_handler_t)(MIDI_EventPacket_t* event);
+static const midi_rx_handler_t midi_rx_handlers[16] PROGMEM = {
+	NULL, NULL, NULL, NULL,
+	sysex_handle_3sc, sysex_handle_1e, sysex_handle_2e, sysex_handle_3e,
+	midi_rx_note_off, midi_rx_note_on, NULL, midi_rx_cc,
+	NULL, NULL, NULL, midi_rx_realtime,
+};
+
+// Act on one received USB-MIDI event packet. Assumes all virtual MIDI cables
+// are intended for us. Returns false for an empty (Code Index Number 0)
+// packet, which ends a large packet's events.
+//
 bool InterpretUsbMidiMessage(MIDI_EventPacket_t input_event) {
-	// Parse the USB-MIDI packet to see what it contains
 	#if USE_LUFA_2015 > 0
-	#warning USING LUFA USB 2015
+	#pragma message "USING LUFA USB 2015"
 	uint8_t command = input_event.Event & 0x0F;
 	#else
 	uint8_t command = input_event.Command;
@@ -270,481 +505,150 @@ bool InterpretUsbMidiMessage(MIDI_EventPacket_t input_event) {
 	if (command == 0) {
 		return false; // was not a valid message, return false
 	}
-	
-	
-	switch (command) {
-		case 0xB : // MIDI CC
-		{
-			// if channel is in correct range...
-			uint8_t channel = input_event.Data1 & 0x0f;
-			if (channel == G_EE_MIDI_CHANNEL) { // Bank 1: key_id 0-63
-				uint8_t cc = input_event.Data2;
-				uint8_t velocity = input_event.Data3;
-				if (cc == MF64_BANK_CC) {
-					uint8_t bank = velocity > 0 ? 1:0;
-					change_bank(bank); // do not send a notification back!
-				}
-			}
-
-			// !test: led colors and power
-			#if ENABLE_TEST_IN_LED_CALIBRATION > 0
-			uint8_t cc = input_event.Data2;
-			uint8_t cc_value = input_event.Data3;
-			if (cc == 0) {
-				led_set_test_colors(cc_value, 0xFF, 0xFF); // Red (> 0x7F means no change)
-			}
-			else if (cc == 1) {
-				// Green
-				led_set_test_colors(0xFF, cc_value, 0xFF);
-			}
-			else if (cc == 2) {
-				// Blue
-				led_set_test_colors(0xFF, 0xFF, cc_value);
-			}
-			#endif
-			
-		}
-	    case 0xF :
-		{
-        // This is a single byte Real Time message.
-			switch (input_event.Data1) {
-			case 0xF8 :
-			// Midi Clock Event
-				midi_clock_enable(true);
-				midi_clock();
-				break;
-			case 0xFA :
-			// Midi Clock Start Event
-				midi_clock_enable(true);
-				break;
-			case 0xFC :
-			// Midi Clock Stop Event
-				midi_clock_enable(false);
-				break;
-			}
-		}
-		break;
-        case 0x9 :
-        {
-			// A NoteOn event was found, if the Channel is within the
-			// correct range update the stored velocity
-			uint8_t channel = input_event.Data1 & 0x0f;
-			if (channel == G_EE_MIDI_CHANNEL) { // Bank 1: key_id 0-63
-				uint8_t note = input_event.Data2;
-				uint8_t velocity = input_event.Data3;
-				uint8_t channel_index =MIDI_CHANNEL_INDEX_CONTROL_BANKS;
-				uint8_t key_id = note - MIDI_BASENOTE;
-				if (key_id < NUM_BUTTONS) {
-					g_midi_note_state[channel_index][key_id] = velocity;
-					#if ENABLE_NOTE_OFF_FEEDBACK_DELAY > 0
-						g_midi_note_off_counter[key_id] = 0;
-					#endif			
-					#if ENABLE_TEST_OUT_NOTE_COUNTERS > 0
-						note_on_count += 1;
-					#endif			
-				}
-
-			}
-			else if (channel == ((G_EE_MIDI_CHANNEL-1) & 0x0F) ) { // Bank 2: key_id 64-127
-				uint8_t note = input_event.Data2;
-				uint8_t velocity = input_event.Data3;
-				uint8_t channel_index = MIDI_CHANNEL_INDEX_CONTROL_BANKS;
-				uint8_t key_id = note - MIDI_BASENOTE;
-				if (key_id < NUM_BUTTONS) {
-					key_id += NUM_BUTTONS;
-					g_midi_note_state[channel_index][key_id] = velocity;
-					#if ENABLE_NOTE_OFF_FEEDBACK_DELAY > 0
-						g_midi_note_off_counter[key_id] = 0; // !review: key_id = 64-127
-					#endif					
-				}
-			}
-			else if (channel == ((G_EE_MIDI_CHANNEL+1) & 0x0F) ) { // Animation Bank
-				uint8_t note = input_event.Data2;
-				uint8_t velocity = input_event.Data3;
-				uint8_t channel_index = MIDI_CHANNEL_INDEX_ANIMATIONS;
-				g_midi_note_state[channel_index][note] = velocity;
-			}
-        }
-        break;
-        case 0x8 :
-        {
-	        // A NoteOff event, so record a zero in the MIDI
-	        // keystate. Yes, a noteoff can have a "velocity",
-	        // but we're relying on the keystate to be zero when
-	        // we have a noteoff, otherwise the LEDs won't match
-	        // the state when we come to calculate them.
-	        uint8_t channel = input_event.Data1 & 0x0f;
-			if (channel == G_EE_MIDI_CHANNEL) { // Bank 1: key_id 0-63
-				uint8_t note = input_event.Data2;
-				//uint8_t velocity = input_event.Data3;
-				uint8_t key_id = note - MIDI_BASENOTE;
-				if (key_id < NUM_BUTTONS) {
-					#if ENABLE_NOTE_OFF_FEEDBACK_DELAY <= 0
-					  uint8_t channel_index = MIDI_CHANNEL_INDEX_CONTROL_BANKS;
-					  g_midi_note_state[channel_index][key_id] = 0;
-					#else // NOTE OFF Feedback delay enabled
-					  uint8_t time_8bit = (system_time_ms & 0x7F) | 0x80;
-					  g_midi_note_off_counter[key_id] = time_8bit; // set flag, will auto-update g_midi_note_state later
-					#endif
-					#if ENABLE_TEST_OUT_NOTE_COUNTERS > 0
-						note_off_count += 1;
-					#endif
-				}
-			}
-			else if (channel == ((G_EE_MIDI_CHANNEL-1) & 0x0F) ) { // Bank 2: key_id 64-127
-				uint8_t note = input_event.Data2;
-				//uint8_t velocity = input_event.Data3;
-				uint8_t key_id = note - MIDI_BASENOTE;
-				if (key_id < NUM_BUTTONS) {
-					key_id += NUM_BUTTONS; // increment key_id for bank 2
-					#if ENABLE_NOTE_OFF_FEEDBACK_DELAY <= 0
-					  uint8_t channel_index = MIDI_CHANNEL_INDEX_CONTROL_BANKS;
-					  g_midi_note_state[channel_index][key_id] = 0;
-					#else // NOTE OFF Feedback delay enabled
-					  uint8_t time_8bit = (system_time_ms & 0x7F) | 0x80;
-					  g_midi_note_off_counter[key_id] = time_8bit; // set flag, will auto-update g_midi_note_state later
-					#endif					
-				}
-			}
-			else if (channel == ((G_EE_MIDI_CHANNEL+1) & 0x0F) ) { // Animation Bank
-				uint8_t note = input_event.Data2;
-				//uint8_t velocity = input_event.Data3;
-				uint8_t channel_index = MIDI_CHANNEL_INDEX_ANIMATIONS;
-				g_midi_note_state[channel_index][note] = 0;  // animation note off's occur immediately and use note and not key_id (both banks on single channel)
-			}			
-			
-        }
-        break;
-        case 0x4 :
-            {
-                // 3 byte sysex start or continue
-                sysex_handle_3sc(&input_event);                
-            }
-            break;
-        case 0x5 :
-            {
-                // One byte sysex end or system common
-                sysex_handle_1e(&input_event);
-            }
-            break;
-        case 0x6 :
-            {
-                // 2 byte sysex end
-                sysex_handle_2e(&input_event);
-            }
-            break;
-        case 0x7 :
-            {
-                // 3 byte sysex end
-                sysex_handle_3e(&input_event);
-            }
-            break;
-		case 0xA:
-		case 0xC:
-		case 0xE:
-			break;
-        default:
-            // unrecognized
-			//return false; // returning false interprets unhandled messages as an error
-			break;
-        } // end USB-MIDI packet parse
-		return true; // is a valid midi packet, signal the sender!
+	if (midi_rx_bank_channel != G_EE_MIDI_CHANNEL) {
+		midi_rx_update_channel_banks(); // the MIDI channel setting changed
+	}
+	midi_rx_handler_t handler = (midi_rx_handler_t)pgm_read_ptr(&midi_rx_handlers[command]);
+	if (handler) {
+		handler(&input_event);
+	}
+	return true; // is a valid midi packet, signal the sender!
 }
 
-#if ENABLE_LUFA_2015_LARGE_PACKET_UPGRADE > 0
+// Interpret every event in the waiting OUT bank straight from the endpoint
+// FIFO, then release the bank. The bank's byte count marks the end of the
+// packet, so a zero-filled or CIN 0 event doesn't cut it short and nothing
+// is copied through Endpoint_Read_Stream_LE(). Returns the number of events
+// read, 0 if no bank was waiting.
+static uint8_t usb_rx_drain_bank(void)
+{
+	uint8_t out_address = g_midi_interface_info->Config.DataOUTEndpoint.Address;
 
+	if (USB_DeviceState != DEVICE_STATE_Configured) {
+		return 0;
+	}
+	Endpoint_SelectEndpoint(out_address);
+	if (!Endpoint_IsOUTReceived()) {
+		return 0;
+	}
 
-void Midifighter_GetIncomingUsbMidiMessages(void) {
-	static MIDI_EventPackets_t input_events;
-	uint16_t usb_rx_fail_count = 0;
-	uint16_t usb_rx_packets = 0;
-	
-	while (1) {
-		if (usb_rx_packets >= USB_RX_PACKET_LIMIT) {
-			break;
-		}
-		// Receive another packet
-		memset(&input_events, 0, sizeof(input_events));
-		bool status = MIDI_Device_ReceiveLargeEventPacket(g_midi_interface_info, &input_events, 32);
-		if (!status) { // No packet was received
-			// return;		
-			usb_rx_fail_count += 1;
-			if (usb_rx_fail_count >= USB_RX_FAIL_LIMIT) {
-				break;
-			} 
-			else {  // 200us on Mac, up to 400us on windows
-				wdt_reset();
-				//_delay_us(50.0); // Consecutive USB Packets can be just 10us to 200us apart in practice
-				continue;
-			}
-		}
-		else { // Packet was received!
-			usb_rx_packets += 1;
-			usb_rx_fail_count = 0;
-	
-			// - we add this delay so that we may get a full frame of leds (often 4 or 5 usb packets) at once.		
-	
-			// Received at least one packet
-			for (uint8_t this_event = 0; this_event < 16; this_event++) {
-				if (!InterpretUsbMidiMessage(input_events.events[this_event])) { // read the 'next' message
-					break;  // if the message did not match USB-MIDI Protocol, then the packet was complete, exit loop!
-				}
-			}
+	uint8_t events = 0;
+	uint8_t bytes = (uint8_t)Endpoint_BytesInEndpoint(); // at most one 64-byte bank
+	while (bytes >= sizeof(MIDI_EventPacket_t)) {
+		MIDI_EventPacket_t input_event;
+		input_event.Event = Endpoint_Read_8();
+		input_event.Data1 = Endpoint_Read_8();
+		input_event.Data2 = Endpoint_Read_8();
+		input_event.Data3 = Endpoint_Read_8();
+		bytes -= sizeof(MIDI_EventPacket_t);
+		events++;
+
+		InterpretUsbMidiMessage(input_event);
+		// Sysex replies select the IN endpoint, come back to the OUT bank.
+		if (Endpoint_GetCurrentEndpoint() != out_address) {
+			Endpoint_SelectEndpoint(out_address);
 		}
 	}
+	Endpoint_ClearOUT(); // also drops a trailing partial event
+	return events;
 }
-#else // DISABLE_LUFA_2015_LARGE_PACKET_UPGRADE
+
+// Reads the banks that have already arrived and returns at the first look
+// that finds none, so an idle host costs one look at the endpoint's RXOUTI
+// flag per call. The rest of a burst is read on the next call rather than
+// waited for.
 void Midifighter_GetIncomingUsbMidiMessages(void) {
-    // If there is data in the Endpoint for us to read, get a USB-MIDI
-    // packet to process. Endpoint_IsReadWriteAllowed() returns true if
-    // there is data remaining inside an OUT endpoint or if an IN endpoint
-    // has space left to fill. The same function doing two jobs, confusing
-    // but there you are.
-
-    MIDI_EventPacket_t input_event;
-	uint16_t usb_rx_fail_count = 0;
-	uint16_t usb_rx_packets = 0;
-		
-	while (1) {
-		//break; // !test: no LED Feedback reading
-		//#if USB_RX_METHOD < USB_RX_PERIODICALLY
-		// Wait here and actively detect incoming USB Messages continuously for up to 1ms
-		if (usb_rx_packets >= USB_RX_PACKET_LIMIT) {
+	uint16_t usb_rx_packets = 0; // events
+
+	while (usb_rx_packets < USB_RX_PACKET_LIMIT) {
+		uint8_t events = usb_rx_drain_bank();
+		if (!events) {
 			break;
 		}
-	    else if (!MIDI_Device_ReceiveEventPacket(g_midi_interface_info,
-	    &input_event)) {  // 
-			usb_rx_fail_count += 1;
-			if (usb_rx_fail_count >= USB_RX_FAIL_LIMIT) {
-				break;
-			} else {  // 200us on Mac, up to 400us on windows
-				wdt_reset();
-				continue;
-			}
-			// - we add this delay so that we may get a full frame of leds (often 4 or 5 usb packets) at once.
-		} else {
-			//Endpoint_ClearOUT(); // !Windows Test: Clear Endpoing Manually (no effect)
-			usb_rx_packets += 1;
-			usb_rx_fail_count = 0;
-			
-			#if ENABLE_TEST_OUT_USB_PACKETS_PER_INTERVAL > 0
-			if (usb_rx_packets > usb_packets_per_interval_max) {
-				usb_packets_per_interval_max = usb_rx_packets;
-			}
-			#endif
-		}
+		usb_rx_packets += events;
 
-        // Assuming all virtual MIDI cables are intended for us, ensure that
-        // this event is being sent on our current MIDI channel.
-        //
-        // The lower 4-bits (".Command") of the USB_MIDI event packet tells
-        // us what kind of data it contains, and whether to expect more data
-        // in the same message. Commands are:
-        //
-        //     0x0 = Reserved for Misc
-        //     0x1 = Reserved for Cable events
-        //     0x2 = 2-byte System Common
-        //     0x3 = 3-byte System Common
-        //     0x4 = 3-byte Sysex starts or continues
-        //     0x5 = 1-byte System Common or Sysex ends
-        //     0x6 = 2-byte Sysex ends
-        //     0x7 = 3-byte Sysex ends
-        //     0x8 = Note On
-        //     0x9 = Note Off
-        //     0xA = Poly KeyPress
-        //     0xB = Control Change (CC)
-        //     0xC = Program Change
-        //     0xD = Channel Pressure
-        //     0xE = PitchBend Change
-        //     0xF = 1-byte message
-        //
-
-        // Parse the USB-MIDI packet to see what it contains
-		#if USE_LUFA_2015 > 0
-		 #warning USING LUFA USB 2015
-		 uint8_t command = input_event.Event & 0x0F;
-		 switch (command) {
-		#else 
-         switch (input_event.Command) {
+		#if ENABLE_TEST_OUT_USB_PACKETS_PER_INTERVAL > 0
+		if (usb_rx_packets > usb_packets_per_interval_max) {
+			usb_packets_per_interval_max = usb_rx_packets;
+		}
 		#endif
-			case 0xF :
-			{
-				// This is a single byte Real Time message.
-				switch (input_event.Data1) {
-					case 0xF8 :
-					// Midi Clock Event
-					midi_clock_enable(true);
-					midi_clock();
-					break;
-					case 0xFA :
-					// Midi Clock Start Event
-					midi_clock_enable(true);
-					break;
-					case 0xFC :
-					// Midi Clock Stop Event
-					midi_clock_enable(false);
-					break;
-				}
-			}
-			break;
+	}
+}
 
-			 // MIDI Feedback and MIDI Sysex Rx
-			case 0x9 :
-			{
-				 // A NoteOn event was found, if the Channel is within the
-				// correct range update the stored velocity
-				uint8_t channel = input_event.Data1 & 0x0f;
-				if (channel == G_EE_MIDI_CHANNEL) { // Bank 1: key_id 0-63
-					uint8_t note = input_event.Data2;
-					uint8_t velocity = input_event.Data3;
-					uint8_t channel_index = MIDI_CHANNEL_INDEX_CONTROL_BANKS;
-					uint8_t key_id = note - MIDI_BASENOTE;
-					if (key_id < NUM_BUTTONS) {
-						g_midi_note_state[channel_index][key_id] = velocity;
-						#if ENABLE_NOTE_OFF_FEEDBACK_DELAY > 0
-						  g_midi_note_off_counter[key_id] = 0;
-						#endif						
-						#if ENABLE_TEST_OUT_NOTE_COUNTERS > 0
-						note_on_count += 1;
-						#endif
-					}
-				
-				}
-				else if (channel == ((G_EE_MIDI_CHANNEL-1) & 0x0F) ) { // Bank 2: key_id 64-127
-					uint8_t note = input_event.Data2;
-					uint8_t velocity = input_event.Data3;
-					uint8_t channel_index = MIDI_CHANNEL_INDEX_CONTROL_BANKS;
-					uint8_t key_id = note - MIDI_BASENOTE;
-					if (key_id < NUM_BUTTONS) {
-						key_id += NUM_BUTTONS;
-						g_midi_note_state[channel_index][key_id] = velocity;
-						#if ENABLE_NOTE_OFF_FEEDBACK_DELAY > 0
-						  g_midi_note_off_counter[key_id] = 0;
-						#endif					
-					}
-				}
-				else if (channel == ((G_EE_MIDI_CHANNEL+1) & 0x0F) ) { // Animation Bank
-					uint8_t note = input_event.Data2;
-					uint8_t velocity = input_event.Data3;
-					uint8_t channel_index = MIDI_CHANNEL_INDEX_ANIMATIONS;
-					g_midi_note_state[channel_index][note] = velocity;
-				}
-			}
-			break;
-			case 0x8 :
-			{
-				// A NoteOff event, so record a zero in the MIDI
-				// keystate. Yes, a noteoff can have a "velocity",
-				// but we're relying on the keystate to be zero when
-				// we have a noteoff, otherwise the LEDs won't match
-				// the state when we come to calculate them.
-				uint8_t channel = input_event.Data1 & 0x0f;
-				if (channel == G_EE_MIDI_CHANNEL) { // Bank 1: key_id 0-63
-					uint8_t note = input_event.Data2;
-					//uint8_t velocity = input_event.Data3;
-					uint8_t key_id = note - MIDI_BASENOTE;
-					if (key_id < NUM_BUTTONS) {
-						#if ENABLE_NOTE_OFF_FEEDBACK_DELAY <= 0
-						  uint8_t channel_index = MIDI_CHANNEL_INDEX_CONTROL_BANKS;
-						  g_midi_note_state[channel_index][key_id] = 0;
-						#else // NOTE OFF Feedback delay enabled
-						  uint8_t time_8bit = (system_time_ms & 0x7F) | 0x80;
-						  g_midi_note_off_counter[key_id] = time_8bit; // set flag, will auto-update g_midi_note_state later
-						#endif
-						
-						#if ENABLE_TEST_OUT_NOTE_COUNTERS > 0
-						  note_off_count += 1;
-						#endif
-					}
-				}
-				else if (channel == ((G_EE_MIDI_CHANNEL-1) & 0x0F) ) { // Bank 2: key_id 64-127
-					uint8_t note = input_event.Data2;
-					//uint8_t velocity = input_event.Data3;
-					uint8_t key_id = note - MIDI_BASENOTE;
-					if (key_id < NUM_BUTTONS) {
-						key_id += NUM_BUTTONS; // increment key_id for bank 2
-						#if ENABLE_NOTE_OFF_FEEDBACK_DELAY <= 0
-						  uint8_t channel_index = MIDI_CHANNEL_INDEX_CONTROL_BANKS;
-						  g_midi_note_state[channel_index][key_id] = 0;
-						#else // NOTE OFF Feedback delay enabled
-						  uint8_t time_8bit = (system_time_ms & 0x7F) | 0x80;
-						  g_midi_note_off_counter[key_id] = time_8bit; // set flag, will auto-update g_midi_note_state later
-						#endif					
-					}
-				}
-				else if (channel == ((G_EE_MIDI_CHANNEL+1) & 0x0F) ) { // Animation Bank
-					uint8_t note = input_event.Data2;
-					//uint8_t velocity = input_event.Data3;
-					uint8_t channel_index = MIDI_CHANNEL_INDEX_ANIMATIONS;
-					g_midi_note_state[channel_index][note] = 0;  // animation note off's occur immediately and use note and not key_id (both banks on single channel)
-				}			
-			}
-			break;
+// Send the NoteOn and/or CC for key i going down. bit is the key's bit in
+// byte i/8 of the key masks.
+static void key_event_down(uint8_t i, uint8_t bit)
+{
+    uint8_t note = midi_64_key_to_note(i);
 
+	if (G_EE_MIDI_OUTPUT_MODE < MIDI_OUTPUT_MODE_CCS_ONLY) {
+	    midi_stream_note(note, true);
+    }
 
-			case 0xB : // MIDI CC
-			{
-				// if channel is in correct range...
-				uint8_t channel = input_event.Data1 & 0x0f;
-				if (channel == G_EE_MIDI_CHANNEL) { // Bank 1: key_id 0-63
-					uint8_t cc = input_event.Data2;
-					uint8_t velocity = input_event.Data3;                
-					if (cc == MF64_BANK_CC) {
-						uint8_t bank = velocity > 0 ? 1:0;
-						change_bank(bank); // do not send a notification back!
-					}
-				}
-
-				// !test: led colors and power
-				#if ENABLE_TEST_IN_LED_CALIBRATION > 0
-				uint8_t cc = input_event.Data2;
-				uint8_t cc_value = input_event.Data3;
-				if (cc == 0) {
-					led_set_test_colors(cc_value, 0xFF, 0xFF); // Red (> 0x7F means no change)
-				}
-				else if (cc == 1) {
-					// Green
-					led_set_test_colors(0xFF, cc_value, 0xFF);
-				}
-				else if (cc == 2) {
-					// Blue
-					led_set_test_colors(0xFF, 0xFF, cc_value);
-				}
-				#endif
-			}
-			break;
-			case 0x4 :
-				{
-					// 3 byte sysex start or continue
-					sysex_handle_3sc(&input_event);                
-				}
-				break;
-			case 0x5 :
-				{
-					// One byte sysex end or system common
-					sysex_handle_1e(&input_event);
-				}
-				break;
-			case 0x6 :
-				{
-					// 2 byte sysex end
-					sysex_handle_2e(&input_event);
-				}
-				break;
-			case 0x7 :
-				{
-					// 3 byte sysex end
-					sysex_handle_3e(&input_event);
-				}
-				break;
-			default:
-				// do nothing.
-				//g_midi_note_state[0][36] = 100; // !test: unhandled messages
-				break;
-			} // end USB-MIDI packet parse
-    } // end while
+    if (G_EE_MIDI_OUTPUT_MODE > MIDI_OUTPUT_MODE_NOTES_ONLY)
+    {
+	    midi_stream_raw_cc(G_EE_MIDI_CHANNEL,note,127);
+    }
+	// record what bank this 'on' message occured in
+	uint8_t* bank_last_up = (uint8_t*)&g_key_bank_last_up;
+	if (g_bank_selected <= 0) {
+		bank_last_up[i >> 3] &= ~bit;
+	} else {
+		bank_last_up[i >> 3] |= bit;
+	}
+	
+	// Trigger Animation if Applicable
+	if (G_EE_ANIMATIONS < GEOMETRIC_ANIMATION_TYPES) {
+		start_geometric_animation(i, G_EE_ANIMATIONS);
+	}
+	
+	key_pressed(i); // button hold functions
+}
+
+// Send the NoteOff and/or CC for key i going up.
+static void key_event_up(uint8_t i, uint8_t bit)
+{
+    uint8_t note = midi_64_key_to_note(i);
+	// Adjust channel based on where the note was triggered (so bank changes don't result in stuck notes
+	const uint8_t* bank_last_up = (const uint8_t*)&g_key_bank_last_up;
+	uint8_t channel = bank_last_up[i >> 3] & bit ? (G_EE_MIDI_CHANNEL-1) & 0x0F : G_EE_MIDI_CHANNEL;
+	// Output Note Message
+	if (G_EE_MIDI_OUTPUT_MODE < MIDI_OUTPUT_MODE_CCS_ONLY) {
+	    midi_stream_note_ch(channel, note, false);
+    }
+	// Output CC Message
+    if (G_EE_MIDI_OUTPUT_MODE > MIDI_OUTPUT_MODE_NOTES_ONLY)
+    {
+		midi_stream_raw_cc(G_EE_MIDI_CHANNEL,note,0);
+	}
+	// Service Button 'Hold' functions
+	key_released(i); // button hold functions
+}
+
+// Send MIDI for the keys that went down or up since the last pass.
+//
+// The ISR queues the edges as it debounces them, so they are sent in the
+// order they happened even if the loop was held up, and a tap that went down
+// and up while the loop was busy elsewhere is still sent. Sending is capped
+// per pass so a host that stops reading, making every flush time out, can't
+// keep the loop here while new edges arrive (and trip the watchdog).
+void service_key_events(void)
+{
+	key_event_t event;
+	for (uint8_t n = 0; n < KEY_EVENTS_PER_PASS && key_event_pop(&event); ++n) {
+		#if USB_RX_METHOD >= USB_RX_PERIODICALLY
+		Midifighter_GetIncomingUsbMidiMessages();
+		#endif
+		uint8_t i = event.key & KEY_EVENT_KEY;
+		uint8_t bit = 1 << (i & 7);
+		if (event.key & KEY_EVENT_DOWN) {
+			sleep_minute_counter=0; // update sleep timer
+			key_event_down(i, bit);
+		} else {
+			key_event_up(i, bit);
+		}
+	}
 }
-#endif // else # DISABLE_LUFA_2015_LARGE_PACKET_UPGRADE
 
 void Midifighter_Task(void)
 {
@@ -766,9 +670,11 @@ void Midifighter_Task(void)
 	#if ENABLE_RGB_TEST <= 0
 	if (USB_DeviceState != DEVICE_STATE_Configured) { // don't go any further if we don't have a USB Connection
 		// !review: add LED Feedback for this state?
+		geometric_animation_advance(); // no frames are drawn, but running animations still run out
         return;
     }
 	#endif
+	PROFILE_BEGIN(LOOP);
 
     // The state of all the active notes is kept in an array of bytes with
     // the value being the velocity of the note. A nonzero velocity is a
@@ -778,80 +684,32 @@ void Midifighter_Task(void)
 
     // INPUT MIDI from USB -----------------------------------------------------
 	#if USB_RX_METHOD < USB_RX_PERIODICALLY
+	PROFILE_BEGIN(USB_RX);
 	Midifighter_GetIncomingUsbMidiMessages();
+	PROFILE_END(USB_RX);
     #endif
 
     // OUTPUT key presses ------------------------------------------------------
 	// - !review: performance improvement - key checking doesn't need to be done every loop (only when there's been another interrupt)
+	PROFILE_BEGIN(KEY_SCAN);
 	key_read();  // Read the debounce buffer to generate a keystate.
     key_calc();  // Use the new keystate to update keydown/keyup state.
+	PROFILE_END(KEY_SCAN);
 	// key_send();
-    // - Loop over all of the 16 arcade keys and send MIDI messages, converting key numbers
+    // - Send MIDI messages for the keys that changed, converting key numbers
     // - to MIDI notes using the mapping table.
-    {
-        uint64_t key_bit = 0x0001;
-		// update sleep timer (if necessary)
-		if (g_key_down) {
-			sleep_minute_counter=0;
-		}
-		// Service Each Individual Button
-        for(uint8_t i=0; i<64; ++i) {
-			#if USB_RX_METHOD >= USB_RX_PERIODICALLY
-			Midifighter_GetIncomingUsbMidiMessages();
-			#endif
-            if (g_key_down & key_bit) {
-                // There's a key down, put a NoteOn and/or CC event into the stream.
-                uint8_t note = midi_64_key_to_note(i);
-
-				if (G_EE_MIDI_OUTPUT_MODE < MIDI_OUTPUT_MODE_CCS_ONLY) {
-				    midi_stream_note(note, true);
-                }
-
-                if (G_EE_MIDI_OUTPUT_MODE > MIDI_OUTPUT_MODE_NOTES_ONLY)
-                {
-				    midi_stream_raw_cc(G_EE_MIDI_CHANNEL,note,127);
-                }
-				// record what bank this 'on' message occured in
-				if (g_bank_selected <= 0) {
-					g_key_bank_last_up &= ~key_bit;
-				} else {
-					g_key_bank_last_up |= key_bit;
-					
-				}
-				
-				// Trigger Animation if Applicable
-				if (G_EE_ANIMATIONS < GEOMETRIC_ANIMATION_TYPES) {
-					start_geometric_animation(i, G_EE_ANIMATIONS);
-				}
-				
-				key_pressed(i); // button hold functions
-            }
-            if (g_key_up & key_bit) {
-                // There's a key up, put a NoteOff event onto the stream.
-                uint8_t note = midi_64_key_to_note(i);
-				// Adjust channel based on where the note was triggered (so bank changes don't result in stuck notes
-				uint8_t channel = g_key_bank_last_up & key_bit ? (G_EE_MIDI_CHANNEL-1) & 0x0F : G_EE_MIDI_CHANNEL;
-				// Output Note Message
-				if (G_EE_MIDI_OUTPUT_MODE < MIDI_OUTPUT_MODE_CCS_ONLY) {
-				    midi_stream_note_ch(channel, note, false);
-			    }
-				// Output CC Message
-                if (G_EE_MIDI_OUTPUT_MODE > MIDI_OUTPUT_MODE_NOTES_ONLY)
-                {
-					midi_stream_raw_cc(G_EE_MIDI_CHANNEL,note,0);
-				}
-				// Service Button 'Hold' functions
-				key_released(i); // button hold functions
-            }
-            key_bit <<= 1;
-        }
-    }
+	// - (with USB_RX_PERIODICALLY the receive time is part of this stage)
+	PROFILE_BEGIN(KEY_EVENTS);
+	service_key_events();
+	PROFILE_END(KEY_EVENTS);
 	// Combos: Detect Button Combination presses
     if (G_EE_COMBOS_ENABLE)
     {
             // Recognize combo key events
             // --------------------------
+            PROFILE_BEGIN(COMBO);
             combo_action_t action = combo_recognize(); //g_key_down, g_key_up, g_key_state);
+            PROFILE_END(COMBO);
             uint8_t channel = g_bank_selected <= 0 ? G_EE_MIDI_CHANNEL : ((G_EE_MIDI_CHANNEL - 1) & 0x0F);
             switch (action) {
             case COMBO_A_DOWN:
@@ -891,12 +749,32 @@ void Midifighter_Task(void)
     } 
 
     // Finished generating MIDI events, flush the endpoints. (otherwise it won't send until it's full!)
-	MIDI_Device_Flush(g_midi_interface_info); // MIDI_Device_USBTask calls Flush, but has redundant checks involved
+	PROFILE_BEGIN(USB_FLUSH);
+	midi_flush(); // MIDI_Device_USBTask calls Flush, but has redundant checks involved
+	PROFILE_END(USB_FLUSH);
 
 	// Finally update the display with current frame
-	if (system_time_ms - last_led_refresh_time_ms >= LED_REFRESH_LIMIT) { // is it time to transmit to the LEDs?
+	#if LED_CONFIGURATION == LED_CONFIGURATION_FOUR_STRANDS
+	// - a frame goes out one strand per pass, finish it before composing the next
+	// - a strand (~0.6ms) goes out just after a Timer0 tick, so it is done
+	//   before the next one (>=0.77ms) rather than holding the key scan off
+	static uint16_t led_group_time_ms;
+	bool led_frame_busy = led_update_busy();
+	if (led_frame_busy && system_time_ms != led_group_time_ms) {
+		led_group_time_ms = system_time_ms;
+		PROFILE_BEGIN(LED_UPDATE);
+		led_update_next_group();
+		PROFILE_END(LED_UPDATE);
+	}
+	#else
+	const bool led_frame_busy = false;
+	#endif
+	if (!led_frame_busy && (uint16_t)(system_time_ms - last_led_refresh_time_ms) >= LED_REFRESH_LIMIT) { // is it time to transmit to the LEDs?
 		// Store this update time
 		last_led_refresh_time_ms = system_time_ms;
+		#if LED_CONFIGURATION == LED_CONFIGURATION_FOUR_STRANDS
+		led_group_time_ms = system_time_ms; // led_update_pixels() sends the first strand
+		#endif
     	 
 		// Perform Test Operations (if desired
 		#if ENABLE_TEST_OUT_LED_REFRESH_COUNT > 0
@@ -945,15 +823,25 @@ void Midifighter_Task(void)
 		update_note_off_feedback_delay();
 		#endif
 
+		PROFILE_BEGIN(DISPLAY);
 	    default_display_run(); //g_bank_selected, g_key_state, g_display_buffer);
+		PROFILE_END(DISPLAY);
 		
 		#if ENABLE_TEST_IN_LED_CALIBRATION > 0
 		led_calibration_test(); // This overrides all led data with color values received via cc0-2
 		#endif 
 		
-		// Send Data to the LEDs
-		led_update_pixels(g_display_buffer);
+		// Send Data to the LEDs (unless nothing changed since the last frame)
+		#if ENABLE_LED_FRAME_SKIP > 0
+		if (led_frame_changed(g_display_buffer))
+		#endif
+		{
+			PROFILE_BEGIN(LED_UPDATE);
+			led_update_pixels(g_display_buffer);
+			PROFILE_END(LED_UPDATE);
+		}
 	}
+	PROFILE_END(LOOP);
 	
 	watchdog_flag = true;
 }
@@ -990,12 +878,15 @@ int main(void)
     midi_setup();     // startup the MIDI keystate and LUFA MIDI Class interface.
     //bank_setup();     // startup the bank select buttons.
 	config_setup();   // setup the configuration system
+#if ENABLE_PROFILER > 0
+	profile_setup();  // start the main loop profiler clock
+#endif
 #ifdef COMBO
 	combo_setup();    // init the combo key recognizer.
 #endif
- 	// Slight delay befor we read the buttons to check for any special start up
-	// configuration
- 	_delay_ms(20);
+ 	// Wait for the debounce to settle befor we read the buttons to check for
+	// any special start up configuration
+	key_wait_debounced();
 	key_read();
 	key_calc();
 
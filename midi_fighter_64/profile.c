@@ -0,0 +1,106 @@
+// Main loop profiler for DJTT Midifighter
+//
+//   Copyright (C) 2016 DJ Techtools
+//
+
+ /* DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+#include "profile.h"
+
+#if ENABLE_PROFILER > 0
+
+// Global variables ------------------------------------------------------------
+
+profile_stage_t g_profile[PROFILE_NUM_STAGES];
+
+// Functions -------------------------------------------------------------------
+
+// Start Timer3 as a free running clock. Its overflow interrupt stays off.
+void profile_setup(void)
+{
+    TCCR3A = 0;
+    TCCR3B = _BV(CS31) | _BV(CS30); // clk/64
+    TCNT3 = 0;
+    profile_reset();
+}
+
+void profile_reset(void)
+{
+    for (uint8_t s = 0; s < PROFILE_NUM_STAGES; ++s) {
+        g_profile[s].min = 0xFFFF;
+        g_profile[s].max = 0;
+        for (uint8_t b = 0; b < PROFILE_NUM_BUCKETS; ++b) {
+            g_profile[s].bucket[b] = 0;
+        }
+    }
+}
+
+// Record the time since 'start' against a stage.
+void profile_record(uint8_t stage, const profile_mark_t* start)
+{
+    profile_mark_t now = profile_mark();
+    uint16_t ticks = now.ticks - start->ticks;
+    // Timer3 wraps after 262ms - anything near that is saturated instead of
+    // aliasing, should a stage ever run that long.
+    if ((uint16_t)(now.ms - start->ms) >= 200) {
+        ticks = 0xFFFF;
+    }
+
+    profile_stage_t* p = &g_profile[stage];
+    if (ticks < p->min) p->min = ticks;
+    if (ticks > p->max) p->max = ticks;
+
+    // Bucket = bit length of the duration, without a 16 step loop.
+    uint8_t b = 0;
+    uint8_t x = ticks & 0xFF;
+    if (ticks & 0xFF00) { b = 8; x = ticks >> 8; }
+    if (x & 0xF0) { b += 4; x >>= 4; }
+    if (x & 0x0C) { b += 2; x >>= 2; }
+    if (x & 0x02) { b += 1; x >>= 1; }
+    b += x;
+    if (b >= PROFILE_NUM_BUCKETS) b = PROFILE_NUM_BUCKETS - 1;
+
+    if (p->bucket[b] == 0xFF) {
+        for (uint8_t i = 0; i < PROFILE_NUM_BUCKETS; ++i) {
+            p->bucket[i] >>= 1;
+        }
+    }
+    p->bucket[b] += 1;
+}
+
+// Upper bound, in ticks, of the bucket holding the 99th percentile.
+uint16_t profile_p99(uint8_t stage)
+{
+    const profile_stage_t* p = &g_profile[stage];
+    uint16_t total = 0;
+    for (uint8_t b = 0; b < PROFILE_NUM_BUCKETS; ++b) {
+        total += p->bucket[b];
+    }
+    if (total == 0) return 0;
+
+    // Samples above the 99th percentile, rounded down.
+    uint16_t above = total / 100;
+    uint8_t b = PROFILE_NUM_BUCKETS - 1;
+    while (b > 0 && p->bucket[b] <= above) {
+        above -= p->bucket[b];
+        --b;
+    }
+    uint16_t bound = b ? (uint16_t)((1U << b) - 1) : 0;
+    if (b == PROFILE_NUM_BUCKETS - 1 || bound > p->max) return p->max;
+    return bound;
+}
+#endif
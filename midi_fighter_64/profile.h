@@ -0,0 +1,99 @@
+// Main loop profiler for DJTT Midifighter
+//
+//   Copyright (C) 2016 DJ Techtools
+//
+
+ /* DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+#ifndef _PROFILE_H_INCLUDED
+#define _PROFILE_H_INCLUDED
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "constants.h"
+#include "key.h"
+
+// Main loop profiler ----------------------------------------------------------
+//
+// Timer3 free-runs at clk/64 (one tick = 4us at 16MHz) and each stage of
+// Midifighter_Task() records how many ticks it took. Per stage we keep the
+// min, the max and a log2 histogram (bucket n holds durations of
+// 2^(n-1) .. 2^n-1 ticks) from which the 99th percentile is estimated.
+// The histogram is decaying: when a bucket fills up all buckets of that stage
+// are halved, so it follows the recent behaviour of the device.
+//
+// Timer1 can't be used as the time base: its ISR reloads TCNT1 every 32
+// ticks, and its overflows are lost while the LED strands are written.
+
+#define PROFILE_TICK_US         4
+
+#define PROFILE_STAGE_USB_RX      0  // Midifighter_GetIncomingUsbMidiMessages
+#define PROFILE_STAGE_KEY_SCAN    1  // key_read + key_calc
+#define PROFILE_STAGE_KEY_EVENTS  2  // service_key_events, draining the key event queue
+#define PROFILE_STAGE_COMBO       3  // combo_recognize
+#define PROFILE_STAGE_USB_FLUSH   4  // midi_flush
+#define PROFILE_STAGE_DISPLAY     5  // default_display_run
+#define PROFILE_STAGE_LED_UPDATE  6  // led_update_next_group, one strand of the frame per pass
+#define PROFILE_STAGE_LOOP        7  // a whole Midifighter_Task pass
+#define PROFILE_NUM_STAGES        8
+
+#define PROFILE_NUM_BUCKETS      12  // the last bucket holds >= 2048 ticks (8ms)
+
+typedef struct {
+    uint16_t min;   // ticks
+    uint16_t max;   // ticks
+    uint8_t bucket[PROFILE_NUM_BUCKETS];
+} profile_stage_t;
+
+typedef struct {
+    uint16_t ticks;
+    uint16_t ms;    // system_time_ms, catches stages longer than a Timer3 period
+} profile_mark_t;
+
+extern profile_stage_t g_profile[PROFILE_NUM_STAGES];
+
+// Profiler functions ----------------------------------------------------------
+
+void profile_setup(void);
+void profile_reset(void);
+void profile_record(uint8_t stage, const profile_mark_t* start);
+uint16_t profile_p99(uint8_t stage);
+
+// Read the stage clock. TCNT3 shares the 16-bit TEMP register with the
+// Timer1 ISR, so it is read with interrupts disabled, and system_time_ms
+// with it so the two agree. The caller's interrupt state is restored.
+static inline profile_mark_t profile_mark(void)
+{
+    profile_mark_t mark;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        mark.ticks = TCNT3;
+        mark.ms = system_time_ms;
+    }
+    return mark;
+}
+
+#if ENABLE_PROFILER > 0
+#define PROFILE_BEGIN(stage) profile_mark_t profile_mark_##stage = profile_mark()
+#define PROFILE_END(stage)   profile_record(PROFILE_STAGE_##stage, &profile_mark_##stage)
+#else
+#define PROFILE_BEGIN(stage) do {} while (0)
+#define PROFILE_END(stage)   do {} while (0)
+#endif
+
+#endif // _PROFILE_H_INCLUDED
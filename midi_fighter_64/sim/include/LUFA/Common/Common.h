@@ -0,0 +1,16 @@
+#ifndef _SIM_LUFA_COMMON_H_INCLUDED
+#define _SIM_LUFA_COMMON_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ATTR_WARN_UNUSED_RESULT
+#define ATTR_NON_NULL_PTR_ARG(...)
+#define ATTR_ALWAYS_INLINE
+#define ATTR_INIT_SECTION(section)
+#define ATTR_NO_RETURN
+#define ATTR_CONST
+#define ATTR_PURE
+
+#endif // _SIM_LUFA_COMMON_H_INCLUDED
@@ -0,0 +1,145 @@
+#ifndef _SIM_LUFA_USB_H_INCLUDED
+#define _SIM_LUFA_USB_H_INCLUDED
+
+// Stand-in for the parts of LUFA 151115 the firmware uses. The endpoint
+// primitives are implemented against the host model in sim_usb.c, and the
+// MIDI class driver there follows Drivers/USB/Class/Device/MIDIClassDevice.c
+// call for call so the firmware pays the same endpoint traffic it does on
+// hardware.
+
+#include "../../Common/Common.h"
+
+// USB core -------------------------------------------------------------------
+
+enum USB_Device_States_t {
+    DEVICE_STATE_Unattached = 0,
+    DEVICE_STATE_Powered    = 1,
+    DEVICE_STATE_Default    = 2,
+    DEVICE_STATE_Addressed  = 3,
+    DEVICE_STATE_Configured = 4,
+    DEVICE_STATE_Suspended  = 5,
+};
+
+extern volatile uint8_t USB_DeviceState;
+
+void USB_Init(void);
+void USB_Disable(void);
+void USB_USBTask(void);
+uint16_t USB_Device_GetFrameNumber(void);
+
+#define USB_STREAM_TIMEOUT_MS 100
+
+// Endpoints ------------------------------------------------------------------
+
+#define ENDPOINT_DIR_OUT  0x00
+#define ENDPOINT_DIR_IN   0x80
+#define ENDPOINT_EPNUM_MASK 0x0F
+#define EP_TYPE_CONTROL   0x00
+#define EP_TYPE_BULK      0x02
+
+typedef struct {
+    uint8_t  Address;
+    uint16_t Size;
+    uint8_t  Type;
+    uint8_t  Banks;
+} USB_Endpoint_Table_t;
+
+enum Endpoint_Stream_RW_ErrorCodes_t {
+    ENDPOINT_RWSTREAM_NoError            = 0,
+    ENDPOINT_RWSTREAM_EndpointStalled    = 1,
+    ENDPOINT_RWSTREAM_DeviceDisconnected = 2,
+    ENDPOINT_RWSTREAM_BusSuspended       = 3,
+    ENDPOINT_RWSTREAM_Timeout            = 4,
+    ENDPOINT_RWSTREAM_IncompleteTransfer = 5,
+};
+
+enum Endpoint_WaitUntilReady_ErrorCodes_t {
+    ENDPOINT_READYWAIT_NoError            = 0,
+    ENDPOINT_READYWAIT_EndpointStalled    = 1,
+    ENDPOINT_READYWAIT_DeviceDisconnected = 2,
+    ENDPOINT_READYWAIT_BusSuspended       = 3,
+    ENDPOINT_READYWAIT_Timeout            = 4,
+};
+
+bool Endpoint_ConfigureEndpointTable(const USB_Endpoint_Table_t* const Table,
+                                     const uint8_t Entries);
+void Endpoint_SelectEndpoint(const uint8_t Address);
+uint8_t Endpoint_GetCurrentEndpoint(void);
+uint16_t Endpoint_BytesInEndpoint(void);
+bool Endpoint_IsReadWriteAllowed(void);
+bool Endpoint_IsINReady(void);
+bool Endpoint_IsOUTReceived(void);
+void Endpoint_ClearIN(void);
+void Endpoint_ClearOUT(void);
+uint8_t Endpoint_Read_8(void);
+void Endpoint_Write_8(const uint8_t Data);
+uint8_t Endpoint_WaitUntilReady(void);
+uint8_t Endpoint_Read_Stream_LE(void* const Buffer, uint16_t Length,
+                                uint16_t* const BytesProcessed);
+uint8_t Endpoint_Write_Stream_LE(const void* const Buffer, uint16_t Length,
+                                 uint16_t* const BytesProcessed);
+
+// Descriptors ----------------------------------------------------------------
+
+// usb_descriptors.h names these in its configuration structure; the
+// simulator never builds the descriptor tables themselves.
+typedef struct { uint8_t Size; uint8_t Type; } USB_Descriptor_Header_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_Descriptor_Configuration_Header_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_Descriptor_Interface_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_Audio_Descriptor_Interface_AC_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_MIDI_Descriptor_AudioInterface_AS_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_MIDI_Descriptor_InputJack_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_MIDI_Descriptor_OutputJack_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_Audio_Descriptor_StreamEndpoint_Std_t;
+typedef struct { USB_Descriptor_Header_t Header; } USB_MIDI_Descriptor_Jack_Endpoint_t;
+
+// MIDI class -----------------------------------------------------------------
+
+#define MIDI_COMMAND_SYSEX_START_3BYTE 0x40
+#define MIDI_COMMAND_SYSEX_END_1BYTE   0x50
+#define MIDI_COMMAND_SYSEX_END_2BYTE   0x60
+#define MIDI_COMMAND_SYSEX_END_3BYTE   0x70
+#define MIDI_COMMAND_NOTE_OFF          0x80
+#define MIDI_COMMAND_NOTE_ON           0x90
+#define MIDI_COMMAND_CONTROL_CHANGE    0xB0
+#define MIDI_CHANNEL(channel)          ((channel) - 1)
+
+typedef struct {
+    uint8_t Event;
+    uint8_t Data1;
+    uint8_t Data2;
+    uint8_t Data3;
+} __attribute__((packed)) MIDI_EventPacket_t;
+
+typedef struct {
+    MIDI_EventPacket_t events[16];
+} __attribute__((packed)) MIDI_EventPackets_t;
+
+typedef struct {
+    struct {
+        uint8_t StreamingInterfaceNumber;
+        USB_Endpoint_Table_t DataINEndpoint;
+        USB_Endpoint_Table_t DataOUTEndpoint;
+    } Config;
+    struct {
+        uint8_t RESERVED;
+    } State;
+} USB_ClassInfo_MIDI_Device_t;
+
+bool MIDI_Device_ConfigureEndpoints(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo);
+void MIDI_Device_USBTask(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo);
+uint8_t MIDI_Device_SendEventPacket(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo,
+                                    const MIDI_EventPacket_t* const Event);
+uint8_t MIDI_Device_Flush(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo);
+bool MIDI_Device_ReceiveEventPacket(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo,
+                                    MIDI_EventPacket_t* const Event);
+bool MIDI_Device_ReceiveLargeEventPacket(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo,
+                                         MIDI_EventPackets_t* const Event,
+                                         uint8_t max_size);
+
+static inline void MIDI_Device_ProcessControlRequest(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo)
+{
+    (void)MIDIInterfaceInfo;
+}
+
+#endif // _SIM_LUFA_USB_H_INCLUDED
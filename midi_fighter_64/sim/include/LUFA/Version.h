@@ -0,0 +1,7 @@
+#ifndef _SIM_LUFA_VERSION_H_INCLUDED
+#define _SIM_LUFA_VERSION_H_INCLUDED
+
+#define LUFA_VERSION_INTEGER 0x151115
+#define LUFA_VERSION_STRING  "151115"
+
+#endif // _SIM_LUFA_VERSION_H_INCLUDED
@@ -0,0 +1,7 @@
+#ifndef _SIM_ACCEL_GYRO_H_INCLUDED
+#define _SIM_ACCEL_GYRO_H_INCLUDED
+
+// The Midifighter 64 has no motion sensor. The firmware still includes the
+// header shared with the Midifighter 3D, which is not part of this tree.
+
+#endif // _SIM_ACCEL_GYRO_H_INCLUDED
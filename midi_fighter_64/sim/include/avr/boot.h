@@ -0,0 +1,6 @@
+#ifndef _SIM_AVR_BOOT_H_INCLUDED
+#define _SIM_AVR_BOOT_H_INCLUDED
+
+// Stand-in for <avr/boot.h>: the simulator has no bootloader section.
+
+#endif // _SIM_AVR_BOOT_H_INCLUDED
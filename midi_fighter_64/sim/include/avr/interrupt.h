@@ -0,0 +1,19 @@
+#ifndef _SIM_AVR_INTERRUPT_H_INCLUDED
+#define _SIM_AVR_INTERRUPT_H_INCLUDED
+
+// Stand-in for <avr/interrupt.h>: ISRs become plain functions that the
+// simulated interrupt controller calls when their timer overflows (or, for
+// EE_READY, while the EEPROM is idle with EERIE set).
+
+#include "io.h"
+
+#define TIMER0_OVF_vect sim_vector_timer0_ovf
+#define TIMER1_OVF_vect sim_vector_timer1_ovf
+#define EE_READY_vect   sim_vector_ee_ready
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#define cli() sim_cli()
+#define sei() sim_sei()
+
+#endif // _SIM_AVR_INTERRUPT_H_INCLUDED
@@ -0,0 +1,108 @@
+#ifndef _SIM_AVR_IO_H_INCLUDED
+#define _SIM_AVR_IO_H_INCLUDED
+
+// Stand-in for <avr/io.h>: the ATmega32U4 registers used by the firmware,
+// each access routed through the simulated hardware.
+
+#include <stdint.h>
+#include "../../sim.h"
+
+#define _BV(bit) (1 << (bit))
+
+// Inline assembly only ever issues "nop" in this firmware.
+#define asm(text) sim_asm(text)
+
+#define PINB   (*sim_reg(SIM_PINB))
+#define DDRB   (*sim_reg(SIM_DDRB))
+#define PORTB  (*sim_reg(SIM_PORTB))
+#define PINC   (*sim_reg(SIM_PINC))
+#define DDRC   (*sim_reg(SIM_DDRC))
+#define PORTC  (*sim_reg(SIM_PORTC))
+#define PIND   (*sim_reg(SIM_PIND))
+#define DDRD   (*sim_reg(SIM_DDRD))
+#define PORTD  (*sim_reg(SIM_PORTD))
+
+#define TIFR0  (*sim_reg(SIM_TIFR0))
+#define TIFR1  (*sim_reg(SIM_TIFR1))
+#define TIFR3  (*sim_reg(SIM_TIFR3))
+#define EECR   (*sim_reg(SIM_EECR))
+#define EEDR   (*sim_reg(SIM_EEDR))
+#define EEAR   (*sim_reg16(SIM_EEAR))
+#define TCCR0A (*sim_reg(SIM_TCCR0A))
+#define TCCR0B (*sim_reg(SIM_TCCR0B))
+#define TCNT0  (*sim_reg(SIM_TCNT0))
+#define SPCR   (*sim_reg(SIM_SPCR))
+#define SPSR   (*sim_reg(SIM_SPSR))
+#define SPDR   (*sim_reg(SIM_SPDR))
+#define MCUSR  (*sim_reg(SIM_MCUSR))
+#define MCUCR  (*sim_reg(SIM_MCUCR))
+#define SREG   (*sim_reg(SIM_SREG))
+#define PRR0   (*sim_reg(SIM_PRR0))
+#define PRR1   (*sim_reg(SIM_PRR1))
+#define TIMSK0 (*sim_reg(SIM_TIMSK0))
+#define TIMSK1 (*sim_reg(SIM_TIMSK1))
+#define TIMSK3 (*sim_reg(SIM_TIMSK3))
+#define TCCR1A (*sim_reg(SIM_TCCR1A))
+#define TCCR1B (*sim_reg(SIM_TCCR1B))
+#define TCNT1  (*sim_reg16(SIM_TCNT1))
+#define TCCR3A (*sim_reg(SIM_TCCR3A))
+#define TCCR3B (*sim_reg(SIM_TCCR3B))
+#define TCNT3  (*sim_reg16(SIM_TCNT3))
+
+// Port bits.
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC6 6
+#define PC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// Timer bits.
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define CS30 0
+#define CS31 1
+#define CS32 2
+#define TOIE0 0
+#define TOIE1 0
+#define TOIE3 0
+#define TOV0 0
+#define TOV1 0
+#define TOV3 0
+
+// EEPROM bits.
+#define EERE  0
+#define EEPE  1
+#define EEMPE 2
+#define EERIE 3
+
+// SPI bits.
+#define SPIF 7
+
+// System bits.
+#define WDRF   3
+#define JTD    7
+#define PRTIM0 5
+#define PRTIM1 3
+#define PRTIM3 3
+
+#define RAMSTART 0x0100
+#define RAMEND 0x0AFF
+
+#endif // _SIM_AVR_IO_H_INCLUDED
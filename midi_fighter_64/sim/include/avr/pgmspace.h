@@ -0,0 +1,18 @@
+#ifndef _SIM_AVR_PGMSPACE_H_INCLUDED
+#define _SIM_AVR_PGMSPACE_H_INCLUDED
+
+// Stand-in for <avr/pgmspace.h>: program memory is ordinary host memory.
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(address)  (*(const uint8_t*)(address))
+#define pgm_read_word(address)  (*(const uint16_t*)(address))
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+#define pgm_read_ptr(address)   (*(void* const*)(address))
+#define memcpy_P(dest, src, n)  memcpy((dest), (src), (n))
+
+#endif // _SIM_AVR_PGMSPACE_H_INCLUDED
@@ -0,0 +1,9 @@
+#ifndef _SIM_AVR_POWER_H_INCLUDED
+#define _SIM_AVR_POWER_H_INCLUDED
+
+// Stand-in for <avr/power.h>: the simulated CPU always runs at F_CPU.
+
+#define clock_div_1 0
+#define clock_prescale_set(div) ((void)(div))
+
+#endif // _SIM_AVR_POWER_H_INCLUDED
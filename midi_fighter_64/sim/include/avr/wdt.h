@@ -0,0 +1,24 @@
+#ifndef _SIM_AVR_WDT_H_INCLUDED
+#define _SIM_AVR_WDT_H_INCLUDED
+
+// Stand-in for <avr/wdt.h>: the watchdog is modelled against the virtual
+// clock and a timeout stops the simulation.
+
+#include "io.h"
+
+#define WDTO_15MS  0
+#define WDTO_30MS  1
+#define WDTO_60MS  2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S    6
+#define WDTO_2S    7
+#define WDTO_4S    8
+#define WDTO_8S    9
+
+#define wdt_enable(timeout) sim_wdt_enable(timeout)
+#define wdt_disable()       sim_wdt_disable()
+#define wdt_reset()         sim_wdt_reset()
+
+#endif // _SIM_AVR_WDT_H_INCLUDED
@@ -0,0 +1,7 @@
+#ifndef _SIM_CIRCULAR_BUFFER_H_INCLUDED
+#define _SIM_CIRCULAR_BUFFER_H_INCLUDED
+
+// Shared with other Midifighter firmwares and not part of this tree. The
+// Midifighter 64 sources include it but use none of its declarations.
+
+#endif // _SIM_CIRCULAR_BUFFER_H_INCLUDED
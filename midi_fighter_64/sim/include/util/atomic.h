@@ -0,0 +1,36 @@
+#ifndef _SIM_UTIL_ATOMIC_H_INCLUDED
+#define _SIM_UTIL_ATOMIC_H_INCLUDED
+
+// Stand-in for <util/atomic.h>: the same cleanup-attribute construction as
+// avr-libc, with the global interrupt flag kept by the simulated CPU.
+
+#include <stdint.h>
+#include "../avr/interrupt.h"
+
+static inline uint8_t sim_atomic_cli(void)
+{
+    cli();
+    return 1;
+}
+
+static inline void sim_atomic_restore(const uint8_t* state)
+{
+    if (*state) {
+        sei();
+    }
+}
+
+static inline void sim_atomic_force_on(const uint8_t* state)
+{
+    (void)state;
+    sei();
+}
+
+#define ATOMIC_BLOCK(type) \
+    for (type, sim_atomic_todo = sim_atomic_cli(); sim_atomic_todo; sim_atomic_todo = 0)
+#define ATOMIC_RESTORESTATE \
+    uint8_t sim_atomic_state __attribute__((__cleanup__(sim_atomic_restore))) = sim_interrupts_enabled()
+#define ATOMIC_FORCEON \
+    uint8_t sim_atomic_state __attribute__((__cleanup__(sim_atomic_force_on))) = 0
+
+#endif // _SIM_UTIL_ATOMIC_H_INCLUDED
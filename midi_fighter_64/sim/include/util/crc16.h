@@ -0,0 +1,26 @@
+#ifndef _SIM_UTIL_CRC16_H_INCLUDED
+#define _SIM_UTIL_CRC16_H_INCLUDED
+
+// Stand-in for <util/crc16.h>: the C equivalent avr-libc documents for its
+// inline assembly.
+
+#include <stdint.h>
+
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+    data ^= (uint8_t)(crc & 0xFF);
+    data ^= (uint8_t)(data << 4);
+    return (uint16_t)((((uint16_t)data << 8) | (crc >> 8)) ^
+                      (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+    data ^= crc;
+    for (uint8_t i = 0; i < 8; ++i) {
+        data = (data & 0x80) ? (uint8_t)((data << 1) ^ 0x07) : (uint8_t)(data << 1);
+    }
+    return data;
+}
+
+#endif // _SIM_UTIL_CRC16_H_INCLUDED
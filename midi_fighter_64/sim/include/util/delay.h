@@ -0,0 +1,11 @@
+#ifndef _SIM_UTIL_DELAY_H_INCLUDED
+#define _SIM_UTIL_DELAY_H_INCLUDED
+
+// Stand-in for <util/delay.h>: busy waits consume virtual cycles.
+
+#include "../avr/io.h"
+
+#define _delay_us(us) sim_delay_us(us)
+#define _delay_ms(ms) sim_delay_us((ms) * 1000.0)
+
+#endif // _SIM_UTIL_DELAY_H_INCLUDED
@@ -0,0 +1,218 @@
+// Host-side simulation of the Midifighter 64 hardware
+//
+//   Copyright (C) 2016 DJ Techtools
+//
+
+ /* DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+#ifndef _SIM_H_INCLUDED
+#define _SIM_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <setjmp.h>
+
+// Host-side simulation of the Midifighter 64 hardware.
+//
+// The firmware sources are compiled unchanged against the stub headers in
+// sim/include. Every I/O register access, "nop" and _delay_*() call is
+// charged to a virtual CPU clock running at F_CPU, and the peripherals the
+// firmware talks to (Timer0/1/3, the key shift registers, the WS2812
+// strands, the EEPROM and the LUFA MIDI endpoints) are modelled against
+// that clock. Computation between register accesses is charged at a flat
+// rate (SIM_CYCLES_CODE), so timings are estimates dominated by I/O - which
+// is where this firmware spends its time. Runs are fully deterministic.
+
+// Clock ----------------------------------------------------------------------
+
+#define SIM_F_CPU            16000000UL
+#define SIM_CYCLES_PER_MS    (SIM_F_CPU / 1000UL)
+#define SIM_CYCLES_PER_US    (SIM_F_CPU / 1000000UL)
+
+// Cost of a single I/O register access (in/out/lds/sts).
+#define SIM_CYCLES_IO        2
+// Computation is not simulated instruction by instruction. Instead every
+// register access is also charged for the straight-line code that typically
+// separates two accesses in this firmware (bit tests, 32/64-bit shifts, loop
+// counters), calibrated so that the bit-banged LED frame and the key scan
+// ISR take roughly as long as they do on hardware.
+#define SIM_CYCLES_CODE      4
+// Cost of interrupt entry plus the register save/restore of a typical ISR.
+#define SIM_CYCLES_ISR_ENTRY 24
+#define SIM_CYCLES_ISR_EXIT  24
+
+extern uint64_t sim_cycles;
+
+static inline double sim_cycles_to_us(uint64_t cycles)
+{
+    return (double)cycles / (double)SIM_CYCLES_PER_US;
+}
+
+static inline double sim_now_ms(void)
+{
+    return (double)sim_cycles / (double)SIM_CYCLES_PER_MS;
+}
+
+// Charge cycles to the virtual clock, running timers, scheduled events and
+// any interrupts that become due.
+void sim_charge(uint32_t cycles);
+
+// Commit the side effects of the last register write.
+void sim_settle(void);
+
+// Registers ------------------------------------------------------------------
+
+enum {
+    SIM_PINB, SIM_DDRB, SIM_PORTB,
+    SIM_PINC, SIM_DDRC, SIM_PORTC,
+    SIM_PIND, SIM_DDRD, SIM_PORTD,
+    SIM_TIFR0, SIM_TIFR1, SIM_TIFR3,
+    SIM_EECR, SIM_EEDR,
+    SIM_TCCR0A, SIM_TCCR0B, SIM_TCNT0,
+    SIM_SPCR, SIM_SPSR, SIM_SPDR,
+    SIM_MCUSR, SIM_MCUCR, SIM_SREG,
+    SIM_PRR0, SIM_PRR1,
+    SIM_TIMSK0, SIM_TIMSK1, SIM_TIMSK3,
+    SIM_TCCR1A, SIM_TCCR1B, SIM_TCCR3A, SIM_TCCR3B,
+    SIM_NUM_REG8
+};
+
+enum {
+    SIM_EEAR, SIM_TCNT1, SIM_TCNT3,
+    SIM_NUM_REG16
+};
+
+volatile uint8_t* sim_reg(uint8_t id);
+volatile uint16_t* sim_reg16(uint8_t id);
+
+// CPU ------------------------------------------------------------------------
+
+void sim_cli(void);
+void sim_sei(void);
+uint8_t sim_interrupts_enabled(void); // the I flag, for <util/atomic.h>
+void sim_asm(const char* text);
+void sim_delay_us(double us);
+void sim_wdt_enable(uint8_t timeout);
+void sim_wdt_disable(void);
+void sim_wdt_reset(void);
+
+// Interrupt vectors implemented by the firmware.
+void sim_vector_timer0_ovf(void);
+void sim_vector_timer1_ovf(void);
+void sim_vector_ee_ready(void);
+
+// Statistics gathered by the hardware model.
+typedef struct {
+    uint64_t count;          // interrupts serviced
+    uint64_t lost;           // overflows that collapsed into a pending flag
+    uint64_t latency_max;    // cycles from overflow to ISR entry
+    uint64_t latency_total;
+    uint64_t duration_max;   // cycles spent inside the ISR
+} sim_irq_stats_t;
+
+typedef struct {
+    sim_irq_stats_t timer0;
+    sim_irq_stats_t timer1;
+    sim_irq_stats_t ee_ready;
+    uint64_t cli_max;            // longest interrupts-disabled window
+    uint64_t cli_total;
+    uint64_t eeprom_writes;
+    uint64_t eeprom_busy_wait;   // cycles spent polling EEPE
+    uint64_t wdt_timeouts;
+    uint64_t led_frames[4];      // WS2812 frames latched per strand
+    uint64_t led_broken_frames;  // frames cut short by a reset-length gap
+} sim_hw_stats_t;
+
+extern sim_hw_stats_t sim_hw;
+
+void sim_reset_stats(void);
+
+// Keys -----------------------------------------------------------------------
+
+// Physical contact state of the 64 keys, bit n = key n closed.
+extern uint64_t sim_key_contacts;
+
+// LEDs -----------------------------------------------------------------------
+
+// Last frame decoded from each strand, in wire order (G, R, B per LED).
+#define SIM_LEDS_PER_STRAND 32
+extern uint8_t sim_led_frame[4][SIM_LEDS_PER_STRAND * 3];
+
+// Optional raw bit capture of every strand, used by the encoder checks.
+void sim_led_capture_begin(void);
+uint16_t sim_led_capture_end(uint8_t strand, uint8_t* bits, uint16_t max_bits);
+
+// EEPROM ---------------------------------------------------------------------
+
+#define SIM_EEPROM_SIZE 1024
+extern uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+extern uint32_t sim_eeprom_cell_writes[SIM_EEPROM_SIZE]; // erase and write cycles each cell has had
+
+// USB ------------------------------------------------------------------------
+
+// Host side of the MIDI streaming endpoints.
+void sim_usb_setup(void);
+void sim_usb_host_send(const uint8_t* data, uint16_t length);
+void sim_usb_set_host_listening(bool listening);
+bool sim_usb_configured(void);
+uint32_t sim_usb_out_pending(void);
+
+typedef struct {
+    uint64_t cycle;
+    uint8_t event[4];
+} sim_usb_event_t;
+
+// Events the device has sent to the host, oldest first.
+#define SIM_USB_LOG_SIZE 65536
+extern sim_usb_event_t sim_usb_log[SIM_USB_LOG_SIZE];
+extern uint32_t sim_usb_log_count;
+
+typedef struct {
+    uint64_t in_packets;         // IN banks handed to the host
+    uint64_t in_events;
+    uint64_t in_wait_cycles;     // cycles blocked in Endpoint_WaitUntilReady
+    uint64_t in_timeouts;
+    uint64_t out_packets;        // OUT banks consumed by the firmware
+    uint64_t out_events;
+    uint64_t out_latency_max;    // cycles from bank arrival to release
+    uint64_t out_latency_total;
+    uint64_t out_hold_total;     // cycles from a bank landing to its release
+    uint64_t rx_polls;           // OUT endpoint checks for a bank
+    uint64_t rx_empty_polls;     // ... that found nothing
+    uint64_t frames;             // USB start-of-frames elapsed
+    uint64_t usb_tasks;          // USB_USBTask calls (one per main loop)
+    uint64_t configured_cycle;   // when the host configured the device, 0 if it hasn't
+} sim_usb_stats_t;
+
+extern sim_usb_stats_t sim_usb;
+
+// Scheduler ------------------------------------------------------------------
+
+// Scenario callbacks run when the virtual clock passes their deadline.
+typedef void (*sim_event_fn)(void* arg);
+void sim_at(uint64_t cycle, sim_event_fn fn, void* arg);
+
+// Run the firmware's main() until the virtual clock reaches end_cycle.
+// Returns false if the firmware stopped early (bootloader, watchdog).
+bool sim_run_firmware(uint64_t end_cycle);
+
+extern const char* sim_stop_reason;
+
+// Stop the simulation from inside the firmware (bootloader, watchdog).
+void sim_stop(const char* reason);
+
+#endif // _SIM_H_INCLUDED
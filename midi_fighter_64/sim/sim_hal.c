@@ -0,0 +1,714 @@
+// Hardware model for the Midifighter 64 host simulation
+//
+//   Copyright (C) 2016 DJ Techtools
+//
+
+ /* DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "sim.h"
+#include "../constants.h"
+
+// Hardware model for the host simulation: the virtual clock, I/O registers,
+// timers and interrupt controller, the key shift registers, the WS2812 LED
+// strands, the EEPROM and the watchdog.
+
+uint64_t sim_cycles = 0;
+sim_hw_stats_t sim_hw;
+const char* sim_stop_reason = NULL;
+
+static uint8_t  s_reg8[SIM_NUM_REG8];
+static uint16_t s_reg16[SIM_NUM_REG16];
+
+// The register most recently handed out, and its value at that time. The
+// firmware reads, modifies and writes through the returned pointer, so a
+// write is only noticed when the next access (or cli/sei/nop) settles it.
+static int      s_last_id = -1;
+static bool     s_last_is16 = false;
+static uint16_t s_last_value = 0;
+static uint64_t s_last_cycle = 0;
+
+// Global interrupt flag, and whether we are inside an ISR.
+static bool     s_sreg_i = false;
+static bool     s_in_isr = false;
+static bool     s_cli_tracking = false;
+static uint64_t s_cli_cycle = 0;
+
+static jmp_buf  s_run_jmp;
+static bool     s_running = false;
+static uint64_t s_end_cycle = UINT64_MAX;
+
+static void sim_timers_update(void);
+static void sim_service_interrupts(void);
+static void sim_events_run(void);
+static void sim_wdt_check(void);
+static bool sim_eeprom_ready(uint64_t* since);
+
+
+// Clock ----------------------------------------------------------------------
+
+// Long charges (busy waits) are taken in small steps so that interrupts
+// and scheduled events still land close to their deadlines.
+#define SIM_CHARGE_STEP 8
+
+void sim_charge(uint32_t cycles)
+{
+    do {
+        uint32_t step = cycles > SIM_CHARGE_STEP ? SIM_CHARGE_STEP : cycles;
+        cycles -= step;
+        sim_cycles += step;
+        sim_events_run();
+        sim_timers_update();
+        sim_wdt_check();
+        sim_service_interrupts();
+        if (s_running && sim_cycles >= s_end_cycle && !s_in_isr) {
+            sim_stop(NULL);
+        }
+    } while (cycles);
+}
+
+void sim_asm(const char* text)
+{
+    // "nop" is the only instruction the firmware issues inline.
+    (void)text;
+    sim_settle();
+    sim_charge(1);
+}
+
+void sim_delay_us(double us)
+{
+    sim_settle();
+    sim_charge((uint32_t)(us * SIM_CYCLES_PER_US));
+}
+
+
+// Timers ---------------------------------------------------------------------
+
+typedef struct {
+    uint8_t  bits;          // 8 or 16
+    uint8_t  tccrb;         // register ids
+    uint8_t  timsk;
+    uint32_t prescale;      // 0 = stopped
+    uint64_t base_cycle;    // the counter held base_count at base_cycle
+    uint32_t base_count;
+    bool     pending;       // TOVn
+    uint64_t pending_cycle;
+    void     (*isr)(void);
+    sim_irq_stats_t* stats;
+} sim_timer_t;
+
+static sim_timer_t s_timer0 = { 8,  SIM_TCCR0B, SIM_TIMSK0, 0, 0, 0, false, 0,
+                                sim_vector_timer0_ovf, &sim_hw.timer0 };
+static sim_timer_t s_timer1 = { 16, SIM_TCCR1B, SIM_TIMSK1, 0, 0, 0, false, 0,
+                                sim_vector_timer1_ovf, &sim_hw.timer1 };
+static sim_timer_t s_timer3 = { 16, SIM_TCCR3B, SIM_TIMSK3, 0, 0, 0, false, 0,
+                                NULL, NULL };
+
+static uint32_t sim_timer_prescale(uint8_t tccrb)
+{
+    static const uint32_t kPrescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    return kPrescale[tccrb & 0x07];
+}
+
+static void sim_timer_advance(sim_timer_t* t, uint64_t now)
+{
+    if (t->prescale == 0) {
+        t->base_cycle = now;
+        return;
+    }
+    uint64_t top = 1ULL << t->bits;
+    uint64_t next = t->base_cycle + (top - t->base_count) * t->prescale;
+    while (next <= now) {
+        bool enabled = t->isr && (s_reg8[t->timsk] & 0x01);
+        if (t->pending) {
+            // A second overflow while the first is still pending is lost.
+            if (enabled && t->stats) { t->stats->lost++; }
+        } else {
+            t->pending = true;
+            t->pending_cycle = next;
+        }
+        t->base_cycle = next;
+        t->base_count = 0;
+        next += top * t->prescale;
+    }
+}
+
+static uint32_t sim_timer_count(sim_timer_t* t, uint64_t now)
+{
+    sim_timer_advance(t, now);
+    if (t->prescale == 0) { return t->base_count; }
+    return t->base_count + (uint32_t)((now - t->base_cycle) / t->prescale);
+}
+
+static void sim_timer_write_count(sim_timer_t* t, uint64_t cycle, uint32_t value)
+{
+    sim_timer_advance(t, cycle);
+    t->base_cycle = cycle;
+    t->base_count = value & ((1UL << t->bits) - 1);
+}
+
+static void sim_timer_write_control(sim_timer_t* t, uint64_t cycle, uint8_t value)
+{
+    uint32_t count = sim_timer_count(t, cycle);
+    t->prescale = sim_timer_prescale(value);
+    t->base_cycle = cycle;
+    t->base_count = count;
+}
+
+static void sim_timers_update(void)
+{
+    sim_timer_advance(&s_timer0, sim_cycles);
+    sim_timer_advance(&s_timer1, sim_cycles);
+    sim_timer_advance(&s_timer3, sim_cycles);
+}
+
+
+// Interrupts -----------------------------------------------------------------
+
+static void sim_dispatch_vector(void (*isr)(void), sim_irq_stats_t* stats, uint64_t raised)
+{
+    uint64_t latency = sim_cycles - raised;
+    stats->count++;
+    stats->latency_total += latency;
+    if (latency > stats->latency_max) { stats->latency_max = latency; }
+
+    uint64_t start = sim_cycles;
+    s_in_isr = true;
+    s_sreg_i = false;
+    sim_cycles += SIM_CYCLES_ISR_ENTRY;
+    isr();
+    sim_settle();
+    sim_cycles += SIM_CYCLES_ISR_EXIT;
+    s_sreg_i = true;
+    s_in_isr = false;
+
+    uint64_t duration = sim_cycles - start;
+    if (duration > stats->duration_max) { stats->duration_max = duration; }
+}
+
+static void sim_dispatch(sim_timer_t* t)
+{
+    t->pending = false;
+    sim_dispatch_vector(t->isr, t->stats, t->pending_cycle);
+}
+
+static void sim_service_interrupts(void)
+{
+    if (!s_sreg_i || s_in_isr) { return; }
+    for (;;) {
+        sim_timers_update();
+        // Lower vector numbers win: TIMER1_OVF (20) before TIMER0_OVF (23)
+        // before EE_READY (31).
+        uint64_t ee_ready_since;
+        if (s_timer1.pending && (s_reg8[SIM_TIMSK1] & _BV(TOIE1))) {
+            sim_dispatch(&s_timer1);
+        } else if (s_timer0.pending && (s_reg8[SIM_TIMSK0] & _BV(TOIE0))) {
+            sim_dispatch(&s_timer0);
+        } else if (sim_eeprom_ready(&ee_ready_since)) {
+            sim_dispatch_vector(sim_vector_ee_ready, &sim_hw.ee_ready, ee_ready_since);
+        } else {
+            return;
+        }
+    }
+}
+
+void sim_cli(void)
+{
+    sim_settle();
+    if (s_sreg_i) {
+        s_cli_tracking = true;
+        s_cli_cycle = sim_cycles;
+    }
+    s_sreg_i = false;
+    sim_charge(1);
+}
+
+void sim_sei(void)
+{
+    sim_settle();
+    if (!s_sreg_i && s_cli_tracking) {
+        uint64_t window = sim_cycles - s_cli_cycle;
+        sim_hw.cli_total += window;
+        if (window > sim_hw.cli_max) { sim_hw.cli_max = window; }
+    }
+    s_cli_tracking = false;
+    s_sreg_i = true;
+    sim_charge(1);
+}
+
+uint8_t sim_interrupts_enabled(void)
+{
+    sim_charge(1); // in r, SREG
+    return s_sreg_i;
+}
+
+
+// Keys -----------------------------------------------------------------------
+
+// Two chains of shift registers clock the 64 key contacts out on KEY_BIT.
+// The contacts are loaded on the falling edge of KEY_LATCH and each rising
+// edge of KEY_CLOCK presents the next key. A closed contact reads high.
+
+uint64_t sim_key_contacts = 0;
+static uint64_t s_key_shift = 0;
+static uint8_t  s_key_position = 0;
+
+static void sim_keys_port_write(uint8_t old_value, uint8_t new_value)
+{
+    if ((old_value & KEY_LATCH) && !(new_value & KEY_LATCH)) {
+        s_key_shift = sim_key_contacts;
+        s_key_position = 0;
+    }
+    if (!(old_value & KEY_CLOCK) && (new_value & KEY_CLOCK)) {
+        if (s_key_position < 64) { s_key_position++; }
+    }
+}
+
+static uint8_t sim_keys_pin(void)
+{
+    if (s_key_position < 64 && ((s_key_shift >> s_key_position) & 1)) {
+        return KEY_BIT;
+    }
+    return 0;
+}
+
+
+// LEDs -----------------------------------------------------------------------
+
+// Each strand is decoded from its pin edges. A high pulse of
+// SIM_LED_ONE_CYCLES or longer is a one bit, and a low gap longer than the
+// 50us WS2812 reset time latches the frame.
+
+#define SIM_LED_ONE_CYCLES   (SIM_CYCLES_CODE + SIM_CYCLES_IO + 2)
+#define SIM_LED_RESET_CYCLES (50 * SIM_CYCLES_PER_US)
+#define SIM_LED_FRAME_BITS   (SIM_LEDS_PER_STRAND * 24)
+#define SIM_LED_CAPTURE_BITS 8192
+
+uint8_t sim_led_frame[4][SIM_LEDS_PER_STRAND * 3];
+
+typedef struct {
+    uint8_t  port;          // SIM_PORTB or SIM_PORTC
+    uint8_t  mask;
+    bool     high;
+    uint64_t rise_cycle;
+    uint64_t fall_cycle;
+    uint16_t bit_count;
+    uint8_t  bits[SIM_LEDS_PER_STRAND * 3];
+} sim_strand_t;
+
+static sim_strand_t s_strand[4] = {
+    { SIM_PORTB, LED_ASYNC_GROUP0, false, 0, 0, 0, {0} },
+    { SIM_PORTC, LED_ASYNC_GROUP1, false, 0, 0, 0, {0} },
+    { SIM_PORTB, LED_ASYNC_GROUP2, false, 0, 0, 0, {0} },
+    { SIM_PORTB, LED_ASYNC_GROUP3, false, 0, 0, 0, {0} },
+};
+
+static bool     s_capture_on = false;
+static uint16_t s_capture_count[4];
+static uint8_t  s_capture[4][SIM_LED_CAPTURE_BITS];
+
+static void sim_strand_latch(uint8_t index)
+{
+    sim_strand_t* s = &s_strand[index];
+    if (s->bit_count == 0) { return; }
+    if (s->bit_count == SIM_LED_FRAME_BITS) {
+        memcpy(sim_led_frame[index], s->bits, sizeof(s->bits));
+        sim_hw.led_frames[index]++;
+    } else {
+        sim_hw.led_broken_frames++;
+    }
+    s->bit_count = 0;
+    memset(s->bits, 0, sizeof(s->bits));
+}
+
+static void sim_leds_port_write(uint8_t port, uint8_t old_value,
+                                uint8_t new_value, uint64_t cycle)
+{
+    for (uint8_t i = 0; i < 4; ++i) {
+        sim_strand_t* s = &s_strand[i];
+        if (s->port != port || !((old_value ^ new_value) & s->mask)) {
+            continue;
+        }
+        if (new_value & s->mask) {
+            if (cycle - s->fall_cycle > SIM_LED_RESET_CYCLES) {
+                sim_strand_latch(i);
+            }
+            s->high = true;
+            s->rise_cycle = cycle;
+        } else {
+            bool one = (cycle - s->rise_cycle) >= SIM_LED_ONE_CYCLES;
+            s->high = false;
+            s->fall_cycle = cycle;
+            if (s->bit_count < SIM_LED_FRAME_BITS && one) {
+                s->bits[s->bit_count >> 3] |= 0x80 >> (s->bit_count & 7);
+            }
+            if (s->bit_count <= SIM_LED_FRAME_BITS) { s->bit_count++; }
+            if (s_capture_on && s_capture_count[i] < SIM_LED_CAPTURE_BITS) {
+                s_capture[i][s_capture_count[i]++] = one;
+            }
+        }
+    }
+}
+
+// Latch any strand that has been idle for longer than the reset time.
+static void sim_leds_flush(void)
+{
+    for (uint8_t i = 0; i < 4; ++i) {
+        if (!s_strand[i].high &&
+            sim_cycles - s_strand[i].fall_cycle > SIM_LED_RESET_CYCLES) {
+            sim_strand_latch(i);
+        }
+    }
+}
+
+void sim_led_capture_begin(void)
+{
+    sim_settle();
+    memset(s_capture_count, 0, sizeof(s_capture_count));
+    s_capture_on = true;
+}
+
+uint16_t sim_led_capture_end(uint8_t strand, uint8_t* bits, uint16_t max_bits)
+{
+    sim_settle();
+    s_capture_on = false;
+    uint16_t count = s_capture_count[strand];
+    if (count > max_bits) { count = max_bits; }
+    memcpy(bits, s_capture[strand], count);
+    return count;
+}
+
+
+// EEPROM ---------------------------------------------------------------------
+
+// An erase and write cycle takes 3.4ms, during which EEPE reads back set.
+#define SIM_EEPROM_WRITE_CYCLES (3400UL * SIM_CYCLES_PER_US)
+
+uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+uint32_t sim_eeprom_cell_writes[SIM_EEPROM_SIZE];
+static uint64_t s_eeprom_busy_until = 0;
+static uint64_t s_eempe_cycle = 0;
+static uint64_t s_eerie_cycle = 0;
+
+// EE_READY is level triggered: it stays raised while EERIE is set and no
+// write is in progress.
+static bool sim_eeprom_ready(uint64_t* since)
+{
+    if (!(s_reg8[SIM_EECR] & _BV(EERIE)) || sim_cycles < s_eeprom_busy_until) { return false; }
+    *since = s_eeprom_busy_until > s_eerie_cycle ? s_eeprom_busy_until : s_eerie_cycle;
+    return true;
+}
+
+static void sim_eeprom_control_write(uint8_t old_value, uint8_t new_value,
+                                     uint64_t cycle)
+{
+    uint16_t address = s_reg16[SIM_EEAR] & (SIM_EEPROM_SIZE - 1);
+    bool busy = cycle < s_eeprom_busy_until;
+
+    if ((new_value & _BV(EEMPE)) && !(old_value & _BV(EEMPE))) {
+        s_eempe_cycle = cycle;
+    }
+    if ((new_value & _BV(EERIE)) && !(old_value & _BV(EERIE))) {
+        s_eerie_cycle = cycle;
+    }
+    if ((new_value & _BV(EEPE)) && !(old_value & _BV(EEPE))) {
+        // EEPE only starts a write within four cycles of setting EEMPE,
+        // which the firmware meets by setting them on consecutive accesses.
+        if ((new_value & _BV(EEMPE)) && !busy &&
+            cycle - s_eempe_cycle <= 4 + SIM_CYCLES_CODE + SIM_CYCLES_IO) {
+            sim_eeprom[address] = s_reg8[SIM_EEDR];
+            sim_eeprom_cell_writes[address]++;
+            s_eeprom_busy_until = cycle + SIM_EEPROM_WRITE_CYCLES;
+            sim_hw.eeprom_writes++;
+        }
+        new_value &= ~(_BV(EEMPE) | _BV(EEPE));
+    }
+    if (new_value & _BV(EERE)) {
+        if (!busy) { s_reg8[SIM_EEDR] = sim_eeprom[address]; }
+        new_value &= ~_BV(EERE);
+        sim_cycles += 4;  // the CPU is halted for four cycles on a read
+    }
+    s_reg8[SIM_EECR] = new_value;
+}
+
+
+// Registers ------------------------------------------------------------------
+
+static void sim_reg_read_hook(uint8_t id)
+{
+    switch (id) {
+    case SIM_PINC:
+        s_reg8[SIM_PINC] = (s_reg8[SIM_PORTC] & ~KEY_BIT) | sim_keys_pin();
+        break;
+    case SIM_EECR:
+        if (sim_cycles < s_eeprom_busy_until) {
+            s_reg8[SIM_EECR] |= _BV(EEPE);
+            sim_hw.eeprom_busy_wait += SIM_CYCLES_CODE + SIM_CYCLES_IO;
+        } else {
+            s_reg8[SIM_EECR] &= ~_BV(EEPE);
+        }
+        break;
+    case SIM_TCNT0:
+        s_reg8[SIM_TCNT0] = (uint8_t)sim_timer_count(&s_timer0, sim_cycles);
+        break;
+    case SIM_SPSR:
+        s_reg8[SIM_SPSR] |= _BV(SPIF);
+        break;
+    default:
+        break;
+    }
+}
+
+static void sim_reg16_read_hook(uint8_t id)
+{
+    switch (id) {
+    case SIM_TCNT1:
+        s_reg16[SIM_TCNT1] = (uint16_t)sim_timer_count(&s_timer1, sim_cycles);
+        break;
+    case SIM_TCNT3:
+        s_reg16[SIM_TCNT3] = (uint16_t)sim_timer_count(&s_timer3, sim_cycles);
+        break;
+    default:
+        break;
+    }
+}
+
+static void sim_reg_write_hook(uint8_t id, uint8_t old_value,
+                               uint8_t new_value, uint64_t cycle)
+{
+    switch (id) {
+    case SIM_PORTB:
+    case SIM_PORTC:
+        sim_leds_port_write(id, old_value, new_value, cycle);
+        break;
+    case SIM_PORTD:
+        sim_keys_port_write(old_value, new_value);
+        break;
+    case SIM_TCNT0:
+        sim_timer_write_count(&s_timer0, cycle, new_value);
+        break;
+    case SIM_TCCR0B:
+        sim_timer_write_control(&s_timer0, cycle, new_value);
+        break;
+    case SIM_TCCR1B:
+        sim_timer_write_control(&s_timer1, cycle, new_value);
+        break;
+    case SIM_TCCR3B:
+        sim_timer_write_control(&s_timer3, cycle, new_value);
+        break;
+    case SIM_TIMSK0:
+    case SIM_TIMSK1:
+        // Latency of a stale overflow counts from when it was unmasked.
+        if ((new_value & ~old_value) & 0x01) {
+            sim_timer_t* t = id == SIM_TIMSK0 ? &s_timer0 : &s_timer1;
+            if (t->pending) { t->pending_cycle = cycle; }
+        }
+        break;
+    case SIM_EECR:
+        sim_eeprom_control_write(old_value, new_value, cycle);
+        break;
+    default:
+        break;
+    }
+}
+
+static void sim_reg16_write_hook(uint8_t id, uint16_t new_value, uint64_t cycle)
+{
+    switch (id) {
+    case SIM_TCNT1:
+        sim_timer_write_count(&s_timer1, cycle, new_value);
+        break;
+    case SIM_TCNT3:
+        sim_timer_write_count(&s_timer3, cycle, new_value);
+        break;
+    default:
+        break;
+    }
+}
+
+void sim_settle(void)
+{
+    if (s_last_id < 0) { return; }
+    uint8_t id = (uint8_t)s_last_id;
+    s_last_id = -1;
+    if (s_last_is16) {
+        if (s_reg16[id] != s_last_value) {
+            sim_reg16_write_hook(id, s_reg16[id], s_last_cycle);
+        }
+    } else if (s_reg8[id] != (uint8_t)s_last_value) {
+        sim_reg_write_hook(id, (uint8_t)s_last_value, s_reg8[id], s_last_cycle);
+    }
+}
+
+volatile uint8_t* sim_reg(uint8_t id)
+{
+    sim_settle();
+    sim_charge(SIM_CYCLES_CODE + SIM_CYCLES_IO);
+    sim_reg_read_hook(id);
+    s_last_id = id;
+    s_last_is16 = false;
+    s_last_value = s_reg8[id];
+    s_last_cycle = sim_cycles;
+    return &s_reg8[id];
+}
+
+volatile uint16_t* sim_reg16(uint8_t id)
+{
+    sim_settle();
+    sim_charge(SIM_CYCLES_CODE + 2 * SIM_CYCLES_IO);
+    sim_reg16_read_hook(id);
+    s_last_id = id;
+    s_last_is16 = true;
+    s_last_value = s_reg16[id];
+    s_last_cycle = sim_cycles;
+    return &s_reg16[id];
+}
+
+
+// Watchdog -------------------------------------------------------------------
+
+static bool     s_wdt_enabled = false;
+static uint64_t s_wdt_timeout = 0;
+static uint64_t s_wdt_last_reset = 0;
+
+void sim_wdt_enable(uint8_t timeout)
+{
+    // WDTO_15MS .. WDTO_8S, nominally 16ms doubling per step.
+    s_wdt_enabled = true;
+    s_wdt_timeout = (16ULL << timeout) * SIM_CYCLES_PER_MS;
+    s_wdt_last_reset = sim_cycles;
+}
+
+void sim_wdt_disable(void)
+{
+    s_wdt_enabled = false;
+}
+
+void sim_wdt_reset(void)
+{
+    s_wdt_last_reset = sim_cycles;
+    sim_charge(1);
+}
+
+static void sim_wdt_check(void)
+{
+    if (s_wdt_enabled && sim_cycles - s_wdt_last_reset > s_wdt_timeout) {
+        s_wdt_enabled = false;
+        sim_hw.wdt_timeouts++;
+        if (s_running) { sim_stop("watchdog reset"); }
+    }
+}
+
+
+// Scheduler ------------------------------------------------------------------
+
+#define SIM_MAX_EVENTS 65536
+
+typedef struct {
+    uint64_t cycle;
+    sim_event_fn fn;
+    void* arg;
+} sim_event_t;
+
+static sim_event_t s_events[SIM_MAX_EVENTS];
+static uint32_t s_event_count = 0;
+static uint32_t s_event_next = 0;
+static bool s_events_running = false;
+
+void sim_at(uint64_t cycle, sim_event_fn fn, void* arg)
+{
+    if (s_event_count >= SIM_MAX_EVENTS && s_event_next > 0) {
+        memmove(s_events, s_events + s_event_next,
+                (s_event_count - s_event_next) * sizeof(s_events[0]));
+        s_event_count -= s_event_next;
+        s_event_next = 0;
+    }
+    if (s_event_count >= SIM_MAX_EVENTS) {
+        fprintf(stderr, "sim: too many scheduled events\n");
+        exit(2);
+    }
+    // Keep the queue sorted, preserving insertion order for equal times.
+    uint32_t i = s_event_count++;
+    while (i > s_event_next && s_events[i - 1].cycle > cycle) {
+        s_events[i] = s_events[i - 1];
+        --i;
+    }
+    s_events[i].cycle = cycle;
+    s_events[i].fn = fn;
+    s_events[i].arg = arg;
+}
+
+static void sim_events_run(void)
+{
+    if (s_events_running) { return; }
+    s_events_running = true;
+    while (s_event_next < s_event_count &&
+           s_events[s_event_next].cycle <= sim_cycles) {
+        sim_event_t e = s_events[s_event_next++];
+        e.fn(e.arg);
+    }
+    if (s_event_next == s_event_count) {
+        s_event_next = 0;
+        s_event_count = 0;
+    }
+    s_events_running = false;
+}
+
+
+// Running the firmware -------------------------------------------------------
+
+int mf64_firmware_main(void);
+
+void sim_stop(const char* reason)
+{
+    if (!s_running) {
+        fprintf(stderr, "sim: stop outside of a run: %s\n",
+                reason ? reason : "end of run");
+        exit(2);
+    }
+    sim_stop_reason = reason;
+    longjmp(s_run_jmp, 1);
+}
+
+bool sim_run_firmware(uint64_t end_cycle)
+{
+    memset(s_reg8, 0, sizeof(s_reg8));
+    memset(s_reg16, 0, sizeof(s_reg16));
+    sim_stop_reason = NULL;
+    s_end_cycle = end_cycle;
+    s_running = true;
+    if (setjmp(s_run_jmp) == 0) {
+        mf64_firmware_main();
+        sim_stop_reason = "firmware main() returned";
+    }
+    s_running = false;
+    s_in_isr = false;
+    s_end_cycle = UINT64_MAX;
+    sim_settle();
+    sim_leds_flush();
+    return sim_stop_reason == NULL;
+}
+
+void sim_reset_stats(void)
+{
+    memset(&sim_hw, 0, sizeof(sim_hw));
+}
@@ -0,0 +1,2108 @@
+// Scenario driver for the Midifighter 64 host simulation
+//
+//   Copyright (C) 2016 DJ Techtools
+//
+
+ /* DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <util/crc16.h>
+
+#include "sim.h"
+#include "../constants.h"
+#include "../midi.h"
+#include "../profile.h"
+#include "../led.h"
+#include "../key.h"
+#include "../eeprom.h"
+#include "../display.h"
+#include "../stack.h"
+
+// Command line driver for the host simulation. Each scenario schedules key
+// presses and host traffic against the virtual clock, runs the unmodified
+// firmware main() for a fixed amount of virtual time and prints a report.
+
+#define MS(x) ((uint64_t)(x) * SIM_CYCLES_PER_MS)
+
+// The host enumerates the device SIM_USB_CONFIGURE_MS after USB_Init(),
+// which itself follows a factory reset on first boot. Scenarios start their
+// traffic after this point.
+#define SCENARIO_START_MS 3500
+
+typedef struct {
+    const char* name;
+    const char* description;
+    uint32_t duration_ms;
+    void (*setup)(void);
+    void (*report)(void);
+} scenario_t;
+
+static uint32_t s_duration_ms = 0;
+static const char* s_eeprom_file = NULL;
+static bool s_failed = false;
+
+// How the scenario expects the firmware to stop, if not at the end of the run.
+static const char* s_expected_stop = NULL;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        printf("CHECK FAILED:             %s\n", what);
+        s_failed = true;
+    }
+}
+
+
+// Bootloader -----------------------------------------------------------------
+
+// Stands in for jumptoboot.c, which needs the real bootloader section.
+void Jump_To_Bootloader(void)
+{
+    sim_stop("jumped to bootloader");
+}
+
+
+// Stack ----------------------------------------------------------------------
+
+// Stands in for stack.c, which needs the AVR linker's RAM layout. The host
+// can't see how much of it the firmware would take, so all of it is
+// reported free and never reached; the profile scenario checks the reply.
+uint16_t stack_static_bytes(void)
+{
+    return 0;
+}
+
+uint16_t stack_free_bytes(void)
+{
+    return RAMEND + 1 - RAMSTART;
+}
+
+uint16_t stack_unused_bytes(void)
+{
+    return stack_free_bytes();
+}
+
+
+// Key presses ----------------------------------------------------------------
+
+#define MAX_PRESSES 4096
+
+typedef struct {
+    uint8_t  key;
+    uint64_t cycle;
+} press_t;
+
+static press_t s_presses[MAX_PRESSES];
+static uint32_t s_press_count = 0;
+
+static void key_close(void* arg)
+{
+    uint8_t key = (uint8_t)(uintptr_t)arg;
+    sim_key_contacts |= 1ULL << key;
+    if (s_press_count < MAX_PRESSES) {
+        s_presses[s_press_count].key = key;
+        s_presses[s_press_count].cycle = sim_cycles;
+        s_press_count++;
+    }
+}
+
+static void key_open(void* arg)
+{
+    uint8_t key = (uint8_t)(uintptr_t)arg;
+    sim_key_contacts &= ~(1ULL << key);
+}
+
+static void schedule_press(uint8_t key, uint64_t at, uint64_t hold)
+{
+    sim_at(at, key_close, (void*)(uintptr_t)key);
+    sim_at(at + hold, key_open, (void*)(uintptr_t)key);
+}
+
+// Contact changes that are not a new press: bounce.
+static void contact_close(void* arg)
+{
+    sim_key_contacts |= 1ULL << (uint8_t)(uintptr_t)arg;
+}
+
+static void contact_open(void* arg)
+{
+    sim_key_contacts &= ~(1ULL << (uint8_t)(uintptr_t)arg);
+}
+
+// A press whose contacts chatter for 1.4ms on closing and 1.2ms on opening.
+static press_t s_releases[MAX_PRESSES];
+static uint32_t s_release_count = 0;
+
+static void schedule_bouncy_press(uint8_t key, uint64_t at, uint64_t hold)
+{
+    void* arg = (void*)(uintptr_t)key;
+    uint64_t us = SIM_CYCLES_PER_US;
+    sim_at(at, key_close, arg);
+    sim_at(at + 300 * us, contact_open, arg);
+    sim_at(at + 700 * us, contact_close, arg);
+    sim_at(at + 900 * us, contact_open, arg);
+    sim_at(at + 1400 * us, contact_close, arg);
+    uint64_t up = at + hold;
+    sim_at(up, contact_open, arg);
+    sim_at(up + 300 * us, contact_close, arg);
+    sim_at(up + 600 * us, contact_open, arg);
+    sim_at(up + 800 * us, contact_close, arg);
+    sim_at(up + 1200 * us, contact_open, arg);
+    if (s_release_count < MAX_PRESSES) {
+        s_releases[s_release_count].key = key;
+        s_releases[s_release_count].cycle = up;
+        s_release_count++;
+    }
+}
+
+// Match each press to the first NoteOn for its note that reached the host
+// after it, and report the distribution of press to USB latencies.
+static double s_press_latency_max_ms = 0;
+
+static void report_key_latency(void)
+{
+    uint32_t matched = 0;
+    uint64_t total = 0, worst = 0, best = UINT64_MAX;
+    uint32_t search = 0;
+    for (uint32_t i = 0; i < s_press_count; ++i) {
+        uint8_t note = MIDI_BASENOTE + s_presses[i].key;
+        for (uint32_t j = search; j < sim_usb_log_count; ++j) {
+            const sim_usb_event_t* e = &sim_usb_log[j];
+            if (e->cycle < s_presses[i].cycle) { search = j + 1; continue; }
+            if ((e->event[0] & 0x0F) == 0x9 && e->event[2] == note && e->event[3]) {
+                uint64_t latency = e->cycle - s_presses[i].cycle;
+                total += latency;
+                if (latency > worst) { worst = latency; }
+                if (latency < best) { best = latency; }
+                matched++;
+                break;
+            }
+        }
+    }
+    printf("key presses:              %u (%u reached the host)\n",
+           s_press_count, matched);
+    if (matched) {
+        printf("press to USB latency:     min %.3f ms, avg %.3f ms, max %.3f ms\n",
+               sim_cycles_to_us(best) / 1000.0,
+               sim_cycles_to_us(total / matched) / 1000.0,
+               sim_cycles_to_us(worst) / 1000.0);
+    }
+    s_press_latency_max_ms = sim_cycles_to_us(worst) / 1000.0;
+}
+
+
+// Host traffic ---------------------------------------------------------------
+
+// Send a NoteOn for every key in one burst, the way Ableton Live refreshes
+// clip colours, with the colour changing each time.
+static uint32_t s_feedback_period_ms = 25;
+static uint8_t s_feedback_round = 0;
+
+static void feedback_send_refresh(void)
+{
+    uint8_t packet[64 * 4];
+    uint8_t channel = G_EE_MIDI_CHANNEL & 0x0F;
+    for (uint8_t key = 0; key < 64; ++key) {
+        packet[key * 4 + 0] = 0x09;
+        packet[key * 4 + 1] = 0x90 | channel;
+        packet[key * 4 + 2] = MIDI_BASENOTE + key;
+        packet[key * 4 + 3] = (uint8_t)((key + s_feedback_round) & 0x7F) | 0x01;
+    }
+    s_feedback_round++;
+    sim_usb_host_send(packet, sizeof(packet));
+}
+
+static void feedback_burst(void* arg)
+{
+    (void)arg;
+    feedback_send_refresh();
+    sim_at(sim_cycles + MS(s_feedback_period_ms), feedback_burst, NULL);
+}
+
+// Send a DJTT sysex message, split into USB-MIDI event packets.
+static void host_send_sysex(const uint8_t* data, uint8_t length)
+{
+    uint8_t packet[MIDI_MAX_SYSEX * 2];
+    uint16_t n = 0;
+    while (length > 0) {
+        uint8_t chunk = length > 3 ? 3 : length;
+        length -= chunk;
+        packet[n++] = length ? 0x04 : 0x04 + chunk; // start/continue or end
+        for (uint8_t i = 0; i < 3; ++i) {
+            packet[n++] = i < chunk ? *data++ : 0;
+        }
+    }
+    sim_usb_host_send(packet, n);
+}
+
+// Reassemble the sysex messages the device sent, calling fn for each one.
+static void host_receive_sysex(void (*fn)(const uint8_t* data, uint16_t length))
+{
+    static const uint8_t kCinBytes[8] = { 0, 0, 0, 0, 3, 1, 2, 3 };
+    uint8_t message[256];
+    uint16_t length = 0;
+    for (uint32_t i = 0; i < sim_usb_log_count; ++i) {
+        const uint8_t* e = sim_usb_log[i].event;
+        uint8_t cin = e[0] & 0x0F;
+        if (cin < 0x4 || cin > 0x7) { continue; }
+        for (uint8_t b = 0; b < kCinBytes[cin]; ++b) {
+            if (length < sizeof(message)) { message[length++] = e[1 + b]; }
+        }
+        if (cin != 0x4) {
+            fn(message, length);
+            length = 0;
+        }
+    }
+}
+
+
+// Profiler -------------------------------------------------------------------
+
+static const char* const kProfileStages[PROFILE_NUM_STAGES] = {
+    "usb rx", "key scan", "key events", "combo",
+    "usb flush", "display", "led update", "whole loop"
+};
+
+static bool s_profile_seen[PROFILE_NUM_STAGES];
+static uint32_t s_profile_loop_samples = 0;
+
+static void request_profile(void* arg)
+{
+    (void)arg;
+    static const uint8_t kRequest[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                                        0x05, 0x00, 0x00, 0xF7 };
+    host_send_sysex(kRequest, sizeof(kRequest));
+}
+
+static uint16_t septets16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 7) | (p[2] << 14));
+}
+
+// The stack report, system sub-command 3.
+static void request_stack_report(void* arg)
+{
+    (void)arg;
+    static const uint8_t kRequest[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                                        0x03, 0x03, 0xF7 };
+    host_send_sysex(kRequest, sizeof(kRequest));
+}
+
+static bool s_stack_report_seen = false;
+static uint16_t s_stack_report[3]; // static, free, unused
+
+static void read_stack_report(const uint8_t* data, uint16_t length)
+{
+    static const uint8_t kHeader[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                                       0x03, 0x03 };
+    if (length == sizeof(kHeader) + 9 + 1 && !memcmp(data, kHeader, sizeof(kHeader))) {
+        for (uint8_t i = 0; i < 3; ++i) { s_stack_report[i] = septets16(data + 6 + i * 3); }
+        s_stack_report_seen = true;
+    }
+}
+
+// Print one profiler stage reply as a histogram.
+static void print_profile_stage(const uint8_t* data, uint16_t length)
+{
+    static const uint8_t kHeader[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                                       0x05, 0x01, 0x00 };
+    if (length != 8 + 9 + PROFILE_NUM_BUCKETS * 2 + 1 ||
+        memcmp(data, kHeader, sizeof(kHeader)) != 0 || data[7] >= PROFILE_NUM_STAGES) {
+        return;
+    }
+    uint8_t stage = data[7];
+    uint16_t min = septets16(data + 8);
+    uint16_t max = septets16(data + 11);
+    uint16_t p99 = septets16(data + 14);
+    uint16_t bucket[PROFILE_NUM_BUCKETS];
+    uint32_t total = 0;
+    uint16_t peak = 1;
+    for (uint8_t b = 0; b < PROFILE_NUM_BUCKETS; ++b) {
+        bucket[b] = data[17 + b * 2] | (data[18 + b * 2] << 7);
+        total += bucket[b];
+        if (bucket[b] > peak) { peak = bucket[b]; }
+    }
+    s_profile_seen[stage] = true;
+    if (stage == PROFILE_STAGE_LOOP) { s_profile_loop_samples = total; }
+
+    if (!total) {
+        printf("%-12s no samples\n", kProfileStages[stage]);
+        return;
+    }
+    printf("%-12s min %6u us   p99 <= %6u us   max %6u us\n", kProfileStages[stage],
+           min * PROFILE_TICK_US, p99 * PROFILE_TICK_US, max * PROFILE_TICK_US);
+    for (uint8_t b = 0; b < PROFILE_NUM_BUCKETS; ++b) {
+        if (!bucket[b]) { continue; }
+        uint32_t lo = b ? (1U << (b - 1)) * PROFILE_TICK_US : 0;
+        uint32_t hi = b ? ((1U << b) - 1) * PROFILE_TICK_US : 0;
+        char bar[41];
+        uint8_t width = (uint8_t)((bucket[b] * 40 + peak - 1) / peak);
+        memset(bar, '#', width);
+        bar[width] = 0;
+        char range[24];
+        if (lo == hi) {
+            snprintf(range, sizeof(range), "%u us", lo);
+        } else if (b == PROFILE_NUM_BUCKETS - 1) {
+            snprintf(range, sizeof(range), "%u us and up", lo);
+        } else {
+            snprintf(range, sizeof(range), "%u..%u us", lo, hi);
+        }
+        printf("    %-16s %3u %s\n", range, bucket[b], bar);
+    }
+}
+
+
+// Key timing -----------------------------------------------------------------
+
+// The key timing the key-timing scenario pushes over sysex.
+#define PUSH_SCAN_PERIOD 2
+#define PUSH_DEBOUNCE_DEPTH 2
+
+// Push the current settings, the way the Midifighter Utility sends the whole
+// tag/value table, with the key timing above and MIDI channel 17, which the
+// device should refuse, if arg is not NULL. The device then saves them, and
+// any colours pushed before them, to the EEPROM.
+static uint8_t s_channel_at_push;
+
+static void push_config(void* arg)
+{
+    uint8_t scan_period = arg ? PUSH_SCAN_PERIOD : G_EE_KEY_SCAN_PERIOD;
+    uint8_t debounce_depth = arg ? PUSH_DEBOUNCE_DEPTH : G_EE_KEY_DEBOUNCE_DEPTH;
+    s_channel_at_push = G_EE_MIDI_CHANNEL;
+    uint8_t message[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                          0x01,
+                          0, arg ? 17 : G_EE_MIDI_CHANNEL + 1,
+                          1, G_EE_MIDI_VELOCITY,
+                          3, G_EE_FOUR_BANKS_MODE,
+                          7, G_EE_MIDI_OUTPUT_MODE,
+                          8, G_EE_COMBOS_ENABLE,
+                          10, G_EE_ANIMATIONS,
+                          11, G_EE_TILT_MASK & 0x3,
+                          12, (G_EE_TILT_MASK >> 4) & 0xF,
+                          13, G_EE_TILT_MODE - 1,
+                          14, G_EE_TILT_SENSITIVITY,
+                          15, G_EE_PITCH_SENSITIVITY,
+                          16, G_EE_TILT_RANGE,
+                          17, G_EE_PITCH_RANGE,
+                          18, G_EE_TILT_DEADZONE,
+                          19, G_EE_PITCH_DEADZONE,
+                          20, G_EE_TILT_AXIS,
+                          21, G_EE_PICK_SENSITIVITY,
+                          22, G_EE_SLEEP_TIME,
+                          23, G_EE_SIDE_BANK,
+                          24, scan_period,
+                          25, debounce_depth,
+                          0xF7 };
+    host_send_sysex(message, sizeof(message));
+}
+
+// Push a new set of idle colours for both banks, the 16 parts of a bulk
+// transfer, as the Midifighter Utility does before pushing the settings.
+static void push_idle_colors(void* arg)
+{
+    (void)arg;
+    for (uint8_t part = 1; part <= 16; ++part) {
+        uint8_t message[11 + 24] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                                     0x04, 0x00, 0x01, part, 16, 24 };
+        for (uint8_t i = 0; i < 24; ++i) {
+            message[10 + i] = (uint8_t)((part * 24 + i) * 5) % 24; // the firmware doubles them
+        }
+        message[10 + 24] = 0xF7;
+        host_send_sysex(message, sizeof(message));
+    }
+}
+
+// Reset the stats section given by arg.
+static void reset_stats(void* arg)
+{
+    uint8_t request[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                          0x05, 0x02, (uint8_t)(uintptr_t)arg, 0xF7 };
+    host_send_sysex(request, sizeof(request));
+}
+
+// Ask for the stats section given by arg (2 debounce, 3 event queue, 4 MIDI
+// out, 5 EEPROM writer).
+static void request_key_stats(void* arg)
+{
+    uint8_t request[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                          0x05, 0x00, (uint8_t)(uintptr_t)arg, 0xF7 };
+    host_send_sysex(request, sizeof(request));
+}
+
+static bool s_key_stats_seen = false;
+static uint16_t s_key_stats[3]; // bounces, presses, latency in us
+static bool s_queue_stats_seen = false;
+static uint16_t s_queue_stats[4]; // read, dropped, max and average wait
+static bool s_midi_out_stats_seen = false;
+static uint16_t s_midi_out_stats[4]; // packets, events, dropped, most packets per frame
+static bool s_eeprom_stats_seen = false;
+static uint16_t s_eeprom_stats[3]; // pending, written, unchanged
+static int s_config_scan_period = -1;
+static int s_config_debounce_depth = -1;
+
+// Pick the key stats and the key timing settings out of the device's replies.
+static void read_key_replies(const uint8_t* data, uint16_t length)
+{
+    static const uint8_t kStats[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                                      0x05, 0x01, 0x02 };
+    static const uint8_t kQueueStats[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                                           0x05, 0x01, 0x03 };
+    static const uint8_t kMidiOutStats[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                                             0x05, 0x01, 0x04 };
+    static const uint8_t kEepromStats[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                                            0x05, 0x01, 0x05 };
+    static const uint8_t kConfig[] = { 0xF0, 0x00, MANUFACTURER_ID >> 8, MANUFACTURER_ID & 0x7F,
+                                       0x02, 0x01 };
+    if (length == sizeof(kStats) + 9 + 1 && !memcmp(data, kStats, sizeof(kStats))) {
+        for (uint8_t i = 0; i < 3; ++i) { s_key_stats[i] = septets16(data + 7 + i * 3); }
+        s_key_stats_seen = true;
+    } else if (length == sizeof(kQueueStats) + 12 + 1 && !memcmp(data, kQueueStats, sizeof(kQueueStats))) {
+        for (uint8_t i = 0; i < 4; ++i) { s_queue_stats[i] = septets16(data + 7 + i * 3); }
+        s_queue_stats_seen = true;
+    } else if (length == sizeof(kMidiOutStats) + 12 + 1 && !memcmp(data, kMidiOutStats, sizeof(kMidiOutStats))) {
+        for (uint8_t i = 0; i < 4; ++i) { s_midi_out_stats[i] = septets16(data + 7 + i * 3); }
+        s_midi_out_stats_seen = true;
+    } else if (length == sizeof(kEepromStats) + 9 + 1 && !memcmp(data, kEepromStats, sizeof(kEepromStats))) {
+        for (uint8_t i = 0; i < 3; ++i) { s_eeprom_stats[i] = septets16(data + 7 + i * 3); }
+        s_eeprom_stats_seen = true;
+    } else if (length > sizeof(kConfig) && !memcmp(data, kConfig, sizeof(kConfig))) {
+        for (uint16_t i = sizeof(kConfig); i + 1 < length; i += 2) {
+            if (data[i] == 24) { s_config_scan_period = data[i + 1]; }
+            if (data[i] == 25) { s_config_debounce_depth = data[i + 1]; }
+        }
+    }
+}
+
+// Print the firmware's own debounce telemetry, read back over sysex.
+static void report_key_stats(void)
+{
+    host_receive_sysex(read_key_replies);
+    check(s_key_stats_seen, "key stats reply");
+    if (!s_key_stats_seen) { return; }
+    printf("debounce telemetry:       %u bounces rejected, %u presses, avg %.3f ms from first contact\n",
+           s_key_stats[0], s_key_stats[1], s_key_stats[2] / 1000.0);
+    check(s_key_stats[1] == s_press_count, "telemetry counted every press");
+    check(s_key_stats[0] > 0, "telemetry counted the bounces");
+}
+
+
+// Key events -----------------------------------------------------------------
+
+void service_key_events(void); // midifighter64.c
+
+// Time the key handling of a main loop pass that sees no edges, one key and
+// a sixteen-key chord: a debounce sample (at a depth of one sample, so the
+// keys change on every pass), the key_read()/key_calc() of the key scan
+// stage, the key event stage and the flush. Passes alternate between the keys
+// going down and coming back up so the notes balance. The sim's cycles only
+// count the I/O of sending the MIDI, including the wait for the host to take
+// it; the host time also counts the bit tests.
+static void bench_key_events(const char* label, uint64_t keys)
+{
+    const uint32_t passes = 20000;
+    key_configure(1, 1);
+    uint64_t cycles = sim_cycles;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint32_t i = 0; i < passes; ++i) {
+        key_debounce_sample((i & 1) ? 0 : keys);
+        key_read();
+        key_calc();
+        service_key_events();
+        midi_flush();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    cycles = sim_cycles - cycles;
+    key_configure(G_EE_KEY_SCAN_PERIOD, G_EE_KEY_DEBOUNCE_DEPTH);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("key events, %-13s %6.0f sim cycles, %6.1f host ns per pass\n",
+           label, (double)cycles / passes, ns / passes);
+}
+
+// Key edges far beyond the queue's size, with the main loop not taking them:
+// the edges it then gets must leave every key as it ended up, with none
+// repeating a key's last state. Timer0 is stopped so only these samples count.
+static void check_key_event_overflow(void)
+{
+    static const uint64_t patterns[] = { ~0ULL, 0, 0x5555555555555555ULL, ~0ULL, 0x0123456789ABCDEFULL };
+    key_disable();
+    key_event_t event;
+    while (key_event_pop(&event)) {}
+    key_configure(1, 1);
+    uint64_t keys = key_read();
+    uint16_t dropped = g_key_events_dropped;
+    for (uint8_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); ++i) {
+        key_debounce_sample(patterns[i]);
+    }
+    bool repeats = false;
+    uint16_t edges = 0;
+    while (key_event_pop(&event)) {
+        uint64_t bit = 1ULL << (event.key & KEY_EVENT_KEY);
+        if (!(keys & bit) == !(event.key & KEY_EVENT_DOWN)) { repeats = true; }
+        keys ^= bit;
+        ++edges;
+    }
+    key_configure(G_EE_KEY_SCAN_PERIOD, G_EE_KEY_DEBOUNCE_DEPTH);
+    printf("key event overflow:       %u edges dropped, %u sent\n",
+           (uint16_t)(g_key_events_dropped - dropped), edges);
+    check(g_key_events_dropped != dropped, "the key event queue overflowed");
+    check(keys == patterns[sizeof(patterns) / sizeof(patterns[0]) - 1] && !repeats,
+          "a full key event queue leaves no key stuck");
+}
+
+
+// USB-MIDI receive -----------------------------------------------------------
+
+bool InterpretUsbMidiMessage(MIDI_EventPacket_t input_event); // midifighter64.c
+
+// Turn all feedback off without going through the NoteOff delay.
+static void feedback_clear(void)
+{
+    memset(g_midi_note_state, 0, sizeof(g_midi_note_state));
+    memset(g_midi_note_lit, 0, sizeof(g_midi_note_lit));
+}
+
+static MIDI_EventPacket_t rx_packet(uint8_t cin, uint8_t data1, uint8_t data2, uint8_t data3)
+{
+    MIDI_EventPacket_t event;
+    event.Event = cin;
+    event.Data1 = data1;
+    event.Data2 = data2;
+    event.Data3 = data3;
+    return event;
+}
+
+// Feedback reaches the right bank for each channel around the device's, but
+// not with the channel setting out of range, and a malformed CC doesn't reach
+// the clock handler.
+static void rx_directed_checks(void)
+{
+    uint8_t ch = G_EE_MIDI_CHANNEL & 0x0F;
+    feedback_clear();
+    InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ch, MIDI_BASENOTE + 5, 11));
+    InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ((ch - 1) & 0x0F), MIDI_BASENOTE + 5, 22));
+    InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ((ch + 1) & 0x0F), MIDI_BASENOTE + 5, 33));
+    InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ((ch + 2) & 0x0F), MIDI_BASENOTE + 6, 44));
+    check(g_midi_note_state[0][5] == 11 && g_midi_note_state[0][NUM_BUTTONS + 5] == 22 &&
+          g_midi_note_state[1][MIDI_BASENOTE + 5] == 33 && g_midi_note_state[0][6] == 0,
+          "feedback lands in the bank for its channel");
+    G_EE_MIDI_CHANNEL = ch + 16;
+    InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ch, MIDI_BASENOTE + 6, 55));
+    G_EE_MIDI_CHANNEL = ch;
+    check(g_midi_note_state[0][6] == 0, "an out of range channel setting takes no feedback");
+    midi_clock_enable(false);
+    InterpretUsbMidiMessage(rx_packet(0xB, 0xF8, 0, 0));
+    check(!midi_clock_enabled, "a CC packet is not treated as a clock message");
+    check(!InterpretUsbMidiMessage(rx_packet(0x0, 0, 0, 0)), "an empty packet ends the events");
+}
+
+// Throughput of LED feedback through the receive dispatcher, then random
+// packets - any Code Index Number, any byte values bar a DJTT sysex header -
+// with the MIDI channel setting changing as they arrive, checking the stored
+// feedback stays in range.
+static void report_rx_fuzz_results(void)
+{
+    rx_directed_checks();
+
+    const uint32_t packets = 4000000;
+    uint8_t ch = G_EE_MIDI_CHANNEL & 0x0F;
+    uint32_t seed = 1;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint32_t i = 0; i < packets; ++i) {
+        seed = seed * 1103515245UL + 12345UL;
+        uint8_t note = MIDI_BASENOTE + ((seed >> 16) & 63);
+        InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ch, note, (seed >> 24) & 0x7F));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("receive dispatch:         %u feedback packets, %.1f host ns per packet\n",
+           packets, ns / packets);
+
+    uint8_t channel = G_EE_MIDI_CHANNEL;
+    bool in_range = true;
+    for (uint32_t i = 0; i < packets; ++i) {
+        if ((i & 0xFFFF) == 0) {
+            G_EE_MIDI_CHANNEL = (uint8_t)(i >> 16) & 0x0F;
+        }
+        seed = seed * 1103515245UL + 12345UL;
+        uint32_t r = seed;
+        seed = seed * 1103515245UL + 12345UL;
+        uint8_t cin = (r >> 28) & 0x0F;
+        uint8_t data1 = (uint8_t)(r >> 8), data2 = (uint8_t)(r >> 16);
+        if (data1 == 0xF0 && data2 == 0x00) {
+            data2 = 0x7D; // keep random sysex away from the DJTT commands (bootloader, EEPROM writes)
+        }
+        InterpretUsbMidiMessage(rx_packet(cin, data1, data2, (uint8_t)(seed >> 8)));
+        in_range = in_range && g_bank_selected <= 1;
+    }
+    G_EE_MIDI_CHANNEL = channel;
+    for (uint16_t n = 0; n < MIDI_MAX_NOTES; ++n) {
+        in_range = in_range && g_midi_note_state[0][n] <= 0x7F && g_midi_note_state[1][n] <= 0x7F;
+        for (uint8_t layer = 0; layer < 2; ++layer) {
+            bool lit = (g_midi_note_lit[layer][n >> 6] >> (n & 63)) & 1;
+            in_range = in_range && lit == (g_midi_note_state[layer][n] != 0);
+        }
+        uint8_t counter = g_midi_note_off_counter[n];
+        in_range = in_range && (counter == 0 || counter - 0x80 < NOTE_OFF_WHEEL_SLOTS);
+    }
+    printf("receive fuzz:             %u random packets, state %s\n",
+           packets, in_range ? "in range" : "OUT OF RANGE");
+    check(in_range, "fuzzed packets leave the feedback state in range");
+}
+
+
+// A whole clip-colour refresh of every key queued FLOOD_REFRESHES times at
+// once, so the OUT endpoint never waits on the host and the drain rate is
+// the firmware's. The bus alone would carry a 64-byte bank every ~53us.
+#define FLOOD_REFRESHES 100
+#define FLOOD_EVENTS (FLOOD_REFRESHES * 64)
+
+static uint64_t s_flood_start = 0;
+static uint64_t s_flood_end = 0;
+static uint64_t s_flood_events = 0;
+static uint64_t s_flood_banks = 0;
+static uint64_t s_flood_hold = 0;
+static bool s_flood_gap_ok = false;
+
+static void flood_watch(void* arg)
+{
+    (void)arg;
+    if (sim_usb_out_pending() == 0) {
+        s_flood_end = sim_cycles;
+        return;
+    }
+    sim_at(sim_cycles + SIM_CYCLES_PER_US * 20, flood_watch, NULL);
+}
+
+static void flood_send(void* arg)
+{
+    (void)arg;
+    s_flood_gap_ok = g_midi_note_state[0][1] == 0x15 && g_midi_note_state[0][2] == 0x2A;
+    s_flood_events = sim_usb.out_events;
+    s_flood_banks = sim_usb.out_packets;
+    s_flood_hold = sim_usb.out_hold_total;
+    s_flood_start = sim_cycles;
+    for (uint8_t n = 0; n < FLOOD_REFRESHES; ++n) {
+        feedback_send_refresh();
+    }
+    flood_watch(NULL);
+}
+
+// One bank with an empty (CIN 0) event between two NoteOns: the bank's byte
+// count, not the empty event, ends the packet.
+static void flood_send_gap(void* arg)
+{
+    (void)arg;
+    uint8_t channel = G_EE_MIDI_CHANNEL & 0x0F;
+    const uint8_t packet[12] = {
+        0x09, 0x90 | channel, MIDI_BASENOTE + 1, 0x15,
+        0x00, 0x00, 0x00, 0x00,
+        0x09, 0x90 | channel, MIDI_BASENOTE + 2, 0x2A,
+    };
+    sim_usb_host_send(packet, sizeof(packet));
+}
+
+static void report_rx_flood_results(void)
+{
+    check(s_flood_gap_ok, "an empty event inside a bank does not end the packet");
+    uint64_t events = sim_usb.out_events - s_flood_events;
+    uint64_t banks = sim_usb.out_packets - s_flood_banks;
+    double hold_us = banks ? sim_cycles_to_us(sim_usb.out_hold_total - s_flood_hold) / banks : 0.0;
+    check(events == FLOOD_EVENTS && s_flood_end > s_flood_start,
+          "the LED flood is drained");
+    double ms = sim_cycles_to_us(s_flood_end - s_flood_start) / 1000.0;
+    double bus_ms = FLOOD_REFRESHES * 4 * sim_cycles_to_us((64 + 16) * 8 * SIM_CYCLES_PER_US / 12) / 1000.0;
+    printf("LED flood drain:          %llu events in %.2f ms, %.0f events per ms (bus limit %.0f)\n",
+           (unsigned long long)events, ms, ms > 0 ? events / ms : 0.0, FLOOD_EVENTS / bus_ms);
+    printf("OUT bank drain:           %.1f us per 16-event bank, %.0f events per ms of firmware time\n",
+           hold_us, hold_us > 0 ? 16000.0 / hold_us : 0.0);
+}
+
+
+// LED feedback NoteOffs ------------------------------------------------------
+
+void update_note_off_feedback_delay(void); // midifighter64.c
+
+// Every key lit, then turned off, timing each key from its NoteOff being
+// taken in (bit 7 of its g_midi_note_off_counter) to its feedback clearing.
+// The clock is moved up to the 16-bit wrap first so the delays span it. Key 5
+// is relit and key 6 turned off twice inside their delays.
+static uint16_t s_note_off_taken[NUM_BUTTONS];
+static uint16_t s_note_off_cleared[NUM_BUTTONS];
+static uint8_t s_note_off_seen[NUM_BUTTONS];
+static bool s_note_off_watching = false;
+
+static void host_send_note(uint8_t* packet, uint8_t on, uint8_t key, uint8_t velocity)
+{
+    packet[0] = on ? 0x09 : 0x08;
+    packet[1] = (on ? 0x90 : 0x80) | (G_EE_MIDI_CHANNEL & 0x0F);
+    packet[2] = MIDI_BASENOTE + key;
+    packet[3] = velocity;
+}
+
+static void note_off_watch(void* arg)
+{
+    (void)arg;
+    uint16_t now = system_time_ms;
+    for (uint8_t key = 0; key < NUM_BUTTONS; ++key) {
+        if (s_note_off_seen[key] == 0 && (g_midi_note_off_counter[key] & 0x80)) {
+            s_note_off_taken[key] = now;
+            s_note_off_seen[key] = 1;
+        }
+        if (s_note_off_seen[key] == 1 && g_midi_note_state[0][key] == 0) {
+            s_note_off_cleared[key] = now;
+            s_note_off_seen[key] = 2;
+        }
+    }
+    if (s_note_off_watching) {
+        sim_at(sim_cycles + SIM_CYCLES_PER_US * 20, note_off_watch, NULL);
+    }
+}
+
+static void note_off_send(void* arg)
+{
+    (void)arg;
+    uint8_t packet[(NUM_BUTTONS + 3) * 4];
+    uint8_t n = 0;
+    for (uint8_t key = 0; key < NUM_BUTTONS; ++key) {
+        host_send_note(&packet[n++ * 4], 0, key, 0);
+        if (key == 5) { host_send_note(&packet[n++ * 4], 1, key, 0x55); }
+        if (key == 6) {
+            host_send_note(&packet[n++ * 4], 1, key, 0x66);
+            host_send_note(&packet[n++ * 4], 0, key, 0);
+        }
+    }
+    system_time_ms = 0x10000 - LED_REFRESH_LIMIT;
+    s_note_off_watching = true;
+    note_off_watch(NULL);
+    sim_usb_host_send(packet, n * 4);
+}
+
+static void note_off_stop(void* arg)
+{
+    (void)arg;
+    s_note_off_watching = false;
+}
+
+// Host time of one update_note_off_feedback_delay() call with notes NoteOffs
+// waiting, either all still inside their delay or all due.
+static void bench_note_off(const char* label, uint8_t notes, bool due)
+{
+    const uint32_t passes = 20000;
+    uint8_t ch = G_EE_MIDI_CHANNEL & 0x0F;
+    double ns = 0;
+    for (uint32_t i = 0; i < passes; ++i) {
+        for (uint8_t key = 0; key < notes; ++key) {
+            InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ch, MIDI_BASENOTE + key, 0x7F));
+            InterpretUsbMidiMessage(rx_packet(0x8, 0x80 | ch, MIDI_BASENOTE + key, 0));
+        }
+        if (due) {
+            system_time_ms += NOTE_OFF_FEEDBACK_DELAY_LIMIT;
+        }
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        update_note_off_feedback_delay();
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        if (!due) {
+            system_time_ms += NOTE_OFF_FEEDBACK_DELAY_LIMIT;
+            update_note_off_feedback_delay();
+        }
+    }
+    printf("note-off delay, %-10s %6.1f host ns per refresh\n", label, ns / passes);
+}
+
+static void report_note_off_results(void)
+{
+    uint16_t delay_min = 0xFFFF, delay_max = 0;
+    uint8_t cleared = 0;
+    for (uint8_t key = 0; key < NUM_BUTTONS; ++key) {
+        if (key == 5 || s_note_off_seen[key] != 2) { continue; }
+        uint16_t delay = s_note_off_cleared[key] - s_note_off_taken[key];
+        if (delay < delay_min) { delay_min = delay; }
+        if (delay > delay_max) { delay_max = delay; }
+        cleared++;
+    }
+    printf("note-off delay:           %u of %u keys cleared, %u to %u ticks after the NoteOff (limit %u)\n",
+           cleared, NUM_BUTTONS - 1, cleared ? delay_min : 0, delay_max, NOTE_OFF_FEEDBACK_DELAY_LIMIT);
+    check(cleared == NUM_BUTTONS - 1, "every NoteOff cleared its key");
+    check(cleared && delay_min >= NOTE_OFF_FEEDBACK_DELAY_LIMIT, "no key cleared before the delay");
+    check(delay_max <= NOTE_OFF_FEEDBACK_DELAY_LIMIT + LED_REFRESH_LIMIT + 1,
+          "every key cleared by the refresh after the delay");
+    check(g_midi_note_state[0][5] == 0x55, "a NoteOn inside the delay keeps the key lit");
+
+    bench_note_off("none:", 0, false);
+    bench_note_off("8 waiting:", 8, false);
+    bench_note_off("64 waiting:", NUM_BUTTONS, false);
+    bench_note_off("8 due:", 8, true);
+    bench_note_off("64 due:", NUM_BUTTONS, true);
+}
+
+
+// LED feedback compositing ---------------------------------------------------
+
+extern uint8_t default_bank_inactive[2][64*KEY_COLOR_BYTES];      // display.c
+extern uint8_t default_bank_active[2][64*KEY_COLOR_BYTES];
+extern uint8_t geometric_animation_pos[];
+extern uint8_t assign_geometric_animation_id;
+
+// Light 0, 8 or all 64 notes, each with a colour and a brightness animation.
+static void feedback_light(uint8_t notes)
+{
+    uint8_t ch = G_EE_MIDI_CHANNEL & 0x0F;
+    feedback_clear();
+    for (uint8_t n = 0; n < notes; ++n) {
+        uint8_t key = notes == NUM_BUTTONS ? n : n * 8 + 3; // eight lit notes: one per byte of the mask
+        InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ch, MIDI_BASENOTE + key, 1 + n));
+        InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ((ch + 1) & 0x0F), key, 18 + (n & 15)));
+    }
+}
+
+// Host time of a whole default_display_run() frame: 0, 8 or 64 notes lit
+// as above, under a few held keys and all four kinds of geometric
+// animation one step out, awake or with the sleep demo showing. The frame
+// checksum should match between builds.
+static const uint8_t kGeometricKeys[GEOMETRIC_ANIMATION_TYPES] = { 0, 21, 42, 63 };
+
+static void bench_display_frame(uint8_t notes, bool asleep)
+{
+    const uint32_t passes = 20000;
+    uint8_t anims[GEOMETRIC_ANIMATION_TYPES];
+    uint8_t sleep_minutes = sleep_minute_counter;
+    feedback_light(notes);
+    g_key_state = 0x0F00F0000000F00FULL;
+    sleep_minute_counter = asleep ? G_EE_SLEEP_TIME + 1 : 0;
+    g_led_counter[2] = 0x30; // hold the sleep demo's balls still
+    for (uint8_t type = 0; type < GEOMETRIC_ANIMATION_TYPES; ++type) {
+        anims[type] = assign_geometric_animation_id;
+        start_geometric_animation(kGeometricKeys[type], type);
+        geometric_animation_pos[anims[type]] = 1;
+    }
+
+    default_display_run();
+    uint32_t sum = 0;
+    for (uint16_t j = 0; j < sizeof(g_display_buffer); ++j) { sum = sum * 31 + g_display_buffer[j]; }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint32_t i = 0; i < passes; ++i) {
+        default_display_run();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("display frame,    %2u lit%s: %6.1f host ns per frame (frame checksum %08x)\n",
+           notes, asleep ? ", asleep" : "", ns / passes, sum);
+
+    // With every optional layer off only the key colours are left
+    uint8_t base[sizeof(g_display_buffer)];
+    for (uint8_t key = 0; key < NUM_BUTTONS; ++key) {
+        const uint8_t* colors = (g_key_state >> key) & 1 ? default_bank_active[g_bank_selected] :
+                                                           default_bank_inactive[g_bank_selected];
+        const uint8_t* rgb = default_color[colors[key]];
+        base[key * 3] = rgb[2]; // BRG
+        base[key * 3 + 1] = rgb[0];
+        base[key * 3 + 2] = rgb[1];
+    }
+    g_display_layers = 0;
+    default_display_run();
+    g_display_layers = DISPLAY_LAYERS_ALL;
+    check(memcmp(base, g_display_buffer, sizeof(base)) == 0, "a frame without its layers shows the key colours");
+
+    for (uint8_t type = 0; type < GEOMETRIC_ANIMATION_TYPES; ++type) {
+        geometric_animation_pos[anims[type]] = 0xFF; // finished
+    }
+    sleep_minute_counter = sleep_minutes;
+    g_key_state = 0;
+}
+
+// Host time of a frame with all 64 keys pulsing, eight to each pulse rate,
+// then how far pulse_animation() strays from the float sin() it started as
+// over 1024 steps of the flash counter, with and without a MIDI clock.
+static void bench_pulse(void)
+{
+    const uint32_t passes = 20000;
+    uint8_t ch = G_EE_MIDI_CHANNEL & 0x0F;
+    uint16_t flash_counter = display_flash_counter;
+    feedback_clear();
+    for (uint8_t key = 0; key < NUM_BUTTONS; ++key) {
+        InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ch, MIDI_BASENOTE + key, 1 + key));
+        InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ((ch + 1) & 0x0F), MIDI_BASENOTE + key, 42 + (key & 7)));
+    }
+    sleep_minute_counter = 0;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint32_t i = 0; i < passes; ++i) {
+        display_flash_counter = (uint16_t)i; // a new phase every frame
+        default_display_run();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("pulse frame, 64 pulsing:  %6.1f host ns per frame\n", ns / passes);
+
+    int worst = 0;
+    bool clock_enabled = midi_clock_enabled;
+    for (uint8_t clock = 0; clock < 2; ++clock) {
+        midi_clock_enabled = clock;
+        for (uint16_t counter = 0; counter < 1024; ++counter) {
+            display_flash_counter = counter;
+            default_display_run();
+            for (uint8_t rate = 1; rate <= 8; ++rate) {
+                uint8_t step = (uint8_t)(((uint16_t)(counter << (clock ? 5 : 4)) >> (8 - rate)) & 0xFF);
+                int expected = (uint8_t)(sin(0.049f * step) * 127 + 127);
+                int error = abs(pulse_animation(rate) - expected);
+                if (error > worst) { worst = error; }
+            }
+        }
+    }
+    midi_clock_enabled = clock_enabled;
+    display_flash_counter = flash_counter;
+    printf("pulse level error:        %d of 254 at worst\n", worst);
+    check(worst <= 4, "pulse levels follow the float sine");
+}
+
+// Where the key colours are kept: a key's colour is an index into
+// default_color[], and the colour tables are in flash.
+static void report_color_ram(void)
+{
+    unsigned keys = sizeof(default_bank_inactive) + sizeof(default_bank_active);
+    printf("colours in RAM:           %u bytes of key colours, 0 of colour tables\n", keys);
+}
+
+static void report_compose_results(void)
+{
+    report_color_ram();
+    bench_display_frame(0, false);
+    bench_display_frame(8, false);
+    bench_display_frame(64, false);
+    bench_display_frame(64, true);
+    bench_pulse();
+    feedback_clear();
+}
+
+
+// Geometric animations -------------------------------------------------------
+
+extern uint8_t geometric_animation_type[];                        // display.c
+extern const uint8_t *geometric_animation_color_ptr[];
+
+static const uint8_t kGeometricSteps[GEOMETRIC_ANIMATION_TYPES] = {
+    GEOMETRIC_ANIMATION_STEPS_SQUARE, GEOMETRIC_ANIMATION_STEPS_CIRCLE,
+    GEOMETRIC_ANIMATION_STEPS_STAR, GEOMETRIC_ANIMATION_STEPS_TRIANGLE
+};
+static const uint8_t geometric_color[3] PROGMEM = { 0x12, 0x34, 0x56 }; // no key color
+
+static void geometric_finish_all(void)
+{
+    for (uint8_t anim = 0; anim < CONCURRENT_GEOMETRIC_ANIMATIONS; ++anim) {
+        geometric_animation_pos[anim] = 0xFF;
+    }
+}
+
+static uint8_t geometric_start(uint8_t button, uint8_t type, uint8_t step)
+{
+    uint8_t anim = assign_geometric_animation_id;
+    start_geometric_animation(button, type);
+    geometric_animation_pos[anim] = step;
+    geometric_animation_color_ptr[anim] = geometric_color;
+    return anim;
+}
+
+static uint8_t geometric_keys_lit(void)
+{
+    uint8_t lit = 0;
+    for (uint8_t key = 0; key < NUM_BUTTONS; ++key) {
+        const uint8_t *led = g_display_buffer + key * 3; // BRG
+        lit += led[0] == geometric_color[2] && led[1] == geometric_color[0] && led[2] == geometric_color[1];
+    }
+    return lit;
+}
+
+// Geometric animation timing: the host starts a square and, part way through
+// its first step, a circle, and the step of each animation slot is watched
+// (as system_time_ms) as the firmware runs them out.
+#define GEOMETRIC_WATCHED 2
+static const uint8_t kGeometricWatchKeys[GEOMETRIC_WATCHED] = { 9, 54 };
+static const uint8_t kGeometricWatchTypes[GEOMETRIC_WATCHED] = { GEOMETRIC_ANIMATION_TYPE_SQUARE, GEOMETRIC_ANIMATION_TYPE_CIRCLE };
+static uint16_t s_geometric_started[CONCURRENT_GEOMETRIC_ANIMATIONS];
+static uint16_t s_geometric_stepped[CONCURRENT_GEOMETRIC_ANIMATIONS][16]; // time each step was reached
+static uint8_t s_geometric_seen[CONCURRENT_GEOMETRIC_ANIMATIONS];       // 0 idle, else last step seen + 1
+static bool s_geometric_watching = false;
+
+static void geometric_watch(void* arg)
+{
+    (void)arg;
+    uint16_t now = system_time_ms;
+    for (uint8_t anim = 0; anim < CONCURRENT_GEOMETRIC_ANIMATIONS; ++anim) {
+        uint8_t pos = geometric_animation_pos[anim];
+        if (s_geometric_seen[anim] == 0 && pos == 0) {
+            s_geometric_started[anim] = now;
+            s_geometric_seen[anim] = 1;
+        }
+        while (s_geometric_seen[anim] && s_geometric_seen[anim] <= pos && s_geometric_seen[anim] < 16) {
+            s_geometric_stepped[anim][s_geometric_seen[anim]++] = now;
+        }
+    }
+    if (s_geometric_watching) {
+        sim_at(sim_cycles + SIM_CYCLES_PER_US * 20, geometric_watch, NULL);
+    }
+}
+
+static void geometric_send(void* arg)
+{
+    uint8_t n = (uint8_t)(uintptr_t)arg;
+    uint8_t packet[4] = { 0x09, 0x90 | ((G_EE_MIDI_CHANNEL + 1) & 0x0F), // the animation channel
+                          kGeometricWatchKeys[n], 50 + kGeometricWatchTypes[n] };
+    if (!s_geometric_watching) {
+        s_geometric_watching = true;
+        geometric_watch(NULL);
+    }
+    sim_usb_host_send(packet, sizeof(packet));
+}
+
+static void geometric_watch_stop(void* arg)
+{
+    (void)arg;
+    s_geometric_watching = false;
+}
+
+static void report_geometric_timing(void)
+{
+    uint8_t started = 0;
+    int16_t late_min = 0x7FFF, late_max = -0x7FFF;
+    uint16_t first_step[GEOMETRIC_WATCHED] = { 0 };
+    for (uint8_t anim = 0; anim < CONCURRENT_GEOMETRIC_ANIMATIONS; ++anim) {
+        if (!s_geometric_seen[anim]) { continue; }
+        uint8_t steps = kGeometricSteps[geometric_animation_type[anim] & 0x03];
+        if (s_geometric_seen[anim] <= steps) { continue; } // never finished
+        for (uint8_t step = 1; step <= steps; ++step) {
+            int16_t late = (int16_t)(s_geometric_stepped[anim][step] - s_geometric_started[anim] -
+                                     step * GEOMETRIC_ANIMATION_STEP_TICKS);
+            if (late < late_min) { late_min = late; }
+            if (late > late_max) { late_max = late; }
+        }
+        if (started < GEOMETRIC_WATCHED) {
+            first_step[started] = s_geometric_stepped[anim][1] - s_geometric_started[anim];
+        }
+        ++started;
+    }
+    printf("geometric timing:         %u of %u animations run out, first steps %u and %u ticks, steps %d to %d ticks late (step %u)\n",
+           started, GEOMETRIC_WATCHED, first_step[0], first_step[1], started ? late_min : 0, started ? late_max : 0,
+           GEOMETRIC_ANIMATION_STEP_TICKS);
+    check(started == GEOMETRIC_WATCHED, "the host's geometric animations ran out");
+    check(started && late_min >= 0, "no animation step comes early");
+    check(late_max <= LED_REFRESH_LIMIT + 1, "every animation step lands by the refresh after it is due");
+}
+
+// Host time of a frame with some animations running, spread over the grid
+// and part way out.
+static void bench_geometric(uint8_t running)
+{
+    const uint32_t passes = 20000;
+    geometric_finish_all();
+    for (uint8_t n = 0; n < running; ++n) {
+        geometric_start((n * 37 + 5) & 63, n & 3, 1 + (n % 7));
+    }
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint32_t i = 0; i < passes; ++i) {
+        default_display_run();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("geometric frame, %2u running: %6.1f host ns per frame (%u keys lit)\n",
+           running, ns / passes, geometric_keys_lit());
+}
+
+static void report_geometric_results(void)
+{
+    feedback_clear();
+    g_key_state = 0;
+    sleep_minute_counter = 0;
+
+    // Every step of every shape from every button, one animation at a time.
+    // The checksum is the one the shapes' original key-by-key loops drew.
+    uint32_t sum = 0, frames = 0, lit = 0;
+    uint8_t square_ring = 0;
+    for (uint8_t type = 0; type < GEOMETRIC_ANIMATION_TYPES; ++type) {
+        for (uint8_t button = 0; button < NUM_BUTTONS; ++button) {
+            for (uint8_t step = 1; step < kGeometricSteps[type]; ++step) {
+                geometric_finish_all();
+                geometric_start(button, type, step);
+                default_display_run();
+                for (uint16_t j = 0; j < sizeof(g_display_buffer); ++j) { sum = sum * 31 + g_display_buffer[j]; }
+                uint8_t keys = geometric_keys_lit();
+                if (type == GEOMETRIC_ANIMATION_TYPE_SQUARE && button == 13 && step == 1) { square_ring = keys; } // row 3, column 1
+                lit += keys;
+                ++frames;
+            }
+        }
+    }
+    printf("geometric steps:          %u frames, %u keys lit (frame checksum %08x)\n", frames, lit, sum);
+    check(square_ring == 8, "a square's first step rings its button");
+    check(sum == 0xe6949400, "every step matches the key-by-key shapes");
+
+    // Drumming: as many animations as there are slots, started together, all
+    // keep running
+    geometric_finish_all();
+    for (uint8_t n = 0; n < CONCURRENT_GEOMETRIC_ANIMATIONS; ++n) {
+        geometric_start(n * 4, n & 3, 0);
+    }
+    system_time_ms += GEOMETRIC_ANIMATION_STEP_TICKS; // step them all
+    default_display_run();
+    uint8_t running = 0;
+    for (uint8_t anim = 0; anim < CONCURRENT_GEOMETRIC_ANIMATIONS; ++anim) {
+        running += geometric_animation_pos[anim] == 1;
+    }
+    printf("geometric drumming:       %u of %u started animations running\n", running, CONCURRENT_GEOMETRIC_ANIMATIONS);
+    check(running == CONCURRENT_GEOMETRIC_ANIMATIONS, "no animation was dropped");
+    check(CONCURRENT_GEOMETRIC_ANIMATIONS >= 16, "16 animations can run at once");
+
+    // A square runs while the animations aren't drawn, for just longer than
+    // system_time_ms takes to wrap, and is still finished when they are again
+    geometric_finish_all();
+    uint8_t stalled = geometric_start(9, GEOMETRIC_ANIMATION_TYPE_SQUARE, 0);
+    g_display_layers &= ~DISPLAY_LAYER_GEOMETRIC;
+    for (uint8_t n = 0; n < 64; ++n) {
+        system_time_ms += 1024;
+        default_display_run();
+    }
+    system_time_ms += GEOMETRIC_ANIMATION_STEP_TICKS;
+    g_display_layers |= DISPLAY_LAYER_GEOMETRIC;
+    default_display_run();
+    bool finished = geometric_animation_pos[stalled] >= GEOMETRIC_ANIMATION_STEPS_SQUARE;
+    printf("geometric stall:          square hidden for %u ticks %s\n", 65536 + GEOMETRIC_ANIMATION_STEP_TICKS,
+           finished ? "stays finished" : "restarted");
+    check(finished && geometric_keys_lit() == 0, "an animation stays finished when system_time_ms wraps");
+
+    // A one-shot sent for a key another animation covers starts in the
+    // frame it is seen, and runs once
+    geometric_finish_all();
+    geometric_start(13, GEOMETRIC_ANIMATION_TYPE_SQUARE, 1); // rings key 12
+    uint8_t oneshot = assign_geometric_animation_id;
+    InterpretUsbMidiMessage(rx_packet(0x9, 0x90 | ((G_EE_MIDI_CHANNEL + 1) & 0x0F), 12, 50 + GEOMETRIC_ANIMATION_TYPE_STAR));
+    default_display_run();
+    default_display_run();
+    check(geometric_animation_type[oneshot] == GEOMETRIC_ANIMATION_TYPE_STAR && geometric_animation_pos[oneshot] == 0 &&
+          assign_geometric_animation_id == (oneshot + 1) % CONCURRENT_GEOMETRIC_ANIMATIONS && !g_midi_note_state[1][12],
+          "a one-shot under another animation starts once");
+
+    bench_geometric(0);
+    bench_geometric(4);
+    bench_geometric(16);
+    geometric_finish_all();
+}
+
+
+// LED encoders ---------------------------------------------------------------
+
+#define ENCODER_BITS (SIM_LEDS_PER_STRAND * 24)
+
+static const uint8_t kPortbStrands[3] = { 0, 2, 3 };
+static const uint8_t kStrandOffset[4] = { 0, 48, 96, 144 };
+static uint32_t s_encoder_frames = 0;
+static uint32_t s_encoder_mismatches = 0;
+
+// Expected wire bits of one strand: two LEDs per key, each sending bits
+// 23..0 of the little endian word at its three bytes.
+static void encoder_expected(const uint8_t* buffer, uint8_t strand, uint8_t* bits)
+{
+    const uint8_t* src = buffer + kStrandOffset[strand];
+    uint16_t n = 0;
+    for (uint8_t led = 0; led < SIM_LEDS_PER_STRAND; ++led) {
+        const uint8_t* rgb = src + (led >> 1) * 3;
+        for (int8_t byte = 2; byte >= 0; --byte) {
+            for (int8_t bit = 7; bit >= 0; --bit) {
+                bits[n++] = (rgb[byte] >> bit) & 1;
+            }
+        }
+    }
+}
+
+// Send one buffer through the PORTB group encoders, and compare every
+// captured bit with the expected wire bits.
+static void encoder_check(uint8_t* buffer)
+{
+    uint8_t expected[ENCODER_BITS];
+    uint8_t captured[ENCODER_BITS + 1];
+
+    sim_led_capture_begin();
+    sim_cli();
+    led_update_pixel_group0(buffer);
+    led_update_pixel_group2(buffer + 96);
+    led_update_pixel_group3(buffer + 144);
+    sim_sei();
+    sim_delay_us(100); // reset latch
+    for (uint8_t i = 0; i < 3; ++i) {
+        uint8_t strand = kPortbStrands[i];
+        uint16_t count = sim_led_capture_end(strand, captured, sizeof(captured));
+        encoder_expected(buffer, strand, expected);
+        if (count != ENCODER_BITS || memcmp(captured, expected, ENCODER_BITS) != 0) {
+            printf("encoder mismatch:         strand %u, %u bits\n", strand, count);
+            s_encoder_mismatches++;
+        }
+    }
+    s_encoder_frames++;
+}
+
+static void setup_led_encoder(void)
+{
+    // +1: the encoders read a 32-bit word at the last key's colour.
+    uint8_t buffer[64 * 3 + 1];
+    memset(buffer, 0x00, sizeof(buffer));
+    encoder_check(buffer);
+    memset(buffer, 0xFF, sizeof(buffer));
+    encoder_check(buffer);
+    uint32_t seed = 0x12345678;
+    for (uint8_t round = 0; round < 8; ++round) {
+        for (size_t i = 0; i < sizeof(buffer); ++i) {
+            seed = seed * 1103515245UL + 12345UL;
+            buffer[i] = (uint8_t)(seed >> 16);
+        }
+        encoder_check(buffer);
+    }
+}
+
+
+// Scenarios ------------------------------------------------------------------
+
+static void setup_idle(void)
+{
+}
+
+// Key 0 held from power on, with the slowest key scan and deepest debounce
+// saved: the firmware should still see it and jump to the bootloader. Saving
+// the settings takes virtual time, so the firmware powers on after it.
+static uint64_t s_power_on;
+
+static void setup_boot_hold(void)
+{
+    eeprom_factory_reset();
+    G_EE_KEY_SCAN_PERIOD = KEY_SCAN_PERIOD_MAX;
+    G_EE_KEY_DEBOUNCE_DEPTH = KEY_DEBOUNCE_DEPTH_MAX;
+    eeprom_save_edits();
+    eeprom_read(EE_EEPROM_VERSION); // waits for the save to finish
+    cli();
+    contact_close((void*)0);
+    s_expected_stop = "jumped to bootloader";
+    s_power_on = sim_cycles;
+    s_duration_ms += (uint32_t)(sim_cycles_to_us(s_power_on) / 1000);
+}
+
+static void setup_keys(void)
+{
+    // One key at a time, 60ms presses 150ms apart, skipping key 0 which
+    // requests the bootloader if it is held at power on.
+    uint64_t t = MS(SCENARIO_START_MS);
+    for (uint8_t n = 0; n < 40; ++n) {
+        uint8_t key = (uint8_t)(1 + (n * 7) % 63);
+        schedule_press(key, t, MS(60));
+        t += MS(150);
+    }
+}
+
+static void setup_chord(void)
+{
+    // Sixteen keys closing on the same scan, ten times.
+    uint64_t t = MS(SCENARIO_START_MS);
+    for (uint8_t n = 0; n < 10; ++n) {
+        for (uint8_t key = 16; key < 32; ++key) {
+            schedule_press(key, t, MS(80));
+        }
+        t += MS(250);
+    }
+    sim_at(MS(s_duration_ms - 200), request_key_stats, (void*)4);
+}
+
+static void setup_key_events(void)
+{
+    // Single presses spread over every byte of the key masks, then chords
+    // across byte boundaries.
+    setup_keys();
+    uint64_t t = MS(SCENARIO_START_MS + 40 * 150);
+    for (uint8_t n = 0; n < 4; ++n) {
+        for (uint8_t key = 4 + n * 12; key < 20 + n * 12; ++key) {
+            schedule_press(key, t, MS(80));
+        }
+        t += MS(250);
+    }
+}
+
+static void setup_feedback(void)
+{
+    sim_at(MS(SCENARIO_START_MS), feedback_burst, NULL);
+    setup_keys();
+}
+
+static void setup_rx_fuzz(void)
+{
+    sim_at(MS(SCENARIO_START_MS), feedback_burst, NULL);
+}
+
+static void setup_rx_flood(void)
+{
+    sim_at(MS(SCENARIO_START_MS), flood_send_gap, NULL);
+    sim_at(MS(SCENARIO_START_MS + 100), flood_send, NULL);
+}
+
+static void setup_note_off(void)
+{
+    sim_at(MS(SCENARIO_START_MS), feedback_burst, NULL);
+    s_feedback_period_ms = 60000; // one refresh
+    sim_at(MS(SCENARIO_START_MS + 100), note_off_send, NULL);
+    sim_at(MS(SCENARIO_START_MS + 400), note_off_stop, NULL);
+}
+
+static void setup_geometric(void)
+{
+    sim_at(MS(SCENARIO_START_MS + 100), geometric_send, (void*)0);
+    sim_at(MS(SCENARIO_START_MS + 123), geometric_send, (void*)1); // 30 ticks into the square's first step
+    sim_at(MS(SCENARIO_START_MS + 1500), geometric_watch_stop, NULL);
+}
+
+static void setup_deaf_host(void)
+{
+    // A host that enumerates the device but never reads its IN endpoint.
+    sim_usb_set_host_listening(false);
+    setup_keys();
+}
+
+static void setup_profile(void)
+{
+    // Keys under LED feedback, then ask for the profile over sysex shortly
+    // before the end of the run.
+    setup_feedback();
+    sim_at(MS(s_duration_ms - 200), request_profile, NULL);
+    sim_at(MS(s_duration_ms - 150), request_stack_report, NULL);
+}
+
+static void setup_bounce(void)
+{
+    // Bouncy presses of 60ms, 150ms apart, and some 3ms blips that are too
+    // short to count as a press at all.
+    uint64_t t = MS(SCENARIO_START_MS);
+    for (uint8_t n = 0; n < 40; ++n) {
+        uint8_t key = (uint8_t)(1 + (n * 7) % 63);
+        schedule_bouncy_press(key, t, MS(60));
+        sim_at(t + MS(100), contact_close, (void*)(uintptr_t)(64 - key));
+        sim_at(t + MS(100) + 600 * SIM_CYCLES_PER_US, contact_open, (void*)(uintptr_t)(64 - key));
+        t += MS(150);
+    }
+    sim_at(MS(s_duration_ms - 200), request_key_stats, (void*)2);
+}
+
+static void setup_key_timing(void)
+{
+    // Halve the scan rate and debounce depth over sysex, then run the
+    // bounce scenario once the settings have been written to the EEPROM.
+    sim_at(MS(SCENARIO_START_MS), push_config, (void*)1);
+    uint64_t t = MS(SCENARIO_START_MS + 3500);
+    for (uint8_t n = 0; n < 40; ++n) {
+        uint8_t key = (uint8_t)(1 + (n * 7) % 63);
+        schedule_bouncy_press(key, t, MS(60));
+        sim_at(t + MS(100), contact_close, (void*)(uintptr_t)(64 - key));
+        sim_at(t + MS(100) + 600 * SIM_CYCLES_PER_US, contact_open, (void*)(uintptr_t)(64 - key));
+        t += MS(150);
+    }
+    sim_at(MS(s_duration_ms - 200), request_key_stats, (void*)2);
+}
+
+// Taps and a rolled chord played while a pushed set of idle colours and the
+// settings are written to the EEPROM. Every edge should still reach the
+// host, in the order it was played, and with the EEPROM written in the
+// background, promptly.
+static uint8_t s_eeprom_at_push[SIM_EEPROM_SIZE];
+
+static void snapshot_eeprom(void* arg)
+{
+    (void)arg;
+    memcpy(s_eeprom_at_push, sim_eeprom, sizeof(s_eeprom_at_push));
+}
+
+static void setup_stall(void)
+{
+    // A tap before the push, which keeps the key timing, so its debounce
+    // stats should survive it.
+    schedule_press(5, MS(SCENARIO_START_MS - 300), MS(40));
+    sim_at(MS(SCENARIO_START_MS - 200), reset_stats, (void*)5);
+    sim_at(MS(SCENARIO_START_MS - 100), push_idle_colors, NULL);
+    sim_at(MS(SCENARIO_START_MS) - 1, snapshot_eeprom, NULL);
+    sim_at(MS(SCENARIO_START_MS), push_config, NULL);
+    uint64_t t = MS(SCENARIO_START_MS + 300);
+    for (uint8_t key = 50; key >= 10; key -= 10) {
+        schedule_press(key, t, MS(40));
+        t += MS(10);
+    }
+    t += MS(200);
+    for (uint8_t key = 60; key > 52; --key) {
+        schedule_press(key, t, MS(150));
+        t += MS(3);
+    }
+    sim_at(MS(s_duration_ms - 250), request_key_stats, (void*)2);
+    sim_at(MS(s_duration_ms - 200), request_key_stats, (void*)3);
+    sim_at(MS(s_duration_ms - 150), request_key_stats, (void*)5);
+}
+
+static void report_boot_hold(void)
+{
+    printf("stopped:                  %s %.1f ms after power on\n", sim_stop_reason ? sim_stop_reason : "end of run",
+           sim_cycles_to_us(sim_cycles - s_power_on) / 1000.0);
+    check(sim_stop_reason && !strcmp(sim_stop_reason, "jumped to bootloader"),
+          "a key held at power on is debounced before the bootloader check");
+}
+
+static void report_common(void)
+{
+    printf("virtual time:             %.1f ms\n", sim_now_ms());
+    printf("USB configured:           %.1f ms after power on\n", sim_cycles_to_us(sim_usb.configured_cycle) / 1000.0);
+    printf("main loop passes:         %llu (%.0f per second)\n",
+           (unsigned long long)sim_usb.usb_tasks,
+           sim_usb.usb_tasks / (sim_now_ms() / 1000.0));
+    printf("LED frames per strand:    %llu %llu %llu %llu (%llu broken)\n",
+           (unsigned long long)sim_hw.led_frames[0],
+           (unsigned long long)sim_hw.led_frames[1],
+           (unsigned long long)sim_hw.led_frames[2],
+           (unsigned long long)sim_hw.led_frames[3],
+           (unsigned long long)sim_hw.led_broken_frames);
+#if ENABLE_LED_FRAME_SKIP > 0
+    printf("LED refreshes:            %u sent, %u skipped as unchanged\n",
+           g_led_frames_sent, g_led_frames_skipped);
+#endif
+    printf("longest cli() window:     %.1f us\n", sim_cycles_to_us(sim_hw.cli_max));
+    printf("Timer0 (keys) ISR:        %llu runs, %llu lost, latency avg %.1f us max %.1f us, longest %.1f us\n",
+           (unsigned long long)sim_hw.timer0.count,
+           (unsigned long long)sim_hw.timer0.lost,
+           sim_hw.timer0.count ? sim_cycles_to_us(sim_hw.timer0.latency_total / sim_hw.timer0.count) : 0.0,
+           sim_cycles_to_us(sim_hw.timer0.latency_max),
+           sim_cycles_to_us(sim_hw.timer0.duration_max));
+    printf("Timer1 (LEDs) ISR:        %llu runs, %llu lost, latency max %.1f us\n",
+           (unsigned long long)sim_hw.timer1.count,
+           (unsigned long long)sim_hw.timer1.lost,
+           sim_cycles_to_us(sim_hw.timer1.latency_max));
+    printf("USB OUT:                  %llu packets, %llu events, latency avg %.3f ms max %.3f ms, %u pending\n",
+           (unsigned long long)sim_usb.out_packets,
+           (unsigned long long)sim_usb.out_events,
+           sim_usb.out_packets ? sim_cycles_to_us(sim_usb.out_latency_total / sim_usb.out_packets) / 1000.0 : 0.0,
+           sim_cycles_to_us(sim_usb.out_latency_max) / 1000.0,
+           sim_usb_out_pending());
+    printf("USB IN:                   %llu packets, %llu events, %.1f ms blocked, %llu timeouts\n",
+           (unsigned long long)sim_usb.in_packets,
+           (unsigned long long)sim_usb.in_events,
+           sim_cycles_to_us(sim_usb.in_wait_cycles) / 1000.0,
+           (unsigned long long)sim_usb.in_timeouts);
+    printf("USB receive polls:        %llu (%.1f%% empty)\n",
+           (unsigned long long)sim_usb.rx_polls,
+           sim_usb.rx_polls ? 100.0 * sim_usb.rx_empty_polls / sim_usb.rx_polls : 0.0);
+    printf("EEPROM writes:            %llu (%.1f ms polling EEPE, %llu EE_READY interrupts)\n",
+           (unsigned long long)sim_hw.eeprom_writes,
+           sim_cycles_to_us(sim_hw.eeprom_busy_wait) / 1000.0,
+           (unsigned long long)sim_hw.ee_ready.count);
+}
+
+static void report_keys(void)
+{
+    report_common();
+    report_key_latency();
+}
+
+// Presses to a host that never reads should cost their events, not main
+// loop time spent waiting for an IN bank.
+static void report_deaf_host(void)
+{
+    report_keys();
+    printf("MIDI out dropped:         %u events\n", g_midi_tx_dropped);
+    check(sim_usb.in_timeouts == 0 && g_midi_tx_dropped > 0, "events to a deaf host are dropped without waiting");
+}
+
+static void report_profile(void)
+{
+    report_keys();
+    printf("\nmain loop profile (decaying histograms, read back over sysex):\n");
+    host_receive_sysex(print_profile_stage);
+    bool all = true;
+    for (uint8_t s = 0; s < PROFILE_NUM_STAGES; ++s) { all = all && s_profile_seen[s]; }
+    check(all, "profiler reply for every stage");
+    check(s_profile_loop_samples > 0, "profiler recorded main loop passes");
+
+    // A mark taken with interrupts off must leave them off.
+    sim_cli();
+    profile_mark();
+    bool still_off = !sim_interrupts_enabled();
+    sim_sei();
+    profile_mark();
+    check(still_off && sim_interrupts_enabled(), "profile_mark() keeps the caller's interrupt state");
+
+    host_receive_sysex(read_stack_report);
+    check(s_stack_report_seen, "stack report reply");
+    if (!s_stack_report_seen) { return; }
+    printf("\nstack report:             %u bytes static, %u free, %u never reached (sim stand-in)\n",
+           s_stack_report[0], s_stack_report[1], s_stack_report[2]);
+    check(s_stack_report[0] + s_stack_report[1] == RAMEND + 1 - RAMSTART && s_stack_report[2] <= s_stack_report[1],
+          "the stack report accounts for all of RAM");
+}
+
+// Release latency and the number of note events per key, which should be
+// exactly one NoteOn and one NoteOff per press despite the bounce.
+static void report_bounce(void)
+{
+    report_keys();
+
+    uint32_t note_ons = 0, note_offs = 0;
+    for (uint32_t j = 0; j < sim_usb_log_count; ++j) {
+        const uint8_t* e = sim_usb_log[j].event;
+        uint8_t cin = e[0] & 0x0F;
+        if (cin == 0x9 && e[3]) { note_ons++; }
+        if (cin == 0x8 || (cin == 0x9 && !e[3])) { note_offs++; }
+    }
+
+    uint32_t matched = 0;
+    uint64_t total = 0, worst = 0;
+    for (uint32_t i = 0; i < s_release_count; ++i) {
+        uint8_t note = MIDI_BASENOTE + s_releases[i].key;
+        for (uint32_t j = 0; j < sim_usb_log_count; ++j) {
+            const sim_usb_event_t* e = &sim_usb_log[j];
+            uint8_t cin = e->event[0] & 0x0F;
+            if (e->cycle < s_releases[i].cycle || e->event[2] != note) { continue; }
+            if (cin == 0x8 || (cin == 0x9 && !e->event[3])) {
+                uint64_t latency = e->cycle - s_releases[i].cycle;
+                total += latency;
+                if (latency > worst) { worst = latency; }
+                matched++;
+                break;
+            }
+        }
+    }
+    printf("release to USB latency:   avg %.3f ms, max %.3f ms\n",
+           matched ? sim_cycles_to_us(total / matched) / 1000.0 : 0.0,
+           sim_cycles_to_us(worst) / 1000.0);
+    printf("note events:              %u NoteOn, %u NoteOff for %u presses\n",
+           note_ons, note_offs, s_press_count);
+    check(note_ons == s_press_count && note_offs == s_press_count,
+          "one NoteOn and one NoteOff per bouncy press, none for blips");
+
+    // Host time of the debounce work per key sample: one ISR update plus
+    // the key_read() calls the main loop makes between two samples.
+    uint32_t reads = sim_hw.timer0.count ? (uint32_t)(sim_usb.usb_tasks / sim_hw.timer0.count) : 1;
+    uint64_t sample = 0;
+    uint32_t seed = 1;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint32_t i = 0; i < 1000000; ++i) {
+        seed = seed * 1103515245UL + 12345UL;
+        sample ^= 1ULL << ((seed >> 16) & 63);
+        key_debounce_sample(sample);
+        for (uint32_t r = 0; r < reads; ++r) { key_read(); }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("debounce cost (host):     %.1f ns per sample (with %u key_read() calls)\n",
+           ns / 1000000.0, reads);
+    report_key_stats();
+}
+
+static void report_key_timing(void)
+{
+    report_bounce();
+    printf("key timing:               scan every %u x 0.768 ms, %u sample debounce (config reply %d, %d)\n",
+           g_key_scan_period, G_EE_KEY_DEBOUNCE_DEPTH, s_config_scan_period, s_config_debounce_depth);
+    check(s_config_scan_period == PUSH_SCAN_PERIOD && s_config_debounce_depth == PUSH_DEBOUNCE_DEPTH,
+          "config reply carries the pushed key timing");
+    check(g_key_scan_period == PUSH_SCAN_PERIOD && G_EE_KEY_DEBOUNCE_DEPTH == PUSH_DEBOUNCE_DEPTH,
+          "pushed key timing in effect");
+    check(G_EE_MIDI_CHANNEL == s_channel_at_push, "a pushed MIDI channel over 16 is refused");
+}
+
+static void report_key_events(void)
+{
+    report_keys();
+    uint32_t note_ons = 0, note_offs = 0;
+    for (uint32_t j = 0; j < sim_usb_log_count; ++j) {
+        const uint8_t* e = sim_usb_log[j].event;
+        uint8_t cin = e[0] & 0x0F;
+        if (cin == 0x9 && e[3]) { note_ons++; }
+        if (cin == 0x8 || (cin == 0x9 && !e[3])) { note_offs++; }
+    }
+    printf("note events:              %u NoteOn, %u NoteOff for %u presses\n",
+           note_ons, note_offs, s_press_count);
+    check(note_ons == s_press_count && note_offs == s_press_count,
+          "one NoteOn and one NoteOff per press");
+
+    // The host keeps reading the IN endpoint, so the benchmark's notes drain
+    // as they would in the main loop.
+    bench_key_events("no keys:", 0);
+    bench_key_events("one key:", 1ULL << 37);
+    bench_key_events("16 keys:", 0x0000FFFF00000000ULL);
+    check_key_event_overflow();
+}
+
+// The chords' notes should go out a bank at a time.
+static void report_chord(void)
+{
+    report_keys();
+    host_receive_sysex(read_key_replies);
+    check(s_midi_out_stats_seen, "MIDI out stats reply");
+    if (!s_midi_out_stats_seen) { return; }
+    printf("MIDI out:                 %u packets, %u events, %u dropped, at most %u packets per USB frame\n",
+           s_midi_out_stats[0], s_midi_out_stats[1], s_midi_out_stats[2], s_midi_out_stats[3]);
+    check(s_midi_out_stats[1] == 2 * s_press_count, "MIDI out counted every note");
+    check(s_midi_out_stats[0] == (s_midi_out_stats[1] + 15) / 16, "chord notes packed into full banks");
+}
+
+// The copy of the image eeprom_setup() reads first: 0, or EE_IMAGE_B if
+// its sequence number is the newer.
+static uint16_t eeprom_newer_image(void)
+{
+    return (int8_t)(sim_eeprom[EE_IMAGE_B + EE_IMAGE_SEQUENCE] - sim_eeprom[EE_IMAGE_SEQUENCE]) > 0 ? EE_IMAGE_B : 0;
+}
+
+// What the stall scenario saved: the EEPROM should hold the pushed colours,
+// and the background writer should only have written the bytes that changed.
+static void report_stall_eeprom(void)
+{
+    uint16_t mismatched = 0, changed = 0;
+    uint16_t image = eeprom_newer_image();
+    for (uint16_t i = 0; i < NUM_BANKS * NUM_BUTTONS * KEY_COLOR_BYTES; ++i) {
+        mismatched += sim_eeprom[image + EE_COLORS_IDLE + i] != ((uint8_t*)default_bank_inactive)[i];
+        mismatched += sim_eeprom[image + EE_COLORS_ACTIVE + i] != ((uint8_t*)default_bank_active)[i];
+    }
+    for (uint16_t a = 0; a < SIM_EEPROM_SIZE; ++a) {
+        changed += sim_eeprom[a] != s_eeprom_at_push[a];
+    }
+    printf("EEPROM save:              %u bytes changed, %u colour bytes differ from RAM\n", changed, mismatched);
+    check(mismatched == 0, "the EEPROM holds the pushed colours");
+    check(s_press_latency_max_ms < 20, "taps reached the host while the EEPROM was written");
+
+    check(s_eeprom_stats_seen, "EEPROM writer stats reply");
+    if (!s_eeprom_stats_seen) { return; }
+    printf("EEPROM writer:            %u pending, %u written, %u unchanged\n",
+           s_eeprom_stats[0], s_eeprom_stats[1], s_eeprom_stats[2]);
+    check(s_eeprom_stats[0] == 0, "the EEPROM save finished");
+    check(s_eeprom_stats[1] == changed, "only the changed bytes were written");
+}
+
+// Config push round trip, then the saved image: how long eeprom_setup()
+// takes to load it, that a save cut short or a corrupted copy of the image
+// falls back to the other copy, and that images saved by older layouts are
+// kept.
+static uint64_t s_push_cycle = 0;
+
+static void eeprom_push(void* arg)
+{
+    s_push_cycle = sim_cycles;
+    push_config(arg);
+}
+
+static void setup_eeprom(void)
+{
+    sim_at(MS(SCENARIO_START_MS - 100), push_idle_colors, NULL);
+    sim_at(MS(SCENARIO_START_MS), eeprom_push, NULL);
+}
+
+// When the last packet of the device's config reply to the push reached the
+// host, 0 if it never did.
+static uint64_t config_reply_cycle(void)
+{
+    for (uint32_t j = 0; j + 1 < sim_usb_log_count; ++j) {
+        const uint8_t* e = sim_usb_log[j].event;
+        const uint8_t* next = sim_usb_log[j + 1].event;
+        if (sim_usb_log[j].cycle < s_push_cycle || (e[0] & 0x0F) != 0x4 || e[1] != 0xF0 ||
+            next[1] != (MANUFACTURER_ID & 0x7F) || next[2] != 0x02 || next[3] != 0x01) {
+            continue;
+        }
+        for (uint32_t k = j + 1; k < sim_usb_log_count; ++k) {
+            uint8_t cin = sim_usb_log[k].event[0] & 0x0F;
+            if (cin >= 0x5 && cin <= 0x7) { return sim_usb_log[k].cycle; }
+        }
+    }
+    return 0;
+}
+
+// Whether the EEPROM boots back into the settings and colours in RAM, as
+// eeprom_setup() checks it: an image whose copies both fail their CRC is
+// reset, and so rewritten.
+static bool eeprom_boots_as_saved(void)
+{
+    eeprom_read(EE_EEPROM_VERSION); // waits for the save to finish
+    uint8_t settings[] = { G_EE_MIDI_CHANNEL, G_EE_MIDI_VELOCITY, G_EE_ANIMATIONS, G_EE_TILT_MASK,
+                           G_EE_SLEEP_TIME, G_EE_KEY_SCAN_PERIOD, G_EE_KEY_DEBOUNCE_DEPTH };
+    uint8_t colors[sizeof(default_bank_inactive) + sizeof(default_bank_active)];
+    memcpy(colors, default_bank_inactive, sizeof(default_bank_inactive));
+    memcpy(colors + sizeof(default_bank_inactive), default_bank_active, sizeof(default_bank_active));
+    uint64_t writes = sim_hw.eeprom_writes;
+    eeprom_setup();
+    eeprom_read(EE_EEPROM_VERSION);
+    uint8_t loaded[] = { G_EE_MIDI_CHANNEL, G_EE_MIDI_VELOCITY, G_EE_ANIMATIONS, G_EE_TILT_MASK,
+                         G_EE_SLEEP_TIME, G_EE_KEY_SCAN_PERIOD, G_EE_KEY_DEBOUNCE_DEPTH };
+    return sim_hw.eeprom_writes == writes && !memcmp(settings, loaded, sizeof(settings)) &&
+           !memcmp(colors, default_bank_inactive, sizeof(default_bank_inactive)) &&
+           !memcmp(colors + sizeof(default_bank_inactive), default_bank_active, sizeof(default_bank_active));
+}
+
+// Save the settings and colours in RAM as layouts 4 and 5 did: one image at
+// 0, under a CRC without a sequence number, with the channel edited to
+// channel in a record at journal. Whether eeprom_setup() keeps it, with the
+// edit, and saves it again in this layout.
+static bool eeprom_keeps_one_image(uint8_t layout, uint16_t journal, uint16_t journal_end, uint8_t channel)
+{
+    static uint8_t* const kSettings[] = { // in the order of eeprom_settings[] in eeprom.c
+        &G_EE_MIDI_CHANNEL, &G_EE_MIDI_VELOCITY, &G_EE_COMBOS_ENABLE, &G_EE_MIDI_OUTPUT_MODE,
+        &G_EE_FOUR_BANKS_MODE, &G_EE_TILT_MODE, &G_EE_TILT_MASK, &G_EE_ANIMATIONS, &G_EE_TILT_SENSITIVITY,
+        &G_EE_PITCH_SENSITIVITY, &G_EE_TILT_RANGE, &G_EE_PITCH_RANGE, &G_EE_TILT_DEADZONE, &G_EE_PITCH_DEADZONE,
+        &G_EE_TILT_AXIS, &G_EE_PICK_SENSITIVITY, &G_EE_SLEEP_TIME, &G_EE_SIDE_BANK, &G_EE_KEY_SCAN_PERIOD,
+        &G_EE_KEY_DEBOUNCE_DEPTH };
+    static const uint8_t kAddresses[] = {
+        EE_MIDI_CHANNEL, EE_MIDI_VELOCITY, EE_COMBOS_ENABLE, EE_MIDI_OUTPUT_MODE, EE_FOUR_BANKS_MODE,
+        EE_TILT_MODE, EE_TILT_MASK, EE_ANIMATIONS, EE_TILT_SENSITIVITY, EE_PITCH_SENSITIVITY, EE_TILT_RANGE,
+        EE_PITCH_RANGE, EE_TILT_DEADZONE, EE_PITCH_DEADZONE, EE_TILT_AXIS, EE_PICK_SENSITIVITY, EE_SLEEP_TIME,
+        EE_SIDE_BANK, EE_KEY_SCAN_PERIOD, EE_KEY_DEBOUNCE_DEPTH };
+    eeprom_read(EE_EEPROM_VERSION); // waits for the save to finish
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < sizeof(kAddresses); ++i) {
+        sim_eeprom[kAddresses[i]] = *kSettings[i];
+        crc = _crc_ccitt_update(crc, *kSettings[i]);
+    }
+    for (uint16_t i = 0; i < 2 * NUM_BANKS * NUM_BUTTONS; ++i) {
+        uint8_t color = i < NUM_BANKS * NUM_BUTTONS ? ((uint8_t*)default_bank_inactive)[i] :
+                                                      ((uint8_t*)default_bank_active)[i - NUM_BANKS * NUM_BUTTONS];
+        sim_eeprom[EE_COLORS_IDLE + i] = color;
+        crc = _crc_ccitt_update(crc, color);
+    }
+    sim_eeprom[EE_IMAGE_CRC] = crc & 0xFF;
+    sim_eeprom[EE_IMAGE_CRC + 1] = crc >> 8;
+    memset(sim_eeprom + journal, 0xFF, journal_end - journal);
+    uint8_t check = _crc8_ccitt_update(0, EE_MIDI_CHANNEL & 0xFF);
+    check = _crc8_ccitt_update(check, EE_MIDI_CHANNEL >> 8);
+    memcpy(sim_eeprom + journal, (const uint8_t[]){ channel, EE_MIDI_CHANNEL & 0xFF,
+                                                    _crc8_ccitt_update(check, channel), EE_MIDI_CHANNEL >> 8 }, 4);
+    sim_eeprom[EE_EEPROM_VERSION] = layout;
+
+    G_EE_MIDI_CHANNEL = 0xEE;
+    uint64_t writes = sim_hw.eeprom_writes;
+    eeprom_setup();
+    eeprom_read(EE_EEPROM_VERSION);
+    printf("layout %u image:           kept, %llu bytes written to save it in layout %u\n", layout,
+           (unsigned long long)(sim_hw.eeprom_writes - writes), EEPROM_LAYOUT);
+    return G_EE_MIDI_CHANNEL == channel && sim_eeprom[EE_EEPROM_VERSION] == EEPROM_LAYOUT && eeprom_boots_as_saved();
+}
+
+static void report_eeprom(void)
+{
+    report_common();
+    uint64_t reply = config_reply_cycle();
+    printf("config push round trip:   %.1f ms\n", reply ? sim_cycles_to_us(reply - s_push_cycle) / 1000.0 : 0.0);
+    check(reply != 0, "the config push was answered");
+
+    // Load the saved image, as at boot
+    eeprom_read(EE_EEPROM_VERSION); // waits for the save to finish
+    uint8_t colors[NUM_BANKS * NUM_BUTTONS * KEY_COLOR_BYTES];
+    memcpy(colors, default_bank_inactive, sizeof(colors));
+    uint64_t writes = sim_hw.eeprom_writes;
+    uint64_t start = sim_cycles;
+    eeprom_setup();
+    printf("eeprom_setup():           %.1f us on a saved image\n", sim_cycles_to_us(sim_cycles - start));
+    check(sim_hw.eeprom_writes == writes, "a saved image loads without being rewritten");
+    check(!memcmp(colors, default_bank_inactive, sizeof(colors)), "the saved image loads back as saved");
+
+    // The same setting changed and saved over and over, as a utility does
+    enum { kEdits = 56 };
+    memset(sim_eeprom_cell_writes, 0, sizeof(sim_eeprom_cell_writes));
+    writes = sim_hw.eeprom_writes;
+    for (int i = 0; i < kEdits; ++i) {
+        G_EE_MIDI_CHANNEL = (G_EE_MIDI_CHANNEL + 1) & 0x0F;
+        eeprom_save_edits();
+        eeprom_read(EE_EEPROM_VERSION);
+    }
+    uint32_t worn = 0;
+    for (uint16_t a = 0; a < SIM_EEPROM_SIZE; ++a) {
+        if (sim_eeprom_cell_writes[a] > worn) { worn = sim_eeprom_cell_writes[a]; }
+    }
+    printf("%d edits of one setting:  %llu bytes written, most worn cell written %u times\n", kEdits,
+           (unsigned long long)(sim_hw.eeprom_writes - writes), worn);
+    uint8_t channel = G_EE_MIDI_CHANNEL;
+    G_EE_MIDI_CHANNEL = 0xEE;
+    start = sim_cycles;
+    eeprom_setup();
+    printf("eeprom_setup():           %.1f us after the edits\n", sim_cycles_to_us(sim_cycles - start));
+    check(G_EE_MIDI_CHANNEL == channel, "the last edit loads back");
+    check(worn <= kEdits / 8, "the edits were spread over the journal");
+
+    check(eeprom_boots_as_saved(), "the saved image boots as saved");
+
+    // One setting journaled, then every idle colour changed with it, too
+    // many edits for the journal, so the older copy is rewritten
+    G_EE_MIDI_CHANNEL = channel = (channel + 1) & 0x0F;
+    eeprom_save_edits();
+    eeprom_read(EE_EEPROM_VERSION);
+    static uint8_t before[SIM_EEPROM_SIZE], after[SIM_EEPROM_SIZE];
+    memcpy(before, sim_eeprom, sizeof(before));
+    memcpy(colors, default_bank_inactive, sizeof(colors));
+    uint8_t edited[sizeof(colors)];
+    for (uint16_t key = 0; key < sizeof(edited); ++key) {
+        edited[key] = (colors[key] + 1) % DISPLAY_PALETTE_SIZE;
+    }
+    memcpy(default_bank_inactive, edited, sizeof(edited));
+    G_EE_MIDI_CHANNEL = (channel + 1) & 0x0F;
+    eeprom_save_edits();
+    eeprom_read(EE_EEPROM_VERSION);
+    memcpy(after, sim_eeprom, sizeof(after));
+    uint16_t image = eeprom_newer_image();
+    check(image != ((int8_t)(before[EE_IMAGE_B + EE_IMAGE_SEQUENCE] - before[EE_IMAGE_SEQUENCE]) > 0 ? EE_IMAGE_B : 0),
+          "a compaction rewrites the older copy");
+
+    // Power lost half way through the idle colours of that copy: the newer
+    // copy loads, with its journal
+    memcpy(sim_eeprom, before, sizeof(before));
+    memcpy(sim_eeprom + image + EE_MIDI_CHANNEL, after + image + EE_MIDI_CHANNEL, EE_IMAGE_CRC - EE_MIDI_CHANNEL);
+    memcpy(sim_eeprom + image + EE_COLORS_IDLE, after + image + EE_COLORS_IDLE, sizeof(edited) / 2);
+    eeprom_setup();
+    check(G_EE_MIDI_CHANNEL == channel && !memcmp(colors, default_bank_inactive, sizeof(colors)) &&
+          eeprom_boots_as_saved(), "a save cut short loads the image from before it");
+
+    // Power lost once that copy was saved, before the journal was cleared:
+    // the records over the other copy are left out
+    memcpy(sim_eeprom, after, sizeof(after));
+    memcpy(sim_eeprom + EE_JOURNAL, before + EE_JOURNAL, EE_JOURNAL_END - EE_JOURNAL);
+    eeprom_setup();
+    check(G_EE_MIDI_CHANNEL == ((channel + 1) & 0x0F) && !memcmp(edited, default_bank_inactive, sizeof(edited)) &&
+          eeprom_boots_as_saved(), "a journal left from before the save is not replayed");
+
+    // A worn cell in the newer copy: the older loads, with the record over it
+    sim_eeprom[image + EE_COLORS_ACTIVE + 100] ^= 0x10;
+    eeprom_setup();
+    check(G_EE_MIDI_CHANNEL == channel && !memcmp(colors, default_bank_inactive, sizeof(colors)) &&
+          eeprom_boots_as_saved(), "a corrupted copy falls back to the other");
+
+    sim_eeprom[(image ^ EE_IMAGE_B) + EE_COLORS_ACTIVE + 100] ^= 0x10;
+    eeprom_setup();
+    eeprom_read(EE_EEPROM_VERSION);
+    check(memcmp(colors, default_bank_inactive, sizeof(colors)) && eeprom_boots_as_saved(),
+          "an image with both copies corrupted is reset to the defaults");
+
+    // Images saved before the second copy was added, with an edit in the
+    // journal where each layout kept it
+    channel = (G_EE_MIDI_CHANNEL + 1) & 0x0F;
+    check(eeprom_keeps_one_image(EEPROM_LAYOUT_JOURNAL_HIGH, EE_JOURNAL_HIGH, EE_JOURNAL_HIGH_END, channel),
+          "a layout 4 image is kept with the edits in its journal");
+    channel = (channel + 1) & 0x0F;
+    check(eeprom_keeps_one_image(EEPROM_LAYOUT_ONE_IMAGE, EE_JOURNAL, EE_JOURNAL_END, channel),
+          "a layout 5 image is kept with the edits in its journal");
+
+    sim_eeprom[EE_EEPROM_VERSION] = EEPROM_LAYOUT_NO_CRC;
+    sim_eeprom[EE_IMAGE_CRC] = sim_eeprom[EE_IMAGE_CRC + 1] = 0xFF;
+    // Saved as three bytes per key, with key 1 a blue off the palette
+    for (uint16_t key = 0; key < 2 * NUM_BANKS * NUM_BUTTONS; ++key) {
+        uint8_t index = key < NUM_BANKS * NUM_BUTTONS ? ((uint8_t*)default_bank_inactive)[key] :
+                                                        ((uint8_t*)default_bank_active)[key - NUM_BANKS * NUM_BUTTONS];
+        memcpy(sim_eeprom + EE_COLORS_RGB_IDLE + key * 3, default_color[index], 3);
+    }
+    memcpy(colors, default_bank_inactive, sizeof(colors));
+    sim_eeprom[EE_COLORS_RGB_IDLE + 3] = sim_eeprom[EE_COLORS_RGB_IDLE + 4] = 0;
+    sim_eeprom[EE_COLORS_RGB_IDLE + 5] = 0x2A;
+    colors[1] = display_palette_index(sim_eeprom + EE_COLORS_RGB_IDLE + 3);
+    check(!memcmp(default_color[colors[1]], (const uint8_t[]){ 0, 0, 48 }, 3), "an off-palette blue is nearest blue");
+    writes = sim_hw.eeprom_writes;
+    eeprom_setup();
+    eeprom_read(EE_EEPROM_VERSION);
+    printf("layout %u image:           kept, %llu bytes written to save it in layout %u\n", EEPROM_LAYOUT_NO_CRC,
+           (unsigned long long)(sim_hw.eeprom_writes - writes), EEPROM_LAYOUT);
+    check(!memcmp(colors, default_bank_inactive, sizeof(colors)) && sim_eeprom[EE_EEPROM_VERSION] == EEPROM_LAYOUT &&
+          eeprom_boots_as_saved(), "a layout 1 image is kept and given a CRC");
+}
+
+static void report_stall(void)
+{
+    report_keys();
+    uint32_t note_ons = 0, in_order = 0;
+    for (uint32_t j = 0; j < sim_usb_log_count; ++j) {
+        const uint8_t* e = sim_usb_log[j].event;
+        if ((e[0] & 0x0F) == 0x9 && e[3]) {
+            if (note_ons < s_press_count && e[2] == MIDI_BASENOTE + s_presses[note_ons].key) {
+                in_order++;
+            }
+            note_ons++;
+        }
+    }
+    printf("note events:              %u NoteOn for %u presses, %u in the order played\n",
+           note_ons, s_press_count, in_order);
+    check(note_ons == s_press_count, "every tap played during the stall reached the host");
+    check(in_order == s_press_count, "notes reached the host in the order played");
+
+    host_receive_sysex(read_key_replies);
+    check(s_key_stats_seen && s_key_stats[1] == s_press_count,
+          "a settings push that keeps the key timing keeps the debounce stats");
+    report_stall_eeprom();
+    check(s_queue_stats_seen, "key event queue stats reply");
+    if (!s_queue_stats_seen) { return; }
+    printf("key event queue:          %u edges, %u dropped, wait max %.1f ms avg %.1f ms\n",
+           s_queue_stats[0], s_queue_stats[1],
+           s_queue_stats[2] * 0.768, s_queue_stats[3] * 0.768);
+    check(s_queue_stats[1] == 0, "no key edges dropped");
+}
+
+static void report_rx_fuzz(void)
+{
+    report_common();
+    report_rx_fuzz_results();
+}
+
+static void report_rx_flood(void)
+{
+    report_common();
+    report_rx_flood_results();
+}
+
+static void report_note_off(void)
+{
+    report_common();
+    report_note_off_results();
+}
+
+static void report_compose(void)
+{
+    report_common();
+    report_compose_results();
+}
+
+static void report_geometric(void)
+{
+    report_common();
+    report_geometric_timing();
+    report_geometric_results();
+}
+
+static void report_led_encoder(void)
+{
+    report_common();
+    printf("encoder frames checked:   %u (%u strand mismatches)\n",
+           s_encoder_frames, s_encoder_mismatches);
+    check(s_encoder_mismatches == 0, "LED encoders produce the expected bits");
+    check(sim_hw.led_broken_frames == 0, "no broken LED frames");
+}
+
+
+static const scenario_t kScenarios[] = {
+    { "idle",      "boot, enumerate and idle",                        5000, setup_idle,      report_common },
+    { "boot-hold", "key 0 held at power on, slowest scan and debounce", 500, setup_boot_hold, report_boot_hold },
+    { "keys",      "single key presses",                              10000, setup_keys,     report_keys },
+    { "chord",     "sixteen-key chords",                              6500, setup_chord,     report_chord },
+    { "feedback",  "key presses under a 64-note LED feedback flood",  10000, setup_feedback, report_keys },
+    { "deaf-host", "key presses to a host that never reads",          10000, setup_deaf_host, report_deaf_host },
+    { "profile",   "main loop stage timings under feedback",          8000, setup_profile,   report_profile },
+    { "bounce",    "bouncy presses and short blips",                  10000, setup_bounce,   report_bounce },
+    { "led-encoder", "LED encoders against the expected wire bits",   4000, setup_led_encoder, report_led_encoder },
+    { "key-events", "key presses and chords, then key event stage timings", 11000, setup_key_events, report_key_events },
+    { "rx-fuzz",   "LED feedback, then receive dispatch fuzzing",     5000, setup_rx_fuzz,   report_rx_fuzz },
+    { "rx-flood",  "a hundred LED refreshes queued at once",         4000, setup_rx_flood,  report_rx_flood },
+    { "compose",   "MIDI feedback and whole-frame compositing, 64 keys pulsing", 4000, setup_idle, report_compose },
+    { "geometric", "host-started animation timing, every step, 16 drummed at once", 5500, setup_geometric, report_geometric },
+    { "note-off",  "LED feedback NoteOffs across the clock wrap",    4500, setup_note_off,  report_note_off },
+    { "eeprom",    "config push round trip, then loading and checking the saved image", 9000, setup_eeprom, report_eeprom },
+    { "stall",     "taps and a rolled chord during an EEPROM write",  8000, setup_stall,     report_stall },
+    { "key-timing", "bouncy presses after halving the key scan rate", 13500, setup_key_timing, report_key_timing },
+};
+
+#define NUM_SCENARIOS (sizeof(kScenarios) / sizeof(kScenarios[0]))
+
+
+// EEPROM image ---------------------------------------------------------------
+
+static void eeprom_load(void)
+{
+    memset(sim_eeprom, 0xFF, sizeof(sim_eeprom));
+    if (!s_eeprom_file) { return; }
+    FILE* f = fopen(s_eeprom_file, "rb");
+    if (!f) { return; }
+    size_t n = fread(sim_eeprom, 1, sizeof(sim_eeprom), f);
+    (void)n;
+    fclose(f);
+}
+
+static void eeprom_save(void)
+{
+    if (!s_eeprom_file) { return; }
+    FILE* f = fopen(s_eeprom_file, "wb");
+    if (!f) { perror(s_eeprom_file); return; }
+    fwrite(sim_eeprom, 1, sizeof(sim_eeprom), f);
+    fclose(f);
+}
+
+
+// Main -----------------------------------------------------------------------
+
+static void usage(void)
+{
+    printf("usage: mf64sim [-s scenario] [-t ms] [-e eeprom.bin]\n\n");
+    printf("  -s scenario   scenario to run (default idle)\n");
+    printf("  -t ms         virtual run time in milliseconds\n");
+    printf("  -e file       load and save the EEPROM image\n\n");
+    printf("scenarios:\n");
+    for (size_t i = 0; i < NUM_SCENARIOS; ++i) {
+        printf("  %-10s %s\n", kScenarios[i].name, kScenarios[i].description);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = "idle";
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            name = argv[++i];
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            s_duration_ms = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            s_eeprom_file = argv[++i];
+        } else {
+            usage();
+            return !strcmp(argv[i], "-h") ? 0 : 1;
+        }
+    }
+
+    const scenario_t* scenario = NULL;
+    for (size_t i = 0; i < NUM_SCENARIOS; ++i) {
+        if (!strcmp(kScenarios[i].name, name)) { scenario = &kScenarios[i]; }
+    }
+    if (!scenario) {
+        fprintf(stderr, "mf64sim: unknown scenario '%s'\n", name);
+        usage();
+        return 1;
+    }
+    if (!s_duration_ms) { s_duration_ms = scenario->duration_ms; }
+
+    eeprom_load();
+    sim_reset_stats();
+    sim_usb_setup();
+    scenario->setup();
+
+    bool ok = sim_run_firmware(MS(s_duration_ms));
+    if (!ok && s_expected_stop && !strcmp(sim_stop_reason, s_expected_stop)) {
+        ok = true;
+    }
+
+    printf("scenario:                 %s - %s\n", scenario->name, scenario->description);
+    scenario->report();
+    if (!ok) {
+        printf("stopped early:            %s\n", sim_stop_reason);
+    }
+    eeprom_save();
+    return ok && !s_failed ? 0 : 1;
+}
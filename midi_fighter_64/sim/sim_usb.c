@@ -0,0 +1,621 @@
+// USB and LUFA MIDI class model for the Midifighter 64 host simulation
+//
+//   Copyright (C) 2016 DJ Techtools
+//
+
+ /* DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <LUFA/Drivers/USB/USB.h>
+
+#include "sim.h"
+
+// USB model for the host simulation: enumeration, the two bulk endpoints of
+// the MIDI streaming interface, and a host that sends OUT packets and
+// collects IN packets. Endpoint primitives charge roughly what the LUFA
+// inline functions cost on the ATmega32U4, and the MIDI class driver below
+// mirrors LUFA's MIDIClassDevice.c so the firmware exercises the same
+// sequence of endpoint operations it does on hardware.
+
+sim_usb_stats_t sim_usb;
+sim_usb_event_t sim_usb_log[SIM_USB_LOG_SIZE];
+uint32_t sim_usb_log_count = 0;
+
+volatile uint8_t USB_DeviceState = DEVICE_STATE_Unattached;
+
+// Cycle costs of the endpoint primitives (register access plus call).
+#define SIM_USB_SELECT_CYCLES   6
+#define SIM_USB_STATUS_CYCLES   4
+#define SIM_USB_DATA_CYCLES     4
+#define SIM_USB_CLEAR_CYCLES    6
+#define SIM_USB_STREAM_CYCLES   10  // per byte of Endpoint_*_Stream_LE
+#define SIM_USB_CALL_CYCLES     12  // class driver call and state check
+#define SIM_USB_TASK_CYCLES     40  // USB_USBTask control endpoint check
+#define SIM_USB_WAIT_CYCLES     12  // one spin of Endpoint_WaitUntilReady
+
+// Enumeration timeline after USB_Init().
+#define SIM_USB_CONNECT_MS      5
+#define SIM_USB_CONFIGURE_MS    120
+
+#define SIM_USB_MAX_BANKS       2
+#define SIM_USB_MAX_SIZE        64
+
+typedef struct {
+    uint8_t  address;
+    uint16_t size;
+    uint8_t  banks;
+    bool     configured;
+    uint8_t  data[SIM_USB_MAX_BANKS][SIM_USB_MAX_SIZE];
+    uint16_t length[SIM_USB_MAX_BANKS];
+    uint16_t position[SIM_USB_MAX_BANKS];
+    bool     full[SIM_USB_MAX_BANKS];      // owned by the USB side
+    uint64_t done_cycle[SIM_USB_MAX_BANKS]; // IN: host finishes reading
+    uint64_t submit_cycle[SIM_USB_MAX_BANKS]; // OUT: host queued the packet
+    uint64_t arrive_cycle[SIM_USB_MAX_BANKS]; // OUT: packet landed in the bank
+    uint64_t free_cycle[SIM_USB_MAX_BANKS];   // OUT: firmware released the bank
+    uint8_t  cpu_bank;   // bank the firmware reads or fills
+    uint8_t  usb_bank;   // bank the USB side fills (OUT) or drains (IN)
+} sim_endpoint_t;
+
+static sim_endpoint_t s_ep_out;
+static sim_endpoint_t s_ep_in;
+static sim_endpoint_t* s_selected = NULL;
+static uint8_t s_selected_address = 0;
+
+// Packets the host has queued for the OUT endpoint.
+typedef struct {
+    uint64_t submit_cycle;
+    uint16_t length;
+    uint8_t  data[SIM_USB_MAX_SIZE];
+} sim_host_packet_t;
+
+static sim_host_packet_t* s_host_queue = NULL;
+static uint32_t s_host_head = 0;
+static uint32_t s_host_tail = 0;
+static uint32_t s_host_capacity = 0;
+static uint64_t s_host_bus_free = 0;   // the bus is busy until this cycle
+static bool     s_host_listening = true;
+
+static uint64_t s_init_cycle = 0;
+static bool     s_initialised = false;
+static uint64_t s_last_frame = 0;
+
+void EVENT_USB_Device_Connect(void);
+void EVENT_USB_Device_ConfigurationChanged(void);
+
+
+// Bus model ------------------------------------------------------------------
+
+// Full speed bulk: 12Mbit/s plus roughly 16 bytes of token, handshake and
+// CRC overhead per transaction.
+static uint64_t sim_usb_transfer_cycles(uint16_t length)
+{
+    return ((uint64_t)(length + 16) * 8 * SIM_CYCLES_PER_US) / 12;
+}
+
+static void sim_usb_update(void)
+{
+    uint64_t now = sim_cycles;
+
+    if (s_initialised) {
+        uint64_t frame = (now - s_init_cycle) / SIM_CYCLES_PER_MS;
+        if (frame > s_last_frame) {
+            sim_usb.frames += frame - s_last_frame;
+            s_last_frame = frame;
+        }
+    }
+
+    // Host to device: fill free OUT banks from the host queue.
+    sim_endpoint_t* ep = &s_ep_out;
+    while (ep->configured && s_host_head != s_host_tail &&
+           !ep->full[ep->usb_bank]) {
+        sim_host_packet_t* p = &s_host_queue[s_host_head % s_host_capacity];
+        // The host's retries are NAKed until the bank is free again.
+        uint8_t b = ep->usb_bank;
+        uint64_t start = p->submit_cycle > s_host_bus_free ? p->submit_cycle
+                                                           : s_host_bus_free;
+        if (ep->free_cycle[b] > start) { start = ep->free_cycle[b]; }
+        uint64_t done = start + sim_usb_transfer_cycles(p->length);
+        if (done > now) { break; }
+        memcpy(ep->data[b], p->data, p->length);
+        ep->length[b] = p->length;
+        ep->position[b] = 0;
+        ep->full[b] = true;
+        ep->submit_cycle[b] = p->submit_cycle;
+        ep->arrive_cycle[b] = done;
+        ep->usb_bank = (uint8_t)((b + 1) % ep->banks);
+        s_host_bus_free = done;
+        s_host_head++;
+    }
+
+    // Device to host: the host drains committed IN banks in order.
+    ep = &s_ep_in;
+    while (ep->configured && s_host_listening && ep->full[ep->usb_bank] &&
+           ep->done_cycle[ep->usb_bank] <= now) {
+        uint8_t b = ep->usb_bank;
+        for (uint16_t i = 0; i + 4 <= ep->length[b]; i += 4) {
+            if (sim_usb_log_count < SIM_USB_LOG_SIZE) {
+                sim_usb_event_t* e = &sim_usb_log[sim_usb_log_count++];
+                e->cycle = ep->done_cycle[b];
+                memcpy(e->event, &ep->data[b][i], 4);
+            }
+            sim_usb.in_events++;
+        }
+        sim_usb.in_packets++;
+        ep->full[b] = false;
+        ep->length[b] = 0;
+        ep->usb_bank = (uint8_t)((b + 1) % ep->banks);
+    }
+}
+
+static void sim_usb_charge(uint32_t cycles)
+{
+    sim_settle();
+    sim_charge(cycles);
+    sim_usb_update();
+}
+
+
+// Host side ------------------------------------------------------------------
+
+void sim_usb_setup(void)
+{
+    memset(&sim_usb, 0, sizeof(sim_usb));
+    sim_usb_log_count = 0;
+    s_host_listening = true;
+}
+
+void sim_usb_host_send(const uint8_t* data, uint16_t length)
+{
+    while (length) {
+        if (s_host_tail - s_host_head >= s_host_capacity) {
+            // Grow the ring, unwrapping it into the new storage.
+            uint32_t capacity = s_host_capacity ? s_host_capacity * 2 : 1024;
+            sim_host_packet_t* queue = malloc(capacity * sizeof(*queue));
+            uint32_t count = s_host_tail - s_host_head;
+            for (uint32_t i = 0; i < count; ++i) {
+                queue[i] = s_host_queue[(s_host_head + i) % s_host_capacity];
+            }
+            free(s_host_queue);
+            s_host_queue = queue;
+            s_host_capacity = capacity;
+            s_host_head = 0;
+            s_host_tail = count;
+        }
+        uint16_t chunk = length > SIM_USB_MAX_SIZE ? SIM_USB_MAX_SIZE : length;
+        sim_host_packet_t* p = &s_host_queue[s_host_tail % s_host_capacity];
+        p->submit_cycle = sim_cycles;
+        p->length = chunk;
+        memcpy(p->data, data, chunk);
+        s_host_tail++;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+void sim_usb_set_host_listening(bool listening)
+{
+    s_host_listening = listening;
+}
+
+bool sim_usb_configured(void)
+{
+    return USB_DeviceState == DEVICE_STATE_Configured;
+}
+
+uint32_t sim_usb_out_pending(void)
+{
+    uint32_t pending = s_host_tail - s_host_head;
+    for (uint8_t b = 0; b < SIM_USB_MAX_BANKS; ++b) {
+        if (s_ep_out.full[b]) { pending++; }
+    }
+    return pending;
+}
+
+
+// USB core -------------------------------------------------------------------
+
+void USB_Init(void)
+{
+    s_init_cycle = sim_cycles;
+    s_last_frame = 0;
+    s_initialised = true;
+    USB_DeviceState = DEVICE_STATE_Powered;
+    sim_usb_charge(SIM_USB_TASK_CYCLES);
+}
+
+void USB_Disable(void)
+{
+    s_initialised = false;
+    USB_DeviceState = DEVICE_STATE_Unattached;
+}
+
+uint16_t USB_Device_GetFrameNumber(void)
+{
+    sim_usb_charge(SIM_USB_STATUS_CYCLES);
+    return (uint16_t)(sim_usb.frames & 0x7FF); // UDFNUM is 11 bits
+}
+
+static void sim_usb_task(void)
+{
+    sim_usb_charge(SIM_USB_TASK_CYCLES);
+    if (!s_initialised) { return; }
+
+    uint64_t elapsed = sim_cycles - s_init_cycle;
+    if (USB_DeviceState == DEVICE_STATE_Powered &&
+        elapsed >= SIM_USB_CONNECT_MS * SIM_CYCLES_PER_MS) {
+        USB_DeviceState = DEVICE_STATE_Default;
+        EVENT_USB_Device_Connect();
+    }
+    if (USB_DeviceState == DEVICE_STATE_Default &&
+        elapsed >= SIM_USB_CONFIGURE_MS * SIM_CYCLES_PER_MS) {
+        USB_DeviceState = DEVICE_STATE_Configured;
+        sim_usb.configured_cycle = sim_cycles;
+        EVENT_USB_Device_ConfigurationChanged();
+    }
+}
+
+void USB_USBTask(void)
+{
+    sim_usb.usb_tasks++;
+    sim_usb_task();
+}
+
+
+// Endpoints ------------------------------------------------------------------
+
+bool Endpoint_ConfigureEndpointTable(const USB_Endpoint_Table_t* const Table,
+                                     const uint8_t Entries)
+{
+    for (uint8_t i = 0; i < Entries; ++i) {
+        sim_endpoint_t* ep = (Table[i].Address & ENDPOINT_DIR_IN) ? &s_ep_in
+                                                                  : &s_ep_out;
+        if (Table[i].Size > SIM_USB_MAX_SIZE || Table[i].Banks > SIM_USB_MAX_BANKS) {
+            return false;
+        }
+        memset(ep, 0, sizeof(*ep));
+        ep->address = Table[i].Address;
+        ep->size = Table[i].Size;
+        ep->banks = Table[i].Banks ? Table[i].Banks : 1;
+        ep->configured = true;
+    }
+    sim_usb_charge(SIM_USB_CALL_CYCLES * 4);
+    return true;
+}
+
+void Endpoint_SelectEndpoint(const uint8_t Address)
+{
+    s_selected_address = Address;
+    if ((Address & ENDPOINT_EPNUM_MASK) == (s_ep_in.address & ENDPOINT_EPNUM_MASK) &&
+        (Address & ENDPOINT_DIR_IN)) {
+        s_selected = &s_ep_in;
+    } else if ((Address & ENDPOINT_EPNUM_MASK) == (s_ep_out.address & ENDPOINT_EPNUM_MASK)) {
+        s_selected = &s_ep_out;
+    } else {
+        s_selected = NULL;
+    }
+    sim_usb_charge(SIM_USB_SELECT_CYCLES);
+}
+
+uint8_t Endpoint_GetCurrentEndpoint(void)
+{
+    return s_selected_address;
+}
+
+static bool sim_ep_is_in(const sim_endpoint_t* ep)
+{
+    return ep == &s_ep_in;
+}
+
+uint16_t Endpoint_BytesInEndpoint(void)
+{
+    sim_usb_charge(SIM_USB_STATUS_CYCLES);
+    sim_endpoint_t* ep = s_selected;
+    if (!ep || !ep->configured) { return 0; }
+    uint8_t b = ep->cpu_bank;
+    if (sim_ep_is_in(ep)) {
+        return ep->full[b] ? 0 : ep->length[b];
+    }
+    return ep->full[b] ? (uint16_t)(ep->length[b] - ep->position[b]) : 0;
+}
+
+bool Endpoint_IsReadWriteAllowed(void)
+{
+    sim_usb_charge(SIM_USB_STATUS_CYCLES);
+    sim_endpoint_t* ep = s_selected;
+    if (!ep || !ep->configured) { return false; }
+    uint8_t b = ep->cpu_bank;
+    if (sim_ep_is_in(ep)) {
+        return !ep->full[b] && ep->length[b] < ep->size;
+    }
+    return ep->full[b] && ep->position[b] < ep->length[b];
+}
+
+bool Endpoint_IsINReady(void)
+{
+    sim_usb_charge(SIM_USB_STATUS_CYCLES);
+    sim_endpoint_t* ep = s_selected;
+    return ep && ep->configured && sim_ep_is_in(ep) && !ep->full[ep->cpu_bank];
+}
+
+bool Endpoint_IsOUTReceived(void)
+{
+    sim_usb_charge(SIM_USB_STATUS_CYCLES);
+    sim_endpoint_t* ep = s_selected;
+    if (!ep || !ep->configured || sim_ep_is_in(ep)) { return false; }
+    sim_usb.rx_polls++;
+    if (!ep->full[ep->cpu_bank]) {
+        sim_usb.rx_empty_polls++;
+        return false;
+    }
+    return true;
+}
+
+void Endpoint_ClearIN(void)
+{
+    sim_usb_charge(SIM_USB_CLEAR_CYCLES);
+    sim_endpoint_t* ep = s_selected;
+    if (!ep || !sim_ep_is_in(ep) || ep->full[ep->cpu_bank]) { return; }
+    uint8_t b = ep->cpu_bank;
+    // The host reads the bank once every bank queued ahead of it is done.
+    uint64_t start = sim_cycles;
+    uint8_t prev = (uint8_t)((b + ep->banks - 1) % ep->banks);
+    if (ep->banks > 1 && ep->full[prev] && ep->done_cycle[prev] > start) {
+        start = ep->done_cycle[prev];
+    }
+    ep->done_cycle[b] = start + sim_usb_transfer_cycles(ep->length[b]);
+    ep->full[b] = true;
+    ep->cpu_bank = (uint8_t)((b + 1) % ep->banks);
+}
+
+void Endpoint_ClearOUT(void)
+{
+    sim_usb_charge(SIM_USB_CLEAR_CYCLES);
+    sim_endpoint_t* ep = s_selected;
+    if (!ep || sim_ep_is_in(ep) || !ep->full[ep->cpu_bank]) { return; }
+    uint8_t b = ep->cpu_bank;
+    uint64_t latency = sim_cycles - ep->submit_cycle[b];
+    sim_usb.out_packets++;
+    sim_usb.out_events += ep->length[b] / 4;
+    sim_usb.out_latency_total += latency;
+    sim_usb.out_hold_total += sim_cycles - ep->arrive_cycle[b];
+    if (latency > sim_usb.out_latency_max) { sim_usb.out_latency_max = latency; }
+    ep->full[b] = false;
+    ep->free_cycle[b] = sim_cycles;
+    ep->cpu_bank = (uint8_t)((b + 1) % ep->banks);
+    sim_usb_update();
+}
+
+uint8_t Endpoint_Read_8(void)
+{
+    sim_usb_charge(SIM_USB_DATA_CYCLES);
+    sim_endpoint_t* ep = s_selected;
+    if (!ep || sim_ep_is_in(ep)) { return 0; }
+    uint8_t b = ep->cpu_bank;
+    if (!ep->full[b] || ep->position[b] >= ep->length[b]) { return 0; }
+    return ep->data[b][ep->position[b]++];
+}
+
+void Endpoint_Write_8(const uint8_t Data)
+{
+    sim_usb_charge(SIM_USB_DATA_CYCLES);
+    sim_endpoint_t* ep = s_selected;
+    if (!ep || !sim_ep_is_in(ep)) { return; }
+    uint8_t b = ep->cpu_bank;
+    if (ep->full[b] || ep->length[b] >= ep->size) { return; }
+    ep->data[b][ep->length[b]++] = Data;
+}
+
+uint8_t Endpoint_WaitUntilReady(void)
+{
+    uint8_t timeout = USB_STREAM_TIMEOUT_MS;
+    uint64_t start = sim_cycles;
+    uint64_t previous_frame = sim_usb.frames;
+    sim_endpoint_t* ep = s_selected;
+    uint8_t result = ENDPOINT_READYWAIT_NoError;
+
+    for (;;) {
+        sim_usb_charge(SIM_USB_WAIT_CYCLES);
+        if (ep && sim_ep_is_in(ep)) {
+            if (!ep->full[ep->cpu_bank]) { break; }
+        } else if (ep && ep->full[ep->cpu_bank]) {
+            break;
+        }
+        if (USB_DeviceState == DEVICE_STATE_Unattached) {
+            result = ENDPOINT_READYWAIT_DeviceDisconnected;
+            break;
+        }
+        if (sim_usb.frames != previous_frame) {
+            previous_frame = sim_usb.frames;
+            if (!(timeout--)) {
+                result = ENDPOINT_READYWAIT_Timeout;
+                sim_usb.in_timeouts++;
+                break;
+            }
+        }
+    }
+    if (ep && sim_ep_is_in(ep)) { sim_usb.in_wait_cycles += sim_cycles - start; }
+    return result;
+}
+
+// Endpoint_Read_Stream_LE and Endpoint_Write_Stream_LE follow LUFA's
+// Template_Endpoint_RW.c with INTERRUPT_CONTROL_ENDPOINT undefined.
+uint8_t Endpoint_Read_Stream_LE(void* const Buffer, uint16_t Length,
+                                uint16_t* const BytesProcessed)
+{
+    uint8_t* data = (uint8_t*)Buffer;
+    uint8_t error;
+    (void)BytesProcessed;
+
+    if ((error = Endpoint_WaitUntilReady())) { return error; }
+    while (Length) {
+        if (!Endpoint_IsReadWriteAllowed()) {
+            Endpoint_ClearOUT();
+            sim_usb_task();
+            if ((error = Endpoint_WaitUntilReady())) { return error; }
+        } else {
+            sim_usb_charge(SIM_USB_STREAM_CYCLES - SIM_USB_DATA_CYCLES);
+            *data++ = Endpoint_Read_8();
+            Length--;
+        }
+    }
+    return ENDPOINT_RWSTREAM_NoError;
+}
+
+uint8_t Endpoint_Write_Stream_LE(const void* const Buffer, uint16_t Length,
+                                 uint16_t* const BytesProcessed)
+{
+    const uint8_t* data = (const uint8_t*)Buffer;
+    uint8_t error;
+    (void)BytesProcessed;
+
+    if ((error = Endpoint_WaitUntilReady())) { return error; }
+    while (Length) {
+        if (!Endpoint_IsReadWriteAllowed()) {
+            Endpoint_ClearIN();
+            sim_usb_task();
+            if ((error = Endpoint_WaitUntilReady())) { return error; }
+        } else {
+            sim_usb_charge(SIM_USB_STREAM_CYCLES - SIM_USB_DATA_CYCLES);
+            Endpoint_Write_8(*data++);
+            Length--;
+        }
+    }
+    return ENDPOINT_RWSTREAM_NoError;
+}
+
+
+// MIDI class driver ----------------------------------------------------------
+
+bool MIDI_Device_ConfigureEndpoints(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo)
+{
+    memset(&MIDIInterfaceInfo->State, 0x00, sizeof(MIDIInterfaceInfo->State));
+
+    MIDIInterfaceInfo->Config.DataINEndpoint.Type  = EP_TYPE_BULK;
+    MIDIInterfaceInfo->Config.DataOUTEndpoint.Type = EP_TYPE_BULK;
+
+    if (!(Endpoint_ConfigureEndpointTable(&MIDIInterfaceInfo->Config.DataINEndpoint, 1)))
+      return false;
+
+    if (!(Endpoint_ConfigureEndpointTable(&MIDIInterfaceInfo->Config.DataOUTEndpoint, 1)))
+      return false;
+
+    return true;
+}
+
+void MIDI_Device_USBTask(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo)
+{
+    sim_usb_charge(SIM_USB_CALL_CYCLES);
+    if (USB_DeviceState != DEVICE_STATE_Configured)
+      return;
+
+    Endpoint_SelectEndpoint(MIDIInterfaceInfo->Config.DataINEndpoint.Address);
+
+    if (Endpoint_IsINReady())
+      MIDI_Device_Flush(MIDIInterfaceInfo);
+}
+
+uint8_t MIDI_Device_SendEventPacket(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo,
+                                    const MIDI_EventPacket_t* const Event)
+{
+    sim_usb_charge(SIM_USB_CALL_CYCLES);
+    if (USB_DeviceState != DEVICE_STATE_Configured)
+      return ENDPOINT_RWSTREAM_DeviceDisconnected;
+
+    uint8_t ErrorCode;
+
+    Endpoint_SelectEndpoint(MIDIInterfaceInfo->Config.DataINEndpoint.Address);
+
+    if ((ErrorCode = Endpoint_Write_Stream_LE(Event, sizeof(MIDI_EventPacket_t), NULL)) != ENDPOINT_RWSTREAM_NoError)
+      return ErrorCode;
+
+    if (!(Endpoint_IsReadWriteAllowed()))
+      Endpoint_ClearIN();
+
+    return ENDPOINT_RWSTREAM_NoError;
+}
+
+uint8_t MIDI_Device_Flush(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo)
+{
+    sim_usb_charge(SIM_USB_CALL_CYCLES);
+    if (USB_DeviceState != DEVICE_STATE_Configured)
+      return ENDPOINT_RWSTREAM_DeviceDisconnected;
+
+    uint8_t ErrorCode;
+
+    Endpoint_SelectEndpoint(MIDIInterfaceInfo->Config.DataINEndpoint.Address);
+
+    if (Endpoint_BytesInEndpoint())
+    {
+        Endpoint_ClearIN();
+
+        if ((ErrorCode = Endpoint_WaitUntilReady()) != ENDPOINT_READYWAIT_NoError)
+          return ErrorCode;
+    }
+
+    return ENDPOINT_READYWAIT_NoError;
+}
+
+bool MIDI_Device_ReceiveEventPacket(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo,
+                                    MIDI_EventPacket_t* const Event)
+{
+    sim_usb_charge(SIM_USB_CALL_CYCLES);
+    if (USB_DeviceState != DEVICE_STATE_Configured)
+      return false;
+
+    Endpoint_SelectEndpoint(MIDIInterfaceInfo->Config.DataOUTEndpoint.Address);
+
+    if (!(Endpoint_IsOUTReceived()))
+      return false;
+
+    if (!(Endpoint_IsReadWriteAllowed()))
+      return false;
+
+    Endpoint_Read_Stream_LE(Event, sizeof(MIDI_EventPacket_t), NULL);
+
+    if (!(Endpoint_IsReadWriteAllowed()))
+      Endpoint_ClearOUT();
+
+    return true;
+}
+
+bool MIDI_Device_ReceiveLargeEventPacket(USB_ClassInfo_MIDI_Device_t* const MIDIInterfaceInfo,
+                                         MIDI_EventPackets_t* const Event,
+                                         uint8_t max_size)
+{
+    sim_usb_charge(SIM_USB_CALL_CYCLES);
+    if (USB_DeviceState != DEVICE_STATE_Configured)
+      return false;
+
+    Endpoint_SelectEndpoint(MIDIInterfaceInfo->Config.DataOUTEndpoint.Address);
+
+    if (!(Endpoint_IsOUTReceived()))
+      return false;
+
+    if (!(Endpoint_IsReadWriteAllowed()))
+      return false;
+
+    Endpoint_Read_Stream_LE(Event, max_size, NULL);
+
+    if (!(Endpoint_IsReadWriteAllowed()))
+      Endpoint_ClearOUT();
+
+    return true;
+}
@@ -0,0 +1,79 @@
+// Stack high-water mark for DJTT Midifighter
+//
+//   Copyright (C) 2016 DJ Techtools
+//
+
+ /* DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+#include <avr/io.h>
+#include "stack.h"
+
+// Set by the linker: the end of the globals, and the top of RAM.
+extern uint8_t _end;
+extern uint8_t __stack;
+
+#if ENABLE_STACK_PAINT > 0
+// Runs from .init3: after .init2 has cleared r1 and set the stack pointer,
+// before .init4 copies .data and clears .bss. Naked and never called, so
+// nothing is on the stack yet and all of it can be painted. A naked function
+// has no frame for C locals to live in, and GCC only supports basic asm in
+// one, so the loop is written in basic asm, with Z walking from _end up to
+// and including __stack.
+#define STACK_STR_(x) #x
+#define STACK_STR(x) STACK_STR_(x)
+void stack_paint(void) __attribute__((naked, used, section(".init3")));
+void stack_paint(void)
+{
+    asm volatile (
+        "    ldi r30, lo8(_end)        \n"
+        "    ldi r31, hi8(_end)        \n"
+        "    ldi r24, lo8(__stack + 1) \n"
+        "    ldi r25, hi8(__stack + 1) \n"
+        "    ldi r26, " STACK_STR(STACK_PAINT_BYTE) "\n"
+        "    rjmp 2f                   \n"
+        "1:  st Z+, r26                \n"
+        "2:  cp r30, r24               \n"
+        "    cpc r31, r25              \n"
+        "    brlo 1b                   \n"
+    );
+}
+#endif
+
+uint16_t stack_static_bytes(void)
+{
+    return &_end - (uint8_t*)RAMSTART;
+}
+
+uint16_t stack_free_bytes(void)
+{
+    return &__stack - &_end + 1;
+}
+
+// Count the painted bytes from the end of the globals up. The stack is well
+// above where this looks, so it needn't be stopped.
+uint16_t stack_unused_bytes(void)
+{
+#if ENABLE_STACK_PAINT > 0
+    const uint8_t *p = &_end;
+    while (p <= &__stack && *p == STACK_PAINT_BYTE) {
+        p++;
+    }
+    return p - &_end;
+#else
+    return 0;
+#endif
+}
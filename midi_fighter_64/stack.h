@@ -0,0 +1,46 @@
+// Stack high-water mark for DJTT Midifighter
+//
+//   Copyright (C) 2016 DJ Techtools
+//
+
+ /* DJTT - MIDI Fighter 64 - Embedded Software License
+ * Copyright (c) 2016: DJ Tech Tools
+ * Permission is hereby granted, free of charge, to any person owning or possessing 
+ * a DJ Tech-Tools MIDI Fighter 64 Hardware Device to view and modify this source 
+ * code for personal use. Person may not publish, distribute, sublicense, or sell 
+ * the source code (modified or un-modified). Person may not use this source code 
+ * or any diminutive works for commercial purposes. The permission to use this source 
+ * code is also subject to the following conditions:
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,  FITNESS FOR A 
+ * PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION 
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE 
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+	*/
+
+#ifndef _STACK_H_INCLUDED
+#define _STACK_H_INCLUDED
+
+#include <stdint.h>
+#include "constants.h"
+
+// Stack high-water mark -------------------------------------------------------
+//
+// At reset, before the globals are set up, the RAM between the end of the
+// globals (.data, .bss and .noinit) and RAMEND is painted with
+// STACK_PAINT_BYTE. The stack grows down from RAMEND into it, so the painted
+// bytes still left above the globals are the margin the deepest stack so far
+// (main loop, sysex handling and nested interrupts) left over. Read back with
+// the system sysex command (sub-command 3).
+//
+// A pushed byte that happens to equal STACK_PAINT_BYTE reads as unused, so
+// the margin can be over by a few bytes, never under by more.
+
+#define STACK_PAINT_BYTE 0xC5
+
+uint16_t stack_static_bytes(void); // RAM taken by the globals
+uint16_t stack_free_bytes(void);   // RAM above them, for the stack
+uint16_t stack_unused_bytes(void); // of that, never reached by the stack
+
+#endif // _STACK_H_INCLUDED
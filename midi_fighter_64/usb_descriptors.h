@@ -41,6 +41,14 @@
 // packets.
 #define MIDI_STREAM_EPSIZE 64
 
+// Banks per MIDI endpoint. With two the host drains (IN) or fills (OUT) one
+// bank while the firmware works on the other. Endpoints 1 to 6 of the
+// ATmega32U4 can be double banked at 64 bytes (256 of the 832 bytes of
+// endpoint RAM for both).
+#ifndef MIDI_STREAM_BANKS
+#define MIDI_STREAM_BANKS 2
+#endif
+
 
 // USB Descriptor -------------------------------------------------------------
 